@@ -5,6 +5,11 @@
 //go:build never
 // +build never
 
+// Required for clock_gettime with -std=c11
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <sqlite3ext.h>
 SQLITE_EXTENSION_INIT1
 
@@ -16,10 +21,36 @@ SQLITE_EXTENSION_INIT1
 #include <stdint.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <assert.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 #include "hedley.h"
 
+#ifdef _WIN32
+#define PCRE2X_API __declspec(dllexport)
+#endif
+#include "sqlite3_pcre2.h"
+
 // Size of the compiled pcre2 code cache.
 #ifndef CACHE_SIZE
 #define CACHE_SIZE 16
@@ -51,6 +82,88 @@ HEDLEY_STATIC_ASSERT(JIT_STACK_START_SIZE > 0,
 HEDLEY_STATIC_ASSERT(JIT_STACK_START_SIZE <= JIT_STACK_MAX_SIZE,
 	"JIT_STACK_MAX_SIZE must be larger than JIT_STACK_START_SIZE");
 
+// Default size that the pcre2 JIT stack may grow to when a match runs out of
+// stack (see: match_env_grow). This can be changed at runtime with:
+// regexp_config('jit_stack_limit', N).
+#ifndef JIT_STACK_LIMIT
+#define JIT_STACK_LIMIT (64 * 1024 * 1024LU)
+#endif
+HEDLEY_STATIC_ASSERT(JIT_STACK_MAX_SIZE <= JIT_STACK_LIMIT,
+	"JIT_STACK_LIMIT must be at least JIT_STACK_MAX_SIZE");
+
+// Default number of matches per timed match (0 disables timing). Reading the
+// clock costs about as much as matching a short subject, so timing every
+// match would noticeably slow down queries. This can be changed at runtime
+// with: regexp_config('sample_rate', N).
+#ifndef MATCH_SAMPLE_RATE
+#define MATCH_SAMPLE_RATE 16
+#endif
+HEDLEY_STATIC_ASSERT(0 <= MATCH_SAMPLE_RATE && MATCH_SAMPLE_RATE <= UINT32_MAX,
+	"invalid MATCH_SAMPLE_RATE");
+
+// Number of records kept by the slow log (see: pcre2_slow_log).
+#ifndef SLOW_LOG_SIZE
+#define SLOW_LOG_SIZE 64
+#endif
+HEDLEY_STATIC_ASSERT(1 <= SLOW_LOG_SIZE && SLOW_LOG_SIZE <= 65536,
+	"invalid SLOW_LOG_SIZE");
+
+// Maximum number of worker threads used by regexp_scan.
+#ifndef SCAN_MAX_THREADS
+#define SCAN_MAX_THREADS 64
+#endif
+HEDLEY_STATIC_ASSERT(1 <= SCAN_MAX_THREADS && SCAN_MAX_THREADS <= 1024,
+	"invalid SCAN_MAX_THREADS");
+
+// Minimum number of literals in an alternation of literals for it to be
+// matched with a literal set DFA instead of PCRE2 (see: litset).
+#ifndef LITSET_MIN_LITERALS
+#define LITSET_MIN_LITERALS 8
+#endif
+HEDLEY_STATIC_ASSERT(LITSET_MIN_LITERALS >= 2, "invalid LITSET_MIN_LITERALS");
+
+// Maximum size in bytes of a literal set DFA.
+#ifndef LITSET_MAX_SIZE
+#define LITSET_MAX_SIZE (16 * 1024 * 1024LU)
+#endif
+HEDLEY_STATIC_ASSERT(LITSET_MAX_SIZE <= UINT32_MAX / 4, "invalid LITSET_MAX_SIZE");
+
+// Default number of subjects whose REGEXP result is memoized for each pattern
+// (see: memo), rounded up to a power of two. 0 disables memoization. This can
+// be changed at runtime with: regexp_config('memo_size', N).
+#ifndef MEMO_SIZE
+#define MEMO_SIZE 1024
+#endif
+HEDLEY_STATIC_ASSERT(0 <= MEMO_SIZE && MEMO_SIZE <= 65536, "invalid MEMO_SIZE");
+
+// Subjects longer than this are not memoized.
+#ifndef MEMO_MAX_SUBJECT
+#define MEMO_MAX_SUBJECT 256
+#endif
+HEDLEY_STATIC_ASSERT(MEMO_MAX_SUBJECT <= 4096, "invalid MEMO_MAX_SUBJECT");
+
+// Maximum number of bytes of freed pcre2 allocations that each cache keeps
+// for reuse (see: re_pool). 0 passes every allocation to sqlite3_malloc64.
+#ifndef ALLOC_POOL_SIZE
+#define ALLOC_POOL_SIZE (1024 * 1024LU)
+#endif
+
+// Initial size of the window that regexp_z decompresses into.
+#ifndef REGEXP_Z_WINDOW
+#define REGEXP_Z_WINDOW (64 * 1024)
+#endif
+HEDLEY_STATIC_ASSERT(REGEXP_Z_WINDOW >= 1024, "invalid REGEXP_Z_WINDOW");
+
+// Default and maximum number of rows sampled by regexp_estimate.
+#ifndef ESTIMATE_SAMPLE_ROWS
+#define ESTIMATE_SAMPLE_ROWS 1000
+#endif
+#ifndef ESTIMATE_MAX_SAMPLE_ROWS
+#define ESTIMATE_MAX_SAMPLE_ROWS 1000000
+#endif
+HEDLEY_STATIC_ASSERT(1 <= ESTIMATE_SAMPLE_ROWS &&
+	ESTIMATE_SAMPLE_ROWS <= ESTIMATE_MAX_SAMPLE_ROWS, "invalid ESTIMATE_SAMPLE_ROWS");
+
 #define noinline HEDLEY_NEVER_INLINE
 
 #ifndef unlikely
@@ -61,6 +174,53 @@ HEDLEY_STATIC_ASSERT(JIT_STACK_START_SIZE <= JIT_STACK_MAX_SIZE,
 #define likely(x) HEDLEY_LIKELY(x)
 #endif
 
+// Static tracepoints (USDT) for tools like bpftrace and perf. Probes are
+// compiled in when HAVE_SYS_SDT_H is defined (the default if <sys/sdt.h> is
+// available) and are a nop instruction until a tracer attaches to them. Each
+// probe has a semaphore that the tracer increments when it attaches, and the
+// probe's arguments are only evaluated if it is set, so disabled probes cost a
+// load and a branch. Otherwise RE_PROBE expands to nothing.
+//
+// Probes (provider sqlite3_pcre2):
+//
+//	compile__start(pattern, pattern_len, caseless)
+//	compile__done(pattern, pattern_len, errcode, jit_compiled, duration_ns)
+//	cache__hit(cache, pattern, pattern_len)
+//	cache__miss(cache, pattern, pattern_len)
+//	cache__evict(cache, pattern, pattern_len, ref_count)
+//	cache__release(cache, pattern, pattern_len, ref_count)
+//	match__start(pattern, pattern_len, subject_len, offset)
+//	match__done(pattern, pattern_len, subject_len, rc)
+//
+// Match durations are not passed to the probes since that would require
+// reading the clock for every match, instead time match__start/match__done.
+#ifdef HAVE_SYS_SDT_H
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define RE_PROBE_SEMAPHORE(name)                                   \
+	__extension__ unsigned short sqlite3_pcre2_##name##_semaphore \
+	__attribute__((unused, section(".probes"), visibility("hidden")))
+
+RE_PROBE_SEMAPHORE(compile__start);
+RE_PROBE_SEMAPHORE(compile__done);
+RE_PROBE_SEMAPHORE(cache__hit);
+RE_PROBE_SEMAPHORE(cache__miss);
+RE_PROBE_SEMAPHORE(cache__evict);
+RE_PROBE_SEMAPHORE(cache__release);
+RE_PROBE_SEMAPHORE(match__start);
+RE_PROBE_SEMAPHORE(match__done);
+
+#define RE_PROBE(name, ...)                                         \
+	do {                                                            \
+		if (unlikely(sqlite3_pcre2_##name##_semaphore)) {           \
+			STAP_PROBEV(sqlite3_pcre2, name, __VA_ARGS__);          \
+		}                                                           \
+	} while (0)
+#else
+#define RE_PROBE(name, ...)
+#endif
+
 // Define __counted_by if it does not exist.
 // https://clang.llvm.org/docs/BoundsSafety.html
 #ifndef __counted_by
@@ -101,9 +261,313 @@ static void re_pcre2_free(void *block, void *data) {
 	re_free(block);
 }
 
+#ifdef HAVE_ZLIB
+
+// malloc wrapper for zlib
+static voidpf re_zalloc(voidpf opaque, uInt items, uInt size) {
+	(void)opaque;
+	return re_malloc((size_t)items * size);
+}
+
+// free wrapper for zlib
+static void re_zfree(voidpf opaque, voidpf p) {
+	(void)opaque;
+	re_free(p);
+}
+
+#endif
+
+// is_gzip_header reports if p starts with the magic number of gzip (RFC 1952).
+static inline bool is_gzip_header(const char *p, size_t n) {
+	return n >= 2 && (unsigned char)p[0] == 0x1f && (unsigned char)p[1] == 0x8b;
+}
+
+// is_zlib_header reports if p starts with a zlib header (RFC 1950) without a
+// preset dictionary: deflate with a window of at most 32K and a valid check.
+static inline bool is_zlib_header(const char *p, size_t n) {
+	if (n < 2) {
+		return false;
+	}
+	unsigned b0 = (unsigned char)p[0];
+	unsigned b1 = (unsigned char)p[1];
+	return (b0 & 0x0f) == 8 && (b0 >> 4) <= 7 && (b1 & 0x20) == 0 &&
+	       ((b0 << 8) | b1) % 31 == 0;
+}
+
+// re_pool is a size class allocator for the pcre2 allocations of a cache.
+// Compiling a pattern makes dozens of allocations (most of them by the JIT
+// compiler), each of which takes SQLite's memory statistics mutex when
+// SQLITE_CONFIG_MEMSTATUS is enabled. Freed blocks of up to POOL_MAX_BLOCK
+// bytes are kept in per-class free lists, up to ALLOC_POOL_SIZE bytes, and
+// reused by the next compilation. Blocks are still allocated with
+// sqlite3_malloc64 so they are included in SQLite's memory statistics.
+//
+// A pool must only be used by one thread at a time, like its cache.
+
+#define POOL_HEADER     16 // keeps blocks 16 byte aligned
+#define POOL_MIN_SHIFT  6  // smallest class is 64 bytes
+#define POOL_CLASSES    8
+#define POOL_MAX_BLOCK  ((size_t)1 << (POOL_MIN_SHIFT + POOL_CLASSES - 1))
+#define POOL_LARGE      POOL_CLASSES // class of blocks that are not pooled
+
+typedef struct pool_block {
+	struct pool_block *next;
+} pool_block;
+
+typedef struct {
+	pool_block *free[POOL_CLASSES];
+	size_t     free_bytes; // bytes in the free lists
+} re_pool;
+
+static inline int pool_class(size_t size) {
+	int c = 0;
+	while (((size_t)1 << (POOL_MIN_SHIFT + c)) < size) {
+		c++;
+	}
+	return c;
+}
+
+static void *re_pool_malloc(size_t size, void *data) {
+	re_pool *pool = (re_pool *)data;
+	size += POOL_HEADER;
+	int c = POOL_LARGE;
+	void *p = NULL;
+	if (ALLOC_POOL_SIZE > 0 && size <= POOL_MAX_BLOCK) {
+		c = pool_class(size);
+		size = (size_t)1 << (POOL_MIN_SHIFT + c);
+		if (pool->free[c]) {
+			p = pool->free[c];
+			pool->free[c] = pool->free[c]->next;
+			pool->free_bytes -= size;
+		}
+	}
+	if (!p) {
+		p = re_malloc(size);
+		if (!p) {
+			return NULL;
+		}
+	}
+	*(unsigned char *)p = (unsigned char)c;
+	return (char *)p + POOL_HEADER;
+}
+
+static void re_pool_free(void *block, void *data) {
+	if (!block) {
+		return;
+	}
+	re_pool *pool = (re_pool *)data;
+	void *p = (char *)block - POOL_HEADER;
+	int c = *(unsigned char *)p;
+	size_t size = (size_t)1 << (POOL_MIN_SHIFT + c);
+	if (c == POOL_LARGE || pool->free_bytes + size > ALLOC_POOL_SIZE) {
+		re_free(p);
+		return;
+	}
+	pool_block *b = (pool_block *)p;
+	b->next = pool->free[c];
+	pool->free[c] = b;
+	pool->free_bytes += size;
+}
+
+// re_pool_trim frees the blocks in the free lists of pool.
+static void re_pool_trim(re_pool *pool) {
+	for (int c = 0; c < POOL_CLASSES; c++) {
+		while (pool->free[c]) {
+			pool_block *b = pool->free[c];
+			pool->free[c] = b->next;
+			re_free(b);
+		}
+	}
+	pool->free_bytes = 0;
+}
+
+// re_nanotime returns the current value of a monotonic clock in nanoseconds.
+static uint64_t re_nanotime(void) {
+#ifdef _WIN32
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (uint64_t)((double)count.QuadPart * (1e9 / (double)freq.QuadPart));
+#else
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC_RAW
+	// Not subject to NTP adjustments
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (uint64_t)ts.tv_sec * 1000000000LLU + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// re_ticks returns a monotonic timestamp in unspecified units and is used
+// to time matches. On x86 this is the TSC, which is significantly cheaper
+// to read than the system clock. Use re_clock_ns to convert ticks to
+// nanoseconds.
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t re_ticks(void) {
+	return __rdtsc();
+}
+#else
+#define RE_TICKS_ARE_NANOSECONDS 1
+static inline uint64_t re_ticks(void) {
+	return re_nanotime();
+}
+#endif
+
+// re_clock converts ticks to nanoseconds. The tick rate is measured against
+// re_nanotime over the lifetime of the clock instead of calibrating it when
+// the extension is loaded.
+typedef struct {
+	uint64_t base_ticks;
+	uint64_t base_ns;
+} re_clock;
+
+static void re_clock_init(re_clock *c) {
+	c->base_ticks = re_ticks();
+	c->base_ns = re_nanotime();
+}
+
+static uint64_t re_clock_ns(const re_clock *c, uint64_t ticks) {
+#ifdef RE_TICKS_ARE_NANOSECONDS
+	(void)c;
+	return ticks;
+#else
+	uint64_t dt = re_ticks() - c->base_ticks;
+	uint64_t dn = re_nanotime() - c->base_ns;
+	if (dt == 0 || dn == 0) {
+		return ticks;
+	}
+	return (uint64_t)((double)ticks * ((double)dn / (double)dt));
+#endif
+}
+
+// re_clock_ticks is the inverse of re_clock_ns.
+static uint64_t re_clock_ticks(const re_clock *c, uint64_t ns) {
+#ifdef RE_TICKS_ARE_NANOSECONDS
+	(void)c;
+	return ns;
+#else
+	uint64_t dt = re_ticks() - c->base_ticks;
+	uint64_t dn = re_nanotime() - c->base_ns;
+	if (dt == 0 || dn == 0) {
+		return ns;
+	}
+	return (uint64_t)((double)ns * ((double)dt / (double)dn));
+#endif
+}
+
+// Match latency histograms are log-linear: values less than HIST_SUB_COUNT
+// have their own bucket and every power of two above that is divided into
+// HIST_SUB_COUNT buckets, which bounds the relative error to 1/HIST_SUB_COUNT.
+// Values are recorded in ticks and converted to nanoseconds when read.
+#define HIST_SUB_BITS  3
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS  40 // larger values are clamped
+#define HIST_BUCKETS   ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct {
+	uint64_t count;
+	uint64_t max;
+	uint32_t buckets[HIST_BUCKETS];
+} latency_hist;
+
+static inline int hist_bucket(uint64_t v) {
+	if (v < HIST_SUB_COUNT) {
+		return (int)v;
+	}
+	if (v >= (1LLU << HIST_MAX_BITS)) {
+		v = (1LLU << HIST_MAX_BITS) - 1;
+	}
+#if HEDLEY_HAS_BUILTIN(__builtin_clzll) || HEDLEY_GCC_VERSION_CHECK(3,4,0)
+	int msb = 63 - __builtin_clzll(v);
+#else
+	int msb = 0;
+	for (uint64_t x = v; x >>= 1; ) {
+		msb++;
+	}
+#endif
+	int shift = msb - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB_COUNT + (int)((v >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+// hist_bucket_value returns the midpoint of the values stored in bucket b.
+static uint64_t hist_bucket_value(int b) {
+	if (b < HIST_SUB_COUNT) {
+		return (uint64_t)b;
+	}
+	int shift = b / HIST_SUB_COUNT - 1;
+	uint64_t lo = (uint64_t)(b % HIST_SUB_COUNT + HIST_SUB_COUNT) << shift;
+	return lo + ((1LLU << shift) >> 1);
+}
+
+static inline void hist_record(latency_hist *h, uint64_t v) {
+	h->count++;
+	h->buckets[hist_bucket(v)]++;
+	if (v > h->max) {
+		h->max = v;
+	}
+}
+
+// hist_percentile returns the value at percentile p (0-100) of h.
+static uint64_t hist_percentile(const latency_hist *h, double p) {
+	if (h->count == 0) {
+		return 0;
+	}
+	uint64_t rank = (uint64_t)((p / 100.0) * (double)h->count + 0.5);
+	if (rank == 0) {
+		rank = 1;
+	}
+	uint64_t n = 0;
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		n += h->buckets[b];
+		if (n >= rank) {
+			uint64_t v = hist_bucket_value(b);
+			return v < h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
 // Forward declarations
 typedef struct cache_entry cache_entry;
 typedef struct cache_list cache_list;
+typedef struct slow_log slow_log;
+typedef struct litset litset;
+typedef struct sig_query sig_query;
+
+typedef struct {
+	uint64_t compile_ticks; // see re_ticks
+	uint64_t hits;
+	uint64_t matches;
+	uint64_t timed_matches; // see MATCH_SAMPLE_RATE
+	uint64_t match_ticks;   // time spent in timed matches
+	uint64_t memo_hits;     // matches whose result was taken from the memo
+} cache_entry_stats;
+
+// memo holds the REGEXP results of the recent subjects of a pattern, which
+// saves matching columns that have few distinct values (e.g. a status or a
+// country). It is a direct-mapped table indexed by a hash of the subject and
+// the subjects are compared in full. Since REGEXP is deterministic a result
+// never goes stale. The memo turns itself off when fewer than one in four
+// lookups of a window of MEMO_WINDOW lookups hit (see: regexp_match_memo).
+typedef struct {
+	uint64_t hash;
+	char     *subject; // NULL if the slot is empty
+	uint32_t len;
+	bool     match;
+} memo_slot;
+
+typedef struct {
+	re_pool   *pool;   // of the cache, allocates the memo and the subjects
+	uint32_t  mask;    // number of slots - 1
+	uint32_t  lookups; // in the current window
+	uint32_t  hits;    // in the current window
+	size_t    size;    // bytes allocated including the subjects
+	memo_slot slots[];
+} memo;
+
+#define MEMO_WINDOW 1024
 
 struct cache_entry {
 	cache_entry *next;
@@ -117,15 +581,69 @@ struct cache_entry {
 	char        *pattern __counted_by(pattern_len);
 	pcre2_code  *code;
 	bool        jit_compiled; // TODO: pack into top-bit of ref_count
+	// Private copy of code for partial matches (regexp_z), since JIT compiling
+	// code for them would modify it while regexp_scan workers may use it.
+	pcre2_code  *partial_code;
+	bool        jit_partial;  // partial_code is JIT compiled
+	uint32_t    sample_countdown; // matches until the next timed match
+	cache_entry_stats stats;
+	latency_hist *hist; // allocated when histograms are enabled
+	// Literal that every match contains, used to rule out subjects before
+	// matching them in batches (see: cache_entry_init_literal).
+	char        *literal __counted_by(literal_len);
+	uint32_t    literal_len;
+	uint32_t    literal_rare; // offset of the rarest byte of the literal
+	bool        literal_init;
+	litset      *litset; // set if the pattern is an alternation of literals
+	memo        *memo;   // allocated by the first REGEXP call
+	bool        memo_off; // the hit rate of the memo was too low
+	sig_query   *sig;     // see: regexp_may_match
+	bool        sig_init;
 };
 
+// memo_round_size rounds the number of slots of a memo up to a power of two.
+static uint32_t memo_round_size(sqlite3_int64 n) {
+	if (n <= 0) {
+		return 0;
+	}
+	uint32_t size = 1;
+	while (size < n) {
+		size <<= 1;
+	}
+	return size;
+}
+
+static void memo_free(memo *m) {
+	for (uint32_t i = 0; i <= m->mask; i++) {
+		re_pool_free(m->slots[i].subject, m->pool);
+	}
+	re_pool_free(m, m->pool);
+}
+
+// cache_entry_free frees the members of c. The pattern is part of the
+// allocation of c (see: regexp_compile).
 static void cache_entry_free(cache_entry *c) {
-	if (c->pattern) {
-		re_free(c->pattern);
+	if (c->memo) {
+		memo_free(c->memo);
 	}
 	if (c->code) {
 		pcre2_code_free(c->code);
 	}
+	if (c->partial_code) {
+		pcre2_code_free(c->partial_code);
+	}
+	if (c->hist) {
+		re_free(c->hist);
+	}
+	if (c->literal) {
+		re_free(c->literal);
+	}
+	if (c->litset) {
+		re_free(c->litset);
+	}
+	if (c->sig) {
+		re_free(c->sig);
+	}
 	// Zero the entry while preserving the intrusive list.
 	memset(&c->ref_count, 0, sizeof(cache_entry) - offsetof(cache_entry, ref_count));
 }
@@ -140,18 +658,52 @@ typedef struct {
 	uint64_t hits;
 	uint64_t misses;
 	uint64_t regexes_compiled;
+	uint64_t compile_ticks;
+	uint64_t matches;
+	uint64_t timed_matches;
+	uint64_t match_ticks;
+	uint64_t memo_hits;
 } cache_list_stats;
 
+// Runtime settings, see: regexp_config.
+typedef struct {
+	uint32_t sample_rate; // matches per timed match, 0 disables timing
+	size_t   jit_stack_limit; // max size of a grown JIT stack
+	uint32_t memo_size;   // slots of the memo of a pattern, 0 disables it
+	bool     histograms;  // record timed matches in latency histograms
+	uint64_t slow_threshold_ns; // 0 disables the slow log
+	uint64_t slow_ticks;        // slow_threshold_ns in ticks
+} cache_list_config;
+
+// match_env holds the JIT stack, match context and match data of a thread.
+// The caches of a connection each have one (connections are only used by one
+// thread at a time) and every regexp_scan worker has its own, so compiled
+// patterns can be matched concurrently. The JIT stack starts with a maximum
+// size of JIT_STACK_MAX_SIZE and is replaced with a larger one when a match
+// runs out of stack (see: match_env_grow).
+typedef struct {
+	pcre2_general_context *general_context; // used to allocate jit_stack
+	pcre2_jit_stack     *jit_stack;
+	size_t              jit_stack_size; // max size of jit_stack
+	pcre2_match_context *context;
+	pcre2_match_data    *match_data; // oveccount == 1
+	uint64_t            jit_stack_grows;
+} match_env;
+
 // cache_list is a doubly linked list of compiled pcre2 codes
 struct cache_list {
 	cache_entry           root;
 	int                   len;
+	const char            *name; // name of the function using the cache
+	re_clock              clock;
+	cache_list_config     config;
+	latency_hist          *hist; // totals of the entry histograms
+	slow_log              *slow_log; // shared by all caches, may be NULL
 	// Shared pcre2 data structures.
+	re_pool               pool; // used by general_context
 	pcre2_general_context *general_context;
 	pcre2_compile_context *compile_context;
-	pcre2_jit_stack       *jit_stack;
-	pcre2_match_context   *context;
-	pcre2_match_data      *match_data; // oveccount == 1
+	match_env             env; // created with the first compiled pattern
 	cache_list_stats      stats;
 };
 
@@ -163,7 +715,7 @@ static void cache_list_insert(cache_list *l, cache_entry *e, cache_entry *at) {
 	e->prev = at;
 	e->next = at->next;
 	e->prev->next = e;
-	e->prev->prev = e;
+	e->next->prev = e;
 	l->len++;
 }
 
@@ -205,31 +757,41 @@ static inline void cache_list_move_front(cache_list *l, cache_entry *e) {
 	cache_list_push_front(l, e);
 	if (l->len > CACHE_SIZE) {
 		cache_entry *back = cache_list_back(l);
-		cache_list_remove(l, e);
+		cache_list_remove(l, back);
+		l->stats.evacuations++;
+		RE_PROBE(cache__evict, l->name, back->pattern, back->pattern_len,
+		         back->ref_count);
 		if (back->ref_count == 0) {
 			// Free the entry if nothing is using it. If it is in
 			// use then it will be put back into the list when the
 			// statement using it is closed.
 			cache_entry_free(back);
+			re_free(back);
 		}
 	}
 }
 
-static cache_list *cache_list_init(void) {
+static cache_list *cache_list_init(const char *name) {
 	cache_list *list = re_malloc(sizeof(cache_list));
 	if (!list) {
 		return NULL;
 	}
 	memset(list, 0, sizeof(cache_list));
+	list->name = name;
+	list->config.sample_rate = MATCH_SAMPLE_RATE;
+	list->config.jit_stack_limit = JIT_STACK_LIMIT;
+	list->config.memo_size = memo_round_size(MEMO_SIZE);
+	re_clock_init(&list->clock);
 
 	// Create a general context that uses sqlite3's memory allocator instead of
-	// the system default. This simplifies the tracking of memory used.
+	// the system default. This simplifies the tracking of memory used. The
+	// allocations are pooled since compiling a pattern makes many of them.
 	//
 	// clang-format off
 	list->general_context = pcre2_general_context_create(
-		re_pcre2_malloc,
-		re_pcre2_free,
-		NULL
+		re_pool_malloc,
+		re_pool_free,
+		&list->pool
 	);
 	if (!list->general_context) {
 		goto error;
@@ -249,71 +811,119 @@ static cache_list *cache_list_init(void) {
 	return list;
 
 error:
-	if (list->general_context) {
-		pcre2_general_context_free(list->general_context);
-	}
 	if (list->compile_context) {
 		pcre2_compile_context_free(list->compile_context);
 	}
+	if (list->general_context) {
+		pcre2_general_context_free(list->general_context);
+	}
+	re_pool_trim(&list->pool);
 	re_free(list);
 	return NULL;
 }
 
-static pcre2_jit_stack *cache_list_jit_stack_callback(void* p) {
-	return ((cache_list *)p)->jit_stack;
+static pcre2_jit_stack *match_env_jit_stack(void *p) {
+	return ((match_env *)p)->jit_stack;
 }
 
-static int cache_list_init_jit_stack(cache_list *cache) {
+// match_env_init creates the JIT stack, match context and match data of env,
+// which must be freed with match_env_free (even on error). The JIT stack is
+// looked up through a callback so that it can be replaced.
+static int match_env_init(match_env *env, pcre2_general_context *gcontext) {
+	memset(env, 0, sizeof(match_env));
+	env->general_context = gcontext;
 	// clang-format off
-	cache->jit_stack = pcre2_jit_stack_create(
+	env->jit_stack = pcre2_jit_stack_create(
 		JIT_STACK_START_SIZE,
 		JIT_STACK_MAX_SIZE,
-		cache->general_context
+		gcontext
 	);
-	if (cache->jit_stack == NULL) {
-		return 1;
+	env->jit_stack_size = JIT_STACK_MAX_SIZE;
+	env->context = pcre2_match_context_create(gcontext);
+	// Use oveccount == 1 since we don't care about capture groups.
+	env->match_data = pcre2_match_data_create(1, gcontext);
+	if (!env->jit_stack || !env->context || !env->match_data) {
+		return SQLITE_NOMEM;
 	}
+	pcre2_jit_stack_assign(env->context, match_env_jit_stack, env);
+	return SQLITE_OK;
+}
 
-	cache->context = pcre2_match_context_create(cache->general_context);
-	if (cache->context == NULL) {
-		return 1;
+static void match_env_free(match_env *env) {
+	if (env->jit_stack) {
+		pcre2_jit_stack_free(env->jit_stack);
 	}
-	pcre2_jit_stack_assign(cache->context, cache_list_jit_stack_callback, cache);
-
-	// Use oveccount == 1 since we don't care about capture groups.
-	cache->match_data = pcre2_match_data_create(1, cache->general_context);
-	if (cache->match_data == NULL) {
-		return 1;
+	if (env->context) {
+		pcre2_match_context_free(env->context);
 	}
-	return 0;
+	if (env->match_data) {
+		pcre2_match_data_free(env->match_data);
+	}
+	memset(env, 0, sizeof(match_env));
 }
 
-static void cache_list_free(cache_list *list) {
-	if (!list) {
-		return;
-	}
-	if (list->general_context) {
-		pcre2_jit_free_unused_memory(list->general_context);
-		pcre2_general_context_free(list->general_context);
+// match_env_grow replaces the JIT stack of env, after a match failed with
+// PCRE2_ERROR_JIT_STACKLIMIT, with one that is twice as large but at most
+// limit bytes. Returns false if the stack cannot grow, in which case the
+// match should fail.
+static noinline bool match_env_grow(match_env *env, size_t limit) {
+	if (env->jit_stack_size >= limit) {
+		return false;
 	}
-	if (list->compile_context) {
-		pcre2_compile_context_free(list->compile_context);
+	size_t size = env->jit_stack_size <= limit / 2 ? 2 * env->jit_stack_size : limit;
+	pcre2_jit_stack *stack = pcre2_jit_stack_create(JIT_STACK_START_SIZE, size,
+	                                                env->general_context);
+	if (!stack) {
+		return false;
 	}
-	if (list->jit_stack) {
-		pcre2_jit_stack_free(list->jit_stack);
+	pcre2_jit_stack_free(env->jit_stack);
+	env->jit_stack = stack;
+	env->jit_stack_size = size;
+	env->jit_stack_grows++;
+	return true;
+}
+
+// match_env_shrink replaces the JIT stack of env with one of the default size
+// if it grew to more than limit bytes.
+static void match_env_shrink(match_env *env, size_t limit) {
+	if (!env->jit_stack || env->jit_stack_size <= limit ||
+	    env->jit_stack_size == JIT_STACK_MAX_SIZE) {
+		return;
 	}
-	if (list->context) {
-		pcre2_match_context_free(list->context);
+	pcre2_jit_stack *stack = pcre2_jit_stack_create(
+		JIT_STACK_START_SIZE, JIT_STACK_MAX_SIZE, env->general_context);
+	if (!stack) {
+		return; // keep the larger stack
 	}
-	if (list->match_data) {
-		pcre2_match_data_free(list->match_data);
+	pcre2_jit_stack_free(env->jit_stack);
+	env->jit_stack = stack;
+	env->jit_stack_size = JIT_STACK_MAX_SIZE;
+}
+
+static void cache_list_free(cache_list *list) {
+	if (!list) {
+		return;
 	}
+	// Everything allocated by the general context must be freed before the
+	// pool is trimmed.
 	for (cache_entry *e = list->root.next; e != &list->root; ) {
 		cache_entry *next = e->next;
 		cache_entry_free(e);
 		re_free(e);
 		e = next;
 	}
+	match_env_free(&list->env);
+	if (list->compile_context) {
+		pcre2_compile_context_free(list->compile_context);
+	}
+	if (list->general_context) {
+		pcre2_jit_free_unused_memory(list->general_context);
+		pcre2_general_context_free(list->general_context);
+	}
+	re_pool_trim(&list->pool);
+	if (list->hist) {
+		re_free(list->hist);
+	}
 #ifndef NDEBUG
 	// Zero when debugging to detect "use after free" errors
 	memset(list, 0, sizeof(cache_list));
@@ -321,6 +931,98 @@ static void cache_list_free(cache_list *list) {
 	re_free(list);
 }
 
+// cache_memory is the memory used by a cache in bytes.
+typedef struct {
+	size_t code;       // compiled patterns and literal sets
+	size_t jit;        // JIT compiled code
+	size_t jit_stack;  // maximum size of the JIT stack
+	size_t match_data; // including the heap frames of the interpreter
+	size_t pool;       // freed allocations kept for reuse (see: re_pool)
+	size_t memo;       // memoized results (see: memo)
+} cache_memory;
+
+static void cache_entry_memory(const cache_entry *e, cache_memory *m) {
+	size_t n = 0;
+	if (e->code) {
+		pcre2_pattern_info(e->code, PCRE2_INFO_SIZE, &n);
+		m->code += n;
+	}
+	if (e->litset) {
+		m->code += (size_t)sqlite3_msize(e->litset);
+	}
+	if (e->sig) {
+		m->code += (size_t)sqlite3_msize(e->sig);
+	}
+	if (e->jit_compiled) {
+		n = 0;
+		pcre2_pattern_info(e->code, PCRE2_INFO_JITSIZE, &n);
+		m->jit += n;
+	}
+	if (e->partial_code) {
+		n = 0;
+		pcre2_pattern_info(e->partial_code, PCRE2_INFO_SIZE, &n);
+		m->code += n;
+	}
+	if (e->jit_partial) {
+		n = 0;
+		pcre2_pattern_info(e->partial_code, PCRE2_INFO_JITSIZE, &n);
+		m->jit += n;
+	}
+	if (e->memo) {
+		m->memo += e->memo->size;
+	}
+}
+
+static void cache_list_memory(const cache_list *l, cache_memory *m) {
+	memset(m, 0, sizeof(cache_memory));
+	for (const cache_entry *e = l->root.next; e != &l->root; e = e->next) {
+		cache_entry_memory(e, m);
+	}
+	if (l->env.jit_stack) {
+		m->jit_stack = l->env.jit_stack_size;
+	}
+	m->pool = l->pool.free_bytes;
+	if (l->env.match_data) {
+		m->match_data = pcre2_get_match_data_size(l->env.match_data);
+#if PCRE2_MAJOR > 10 || (PCRE2_MAJOR == 10 && PCRE2_MINOR >= 45)
+		m->match_data += pcre2_get_match_data_heapframes_size(l->env.match_data);
+#endif
+	}
+}
+
+// cache_list_shrink releases the memory that l does not need right now: it
+// evicts the entries that are not in use, frees the memos of the entries that
+// are, shrinks the JIT stack to its default size, recreates the match data
+// (which keeps the heap frames of the largest interpreted match) and returns
+// unused JIT memory to the system. Memos are on by default (MEMO_SIZE), so a
+// shrink always drops them and they are rebuilt by later matches.
+static void cache_list_shrink(cache_list *l) {
+	for (cache_entry *e = l->root.next; e != &l->root; ) {
+		cache_entry *next = e->next;
+		if (e->ref_count == 0) {
+			cache_list_remove(l, e);
+			l->stats.evacuations++;
+			RE_PROBE(cache__evict, l->name, e->pattern, e->pattern_len, 0);
+			cache_entry_free(e);
+			re_free(e);
+		} else if (e->memo) {
+			memo_free(e->memo);
+			e->memo = NULL;
+		}
+		e = next;
+	}
+	if (l->env.jit_stack) {
+		match_env_shrink(&l->env, JIT_STACK_MAX_SIZE);
+		pcre2_match_data *md = pcre2_match_data_create(1, l->general_context);
+		if (md) {
+			pcre2_match_data_free(l->env.match_data);
+			l->env.match_data = md;
+		}
+	}
+	pcre2_jit_free_unused_memory(l->general_context);
+	re_pool_trim(&l->pool);
+}
+
 // sqlite3_cache_list_destroy is the destructor
 // used be sqlite3_create_function_v2.
 static void sqlite3_cache_list_destroy(void *p) {
@@ -335,16 +1037,45 @@ static cache_entry *cache_list_find(cache_list *l, const char *ptrn, uint32_t pl
 		if (cache_entry_match(e, ptrn, plen)) {
 			cache_list_move_front(l, e);
 			l->stats.hits++;
+			e->stats.hits++;
+			RE_PROBE(cache__hit, l->name, ptrn, plen);
 			return e;
 		}
 	}
 	l->stats.misses++;
+	RE_PROBE(cache__miss, l->name, ptrn, plen);
 	return NULL;
 }
 
-HEDLEY_PRINTF_FORMAT(3, 4)
-static noinline void handle_pcre2_error(sqlite3_context *ctx, int errcode,
-                                         const char *format, ...) {
+// set_result_error sets the result of ctx to the error message err, which
+// must have been allocated by sqlite3_mprintf, and frees it. A NULL err is
+// treated as an out of memory error.
+static void set_result_error(sqlite3_context *ctx, char *err) {
+	if (!err) {
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+	sqlite3_result_error(ctx, err, -1);
+	re_free(err);
+}
+
+// set_vtab_error replaces the error message of virtual table vtab with err,
+// which must have been allocated by sqlite3_mprintf, and returns the sqlite3
+// error code that should be returned to the caller.
+static int set_vtab_error(sqlite3_vtab *vtab, char *err) {
+	if (!err) {
+		return SQLITE_NOMEM;
+	}
+	sqlite3_free(vtab->zErrMsg);
+	vtab->zErrMsg = err;
+	return SQLITE_ERROR;
+}
+
+// format_pcre2_error returns an error message describing pcre2 error errcode
+// prefixed with the printf style message format. The returned string must be
+// freed with sqlite3_free. NULL is returned if memory could not be allocated.
+HEDLEY_PRINTF_FORMAT(2, 3)
+static noinline char *format_pcre2_error(int errcode, const char *format, ...) {
 	enum { ERRBUFSIZ = 256 }; // taken from pcre2grep
 	char buf[ERRBUFSIZ];
 	int rc = pcre2_get_error_message(errcode, (PCRE2_UCHAR8 *)&buf[0], ERRBUFSIZ);
@@ -357,111 +1088,443 @@ static noinline void handle_pcre2_error(sqlite3_context *ctx, int errcode,
 	char *msg = sqlite3_vmprintf(format, args);
 	va_end(args);
 	if (!msg) {
-		sqlite3_result_error_nomem(ctx);
-		return;
+		return NULL;
 	}
 
 	char *err = sqlite3_mprintf("regexp: %s: %s", msg, &buf[0]);
-	if (!err) {
-		re_free(msg);
-		sqlite3_result_error_nomem(ctx);
-		return;
-	}
-
-	sqlite3_result_error(ctx, err, -1);
-
 	re_free(msg);
-	re_free(err);
+	return err;
 }
 
-static noinline void handle_pcre2_compilation_error(
-	sqlite3_context *ctx,
-	int errcode,
-    const char *pattern,
-    uint32_t pattern_len,
-    size_t errpos
-) {
+// truncate_pattern returns a copy of pattern that has been truncated to
+// MAX_DISPLAYED_PATTERN_LENGTH, or NULL if the pattern does not need to
+// be truncated or memory could not be allocated (check *nomem).
+static char *truncate_pattern(const char *pattern, uint32_t pattern_len, bool *nomem) {
 	#define max_size MAX_DISPLAYED_PATTERN_LENGTH
-	static const char *format = "error compiling pattern '%s' at offset %llu";
+	*nomem = false;
+	if (max_size < 0 || pattern_len <= max_size) {
+		return NULL;
+	}
+	int64_t omitted = pattern_len - max_size;
+	char *s = sqlite3_mprintf("%.*s... omitting %lld bytes ...%.*s",
+	                          max_size/2, pattern,
+	                          omitted,
+	                          max_size/2, &pattern[pattern_len - (max_size/2)]);
+	*nomem = (s == NULL);
+	return s;
+	#undef max_size
+}
 
-	if (0 < max_size && pattern_len <= max_size) {
-		handle_pcre2_error(ctx, errcode, format, pattern, errpos);
-	} else {
-		// Truncate large patterns
-		int64_t omitted = pattern_len - max_size;
-		char *msg = sqlite3_mprintf("%.*s... omitting %lld bytes ...%.*s",
-		                       max_size/2, pattern,
-		                       omitted,
-		                       max_size/2, &pattern[pattern_len - (max_size/2)]);
-		if (!msg) {
-			sqlite3_result_error_nomem(ctx);
-			return;
+// slow_log is a ring buffer of the compilations and matches that took longer
+// than slow_threshold_ns (see: regexp_config). Subjects are not recorded
+// since they may contain sensitive data.
+typedef struct {
+	uint64_t   seq;         // position of the record in the log
+	const char *cache;      // name of the cache
+	char       *pattern;    // truncated, see truncate_pattern
+	uint32_t   pattern_len; // length of the full pattern
+	int64_t    subject_len; // -1 for compilations
+	uint64_t   duration_ns;
+	bool       jit;
+} slow_log_record;
+
+struct slow_log {
+	uint64_t        seq; // number of records ever added
+	int             len; // number of records in the log
+	slow_log_record records[SLOW_LOG_SIZE];
+};
+
+static void slow_log_reset(slow_log *log) {
+	for (int i = 0; i < SLOW_LOG_SIZE; i++) {
+		if (log->records[i].pattern) {
+			re_free(log->records[i].pattern);
 		}
-		handle_pcre2_error(ctx, errcode, format, msg, errpos);
-		re_free(msg);
 	}
-	#undef max_size
+	memset(log->records, 0, sizeof(log->records));
+	log->len = 0;
+}
+
+// slow_log_add adds a record to the slow log of cache, replacing the oldest
+// record if the log is full. The record is dropped if memory could not be
+// allocated.
+static noinline void slow_log_add(cache_list *cache, const char *pattern,
+                                  uint32_t pattern_len, int64_t subject_len,
+                                  uint64_t ticks, bool jit) {
+	slow_log *log = cache->slow_log;
+	if (!log) {
+		return;
+	}
+	bool nomem;
+	char *p = truncate_pattern(pattern, pattern_len, &nomem);
+	if (!p && !nomem) {
+		p = sqlite3_mprintf("%.*s", (int)pattern_len, pattern);
+	}
+	if (!p) {
+		return;
+	}
+	slow_log_record *rec = &log->records[log->seq % SLOW_LOG_SIZE];
+	if (rec->pattern) {
+		re_free(rec->pattern);
+	}
+	rec->seq = log->seq++;
+	rec->cache = cache->name;
+	rec->pattern = p;
+	rec->pattern_len = pattern_len;
+	rec->subject_len = subject_len;
+	rec->duration_ns = re_clock_ns(&cache->clock, ticks);
+	rec->jit = jit;
+	if (log->len < SLOW_LOG_SIZE) {
+		log->len++;
+	}
+}
+
+// is_slow returns if an operation that took ticks should be logged.
+static inline bool is_slow(const cache_list *cache, uint64_t ticks) {
+	return cache->config.slow_ticks != 0 && ticks >= cache->config.slow_ticks;
+}
+
+static noinline char *format_pcre2_compilation_error(
+	int errcode,
+    const char *pattern,
+    uint32_t pattern_len,
+    size_t errpos
+) {
+	static const char *format = "error compiling pattern '%s' at offset %llu";
+
+	// Truncate large patterns
+	bool nomem;
+	char *p = truncate_pattern(pattern, pattern_len, &nomem);
+	if (nomem) {
+		return NULL;
+	}
+	char *err = format_pcre2_error(errcode, format, p ? p : pattern,
+	                               (unsigned long long)errpos);
+	if (p) {
+		re_free(p);
+	}
+	return err;
 }
 
 // TODO: Consider only printing the pattern and omitting the subject since there
 // could be some security and PIAA risks caused by including the subject in the
 // error message, which will likely be logged.
-static noinline void handle_pcre2_match_error(
-	sqlite3_context *ctx,
+static noinline char *format_pcre2_match_error(
 	int errcode,
     const char *pattern,
     uint32_t pattern_len,
     const char *subject,
     uint32_t subject_len
 ) {
-	#define max_size MAX_DISPLAYED_PATTERN_LENGTH
 	const char *format = "error matching regex: '%s' against subject: '%s'";
 
-	if (max_size < 0 || (pattern_len <= max_size && subject_len <= max_size)) {
-		handle_pcre2_error(ctx, errcode, format, pattern, subject);
-		return;
-	}
-
-	char *p = NULL;
-	char *s = NULL;
-	if (pattern_len > max_size) {
-		int64_t omitted = pattern_len - max_size;
-		p = sqlite3_mprintf("%.*s... omitting %lld bytes ...%.*s",
-		                    max_size/2, pattern,
-		                    omitted,
-		                    max_size/2, &pattern[pattern_len - (max_size/2)]);
-		if (!p) {
-			sqlite3_result_error_nomem(ctx);
-			return;
-		}
+	bool nomem;
+	char *p = truncate_pattern(pattern, pattern_len, &nomem);
+	if (nomem) {
+		return NULL;
 	}
 	// WARN: printing the subject could be a security/privacy risk and
 	// should be optional.
-	if (subject_len > max_size) {
-		int64_t omitted = subject_len - max_size;
-		s = sqlite3_mprintf("%.*s... omitting %lld bytes ...%.*s",
-		                    max_size/2, subject,
-		                    omitted,
-		                    max_size/2, &subject[subject_len - (max_size/2)]);
-		if (!s) {
+	char *s = truncate_pattern(subject, subject_len, &nomem);
+	if (nomem) {
+		if (p) {
 			re_free(p);
-			sqlite3_result_error_nomem(ctx);
-			return;
 		}
+		return NULL;
 	}
-	handle_pcre2_error(ctx, errcode, format, p ? p : pattern, s ? s : subject);
+	char *err = format_pcre2_error(errcode, format, p ? p : pattern, s ? s : subject);
 	if (p) {
 		re_free(p);
 	}
 	if (s) {
 		re_free(s);
 	}
-	#undef max_size
+	return err;
+}
+
+// litset is a DFA that matches alternations of literals, like keyword lists
+// (foo|bar|baz), in time independent of the number of literals. PCRE2 tries
+// each alternative at every position of the subject, which makes matching
+// large lists slow.
+//
+// The DFA is built from an Aho-Corasick automaton: every transition of every
+// state is precomputed so that matching is a table lookup per byte. Bytes are
+// mapped to equivalence classes (bytes that do not appear in a literal share
+// one class) to keep the table small. Since only whether a subject matches
+// is needed, transitions into states that complete a literal point to
+// LITSET_MATCH and matching stops.
+//
+// Caseless literals are folded to lower case with ASCII rules. PCRE2 also
+// matches 'k' and 's' with the Kelvin sign (U+212A) and the long s (U+017F),
+// so if the literals contain them the lead bytes of those characters lead to
+// the FOLD state, which reads the character and follows the transition of the
+// ASCII letter instead.
+
+#define LITSET_MATCH 0 // offset of the match state
+#define LITSET_FOLD  1 // index of the state that folds U+017F and U+212A
+#define LITSET_ROOT  2 // index of the root state
+#define LITSET_NONE UINT32_MAX
+
+// Error of functions that need the position of matches for literal sets that
+// are too large for PCRE2 (see: regexp_compile).
+#define LITSET_ONLY_ERROR \
+	"pattern is too large (keyword lists this large can only be used with REGEXP)"
+
+struct litset {
+	uint32_t n_literals;
+	uint32_t n_classes;
+	uint32_t n_states;
+	uint8_t  classes[256];
+	uint32_t delta[]; // n_states * n_classes, entries are state offsets
+};
+
+// litset_match returns 1 if subject contains a literal of ls and
+// PCRE2_ERROR_NOMATCH otherwise.
+static int litset_match(const litset *ls, const char *subject, size_t subject_len) {
+	const unsigned char *s = (const unsigned char *)subject;
+	const uint32_t *delta = ls->delta;
+	const uint32_t root = LITSET_ROOT * ls->n_classes;
+	uint32_t state = root;
+	for (size_t i = 0; i < subject_len; i++) {
+		uint32_t next = delta[state + ls->classes[s[i]]];
+		if (unlikely(next < root)) {
+			if (next == LITSET_MATCH) {
+				return 1;
+			}
+			// LITSET_FOLD: bytes that are not part of a literal are
+			// class 0.
+			uint8_t c = 0;
+			if (s[i] == 0xc5 && i + 1 < subject_len && s[i + 1] == 0xbf) {
+				c = ls->classes['s'];
+				i += 1;
+			} else if (s[i] == 0xe2 && i + 2 < subject_len && s[i + 1] == 0x84 &&
+			           s[i + 2] == 0xaa) {
+				c = ls->classes['k'];
+				i += 2;
+			}
+			next = delta[state + c];
+			if (next == LITSET_MATCH) {
+				return 1;
+			}
+		}
+		state = next;
+	}
+	return PCRE2_ERROR_NOMATCH;
+}
+
+static inline bool litset_is_meta(unsigned char c) {
+	return c != '\0' && strchr("\\^$.[]|()?*+{}", c) != NULL;
+}
+
+static inline bool litset_is_alnum(unsigned char c) {
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
 }
 
-static cache_entry *regexp_compile(sqlite3_context *ctx, cache_list *cache,
-                                   const char *pattern, uint32_t pattern_len,
-                                   bool caseless) {
+static inline unsigned char litset_fold(unsigned char c) {
+	return c >= 'A' && c <= 'Z' ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+// litset_parse stores the literals of pattern, if it is an alternation of at
+// least LITSET_MIN_LITERALS literals optionally wrapped in a group and
+// preceded by (?i), in buf (which must be at least as large as pattern) and
+// their end offsets in ends. Returns the number of literals or 0.
+static uint32_t litset_parse(const char *pattern, size_t len, bool *caseless,
+                             char *buf, uint32_t *ends) {
+	const char *p = pattern;
+	const char *end = pattern + len;
+	if (len >= 4 && memcmp(p, "(?i)", 4) == 0) {
+		*caseless = true;
+		p += 4;
+	}
+	if (end - p >= 2 && *p == '(' && end[-1] == ')') {
+		p += (end - p >= 4 && memcmp(p, "(?:", 3) == 0) ? 3 : 1;
+		end--;
+	}
+	uint32_t n = 0;
+	size_t size = 0;
+	size_t start = 0;
+	for (; p <= end; p++) {
+		if (p == end || *p == '|') {
+			if (size == start) {
+				return 0; // empty alternative
+			}
+			ends[n++] = (uint32_t)size;
+			start = size;
+			continue;
+		}
+		unsigned char c = (unsigned char)*p;
+		if (c == '\\') {
+			// Only escaped punctuation is a literal.
+			if (++p == end) {
+				return 0;
+			}
+			c = (unsigned char)*p;
+			if (c >= 0x80 || litset_is_alnum(c) || c < 0x20) {
+				return 0;
+			}
+		} else if (litset_is_meta(c)) {
+			return 0;
+		}
+		if (*caseless) {
+			if (c >= 0x80) {
+				return 0; // non-ASCII case folding
+			}
+			c = litset_fold(c);
+		}
+		buf[size++] = (char)c;
+	}
+	return n >= LITSET_MIN_LITERALS ? n : 0;
+}
+
+// litset_compile sets *out to the literal set matcher of pattern or NULL if
+// pattern is not an alternation of literals or the DFA would be too large.
+static int litset_compile(const char *pattern, size_t pattern_len, bool caseless,
+                          litset **out) {
+	*out = NULL;
+	if (pattern_len < LITSET_MIN_LITERALS) {
+		return SQLITE_OK;
+	}
+
+	int rc = SQLITE_NOMEM;
+	litset *ls = NULL;
+	uint32_t *fail = NULL;
+	uint32_t *queue = NULL;
+	bool *terminal = NULL;
+	char *buf = re_malloc(pattern_len);
+	uint32_t *ends = re_malloc(sizeof(uint32_t) * (pattern_len / 2 + 1));
+	if (!buf || !ends) {
+		goto exit;
+	}
+	uint32_t n = litset_parse(pattern, pattern_len, &caseless, buf, ends);
+	if (n == 0) {
+		rc = SQLITE_OK;
+		goto exit;
+	}
+	size_t size = ends[n - 1];
+
+	// Byte classes: 0 for bytes that are not part of a literal.
+	uint8_t classes[256] = {0};
+	uint32_t n_classes = 1;
+	bool fold = false;
+	for (size_t i = 0; i < size; i++) {
+		unsigned char c = (unsigned char)buf[i];
+		if (classes[c] == 0) {
+			if (n_classes == 254) {
+				rc = SQLITE_OK; // leave large alphabets to PCRE2
+				goto exit;
+			}
+			classes[c] = (uint8_t)n_classes++;
+			if (caseless && c >= 'a' && c <= 'z') {
+				classes[c - ('a' - 'A')] = classes[c];
+			}
+			fold = fold || (caseless && (c == 'k' || c == 's'));
+		}
+	}
+	uint8_t fold_class = 0;
+	if (fold) {
+		fold_class = (uint8_t)n_classes++;
+		classes[0xc5] = fold_class; // U+017F
+		classes[0xe2] = fold_class; // U+212A
+	}
+
+	size_t max_states = LITSET_ROOT + size + 1;
+	if (max_states * n_classes * sizeof(uint32_t) > LITSET_MAX_SIZE) {
+		rc = SQLITE_OK;
+		goto exit;
+	}
+	ls = re_malloc(sizeof(litset) + max_states * n_classes * sizeof(uint32_t));
+	fail = re_malloc(max_states * sizeof(uint32_t));
+	queue = re_malloc(max_states * sizeof(uint32_t));
+	terminal = re_malloc(max_states * sizeof(bool));
+	if (!ls || !fail || !queue || !terminal) {
+		goto exit;
+	}
+	memset(terminal, 0, max_states * sizeof(bool));
+	uint32_t *delta = ls->delta;
+	for (size_t i = 0; i < max_states * n_classes; i++) {
+		delta[i] = LITSET_NONE;
+	}
+
+	// Build the trie of the literals. Literals that contain another
+	// literal do not need to be added since the shorter one matches first.
+	uint32_t n_states = LITSET_ROOT + 1;
+	for (uint32_t i = 0, start = 0; i < n; start = ends[i++]) {
+		uint32_t state = LITSET_ROOT;
+		for (uint32_t j = start; j < ends[i] && !terminal[state]; j++) {
+			uint32_t *next = &delta[state * n_classes + classes[(unsigned char)buf[j]]];
+			if (*next == LITSET_NONE) {
+				*next = n_states++;
+			}
+			state = *next;
+		}
+		terminal[state] = true;
+	}
+
+	// Compute the failure links in breadth-first order and complete the
+	// transitions of each state with those of its failure state.
+	uint32_t head = 0;
+	uint32_t tail = 0;
+	fail[LITSET_ROOT] = LITSET_ROOT;
+	queue[tail++] = LITSET_ROOT;
+	while (head < tail) {
+		uint32_t state = queue[head++];
+		uint32_t *row = &delta[state * n_classes];
+		const uint32_t *fail_row = &delta[fail[state] * n_classes];
+		for (uint32_t c = 0; c < n_classes; c++) {
+			if (fold && c == fold_class) {
+				row[c] = LITSET_FOLD;
+			} else if (row[c] == LITSET_NONE) {
+				row[c] = state == LITSET_ROOT ? LITSET_ROOT : fail_row[c];
+			} else {
+				uint32_t child = row[c];
+				fail[child] = state == LITSET_ROOT ? LITSET_ROOT : fail_row[c];
+				terminal[child] = terminal[child] || terminal[fail[child]];
+				queue[tail++] = child;
+			}
+		}
+	}
+
+	// Replace state indexes with offsets into delta.
+	for (uint32_t state = LITSET_ROOT; state < n_states; state++) {
+		uint32_t *row = &delta[state * n_classes];
+		for (uint32_t c = 0; c < n_classes; c++) {
+			row[c] = terminal[row[c]] ? LITSET_MATCH : row[c] * n_classes;
+		}
+	}
+	// The match and fold states are never entered.
+	for (uint32_t i = 0; i < LITSET_ROOT * n_classes; i++) {
+		delta[i] = LITSET_MATCH;
+	}
+
+	ls->n_literals = n;
+	ls->n_classes = n_classes;
+	ls->n_states = n_states;
+	memcpy(ls->classes, classes, sizeof(classes));
+	litset *shrunk = sqlite3_realloc64(ls, sizeof(litset) +
+	                                   (size_t)n_states * n_classes * sizeof(uint32_t));
+	if (shrunk) {
+		ls = shrunk;
+	}
+	*out = ls;
+	ls = NULL;
+	rc = SQLITE_OK;
+
+exit:
+	re_free(ls);
+	re_free(fail);
+	re_free(queue);
+	re_free(terminal);
+	re_free(buf);
+	re_free(ends);
+	return rc;
+}
+
+// regexp_compile compiles pattern and returns a new cache entry for it, which
+// is not yet part of the cache and is not included in the cache's statistics.
+// On error NULL is returned and *errmsg is set to an error message that must be
+// freed with sqlite3_free (*errmsg is NULL if memory could not be allocated).
+static cache_entry *regexp_compile(cache_list *cache, const char *pattern,
+                                   uint32_t pattern_len, bool caseless,
+                                   char **errmsg) {
 
 	uint32_t options = PCRE2_MULTILINE | PCRE2_UTF;
 #ifdef PCRE2_MATCH_INVALID_UTF
@@ -474,91 +1537,446 @@ static cache_entry *regexp_compile(sqlite3_context *ctx, cache_list *cache,
 	int errcode;
 	size_t errpos;
 	cache_entry *ent = NULL;
+	*errmsg = NULL;
+
+	RE_PROBE(compile__start, pattern, pattern_len, (int)caseless);
+	uint64_t start = re_ticks();
 
 	// TODO: check if the pattern matches an empty string
 	//	 see: pcre_comp.empty_match in grep/src/pcresearch.c
 	//
 	// clang-format off
+	litset *ls = NULL;
+	int rc = PCRE2_ERROR_JIT_BADOPTION;
 	pcre2_code *code = pcre2_compile((PCRE2_SPTR)pattern, pattern_len, options,
 	                                 &errcode, &errpos, cache->compile_context);
 	if (code == NULL) {
 		// TODO: I think there are more error cases that we want to handle here.
+		RE_PROBE(compile__done, pattern, pattern_len, errcode, 0,
+		         re_clock_ns(&cache->clock, re_ticks() - start));
 		if (errcode == PCRE2_ERROR_NOMEMORY) {
 			goto err_nomem;
 		}
-		handle_pcre2_compilation_error(ctx, errcode, pattern, pattern_len, errpos);
-		return NULL;
-	}
-
-	int rc = pcre2_jit_compile(code, PCRE2_JIT_COMPLETE);
-	if (rc != SQLITE_OK && rc != PCRE2_ERROR_JIT_BADOPTION && rc != PCRE2_ERROR_NOMEMORY) {
-		// PCRE2_ERROR_JIT_BADOPTION: jit not supported
-		// PCRE2_ERROR_NOMEMORY:      pattern too large for jit compilation.
-		pcre2_code_free(code);
-		handle_pcre2_error(ctx, rc, "internal JIT error: %d", rc);
-		return NULL;
+		// Keyword lists that are too large for PCRE2 can still be matched
+		// with a literal set, but not by functions that need the position
+		// of the match (see: LITSET_ONLY_ERROR).
+		if (errcode == PCRE2_ERROR_PATTERN_TOO_LARGE &&
+		    litset_compile(pattern, pattern_len, caseless, &ls) != SQLITE_OK) {
+			goto err_nomem;
+		}
+		if (ls == NULL) {
+			*errmsg = format_pcre2_compilation_error(errcode, pattern, pattern_len, errpos);
+			return NULL;
+		}
+	} else {
+		rc = pcre2_jit_compile(code, PCRE2_JIT_COMPLETE);
+		if (rc != SQLITE_OK && rc != PCRE2_ERROR_JIT_BADOPTION && rc != PCRE2_ERROR_NOMEMORY) {
+			// PCRE2_ERROR_JIT_BADOPTION: jit not supported
+			// PCRE2_ERROR_NOMEMORY:      pattern too large for jit compilation.
+			RE_PROBE(compile__done, pattern, pattern_len, rc, 0,
+			         re_clock_ns(&cache->clock, re_ticks() - start));
+			pcre2_code_free(code);
+			*errmsg = format_pcre2_error(rc, "internal JIT error: %d", rc);
+			return NULL;
+		}
+		if (litset_compile(pattern, pattern_len, caseless, &ls) != SQLITE_OK) {
+			goto err_nomem;
+		}
 	}
 
-	ent = re_malloc(sizeof(cache_entry));
+	// The pattern is stored after the entry to save an allocation.
+	ent = re_malloc(sizeof(cache_entry) + pattern_len + 1);
 	if (ent == NULL) {
 		goto err_nomem;
 	}
-	ent->next = NULL; // pedantically zero
-	ent->prev = NULL;
+	memset(ent, 0, sizeof(cache_entry));
+	ent->pattern_len = pattern_len;
+	ent->pattern = (char *)(ent + 1);
+	memcpy(ent->pattern, pattern, pattern_len);
+	ent->pattern[pattern_len] = '\0';
 	ent->cache = cache;
 	ent->code = code;
 	ent->jit_compiled = (rc == SQLITE_OK);
+	ent->litset = ls;
+	code = NULL; // owned by ent
+	ls = NULL;
+	ent->sample_countdown = 1; // time the first match
+	ent->stats.compile_ticks = re_ticks() - start;
+	RE_PROBE(compile__done, pattern, pattern_len, 0, (int)ent->jit_compiled,
+	         re_clock_ns(&cache->clock, ent->stats.compile_ticks));
 
 	// Initialize the shared JIT stack.
-	if (unlikely(cache->jit_stack == NULL)) {
-		if (cache_list_init_jit_stack(cache)) {
+	if (unlikely(cache->env.jit_stack == NULL)) {
+		if (match_env_init(&cache->env, cache->general_context) != SQLITE_OK) {
+			match_env_free(&cache->env);
 			goto err_nomem;
 		}
 	}
 
-	ent->pattern_len = pattern_len;
-	ent->pattern = re_malloc(ent->pattern_len + 1);
-	if (unlikely(ent->pattern == NULL)) {
-		goto err_nomem;
-	}
-	memcpy(ent->pattern, pattern, ent->pattern_len + 1);
-
-	cache->stats.regexes_compiled++;
 	return ent;
 
 err_nomem:
 	if (code) {
 		pcre2_code_free(code);
 	}
+	if (ls) {
+		re_free(ls);
+	}
 	if (ent) {
 		cache_entry_free(ent);
+		re_free(ent);
 	}
-	sqlite3_result_error_nomem(ctx);
 	return NULL;
 }
 
+// cache_list_lookup returns the cached entry for pattern or compiles a new one
+// if it is not in the cache. The entry's ref_count is incremented and it must
+// be released with cache_entry_release. On error NULL is returned and *errmsg
+// is set (see regexp_compile).
+static cache_entry *cache_list_lookup(cache_list *cache, const char *pattern,
+                                      uint32_t pattern_len, bool caseless,
+                                      char **errmsg) {
+	*errmsg = NULL;
+	cache_entry *ent = cache_list_find(cache, pattern, pattern_len);
+	if (ent == NULL) {
+		// No cached regex: compile a new one.
+		ent = regexp_compile(cache, pattern, pattern_len, caseless, errmsg);
+		if (ent == NULL) {
+			return NULL;
+		}
+		cache->stats.regexes_compiled++;
+		cache->stats.compile_ticks += ent->stats.compile_ticks;
+		if (unlikely(is_slow(cache, ent->stats.compile_ticks))) {
+			slow_log_add(cache, pattern, pattern_len, -1, ent->stats.compile_ticks,
+			             ent->jit_compiled);
+		}
+		cache_list_move_front(cache, ent);
+	}
+	ent->ref_count++;
+	return ent;
+}
+
+// cache_entry_release decrements the entry's ref_count and puts it
+// back into the cache.
+static void cache_entry_release(cache_entry *e) {
+	e->ref_count--;
+	cache_list_move_front(e->cache, e);
+}
+
 // cache_aux_data_destroy is the deestructor for sqlite3_set_auxdata and ensures
 // that we decrement the entry's ref_count and put it back into the cache.
 static void cache_aux_data_destroy(void *p) {
 	cache_entry *e = (cache_entry *)p;
-	e->ref_count--;
-	cache_list_move_front(e->cache, e);
+	RE_PROBE(cache__release, e->cache->name, e->pattern, e->pattern_len,
+	         e->ref_count - 1);
+	cache_entry_release(e);
 }
 
-// cache_aux_data_set is a wrapper around sqlite3_set_auxdata that
-// ensures we increment the entry's ref_count.
+// cache_aux_data_set is a wrapper around sqlite3_set_auxdata for entries
+// returned by cache_list_lookup (which already incremented the ref_count).
 static void cache_aux_data_set(sqlite3_context *ctx, cache_entry *e) {
-	e->ref_count++;
 	sqlite3_set_auxdata(ctx, 0, e, cache_aux_data_destroy);
 }
 
-static inline int regexp_match(const cache_list *cache, const cache_entry *ent,
+// regexp_record_latency records a timed match in the latency histograms
+// of ent and its cache, which are allocated on first use.
+static noinline void regexp_record_latency(cache_entry *ent, uint64_t ticks) {
+	cache_list *cache = ent->cache;
+	if (unlikely(ent->hist == NULL)) {
+		ent->hist = re_malloc(sizeof(latency_hist));
+		if (!ent->hist) {
+			return;
+		}
+		memset(ent->hist, 0, sizeof(latency_hist));
+	}
+	if (unlikely(cache->hist == NULL)) {
+		cache->hist = re_malloc(sizeof(latency_hist));
+		if (!cache->hist) {
+			return;
+		}
+		memset(cache->hist, 0, sizeof(latency_hist));
+	}
+	hist_record(ent->hist, ticks);
+	hist_record(cache->hist, ticks);
+}
+
+// regexp_match_env matches ent against subject using the JIT stack and match
+// context of env. If the match runs out of JIT stack it is retried with a
+// larger stack until it succeeds or the stack reaches limit.
+static inline int regexp_match_env(const cache_entry *ent, const char *subject,
+                                   size_t subject_len, size_t offset,
+                                   pcre2_match_data *md, match_env *env,
+                                   size_t limit) {
+	if (!ent->jit_compiled) {
+		return pcre2_match(ent->code, (const PCRE2_SPTR)subject, subject_len, offset,
+		                   PCRE2_NO_UTF_CHECK, md, env->context);
+	}
+	int rc;
+	do {
+		rc = pcre2_jit_match(ent->code, (const PCRE2_SPTR)subject, subject_len, offset,
+		                     PCRE2_NO_UTF_CHECK, md, env->context);
+	} while (unlikely(rc == PCRE2_ERROR_JIT_STACKLIMIT) &&
+	         match_env_grow(env, limit));
+	return rc;
+}
+
+static inline int regexp_match_code(const cache_entry *ent, const char *subject,
+                                    size_t subject_len, size_t offset,
+                                    pcre2_match_data *md) {
+	RE_PROBE(match__start, ent->pattern, ent->pattern_len, subject_len, offset);
+	int rc;
+	if (md == NULL && ent->litset) {
+		// Only whether the subject matches is needed (see: regexp_match).
+		rc = litset_match(ent->litset, subject, subject_len);
+	} else {
+		cache_list *cache = ent->cache;
+		rc = regexp_match_env(ent, subject, subject_len, offset,
+		                      md ? md : cache->env.match_data, &cache->env,
+		                      cache->config.jit_stack_limit);
+	}
+	RE_PROBE(match__done, ent->pattern, ent->pattern_len, subject_len, rc);
+	return rc;
+}
+
+// regexp_match_timed is the slow path of regexp_match_data and is used when
+// the match is sampled or the slow log is enabled (every match is timed).
+static noinline int regexp_match_timed(cache_entry *ent, const char *subject,
+                                       size_t subject_len, size_t offset,
+                                       pcre2_match_data *md, bool sample) {
+	cache_list *cache = ent->cache;
+	if (sample) {
+		uint32_t rate = cache->config.sample_rate;
+		ent->sample_countdown = rate ? rate : UINT32_MAX;
+		sample = rate != 0;
+	}
+	if (!sample && cache->config.slow_ticks == 0) {
+		return regexp_match_code(ent, subject, subject_len, offset, md);
+	}
+
+	uint64_t start = re_ticks();
+	int rc = regexp_match_code(ent, subject, subject_len, offset, md);
+	uint64_t elapsed = re_ticks() - start;
+	if (sample) {
+		ent->stats.timed_matches++;
+		ent->stats.match_ticks += elapsed;
+		cache->stats.timed_matches++;
+		cache->stats.match_ticks += elapsed;
+		if (cache->config.histograms) {
+			regexp_record_latency(ent, elapsed);
+		}
+	}
+	if (is_slow(cache, elapsed)) {
+		slow_log_add(cache, ent->pattern, ent->pattern_len, (int64_t)subject_len,
+		             elapsed, ent->jit_compiled);
+	}
+	return rc;
+}
+
+// regexp_match_data matches ent against subject starting at offset and stores
+// the result in match data md.
+static inline int regexp_match_data(cache_entry *ent, const char *subject,
+                                    size_t subject_len, size_t offset,
+                                    pcre2_match_data *md) {
+	cache_list *cache = ent->cache;
+	cache->stats.matches++;
+	ent->stats.matches++;
+	bool sample = --ent->sample_countdown == 0;
+	if (likely(!sample && cache->config.slow_ticks == 0)) {
+		return regexp_match_code(ent, subject, subject_len, offset, md);
+	}
+	return regexp_match_timed(ent, subject, subject_len, offset, md, sample);
+}
+
+// regexp_match returns the result of matching ent against subject. The match
+// data of the cache is not set if the subject was matched with the literal set
+// of ent.
+static inline int regexp_match(const cache_list *cache, cache_entry *ent,
 	                           const char *subject, size_t subject_len) {
-	return ent->jit_compiled
-		? pcre2_jit_match(ent->code, (const PCRE2_SPTR)subject, subject_len, 0,
-		                  PCRE2_NO_UTF_CHECK, cache->match_data, cache->context)
-		: pcre2_match(ent->code, (const PCRE2_SPTR)subject, subject_len, 0,
-		              PCRE2_NO_UTF_CHECK, cache->match_data, cache->context);
+	assert(cache == ent->cache);
+	(void)cache;
+	return regexp_match_data(ent, subject, subject_len, 0, NULL);
+}
+
+// memo_hash returns the hash of subject s, which is read 8 bytes at a time.
+static inline uint64_t memo_hash(const char *s, size_t n) {
+	const uint64_t k = 0xff51afd7ed558ccdULL;
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ n;
+	uint64_t w;
+	for (; n >= 8; s += 8, n -= 8) {
+		memcpy(&w, s, 8);
+		h = (h ^ w) * k;
+		h ^= h >> 32;
+	}
+	if (n > 0) {
+		w = 0;
+		memcpy(&w, s, n);
+		h = (h ^ w) * k;
+	}
+	h ^= h >> 33;
+	return h * k;
+}
+
+// memo_init allocates the memo of ent and returns false if memory could not
+// be allocated.
+static noinline bool memo_init(cache_entry *ent) {
+	re_pool *pool = &ent->cache->pool;
+	uint32_t n = ent->cache->config.memo_size;
+	size_t size = sizeof(memo) + sizeof(memo_slot) * n;
+	memo *m = re_pool_malloc(size, pool);
+	if (!m) {
+		return false;
+	}
+	memset(m, 0, size);
+	m->pool = pool;
+	m->mask = n - 1;
+	m->size = size;
+	ent->memo = m;
+	return true;
+}
+
+static inline bool memo_slot_equal(const memo_slot *slot, uint64_t hash,
+                                    const char *subject, size_t len) {
+	return slot->hash == hash && slot->subject && slot->len == len &&
+		memcmp(slot->subject, subject, len) == 0;
+}
+
+// memo_find sets *slot to the slot of subject and returns true if subject is
+// in the memo, otherwise it sets it to the slot to store subject in. A subject
+// can be in one of two slots, which are chosen by the low and high bits of its
+// hash, so that a few colliding subjects do not keep replacing each other.
+static inline bool memo_find(memo *m, uint64_t hash, const char *subject,
+                             size_t len, memo_slot **slot) {
+	memo_slot *a = &m->slots[hash & m->mask];
+	memo_slot *b = &m->slots[(hash >> 32) & m->mask];
+	if (memo_slot_equal(a, hash, subject, len)) {
+		*slot = a;
+		return true;
+	}
+	if (memo_slot_equal(b, hash, subject, len)) {
+		*slot = b;
+		return true;
+	}
+	if (!a->subject) {
+		*slot = a;
+	} else if (!b->subject) {
+		*slot = b;
+	} else {
+		*slot = (hash & (1ULL << 31)) ? a : b;
+	}
+	return false;
+}
+
+// memo_store stores the result of matching subject in slot, replacing the
+// subject that was stored in it.
+static noinline void memo_store(memo *m, memo_slot *slot, uint64_t hash,
+                                const char *subject, uint32_t len, bool match) {
+	if (slot->subject) {
+		re_pool_free(slot->subject, m->pool);
+		m->size -= slot->len;
+	}
+	slot->subject = re_pool_malloc(len ? len : 1, m->pool);
+	if (!slot->subject) {
+		return; // the result is not memoized
+	}
+	memcpy(slot->subject, subject, len);
+	slot->hash = hash;
+	slot->len = len;
+	slot->match = match;
+	m->size += len;
+}
+
+// regexp_match_memo is regexp_match for REGEXP, which only needs to know if
+// subject matches, and takes the result from the memo of ent if subject was
+// matched recently (see: memo).
+static inline int regexp_match_memo(cache_entry *ent, const char *subject,
+                                    size_t subject_len) {
+	cache_list *cache = ent->cache;
+	if (ent->memo_off || subject_len > MEMO_MAX_SUBJECT || cache->config.memo_size == 0 ||
+	    (!ent->memo && !memo_init(ent))) {
+		return regexp_match(cache, ent, subject, subject_len);
+	}
+	memo *m = ent->memo;
+	uint64_t hash = memo_hash(subject, subject_len);
+	memo_slot *slot;
+	int rc;
+	if (memo_find(m, hash, subject, subject_len, &slot)) {
+		m->hits++;
+		ent->stats.matches++;
+		ent->stats.memo_hits++;
+		cache->stats.matches++;
+		cache->stats.memo_hits++;
+		rc = slot->match ? 1 : PCRE2_ERROR_NOMATCH;
+	} else {
+		rc = regexp_match(cache, ent, subject, subject_len);
+		if (rc >= PCRE2_ERROR_NOMATCH) {
+			memo_store(m, slot, hash, subject, (uint32_t)subject_len, rc >= 0);
+		}
+	}
+	if (unlikely(++m->lookups == MEMO_WINDOW)) {
+		if (m->hits < MEMO_WINDOW / 4) {
+			memo_free(m);
+			ent->memo = NULL;
+			ent->memo_off = true;
+		} else {
+			m->lookups = 0;
+			m->hits = 0;
+		}
+	}
+	return rc;
+}
+
+// regexp_iter iterates over the successive non-overlapping matches of a regex
+// in a subject. Like Go's regexp.FindAllIndex, empty matches abutting a
+// preceding match are ignored.
+typedef struct {
+	const char *subject;
+	size_t     subject_len;
+	size_t     pos;      // offset of the next search
+	size_t     prev_end; // end of the previous match, or SIZE_MAX
+} regexp_iter;
+
+static void regexp_iter_init(regexp_iter *it, const char *subject, size_t subject_len) {
+	it->subject = subject;
+	it->subject_len = subject_len;
+	it->pos = 0;
+	it->prev_end = SIZE_MAX;
+}
+
+// regexp_iter_next finds the next match of ent and stores its offsets in md.
+// It returns 1 if a match was found, 0 if there are no more matches, or a
+// negative pcre2 error code.
+static int regexp_iter_next(regexp_iter *it, cache_entry *ent,
+                            pcre2_match_data *md) {
+	while (it->pos <= it->subject_len) {
+		int rc = regexp_match_data(ent, it->subject, it->subject_len, it->pos, md);
+		if (rc == PCRE2_ERROR_NOMATCH) {
+			break;
+		}
+		if (rc < 0) {
+			return rc;
+		}
+		const PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(md);
+		bool accept = true;
+		if (ovector[1] == it->pos) {
+			// Empty match: ignore it if it abuts the previous match and
+			// advance past the current (UTF-8) character.
+			if (ovector[0] == it->prev_end) {
+				accept = false;
+			}
+			it->pos++;
+			while (it->pos < it->subject_len && (it->subject[it->pos] & 0xC0) == 0x80) {
+				it->pos++;
+			}
+		} else {
+			it->pos = ovector[1];
+		}
+		it->prev_end = ovector[1];
+		if (accept) {
+			return 1;
+		}
+	}
+	it->pos = it->subject_len + 1;
+	return 0;
 }
 
 // regexp_execute does the actual work of matching a regex pattern against
@@ -622,19 +2040,25 @@ static void regexp_execute(sqlite3_context *ctx, sqlite3_value *pval,
 			return;
 		}
 
-		ent = cache_list_find(cache, pattern, pattern_len);
+		char *errmsg;
+		ent = cache_list_lookup(cache, pattern, pattern_len, caseless, &errmsg);
 		if (ent == NULL) {
-			// No cached regex: compile a new one.
-			ent = regexp_compile(ctx, cache, pattern, pattern_len, caseless);
-			if (ent == NULL) {
-				return; // sqlite3 error already set
-			}
+			set_result_error(ctx, errmsg);
+			return;
 		}
 
 		cache_aux_data_set(ctx, ent);
+
+		// The entry is released immediately if the aux data
+		// could not be set.
+		ent = sqlite3_get_auxdata(ctx, 0);
+		if (unlikely(ent == NULL)) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
 	}
 
-	int rc = regexp_match(ent->cache, ent, subject, subject_len);
+	int rc = regexp_match_memo(ent, subject, subject_len);
 	if (likely(rc >= PCRE2_ERROR_NOMATCH)) {
 		sqlite3_result_int(ctx, !!(rc >= 0));
 		return;
@@ -644,7 +2068,8 @@ static void regexp_execute(sqlite3_context *ctx, sqlite3_value *pval,
 		pattern_len = sqlite3_value_bytes(pval);
 		pattern = (const char *)sqlite3_value_text(pval);
 	}
-	handle_pcre2_match_error(ctx, rc, pattern, pattern_len, subject, subject_len);
+	set_result_error(ctx, format_pcre2_match_error(rc, pattern, pattern_len,
+	                                               subject, subject_len));
 	return;
 }
 
@@ -663,10 +2088,8 @@ static void iregexp(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
 }
 
 // regexp_info provides information about the state of the regex extension.
+// Per-cache statistics are available from the pcre2_cache_stats table.
 static void regexp_info(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
-	// TODO: create virtual table (or similar) to access the settings
-	// and statistics of this package (might be kind of a big lift,
-	// that only benefits debugging).
 	(void)argc;
 
 	sqlite3_value *val = argv[0];
@@ -693,6 +2116,11 @@ static void regexp_info(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
 		sqlite3_result_int(ctx, JIT_STACK_START_SIZE);
 	} else if (strieq("jit_stack_max_size", query)) {
 		sqlite3_result_int(ctx, JIT_STACK_MAX_SIZE);
+	} else if (strieq("jit_stack_size", query)) {
+		size_t size = cache->env.jit_stack ? cache->env.jit_stack_size : JIT_STACK_MAX_SIZE;
+		sqlite3_result_int64(ctx, (sqlite3_int64)size);
+	} else if (strieq("jit_stack_grows", query)) {
+		sqlite3_result_int64(ctx, (sqlite3_int64)cache->env.jit_stack_grows);
 	} else if (strieq("max_displayed_pattern_length", query)) {
 		sqlite3_result_int(ctx, MAX_DISPLAYED_PATTERN_LENGTH);
 	} else if (strieq("cache_evacuations", query)) {
@@ -707,6 +2135,24 @@ static void regexp_info(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
 		sqlite3_result_int64(ctx, cache->stats.regexes_compiled);
 	} else if (strieq("reset_stats", query)) {
 		memset(&cache->stats, 0, sizeof(cache_list_stats));
+		if (cache->hist) {
+			memset(cache->hist, 0, sizeof(latency_hist));
+		}
+		for (cache_entry *e = cache->root.next; e != &cache->root; e = e->next) {
+			e->stats.hits = 0;
+			e->stats.matches = 0;
+			e->stats.timed_matches = 0;
+			e->stats.match_ticks = 0;
+			e->stats.memo_hits = 0;
+			if (e->hist) {
+				memset(e->hist, 0, sizeof(latency_hist));
+			}
+		}
+		sqlite3_result_null(ctx);
+	} else if (strieq("reset_slow_log", query)) {
+		if (cache->slow_log) {
+			slow_log_reset(cache->slow_log);
+		}
 		sqlite3_result_null(ctx);
 	} else {
 		char *err = sqlite3_mprintf("regexp: invalid query: %s", query);
@@ -721,29 +2167,7876 @@ static void regexp_info(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
 	#undef strieq
 }
 
-// Extension entry point.
-API int sqlite3_sqlitepcre_init(sqlite3 *db, char **pzErrMsg, const sqlite3_api_routines *pApi) {
-	(void)pzErrMsg;
+// str_append_json_string appends z as a quoted JSON string to s. Since z is
+// UTF-8 only control characters need to be escaped.
+static void str_append_json_string(sqlite3_str *s, const char *z, size_t n) {
+	sqlite3_str_appendchar(s, 1, '"');
+	for (size_t i = 0; i < n; i++) {
+		unsigned char c = (unsigned char)z[i];
+		if (c == '"' || c == '\\') {
+			sqlite3_str_appendf(s, "\\%c", c);
+		} else if (c < 0x20) {
+			sqlite3_str_appendf(s, "\\u%04x", c);
+		} else {
+			sqlite3_str_appendchar(s, 1, (char)c);
+		}
+	}
+	sqlite3_str_appendchar(s, 1, '"');
+}
 
-	int rc = SQLITE_OK;
-	SQLITE_EXTENSION_INIT2(pApi);
+// str_append_code_unit appends code unit c to a JSON string. Non-printable
+// and non-ASCII code units are written as "\\xNN" since they may only be
+// part of a UTF-8 sequence.
+static void str_append_code_unit(sqlite3_str *s, uint32_t c) {
+	if (c == '"' || c == '\\') {
+		sqlite3_str_appendf(s, "\\%c", (int)c);
+	} else if (0x20 <= c && c < 0x7f) {
+		sqlite3_str_appendchar(s, 1, (char)c);
+	} else {
+		sqlite3_str_appendf(s, "\\\\x%02x", c);
+	}
+}
 
-	cache_list *rcache = cache_list_init();
-	cache_list *icache = cache_list_init();
-	if (!rcache || !icache) {
-		rc = SQLITE_NOMEM;
-		goto err_exit;
+// str_append_bitmap appends the code units set in the 256-bit first code unit
+// bitmap of a pattern to s as a JSON string of ranges (e.g. "0-9a-f").
+static void str_append_bitmap(sqlite3_str *s, const uint8_t *bitmap) {
+	#define bit_set(_c) (bitmap[(_c) / 8] & (1u << ((_c) % 8)))
+	sqlite3_str_appendchar(s, 1, '"');
+	for (uint32_t c = 0; c < 256; c++) {
+		if (!bit_set(c)) {
+			continue;
+		}
+		uint32_t hi = c;
+		while (hi < 255 && bit_set(hi + 1)) {
+			hi++;
+		}
+		str_append_code_unit(s, c);
+		if (hi > c + 1) {
+			sqlite3_str_appendchar(s, 1, '-');
+		}
+		if (hi > c) {
+			str_append_code_unit(s, hi);
+		}
+		c = hi;
 	}
+	sqlite3_str_appendchar(s, 1, '"');
+	#undef bit_set
+}
 
-	const int opts = SQLITE_UTF8 | SQLITE_INNOCUOUS | SQLITE_DETERMINISTIC;
+// explain_pattern appends a JSON description of the compiled pattern ent to s.
+static void explain_pattern(sqlite3_str *s, const cache_entry *ent, bool caseless) {
+	const pcre2_code *code = ent->code;
+	uint32_t capture_count = 0, name_count = 0, min_length = 0, max_lookbehind = 0;
+	uint32_t backref_max = 0, match_empty = 0, has_crorlf = 0, all_options = 0;
+	uint32_t first_type = 0, last_type = 0;
+	size_t code_size = 0, jit_size = 0;
+	pcre2_pattern_info(code, PCRE2_INFO_CAPTURECOUNT, &capture_count);
+	pcre2_pattern_info(code, PCRE2_INFO_NAMECOUNT, &name_count);
+	pcre2_pattern_info(code, PCRE2_INFO_MINLENGTH, &min_length);
+	pcre2_pattern_info(code, PCRE2_INFO_MAXLOOKBEHIND, &max_lookbehind);
+	pcre2_pattern_info(code, PCRE2_INFO_BACKREFMAX, &backref_max);
+	pcre2_pattern_info(code, PCRE2_INFO_MATCHEMPTY, &match_empty);
+	pcre2_pattern_info(code, PCRE2_INFO_HASCRORLF, &has_crorlf);
+	pcre2_pattern_info(code, PCRE2_INFO_ALLOPTIONS, &all_options);
+	pcre2_pattern_info(code, PCRE2_INFO_FIRSTCODETYPE, &first_type);
+	pcre2_pattern_info(code, PCRE2_INFO_LASTCODETYPE, &last_type);
+	pcre2_pattern_info(code, PCRE2_INFO_SIZE, &code_size);
+	if (ent->jit_compiled) {
+		pcre2_pattern_info(code, PCRE2_INFO_JITSIZE, &jit_size);
+	}
 
-	rc = sqlite3_create_function_v2(db, "regexp", 2, opts, (void*)rcache, regexp,
-	                                NULL, NULL, sqlite3_cache_list_destroy);
-	if (rc != SQLITE_OK) {
-		goto err_exit;
+	// Empty patterns are matched without calling pcre2 (see: regexp_execute).
+	const char *engine = "interpreter";
+	if (ent->pattern_len == 0) {
+		engine = "match_all";
+	} else if (ent->litset) {
+		engine = "literal_set";
+	} else if (ent->jit_compiled) {
+		engine = "jit";
 	}
-	rc = sqlite3_create_function_v2(db, "iregexp", 2, opts, (void*)icache, iregexp,
+
+	sqlite3_str_appendall(s, "{\"pattern\":");
+	str_append_json_string(s, ent->pattern, ent->pattern_len);
+	sqlite3_str_appendf(s, ",\"caseless\":%s", caseless ? "true" : "false");
+	sqlite3_str_appendf(s, ",\"engine\":\"%s\"", engine);
+	sqlite3_str_appendf(s, ",\"jit_compiled\":%s", ent->jit_compiled ? "true" : "false");
+	sqlite3_str_appendf(s, ",\"compile_time_ns\":%llu",
+	                    (unsigned long long)re_clock_ns(&ent->cache->clock,
+	                                                    ent->stats.compile_ticks));
+	sqlite3_str_appendf(s, ",\"code_size\":%llu", (unsigned long long)code_size);
+	sqlite3_str_appendf(s, ",\"jit_size\":%llu", (unsigned long long)jit_size);
+	sqlite3_str_appendf(s, ",\"capture_count\":%u", capture_count);
+	sqlite3_str_appendf(s, ",\"named_groups\":%u", name_count);
+	sqlite3_str_appendf(s, ",\"min_length\":%u", min_length);
+	sqlite3_str_appendf(s, ",\"max_lookbehind\":%u", max_lookbehind);
+	sqlite3_str_appendf(s, ",\"anchored\":%s",
+	                    (all_options & PCRE2_ANCHORED) ? "true" : "false");
+	sqlite3_str_appendf(s, ",\"start_of_line\":%s", first_type == 2 ? "true" : "false");
+
+	sqlite3_str_appendall(s, ",\"first_code_unit\":");
+	if (first_type == 1) {
+		uint32_t c = 0;
+		pcre2_pattern_info(code, PCRE2_INFO_FIRSTCODEUNIT, &c);
+		sqlite3_str_appendchar(s, 1, '"');
+		str_append_code_unit(s, c);
+		sqlite3_str_appendchar(s, 1, '"');
+	} else {
+		sqlite3_str_appendall(s, "null");
+	}
+	sqlite3_str_appendall(s, ",\"first_code_units\":");
+	const uint8_t *bitmap = NULL;
+	pcre2_pattern_info(code, PCRE2_INFO_FIRSTBITMAP, &bitmap);
+	if (first_type == 0 && bitmap != NULL) {
+		str_append_bitmap(s, bitmap);
+	} else {
+		sqlite3_str_appendall(s, "null");
+	}
+	sqlite3_str_appendall(s, ",\"last_code_unit\":");
+	if (last_type == 1) {
+		uint32_t c = 0;
+		pcre2_pattern_info(code, PCRE2_INFO_LASTCODEUNIT, &c);
+		sqlite3_str_appendchar(s, 1, '"');
+		str_append_code_unit(s, c);
+		sqlite3_str_appendchar(s, 1, '"');
+	} else {
+		sqlite3_str_appendall(s, "null");
+	}
+
+	sqlite3_str_appendf(s, ",\"backrefs\":%s", backref_max ? "true" : "false");
+	sqlite3_str_appendf(s, ",\"max_backref\":%u", backref_max);
+	sqlite3_str_appendf(s, ",\"match_empty\":%s", match_empty ? "true" : "false");
+	sqlite3_str_appendf(s, ",\"has_cr_or_lf\":%s", has_crorlf ? "true" : "false");
+	sqlite3_str_appendchar(s, 1, '}');
+}
+
+// regexp_explain returns a JSON object describing how a pattern is compiled,
+// which is useful for finding out why a pattern is slow:
+//
+//	SELECT regexp_explain('^\d+foo');
+//	SELECT regexp_explain('foo', 'i'); -- caseless (IREGEXP)
+//
+// The pattern is compiled with the same options as REGEXP but is not added
+// to the cache.
+static void regexp_explain(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+		sqlite3_result_error(ctx, "regexp_explain: NULL pattern", -1);
+		return;
+	}
+	bool caseless = false;
+	if (argc == 2 && sqlite3_value_type(argv[1]) != SQLITE_NULL) {
+		const char *flags = (const char *)sqlite3_value_text(argv[1]);
+		if (!flags) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+		for (const char *p = flags; *p; p++) {
+			if (*p == 'i') {
+				caseless = true;
+			} else {
+				set_result_error(ctx, sqlite3_mprintf(
+					"regexp_explain: invalid flag: '%c'", *p));
+				return;
+			}
+		}
+	}
+
+	const char *pattern = (const char *)sqlite3_value_text(argv[0]);
+	if (!pattern) {
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+	uint32_t pattern_len = (uint32_t)sqlite3_value_bytes(argv[0]);
+
+	cache_list *cache = sqlite3_user_data(ctx);
+	char *errmsg;
+	cache_entry *ent = regexp_compile(cache, pattern, pattern_len, caseless, &errmsg);
+	if (!ent) {
+		set_result_error(ctx, errmsg);
+		return;
+	}
+
+	sqlite3_str *s = sqlite3_str_new(sqlite3_context_db_handle(ctx));
+	explain_pattern(s, ent, caseless);
+	cache_entry_free(ent);
+	re_free(ent);
+
+	int rc = sqlite3_str_errcode(s);
+	char *json = sqlite3_str_finish(s);
+	if (rc != SQLITE_OK) {
+		re_free(json);
+		sqlite3_result_error_code(ctx, rc);
+		return;
+	}
+	sqlite3_result_text(ctx, json, -1, re_free);
+}
+
+// lit_query is a query of the literal strings that every match of a regex
+// must contain, which can be used to rule out subjects without running the
+// regex. It is a tree of AND and OR nodes whose leaves are literals or ALL,
+// which matches any subject. The query is conservative: any syntax that is
+// not understood is treated as ALL.
+//
+// Node 0 is always ALL and is never linked into a list of children.
+
+typedef enum {
+	LITQ_ALL,
+	LITQ_LIT,
+	LITQ_AND,
+	LITQ_OR,
+} lit_query_op;
+
+typedef struct {
+	lit_query_op op;
+	int          child; // first child of AND and OR nodes
+	int          next;  // next sibling or -1
+	uint32_t     off;   // LIT: offset of the literal in lit_query.buf
+	uint32_t     len;   // LIT: length of the literal
+} lit_query_node;
+
+typedef struct {
+	lit_query_node *nodes;
+	int            nnodes;
+	int            cap;
+	char           *buf; // literal bytes
+	uint32_t       buflen;
+	uint32_t       bufcap;
+	int            root;
+} lit_query;
+
+#define LITQ_MAX_DEPTH 64
+
+typedef struct {
+	lit_query  *q;
+	const char *p;
+	const char *end;
+	int        depth;
+	bool       caseless;
+	bool       bail; // unsupported syntax: the query is ALL
+} lit_parser;
+
+typedef struct {
+	int head;
+	int tail;
+	int n;
+} litq_list;
+
+// litq_atom is a single character or a non-literal item of a regex.
+typedef struct {
+	int        node; // non-literal atom (0 is ALL)
+	const char *lit; // literal character or NULL
+	size_t     len;
+	char       ch;   // storage for escaped characters
+} litq_atom;
+
+static int litq_new(lit_parser *ps, lit_query_op op) {
+	lit_query *q = ps->q;
+	if (q->nnodes >= q->cap) {
+		ps->bail = true;
+		return 0;
+	}
+	lit_query_node *n = &q->nodes[q->nnodes];
+	memset(n, 0, sizeof(lit_query_node));
+	n->op = op;
+	n->child = -1;
+	n->next = -1;
+	return q->nnodes++;
+}
+
+static void litq_list_add(lit_parser *ps, litq_list *l, int node) {
+	lit_query_node *nodes = ps->q->nodes;
+	nodes[node].next = -1;
+	if (l->tail >= 0) {
+		nodes[l->tail].next = node;
+	} else {
+		l->head = node;
+	}
+	l->tail = node;
+	l->n++;
+}
+
+// litq_list_node returns a node for the list l: ALL if it is empty, its only
+// element or an op node with the elements as children.
+static int litq_list_node(lit_parser *ps, const litq_list *l, lit_query_op op) {
+	if (l->n == 0) {
+		return 0;
+	}
+	if (l->n == 1) {
+		return l->head;
+	}
+	int n = litq_new(ps, op);
+	if (n != 0) {
+		ps->q->nodes[n].child = l->head;
+	}
+	return n;
+}
+
+static void litq_append(lit_parser *ps, const char *s, size_t n) {
+	lit_query *q = ps->q;
+	if (n > q->bufcap - q->buflen) {
+		ps->bail = true;
+		return;
+	}
+	memcpy(&q->buf[q->buflen], s, n);
+	q->buflen += (uint32_t)n;
+}
+
+// litq_flush adds the literal that starts at *run to the list l.
+static void litq_flush(lit_parser *ps, litq_list *l, uint32_t *run) {
+	lit_query *q = ps->q;
+	if (q->buflen > *run) {
+		int n = litq_new(ps, LITQ_LIT);
+		if (n != 0) {
+			q->nodes[n].off = *run;
+			q->nodes[n].len = q->buflen - *run;
+			litq_list_add(ps, l, n);
+		}
+	}
+	*run = q->buflen;
+}
+
+static inline bool litq_isdigit(char c) {
+	return '0' <= c && c <= '9';
+}
+
+static inline bool litq_isalpha(char c) {
+	return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+}
+
+// litq_quantifier consumes the quantifier at the current position, if any,
+// and returns its minimum or -1 if there is no quantifier. Both {n,m} and
+// {,m} (pcre2 10.43) are accepted so that the result is conservative for all
+// versions of pcre2.
+static int litq_quantifier(lit_parser *ps) {
+	const char *p = ps->p;
+	const char *end = ps->end;
+	if (p >= end) {
+		return -1;
+	}
+	int min = 0;
+	switch (*p) {
+	case '*':
+	case '?':
+		p++;
+		break;
+	case '+':
+		min = 1;
+		p++;
+		break;
+	case '{': {
+		#define skip_space() while (p < end && (*p == ' ' || *p == '\t')) p++
+		p++;
+		skip_space();
+		bool lo = false;
+		while (p < end && litq_isdigit(*p)) {
+			if (min < 100000) {
+				min = min * 10 + (*p - '0');
+			}
+			lo = true;
+			p++;
+		}
+		skip_space();
+		bool hi = false;
+		if (p < end && *p == ',') {
+			p++;
+			skip_space();
+			while (p < end && litq_isdigit(*p)) {
+				hi = true;
+				p++;
+			}
+			skip_space();
+		}
+		if ((!lo && !hi) || p >= end || *p != '}') {
+			return -1; // literal '{'
+		}
+		p++;
+		break;
+		#undef skip_space
+	}
+	default:
+		return -1;
+	}
+	// Lazy or possessive
+	if (p < end && (*p == '?' || *p == '+')) {
+		p++;
+	}
+	ps->p = p;
+	return min;
+}
+
+// litq_char consumes a literal (UTF-8) character.
+static void litq_char(lit_parser *ps, litq_atom *a) {
+	unsigned char c = (unsigned char)*ps->p;
+	size_t n = 1;
+	if (c >= 0xC0) {
+		n = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+	}
+	if (n > (size_t)(ps->end - ps->p)) {
+		n = (size_t)(ps->end - ps->p);
+	}
+	a->lit = ps->p;
+	a->len = n;
+	ps->p += n;
+}
+
+// litq_skip_to consumes everything up to and including the next c.
+static void litq_skip_to(lit_parser *ps, char c) {
+	const char *p = memchr(ps->p, c, (size_t)(ps->end - ps->p));
+	if (!p) {
+		ps->bail = true;
+		ps->p = ps->end;
+		return;
+	}
+	ps->p = p + 1;
+}
+
+static void litq_escape(lit_parser *ps, litq_atom *a) {
+	ps->p++; // '\\'
+	if (ps->p >= ps->end) {
+		return;
+	}
+	char c = *ps->p;
+	if (!litq_isalpha(c) && !litq_isdigit(c)) {
+		litq_char(ps, a); // escaped literal
+		return;
+	}
+	ps->p++;
+	switch (c) {
+	case 'a': a->ch = '\a'; break;
+	case 'e': a->ch = '\x1b'; break;
+	case 'f': a->ch = '\f'; break;
+	case 'n': a->ch = '\n'; break;
+	case 'r': a->ch = '\r'; break;
+	case 't': a->ch = '\t'; break;
+	case 'Q':
+		ps->bail = true;
+		return;
+	case 'c':
+		if (ps->p < ps->end) {
+			ps->p++;
+		}
+		return;
+	case 'g':
+	case 'k':
+	case 'N':
+	case 'o':
+	case 'p':
+	case 'P':
+	case 'x':
+		// Skip the argument of the escape.
+		if (ps->p >= ps->end) {
+			return;
+		}
+		if (*ps->p == '{') {
+			litq_skip_to(ps, '}');
+		} else if ((c == 'g' || c == 'k') && (*ps->p == '<' || *ps->p == '\'')) {
+			char close = *ps->p == '<' ? '>' : '\'';
+			ps->p++;
+			litq_skip_to(ps, close);
+		} else if (c == 'g') {
+			if (*ps->p == '+' || *ps->p == '-') {
+				ps->p++;
+			}
+			while (ps->p < ps->end && litq_isdigit(*ps->p)) {
+				ps->p++;
+			}
+		} else if (c == 'x') {
+			for (int i = 0; i < 2 && ps->p < ps->end; i++) {
+				char h = *ps->p;
+				if (!litq_isdigit(h) && !('a' <= h && h <= 'f') && !('A' <= h && h <= 'F')) {
+					break;
+				}
+				ps->p++;
+			}
+		} else if (c == 'p' || c == 'P') {
+			ps->p++;
+		}
+		return;
+	default:
+		// Character types, assertions and back references.
+		while (litq_isdigit(c) && ps->p < ps->end && litq_isdigit(*ps->p)) {
+			ps->p++;
+		}
+		return;
+	}
+	a->lit = &a->ch;
+	a->len = 1;
+}
+
+static void litq_skip_class(lit_parser *ps) {
+	const char *p = ps->p + 1;
+	const char *end = ps->end;
+	if (p < end && *p == '^') {
+		p++;
+	}
+	if (p < end && *p == ']') {
+		p++; // literal ']'
+	}
+	while (p < end && *p != ']') {
+		if (*p == '\\') {
+			if (p + 1 < end && p[1] == 'Q') {
+				ps->bail = true;
+				return;
+			}
+			p += 2;
+		} else if (*p == '[' && p + 1 < end && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+			// POSIX class: [:alpha:]
+			char d = p[1];
+			p += 2;
+			while (p + 1 < end && !(p[0] == d && p[1] == ']')) {
+				p++;
+			}
+			p += 2;
+		} else {
+			p++;
+		}
+	}
+	ps->p = p < end ? p + 1 : end;
+}
+
+static int litq_parse_alt(lit_parser *ps);
+
+static int litq_parse_group(lit_parser *ps) {
+	const char *end = ps->end;
+	const char *p = ps->p + 1;
+	bool discard = false; // lookaround assertions do not consume the subject
+	if (p < end && *p == '*') {
+		ps->bail = true; // verbs and alpha assertions
+		return 0;
+	}
+	if (p < end && *p == '?') {
+		p++;
+		char c = p < end ? *p : '\0';
+		char c1 = p + 1 < end ? p[1] : '\0';
+		if (c == ':' || c == '|' || c == '>') {
+			p++;
+		} else if (c == '=' || c == '!') {
+			p++;
+			discard = true;
+		} else if (c == '<' && (c1 == '=' || c1 == '!')) {
+			p += 2;
+			discard = true;
+		} else if (c == '<' || c == '\'' || (c == 'P' && c1 == '<')) {
+			// Named group
+			ps->p = p + (c == 'P' ? 2 : 1);
+			litq_skip_to(ps, c == '\'' ? '\'' : '>');
+			p = ps->p;
+		} else if (c == '#') {
+			ps->p = p;
+			litq_skip_to(ps, ')');
+			return 0;
+		} else {
+			// Option setting: (?imsx-imsx) or (?imsx-imsx:...). Extended
+			// mode changes the meaning of whitespace so give up on it.
+			// Other constructs like recursion are treated as ALL.
+			const char *s = p;
+			while (p < end && (litq_isalpha(*p) || *p == '-' || *p == '^')) {
+				p++;
+			}
+			if (p >= end || (*p != ')' && *p != ':') || memchr(s, 'x', (size_t)(p - s))) {
+				ps->bail = true;
+				return 0;
+			}
+			if (*p == ')') {
+				ps->p = p + 1;
+				return 0;
+			}
+			p++;
+		}
+	}
+	if (ps->bail) {
+		return 0;
+	}
+	if (ps->depth >= LITQ_MAX_DEPTH) {
+		ps->bail = true;
+		return 0;
+	}
+	ps->p = p;
+	ps->depth++;
+	int node = litq_parse_alt(ps);
+	ps->depth--;
+	if (ps->p >= end || *ps->p != ')') {
+		ps->bail = true;
+		return 0;
+	}
+	ps->p++;
+	return discard ? 0 : node;
+}
+
+static void litq_parse_atom(lit_parser *ps, litq_atom *a) {
+	switch (*ps->p) {
+	case '(':
+		a->node = litq_parse_group(ps);
+		return;
+	case '[':
+		litq_skip_class(ps);
+		return;
+	case '\\':
+		litq_escape(ps, a);
+		return;
+	case '.':
+	case '^':
+	case '$':
+		ps->p++;
+		return;
+	case '*':
+	case '+':
+	case '?':
+		ps->bail = true; // repeated quantifier
+		return;
+	case '{':
+		if (litq_quantifier(ps) >= 0) {
+			ps->bail = true;
+			return;
+		}
+		break;
+	}
+	litq_char(ps, a);
+}
+
+// litq_caseless_literal returns if literal s only matches itself (ignoring
+// ASCII case) when matching caselessly. In UTF mode 'k' and 's' also match
+// KELVIN SIGN and LATIN SMALL LETTER LONG S and non-ASCII characters may
+// have any number of case variants.
+static bool litq_caseless_literal(const char *s, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		unsigned char c = (unsigned char)s[i];
+		if (c >= 0x80 || c == 'k' || c == 'K' || c == 's' || c == 'S') {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int litq_parse_concat(lit_parser *ps) {
+	lit_query *q = ps->q;
+	litq_list and = { .head = -1, .tail = -1, .n = 0 };
+	uint32_t run = q->buflen; // start of the current literal
+	while (ps->p < ps->end && !ps->bail) {
+		char c = *ps->p;
+		if (c == '|' || c == ')') {
+			break;
+		}
+		if (c == '(') {
+			litq_flush(ps, &and, &run); // groups add their own literals
+		}
+		litq_atom a = { .node = 0, .lit = NULL, .len = 0, .ch = 0 };
+		litq_parse_atom(ps, &a);
+		if (ps->bail) {
+			break;
+		}
+		if (c == '(') {
+			run = q->buflen; // skip the literals of the group
+		}
+		if (a.lit && ps->caseless && !litq_caseless_literal(a.lit, a.len)) {
+			a.lit = NULL;
+		}
+		int min = litq_quantifier(ps);
+		if (a.lit) {
+			if (min < 0) {
+				litq_append(ps, a.lit, a.len);
+			} else if (min == 0) {
+				litq_flush(ps, &and, &run);
+			} else {
+				// The character is repeated: it ends the current literal
+				// and starts the next one ("ab+c" => "ab", "bc").
+				litq_append(ps, a.lit, a.len);
+				litq_flush(ps, &and, &run);
+				litq_append(ps, a.lit, a.len);
+			}
+			continue;
+		}
+		litq_flush(ps, &and, &run);
+		if (min != 0 && a.node != 0) {
+			litq_list_add(ps, &and, a.node);
+		}
+	}
+	litq_flush(ps, &and, &run);
+	return litq_list_node(ps, &and, LITQ_AND);
+}
+
+static int litq_parse_alt(lit_parser *ps) {
+	litq_list or = { .head = -1, .tail = -1, .n = 0 };
+	bool all = false;
+	for (;;) {
+		int n = litq_parse_concat(ps);
+		if (n == 0) {
+			all = true;
+		} else if (!all) {
+			litq_list_add(ps, &or, n);
+		}
+		if (ps->bail || ps->p >= ps->end || *ps->p != '|') {
+			break;
+		}
+		ps->p++;
+	}
+	return all ? 0 : litq_list_node(ps, &or, LITQ_OR);
+}
+
+// litq_has_caseless_option returns if pattern may enable caseless matching
+// with an option setting like "(?i)" or "(?^i)".
+static bool litq_has_caseless_option(const char *pattern, size_t len) {
+	for (size_t i = 0; i + 2 < len; i++) {
+		if (pattern[i] != '(' || pattern[i+1] != '?') {
+			continue;
+		}
+		for (size_t j = i + 2; j < len && (litq_isalpha(pattern[j]) ||
+		                                   pattern[j] == '-' || pattern[j] == '^'); j++) {
+			if (pattern[j] == 'i') {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void lit_query_free(lit_query *q) {
+	if (q->nodes) {
+		re_free(q->nodes);
+	}
+	if (q->buf) {
+		re_free(q->buf);
+	}
+	memset(q, 0, sizeof(lit_query));
+}
+
+// lit_query_parse stores the query of the literals that any match of pattern
+// must contain in q, which must be freed with lit_query_free. The pattern
+// must be valid (compiled by pcre2) and caseless patterns only produce ASCII
+// literals, which must be compared case-insensitively.
+static int lit_query_parse(lit_query *q, const char *pattern, uint32_t len,
+                           bool caseless) {
+	memset(q, 0, sizeof(lit_query));
+	q->cap = (int)(4 * (uint64_t)len < INT32_MAX - 16 ? 4 * len + 16 : INT32_MAX);
+	q->bufcap = 2 * len + 8;
+	q->nodes = re_malloc(sizeof(lit_query_node) * (size_t)q->cap);
+	q->buf = re_malloc(q->bufcap);
+	if (!q->nodes || !q->buf) {
+		lit_query_free(q);
+		return SQLITE_NOMEM;
+	}
+	memset(&q->nodes[0], 0, sizeof(lit_query_node));
+	q->nodes[0].op = LITQ_ALL;
+	q->nodes[0].child = -1;
+	q->nodes[0].next = -1;
+	q->nnodes = 1;
+
+	lit_parser ps = {
+		.q        = q,
+		.p        = pattern,
+		.end      = pattern + len,
+		.depth    = 0,
+		.caseless = caseless || litq_has_caseless_option(pattern, len),
+		.bail     = false,
+	};
+	q->root = litq_parse_alt(&ps);
+	if (ps.bail || ps.p != ps.end) {
+		q->root = 0;
+	}
+	return SQLITE_OK;
+}
+
+// byte_rank is a rough estimate of how common byte c is in text, which is
+// used to search for the rarest byte of a literal.
+static int byte_rank(unsigned char c) {
+	if (c == ' ') {
+		return 255;
+	}
+	if (c >= 'a' && c <= 'z') {
+		return strchr("etaoinshrdlu", c) ? 220 : 180;
+	}
+	if (c >= 'A' && c <= 'Z') {
+		return 120;
+	}
+	if (c >= '0' && c <= '9') {
+		return 130;
+	}
+	if (c == '\n' || c == '\t' || c == ',' || c == '.' || c == '_' || c == '-' ||
+	    c == '/' || c == '"' || c == '=' || c == ':') {
+		return 110;
+	}
+	if (c >= 0x80) {
+		return 60; // UTF-8
+	}
+	return c < 0x20 || c == 0x7f ? 10 : 80;
+}
+
+// cache_entry_init_literal sets the required literal of ent to the longest
+// literal of its lit_query that every match must contain, if any. Caseless
+// patterns have no required literal.
+static int cache_entry_init_literal(cache_entry *ent) {
+	if (ent->literal_init) {
+		return SQLITE_OK;
+	}
+	uint32_t options = 0;
+	pcre2_pattern_info(ent->code, PCRE2_INFO_ALLOPTIONS, &options);
+	if ((options & PCRE2_CASELESS) ||
+	    litq_has_caseless_option(ent->pattern, ent->pattern_len)) {
+		ent->literal_init = true;
+		return SQLITE_OK;
+	}
+
+	lit_query q;
+	if (lit_query_parse(&q, ent->pattern, ent->pattern_len, false) != SQLITE_OK) {
+		return SQLITE_NOMEM;
+	}
+	const lit_query_node *best = NULL;
+	const lit_query_node *root = &q.nodes[q.root];
+	if (root->op == LITQ_LIT) {
+		best = root;
+	} else if (root->op == LITQ_AND) {
+		for (int i = root->child; i >= 0; i = q.nodes[i].next) {
+			const lit_query_node *n = &q.nodes[i];
+			if (n->op == LITQ_LIT && (!best || n->len > best->len)) {
+				best = n;
+			}
+		}
+	}
+	if (best) {
+		ent->literal = re_malloc(best->len);
+		if (!ent->literal) {
+			lit_query_free(&q);
+			return SQLITE_NOMEM;
+		}
+		memcpy(ent->literal, &q.buf[best->off], best->len);
+		ent->literal_len = best->len;
+		ent->literal_rare = 0;
+		for (uint32_t i = 1; i < best->len; i++) {
+			if (byte_rank((unsigned char)ent->literal[i]) <
+			    byte_rank((unsigned char)ent->literal[ent->literal_rare])) {
+				ent->literal_rare = i;
+			}
+		}
+	}
+	lit_query_free(&q);
+	ent->literal_init = true;
+	return SQLITE_OK;
+}
+
+// cache_entry_find_literal returns the first occurrence of the required
+// literal of ent, which must have one, in subject or NULL.
+static inline const char *cache_entry_find_literal(const cache_entry *ent,
+                                                   const char *subject,
+                                                   size_t subject_len) {
+	size_t n = ent->literal_len;
+	if (n > subject_len) {
+		return NULL;
+	}
+	// Search for the rarest byte of the literal and compare the rest.
+	const char *lit = ent->literal;
+	size_t k = ent->literal_rare;
+	const char *p = subject + k;
+	const char *end = subject + subject_len - (n - k - 1); // end of the rare byte
+	while (p < end) {
+		p = memchr(p, lit[k], (size_t)(end - p));
+		if (!p) {
+			return NULL;
+		}
+		if (memcmp(p - k, lit, n) == 0) {
+			return p - k;
+		}
+		p++;
+	}
+	return NULL;
+}
+
+// cache_entry_may_match returns false if subject does not contain the
+// required literal of ent and therefore cannot match.
+static inline bool cache_entry_may_match(const cache_entry *ent, const char *subject,
+                                         size_t subject_len) {
+	return ent->literal_len == 0 ||
+		cache_entry_find_literal(ent, subject, subject_len) != NULL;
+}
+
+// regexp_split is an eponymous table-valued function that splits a subject
+// into the substrings between matches of a regex:
+//
+//	SELECT value FROM regexp_split('a, b,c', '\s*,\s*');
+//
+// The subject is split using the same rules as Go's regexp.Split: empty
+// matches abutting a preceding match are ignored and empty matches at the
+// start of the subject do not produce an empty leading value.
+//
+// The subject is copied once when the query starts and each value is a slice
+// of it, which is only copied when sqlite3 reads the column.
+
+enum {
+	REGEXP_SPLIT_VALUE,
+	REGEXP_SPLIT_SUBJECT, // hidden
+	REGEXP_SPLIT_PATTERN, // hidden
+};
+
+typedef struct {
+	sqlite3_vtab base;
+	cache_list   *cache;
+} regexp_split_vtab;
+
+typedef struct {
+	sqlite3_vtab_cursor base;
+	sqlite3_value       *subject_val; // copy of the subject
+	const char          *subject;
+	size_t              subject_len;
+	bool                blob;
+	cache_entry         *ent;
+	pcre2_match_data    *match_data; // oveccount == 1
+	regexp_iter         iter;
+	size_t              beg;         // start of the next value
+	size_t              last_start;  // start of the last match
+	size_t              value_start;
+	size_t              value_end;
+	bool                matches_done;
+	bool                eof;
+	sqlite3_int64       rowid;
+} regexp_split_cursor;
+
+static int regexp_split_connect(sqlite3 *db, void *pAux, int argc,
+                                const char *const *argv,
+                                sqlite3_vtab **ppVtab, char **pzErr) {
+	(void)argc;
+	(void)argv;
+	(void)pzErr;
+
+	int rc = sqlite3_declare_vtab(db,
+		"CREATE TABLE x(value, subject HIDDEN, pattern HIDDEN)");
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	regexp_split_vtab *vtab = re_malloc(sizeof(regexp_split_vtab));
+	if (!vtab) {
+		return SQLITE_NOMEM;
+	}
+	memset(vtab, 0, sizeof(regexp_split_vtab));
+	vtab->cache = (cache_list *)pAux;
+	sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+	*ppVtab = &vtab->base;
+	return SQLITE_OK;
+}
+
+static int regexp_split_disconnect(sqlite3_vtab *pVtab) {
+	re_free(pVtab);
+	return SQLITE_OK;
+}
+
+static int regexp_split_open(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+	(void)pVtab;
+	regexp_split_cursor *cur = re_malloc(sizeof(regexp_split_cursor));
+	if (!cur) {
+		return SQLITE_NOMEM;
+	}
+	memset(cur, 0, sizeof(regexp_split_cursor));
+	cur->eof = true;
+	*ppCursor = &cur->base;
+	return SQLITE_OK;
+}
+
+static void regexp_split_cursor_reset(regexp_split_cursor *cur) {
+	if (cur->match_data) {
+		pcre2_match_data_free(cur->match_data);
+		cur->match_data = NULL;
+	}
+	if (cur->ent) {
+		cache_entry_release(cur->ent);
+		cur->ent = NULL;
+	}
+	if (cur->subject_val) {
+		sqlite3_value_free(cur->subject_val);
+		cur->subject_val = NULL;
+	}
+	cur->subject = NULL;
+	cur->subject_len = 0;
+	cur->beg = 0;
+	cur->last_start = 0;
+	cur->value_start = 0;
+	cur->value_end = 0;
+	cur->matches_done = false;
+	cur->eof = true;
+	cur->rowid = 0;
+}
+
+static int regexp_split_close(sqlite3_vtab_cursor *pCursor) {
+	regexp_split_cursor *cur = (regexp_split_cursor *)pCursor;
+	regexp_split_cursor_reset(cur);
+	re_free(cur);
+	return SQLITE_OK;
+}
+
+static int regexp_split_next(sqlite3_vtab_cursor *pCursor) {
+	regexp_split_cursor *cur = (regexp_split_cursor *)pCursor;
+	cur->rowid++;
+	while (!cur->matches_done) {
+		int rc = regexp_iter_next(&cur->iter, cur->ent, cur->match_data);
+		if (rc == 0) {
+			cur->matches_done = true;
+			break;
+		}
+		if (rc < 0) {
+			return set_vtab_error(cur->base.pVtab,
+				format_pcre2_match_error(rc, cur->ent->pattern, cur->ent->pattern_len,
+				                         cur->subject, (uint32_t)cur->subject_len));
+		}
+		const PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(cur->match_data);
+		size_t beg = cur->beg;
+		cur->last_start = ovector[0];
+		cur->beg = ovector[1];
+		if (ovector[1] != 0) {
+			cur->value_start = beg;
+			cur->value_end = ovector[0];
+			return SQLITE_OK;
+		}
+	}
+	// Trailing value
+	if (cur->last_start != cur->subject_len && cur->beg <= cur->subject_len) {
+		cur->value_start = cur->beg;
+		cur->value_end = cur->subject_len;
+		cur->beg = cur->subject_len + 1; // only emit the trailing value once
+		return SQLITE_OK;
+	}
+	cur->eof = true;
+	return SQLITE_OK;
+}
+
+static int regexp_split_filter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                               const char *idxStr, int argc, sqlite3_value **argv) {
+	(void)idxStr;
+	regexp_split_cursor *cur = (regexp_split_cursor *)pCursor;
+	regexp_split_vtab *vtab = (regexp_split_vtab *)pCursor->pVtab;
+	regexp_split_cursor_reset(cur);
+
+	if (idxNum != 3 || argc != 2) {
+		return SQLITE_OK; // missing arguments: no rows
+	}
+	sqlite3_value *sval = argv[0];
+	sqlite3_value *pval = argv[1];
+	if (sqlite3_value_type(sval) == SQLITE_NULL) {
+		return SQLITE_OK; // NULL values never match
+	}
+	if (sqlite3_value_type(pval) == SQLITE_NULL) {
+		return set_vtab_error(pCursor->pVtab, sqlite3_mprintf("regexp: NULL pattern"));
+	}
+
+	cur->subject_val = sqlite3_value_dup(sval);
+	if (!cur->subject_val) {
+		return SQLITE_NOMEM;
+	}
+	cur->blob = sqlite3_value_type(cur->subject_val) == SQLITE_BLOB;
+	cur->subject = cur->blob
+		? (const char *)sqlite3_value_blob(cur->subject_val)
+		: (const char *)sqlite3_value_text(cur->subject_val);
+	cur->subject_len = (size_t)sqlite3_value_bytes(cur->subject_val);
+	if (cur->subject == NULL) {
+		if (cur->subject_len == 0) {
+			cur->subject = ""; // zero-length blob
+		} else {
+			return SQLITE_NOMEM;
+		}
+	}
+
+	const char *pattern = (const char *)sqlite3_value_text(pval);
+	if (!pattern) {
+		return SQLITE_NOMEM;
+	}
+	uint32_t pattern_len = (uint32_t)sqlite3_value_bytes(pval);
+
+	char *errmsg;
+	cur->ent = cache_list_lookup(vtab->cache, pattern, pattern_len, false, &errmsg);
+	if (!cur->ent) {
+		return set_vtab_error(pCursor->pVtab, errmsg);
+	}
+	if (!cur->ent->code) {
+		return set_vtab_error(pCursor->pVtab,
+			sqlite3_mprintf("regexp_split: %s", LITSET_ONLY_ERROR));
+	}
+	cur->match_data = pcre2_match_data_create(1, vtab->cache->general_context);
+	if (!cur->match_data) {
+		return SQLITE_NOMEM;
+	}
+	regexp_iter_init(&cur->iter, cur->subject, cur->subject_len);
+
+	cur->eof = false;
+	if (cur->subject_len == 0 && pattern_len > 0) {
+		// Splitting an empty subject yields a single empty value.
+		cur->matches_done = true;
+		cur->beg = 1;
+		cur->rowid = 1;
+		return SQLITE_OK;
+	}
+	return regexp_split_next(pCursor);
+}
+
+static int regexp_split_eof(sqlite3_vtab_cursor *pCursor) {
+	return ((regexp_split_cursor *)pCursor)->eof;
+}
+
+static int regexp_split_column(sqlite3_vtab_cursor *pCursor,
+                               sqlite3_context *ctx, int i) {
+	regexp_split_cursor *cur = (regexp_split_cursor *)pCursor;
+	switch (i) {
+	case REGEXP_SPLIT_VALUE: {
+		const char *p = &cur->subject[cur->value_start];
+		int n = (int)(cur->value_end - cur->value_start);
+		if (cur->blob) {
+			sqlite3_result_blob(ctx, p, n, SQLITE_TRANSIENT);
+		} else {
+			sqlite3_result_text(ctx, p, n, SQLITE_TRANSIENT);
+		}
+		break;
+	}
+	case REGEXP_SPLIT_SUBJECT:
+		sqlite3_result_value(ctx, cur->subject_val);
+		break;
+	case REGEXP_SPLIT_PATTERN:
+		sqlite3_result_text(ctx, cur->ent->pattern, (int)cur->ent->pattern_len,
+		                    SQLITE_TRANSIENT);
+		break;
+	default:
+		break;
+	}
+	return SQLITE_OK;
+}
+
+static int regexp_split_rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid) {
+	*pRowid = ((regexp_split_cursor *)pCursor)->rowid;
+	return SQLITE_OK;
+}
+
+// regexp_split_best_index requires that both the subject and pattern are
+// provided as equality constraints. idxNum is a bitmask of the constraints
+// present: 1 for the subject and 2 for the pattern.
+static int regexp_split_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *info) {
+	(void)pVtab;
+	int idx[2] = {-1, -1};
+	int unusable = 0;
+	const struct sqlite3_index_constraint *c = info->aConstraint;
+	for (int i = 0; i < info->nConstraint; i++, c++) {
+		if (c->iColumn < REGEXP_SPLIT_SUBJECT) {
+			continue;
+		}
+		int col = c->iColumn - REGEXP_SPLIT_SUBJECT;
+		if (!c->usable) {
+			unusable |= 1 << col;
+		} else if (c->op == SQLITE_INDEX_CONSTRAINT_EQ) {
+			idx[col] = i;
+		}
+	}
+	if (idx[0] < 0 || idx[1] < 0) {
+		// Both arguments are required. Reject plans where they are not usable
+		// so that the planner tries another join order.
+		if (unusable) {
+			return SQLITE_CONSTRAINT;
+		}
+		info->idxNum = 0;
+		info->estimatedCost = 2147483647.0;
+		return SQLITE_OK;
+	}
+	for (int i = 0; i < 2; i++) {
+		info->aConstraintUsage[idx[i]].argvIndex = i + 1;
+		info->aConstraintUsage[idx[i]].omit = 1;
+	}
+	info->idxNum = 3;
+	info->estimatedCost = 1000.0;
+	return SQLITE_OK;
+}
+
+static sqlite3_module regexp_split_module = {
+	.iVersion    = 0,
+	.xCreate     = NULL, // eponymous-only
+	.xConnect    = regexp_split_connect,
+	.xBestIndex  = regexp_split_best_index,
+	.xDisconnect = regexp_split_disconnect,
+	.xDestroy    = NULL,
+	.xOpen       = regexp_split_open,
+	.xClose      = regexp_split_close,
+	.xFilter     = regexp_split_filter,
+	.xNext       = regexp_split_next,
+	.xEof        = regexp_split_eof,
+	.xColumn     = regexp_split_column,
+	.xRowid      = regexp_split_rowid,
+};
+
+// regexp_parse is a virtual table whose columns are the named capture groups
+// of a regex. The pattern is provided when the table is created and the
+// subject is passed as a table-valued function argument, which yields one row
+// per match:
+//
+//	CREATE VIRTUAL TABLE temp.access USING regexp_parse(
+//		'^(?<ip>\S+) \S+ \S+ \[(?<time>[^]]+)\] "(?<method>\w+) (?<path>\S+)'
+//	);
+//	SELECT ip, method, path FROM logs, access(logs.line);
+//
+// Unset groups are NULL. The pattern is executed once per match regardless
+// of the number of groups.
+
+typedef struct {
+	sqlite3_vtab base;
+	cache_entry  *ent;
+	int          name_count;  // number of entries in the name table
+	int          *entry_col;  // column of each name table entry
+	int          *entry_group; // group number of each name table entry
+	int          ncol;        // number of named columns (excludes subject)
+} regexp_parse_vtab;
+
+typedef struct {
+	sqlite3_vtab_cursor base;
+	sqlite3_value       *subject_val; // copy of the subject
+	const char          *subject;
+	size_t              subject_len;
+	bool                blob;
+	pcre2_match_data    *match_data;
+	regexp_iter         iter;
+	bool                eof;
+	sqlite3_int64       rowid;
+} regexp_parse_cursor;
+
+// dequote_arg returns a copy of virtual table module argument arg with any
+// surrounding SQL quotes removed.
+static char *dequote_arg(const char *arg) {
+	size_t n = strlen(arg);
+	char q = arg[0];
+	if (n < 2 || (q != '\'' && q != '"' && q != '`' && q != '[')) {
+		return sqlite3_mprintf("%s", arg);
+	}
+	char end = q == '[' ? ']' : q;
+	char *s = re_malloc(n);
+	if (!s) {
+		return NULL;
+	}
+	size_t j = 0;
+	for (size_t i = 1; i < n - 1; i++) {
+		s[j++] = arg[i];
+		if (arg[i] == end && arg[i+1] == end) {
+			i++; // doubled quote
+		}
+	}
+	s[j] = '\0';
+	return s;
+}
+
+static void regexp_parse_vtab_free(regexp_parse_vtab *vtab) {
+	if (vtab->ent) {
+		cache_entry_release(vtab->ent);
+	}
+	if (vtab->entry_col) {
+		re_free(vtab->entry_col);
+	}
+	re_free(vtab);
+}
+
+static int regexp_parse_connect(sqlite3 *db, void *pAux, int argc,
+                                const char *const *argv,
+                                sqlite3_vtab **ppVtab, char **pzErr) {
+	if (argc != 4) {
+		*pzErr = sqlite3_mprintf("regexp_parse: expected a single pattern argument");
+		return SQLITE_ERROR;
+	}
+	cache_list *cache = (cache_list *)pAux;
+	char *pattern = dequote_arg(argv[3]);
+	if (!pattern) {
+		return SQLITE_NOMEM;
+	}
+
+	int rc = SQLITE_OK;
+	sqlite3_str *schema = NULL;
+	regexp_parse_vtab *vtab = re_malloc(sizeof(regexp_parse_vtab));
+	if (!vtab) {
+		rc = SQLITE_NOMEM;
+		goto exit;
+	}
+	memset(vtab, 0, sizeof(regexp_parse_vtab));
+
+	vtab->ent = cache_list_lookup(cache, pattern, (uint32_t)strlen(pattern), false, pzErr);
+	if (!vtab->ent) {
+		rc = *pzErr ? SQLITE_ERROR : SQLITE_NOMEM;
+		goto exit;
+	}
+	if (!vtab->ent->code) {
+		*pzErr = sqlite3_mprintf("regexp_parse: %s", LITSET_ONLY_ERROR);
+		rc = *pzErr ? SQLITE_ERROR : SQLITE_NOMEM;
+		goto exit;
+	}
+
+	uint32_t name_count;
+	uint32_t entry_size;
+	PCRE2_SPTR table;
+	pcre2_pattern_info(vtab->ent->code, PCRE2_INFO_NAMECOUNT, &name_count);
+	pcre2_pattern_info(vtab->ent->code, PCRE2_INFO_NAMEENTRYSIZE, &entry_size);
+	pcre2_pattern_info(vtab->ent->code, PCRE2_INFO_NAMETABLE, &table);
+	if (name_count == 0) {
+		*pzErr = sqlite3_mprintf("regexp_parse: pattern has no named capture groups");
+		rc = SQLITE_ERROR;
+		goto exit;
+	}
+
+	vtab->name_count = (int)name_count;
+	vtab->entry_col = re_malloc(2 * sizeof(int) * name_count);
+	if (!vtab->entry_col) {
+		rc = SQLITE_NOMEM;
+		goto exit;
+	}
+	vtab->entry_group = &vtab->entry_col[name_count];
+
+	// The name table is sorted by name: order the columns by group number
+	// and give duplicate names (?J) a single column.
+	for (uint32_t i = 0; i < name_count; i++) {
+		PCRE2_SPTR e = &table[i * entry_size];
+		vtab->entry_group[i] = (e[0] << 8) | e[1];
+		vtab->entry_col[i] = -1;
+	}
+	for (int col = 0; ; col++) {
+		int first = -1;
+		for (int i = 0; i < vtab->name_count; i++) {
+			if (vtab->entry_col[i] < 0 &&
+				(first < 0 || vtab->entry_group[i] < vtab->entry_group[first])) {
+				first = i;
+			}
+		}
+		if (first < 0) {
+			break;
+		}
+		const char *name = (const char *)&table[first * entry_size + 2];
+		for (int i = 0; i < vtab->name_count; i++) {
+			if (strcmp(name, (const char *)&table[i * entry_size + 2]) == 0) {
+				vtab->entry_col[i] = col;
+			}
+		}
+		vtab->ncol = col + 1;
+	}
+
+	schema = sqlite3_str_new(db);
+	sqlite3_str_appendall(schema, "CREATE TABLE x(");
+	for (int col = 0; col < vtab->ncol; col++) {
+		for (int i = 0; i < vtab->name_count; i++) {
+			if (vtab->entry_col[i] == col) {
+				sqlite3_str_appendf(schema, "\"%w\", ", &table[i * entry_size + 2]);
+				break;
+			}
+		}
+	}
+	sqlite3_str_appendall(schema, "subject HIDDEN)");
+	rc = sqlite3_str_errcode(schema);
+	if (rc != SQLITE_OK) {
+		goto exit;
+	}
+	rc = sqlite3_declare_vtab(db, sqlite3_str_value(schema));
+	if (rc != SQLITE_OK) {
+		*pzErr = sqlite3_mprintf("regexp_parse: invalid group names: %s",
+		                         sqlite3_errmsg(db));
+		goto exit;
+	}
+	sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+
+exit:
+	if (schema) {
+		re_free(sqlite3_str_finish(schema));
+	}
+	re_free(pattern);
+	if (rc != SQLITE_OK) {
+		if (vtab) {
+			regexp_parse_vtab_free(vtab);
+		}
+		return rc;
+	}
+	*ppVtab = &vtab->base;
+	return SQLITE_OK;
+}
+
+// regexp_parse_create is distinct from regexp_parse_connect so that
+// regexp_parse is not an eponymous virtual table.
+static int regexp_parse_create(sqlite3 *db, void *pAux, int argc,
+                               const char *const *argv,
+                               sqlite3_vtab **ppVtab, char **pzErr) {
+	return regexp_parse_connect(db, pAux, argc, argv, ppVtab, pzErr);
+}
+
+static int regexp_parse_disconnect(sqlite3_vtab *pVtab) {
+	regexp_parse_vtab_free((regexp_parse_vtab *)pVtab);
+	return SQLITE_OK;
+}
+
+static int regexp_parse_open(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+	regexp_parse_vtab *vtab = (regexp_parse_vtab *)pVtab;
+	regexp_parse_cursor *cur = re_malloc(sizeof(regexp_parse_cursor));
+	if (!cur) {
+		return SQLITE_NOMEM;
+	}
+	memset(cur, 0, sizeof(regexp_parse_cursor));
+	cur->match_data = pcre2_match_data_create_from_pattern(
+		vtab->ent->code,
+		vtab->ent->cache->general_context
+	);
+	if (!cur->match_data) {
+		re_free(cur);
+		return SQLITE_NOMEM;
+	}
+	cur->eof = true;
+	*ppCursor = &cur->base;
+	return SQLITE_OK;
+}
+
+static void regexp_parse_cursor_reset(regexp_parse_cursor *cur) {
+	if (cur->subject_val) {
+		sqlite3_value_free(cur->subject_val);
+		cur->subject_val = NULL;
+	}
+	cur->subject = NULL;
+	cur->subject_len = 0;
+	cur->eof = true;
+	cur->rowid = 0;
+}
+
+static int regexp_parse_close(sqlite3_vtab_cursor *pCursor) {
+	regexp_parse_cursor *cur = (regexp_parse_cursor *)pCursor;
+	regexp_parse_cursor_reset(cur);
+	pcre2_match_data_free(cur->match_data);
+	re_free(cur);
+	return SQLITE_OK;
+}
+
+static int regexp_parse_next(sqlite3_vtab_cursor *pCursor) {
+	regexp_parse_cursor *cur = (regexp_parse_cursor *)pCursor;
+	regexp_parse_vtab *vtab = (regexp_parse_vtab *)pCursor->pVtab;
+	int rc = regexp_iter_next(&cur->iter, vtab->ent, cur->match_data);
+	if (rc < 0) {
+		return set_vtab_error(pCursor->pVtab,
+			format_pcre2_match_error(rc, vtab->ent->pattern, vtab->ent->pattern_len,
+			                         cur->subject, (uint32_t)cur->subject_len));
+	}
+	cur->eof = (rc == 0);
+	cur->rowid++;
+	return SQLITE_OK;
+}
+
+static int regexp_parse_filter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                               const char *idxStr, int argc, sqlite3_value **argv) {
+	(void)idxStr;
+	regexp_parse_cursor *cur = (regexp_parse_cursor *)pCursor;
+	regexp_parse_cursor_reset(cur);
+
+	if (idxNum != 1 || argc != 1 || sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+		return SQLITE_OK; // no subject: no rows
+	}
+	cur->subject_val = sqlite3_value_dup(argv[0]);
+	if (!cur->subject_val) {
+		return SQLITE_NOMEM;
+	}
+	cur->blob = sqlite3_value_type(cur->subject_val) == SQLITE_BLOB;
+	cur->subject = cur->blob
+		? (const char *)sqlite3_value_blob(cur->subject_val)
+		: (const char *)sqlite3_value_text(cur->subject_val);
+	cur->subject_len = (size_t)sqlite3_value_bytes(cur->subject_val);
+	if (cur->subject == NULL) {
+		if (cur->subject_len != 0) {
+			return SQLITE_NOMEM;
+		}
+		cur->subject = ""; // zero-length blob
+	}
+	regexp_iter_init(&cur->iter, cur->subject, cur->subject_len);
+	return regexp_parse_next(pCursor);
+}
+
+static int regexp_parse_eof(sqlite3_vtab_cursor *pCursor) {
+	return ((regexp_parse_cursor *)pCursor)->eof;
+}
+
+static int regexp_parse_column(sqlite3_vtab_cursor *pCursor,
+                               sqlite3_context *ctx, int i) {
+	regexp_parse_cursor *cur = (regexp_parse_cursor *)pCursor;
+	regexp_parse_vtab *vtab = (regexp_parse_vtab *)pCursor->pVtab;
+	if (i == vtab->ncol) {
+		sqlite3_result_value(ctx, cur->subject_val);
+		return SQLITE_OK;
+	}
+	const PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(cur->match_data);
+	uint32_t pairs = pcre2_get_ovector_count(cur->match_data);
+	for (int e = 0; e < vtab->name_count; e++) {
+		uint32_t g = (uint32_t)vtab->entry_group[e];
+		if (vtab->entry_col[e] != i || g >= pairs || ovector[2*g] == PCRE2_UNSET) {
+			continue;
+		}
+		const char *p = &cur->subject[ovector[2*g]];
+		int n = (int)(ovector[2*g+1] - ovector[2*g]);
+		if (cur->blob) {
+			sqlite3_result_blob(ctx, p, n, SQLITE_TRANSIENT);
+		} else {
+			sqlite3_result_text(ctx, p, n, SQLITE_TRANSIENT);
+		}
+		break;
+	}
+	return SQLITE_OK; // NULL if the group is unset
+}
+
+static int regexp_parse_rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid) {
+	*pRowid = ((regexp_parse_cursor *)pCursor)->rowid;
+	return SQLITE_OK;
+}
+
+// regexp_parse_best_index requires an equality constraint on the subject.
+static int regexp_parse_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *info) {
+	regexp_parse_vtab *vtab = (regexp_parse_vtab *)pVtab;
+	bool unusable = false;
+	const struct sqlite3_index_constraint *c = info->aConstraint;
+	for (int i = 0; i < info->nConstraint; i++, c++) {
+		if (c->iColumn != vtab->ncol) {
+			continue;
+		}
+		if (!c->usable) {
+			unusable = true;
+		} else if (c->op == SQLITE_INDEX_CONSTRAINT_EQ) {
+			info->aConstraintUsage[i].argvIndex = 1;
+			info->aConstraintUsage[i].omit = 1;
+			info->idxNum = 1;
+			info->estimatedCost = 10.0;
+			return SQLITE_OK;
+		}
+	}
+	if (unusable) {
+		return SQLITE_CONSTRAINT;
+	}
+	info->idxNum = 0;
+	info->estimatedCost = 2147483647.0;
+	return SQLITE_OK;
+}
+
+static sqlite3_module regexp_parse_module = {
+	.iVersion    = 0,
+	.xCreate     = regexp_parse_create,
+	.xConnect    = regexp_parse_connect,
+	.xBestIndex  = regexp_parse_best_index,
+	.xDisconnect = regexp_parse_disconnect,
+	.xDestroy    = regexp_parse_disconnect,
+	.xOpen       = regexp_parse_open,
+	.xClose      = regexp_parse_close,
+	.xFilter     = regexp_parse_filter,
+	.xNext       = regexp_parse_next,
+	.xEof        = regexp_parse_eof,
+	.xColumn     = regexp_parse_column,
+	.xRowid      = regexp_parse_rowid,
+};
+
+// regexp_trgm is a trigram index for the REGEXP operator. The index is kept
+// in the shadow table %_trgm and, like an FTS5 external content table, the
+// rows are read from a content table:
+//
+//	CREATE TABLE docs(content TEXT);
+//	CREATE VIRTUAL TABLE docs_rx USING regexp_trgm(docs, content);
+//	SELECT rowid, content FROM docs_rx WHERE content REGEXP 'foo(bar|baz)';
+//
+// The literals that every match must contain (see: lit_query) are converted
+// to a query of trigrams and the regex is only run against the rows that
+// contain them. Patterns without literals of at least 3 bytes scan the whole
+// content table. Trigrams are indexed with ASCII letters folded to lower case
+// so that the index can also be used by caseless patterns.
+//
+// The index is built when the table is created and must be kept up to date
+// with triggers or rebuilt:
+//
+//	INSERT INTO docs_rx(rowid, content) VALUES (new.rowid, new.content);
+//	INSERT INTO docs_rx(docs_rx, rowid, content) VALUES ('delete', old.rowid, old.content);
+//	INSERT INTO docs_rx(docs_rx) VALUES ('rebuild');
+
+enum {
+	TRGM_COL_VALUE,
+	TRGM_COL_COMMAND, // hidden, has the name of the table
+};
+
+typedef struct {
+	sqlite3_vtab base;
+	sqlite3      *db;
+	cache_list   *cache;
+	char         *schema;  // database of the table
+	char         *name;    // name of the table
+	char         *content; // content table
+	char         *column;  // indexed column of the content table
+	sqlite3_stmt *insert_stmt;
+	sqlite3_stmt *delete_stmt;
+	sqlite3_stmt *postings_stmt;
+} trgm_vtab;
+
+// trgm_ids is a sorted list of rowids.
+typedef struct {
+	sqlite3_int64 *ids;
+	sqlite3_int64 n;
+	sqlite3_int64 cap;
+} trgm_ids;
+
+typedef struct {
+	sqlite3_vtab_cursor base;
+	sqlite3_stmt        *stmt;    // reads the content table
+	bool                lookup;   // stmt reads a single rowid
+	bool                filtered; // REGEXP constraint
+	cache_entry         *ent;     // NULL if the pattern is empty
+	trgm_ids            ids;      // candidate rows
+	sqlite3_int64       pos;
+	bool                eof;
+} trgm_cursor;
+
+static void trgm_ids_free(trgm_ids *l) {
+	if (l->ids) {
+		re_free(l->ids);
+	}
+	memset(l, 0, sizeof(trgm_ids));
+}
+
+static int trgm_ids_push(trgm_ids *l, sqlite3_int64 id) {
+	if (l->n == l->cap) {
+		sqlite3_int64 cap = l->cap ? 2 * l->cap : 64;
+		sqlite3_int64 *ids = sqlite3_realloc64(l->ids, sizeof(sqlite3_int64) * (uint64_t)cap);
+		if (!ids) {
+			return SQLITE_NOMEM;
+		}
+		l->ids = ids;
+		l->cap = cap;
+	}
+	l->ids[l->n++] = id;
+	return SQLITE_OK;
+}
+
+// trgm_ids_intersect stores the intersection of a and b in a.
+static void trgm_ids_intersect(trgm_ids *a, const trgm_ids *b) {
+	sqlite3_int64 n = 0;
+	for (sqlite3_int64 i = 0, j = 0; i < a->n && j < b->n; ) {
+		if (a->ids[i] < b->ids[j]) {
+			i++;
+		} else if (a->ids[i] > b->ids[j]) {
+			j++;
+		} else {
+			a->ids[n++] = a->ids[i];
+			i++;
+			j++;
+		}
+	}
+	a->n = n;
+}
+
+// trgm_ids_union stores the union of a and b in a.
+static int trgm_ids_union(trgm_ids *a, const trgm_ids *b) {
+	trgm_ids u = { .ids = NULL, .n = 0, .cap = 0 };
+	sqlite3_int64 i = 0;
+	sqlite3_int64 j = 0;
+	int rc = SQLITE_OK;
+	while (rc == SQLITE_OK && (i < a->n || j < b->n)) {
+		if (j >= b->n || (i < a->n && a->ids[i] < b->ids[j])) {
+			rc = trgm_ids_push(&u, a->ids[i++]);
+		} else if (i >= a->n || b->ids[j] < a->ids[i]) {
+			rc = trgm_ids_push(&u, b->ids[j++]);
+		} else {
+			rc = trgm_ids_push(&u, a->ids[i]);
+			i++;
+			j++;
+		}
+	}
+	if (rc != SQLITE_OK) {
+		trgm_ids_free(&u);
+		return rc;
+	}
+	trgm_ids_free(a);
+	*a = u;
+	return SQLITE_OK;
+}
+
+static inline uint32_t trgm_fold(unsigned char c) {
+	return ('A' <= c && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline uint32_t trgm_trigram(const char *s) {
+	return (trgm_fold((unsigned char)s[0]) << 16) |
+		(trgm_fold((unsigned char)s[1]) << 8) |
+		trgm_fold((unsigned char)s[2]);
+}
+
+static int trgm_compare(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+// trgm_subject returns the bytes of v as seen by REGEXP or NULL if v is NULL
+// or memory could not be allocated (check *nomem).
+static const char *trgm_subject(sqlite3_value *v, int *n, bool *nomem) {
+	*nomem = false;
+	*n = 0;
+	int type = sqlite3_value_type(v);
+	if (type == SQLITE_NULL) {
+		return NULL;
+	}
+	const char *s = type == SQLITE_BLOB
+		? (const char *)sqlite3_value_blob(v)
+		: (const char *)sqlite3_value_text(v);
+	*n = sqlite3_value_bytes(v);
+	if (!s) {
+		if (*n == 0) {
+			return ""; // empty blob
+		}
+		*nomem = true;
+	}
+	return s;
+}
+
+// trgm_prepare prepares the statement created from the sqlite3_mprintf style
+// format (which supports "%w" for quoting identifiers).
+static int trgm_prepare(trgm_vtab *vtab, sqlite3_stmt **stmt, const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	char *sql = sqlite3_vmprintf(format, args);
+	va_end(args);
+	if (!sql) {
+		return SQLITE_NOMEM;
+	}
+	int rc = sqlite3_prepare_v3(vtab->db, sql, -1, SQLITE_PREPARE_PERSISTENT, stmt, NULL);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		return set_vtab_error(&vtab->base, sqlite3_mprintf("regexp_trgm: %s",
+		                                                   sqlite3_errmsg(vtab->db)));
+	}
+	return SQLITE_OK;
+}
+
+static void trgm_finalize_stmts(trgm_vtab *vtab) {
+	sqlite3_finalize(vtab->insert_stmt);
+	sqlite3_finalize(vtab->delete_stmt);
+	sqlite3_finalize(vtab->postings_stmt);
+	vtab->insert_stmt = NULL;
+	vtab->delete_stmt = NULL;
+	vtab->postings_stmt = NULL;
+}
+
+// trgm_doc_trigrams stores the sorted and unique trigrams of text in
+// *trigrams, which must be freed with re_free, and their number in *n.
+static int trgm_doc_trigrams(const char *text, int len, uint32_t **trigrams, size_t *n) {
+	*trigrams = NULL;
+	*n = 0;
+	if (len < 3) {
+		return SQLITE_OK;
+	}
+	size_t m = (size_t)len - 2;
+	uint32_t *t = re_malloc(sizeof(uint32_t) * m);
+	if (!t) {
+		return SQLITE_NOMEM;
+	}
+	for (size_t i = 0; i < m; i++) {
+		t[i] = trgm_trigram(&text[i]);
+	}
+	qsort(t, m, sizeof(uint32_t), trgm_compare);
+	size_t j = 0;
+	for (size_t i = 0; i < m; i++) {
+		if (i == 0 || t[i] != t[j-1]) {
+			t[j++] = t[i];
+		}
+	}
+	*trigrams = t;
+	*n = j;
+	return SQLITE_OK;
+}
+
+// trgm_step_pair binds trigram and id to stmt, an insert or delete statement,
+// and executes it.
+static int trgm_step_pair(trgm_vtab *vtab, sqlite3_stmt *stmt, uint32_t trigram,
+                          sqlite3_int64 id) {
+	sqlite3_bind_int64(stmt, 1, trigram);
+	sqlite3_bind_int64(stmt, 2, id);
+	int rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	if (rc == SQLITE_DONE) {
+		return SQLITE_OK;
+	}
+	return set_vtab_error(&vtab->base, sqlite3_mprintf("regexp_trgm: %s",
+	                                                   sqlite3_errmsg(vtab->db)));
+}
+
+// trgm_update_doc adds (insert_stmt) or removes (delete_stmt) the trigrams of
+// the document text to the index of rowid id.
+static int trgm_update_doc(trgm_vtab *vtab, sqlite3_stmt *stmt, sqlite3_int64 id,
+                           const char *text, int len) {
+	uint32_t *trigrams;
+	size_t n;
+	int rc = trgm_doc_trigrams(text, len, &trigrams, &n);
+	for (size_t i = 0; i < n && rc == SQLITE_OK; i++) {
+		rc = trgm_step_pair(vtab, stmt, trigrams[i], id);
+	}
+	if (trigrams) {
+		re_free(trigrams);
+	}
+	return rc;
+}
+
+// The index is rebuilt in batches of (trigram, rowid) pairs, which are sorted
+// before they are inserted so that the index b-tree is written in order.
+// Pairs are packed as: trigram << TRGM_ID_BITS | rowid. The batch buffer grows
+// as needed and is flushed once it holds TRGM_REBUILD_SIZE pairs.
+#define TRGM_ID_BITS      40
+#define TRGM_REBUILD_SIZE (1 << 22)
+
+static int trgm_compare_pairs(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int trgm_flush_pairs(trgm_vtab *vtab, uint64_t *pairs, size_t n) {
+	if (n == 0) {
+		return SQLITE_OK;
+	}
+	qsort(pairs, n, sizeof(uint64_t), trgm_compare_pairs);
+	const uint64_t mask = (1LLU << TRGM_ID_BITS) - 1;
+	for (size_t i = 0; i < n; i++) {
+		int rc = trgm_step_pair(vtab, vtab->insert_stmt, (uint32_t)(pairs[i] >> TRGM_ID_BITS),
+		                        (sqlite3_int64)(pairs[i] & mask));
+		if (rc != SQLITE_OK) {
+			return rc;
+		}
+	}
+	return SQLITE_OK;
+}
+
+// trgm_rebuild rebuilds the index from the content table.
+static int trgm_rebuild(trgm_vtab *vtab) {
+	sqlite3_stmt *scan = NULL;
+	char *sql = sqlite3_mprintf("DELETE FROM \"%w\".\"%w_trgm\"", vtab->schema, vtab->name);
+	if (!sql) {
+		return SQLITE_NOMEM;
+	}
+	int rc = sqlite3_exec(vtab->db, sql, NULL, NULL, NULL);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		goto error;
+	}
+	if (!vtab->insert_stmt) {
+		rc = trgm_prepare(vtab, &vtab->insert_stmt,
+			"INSERT OR IGNORE INTO \"%w\".\"%w_trgm\"(trigram, id) VALUES (?1, ?2)",
+			vtab->schema, vtab->name);
+		if (rc != SQLITE_OK) {
+			return rc;
+		}
+	}
+	// Qualify the column so that a missing column is not taken as a string.
+	rc = trgm_prepare(vtab, &scan, "SELECT rowid, \"%w\".\"%w\" FROM \"%w\".\"%w\"",
+	                  vtab->content, vtab->column, vtab->schema, vtab->content);
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	uint64_t *pairs = NULL;
+	size_t npairs = 0;
+	size_t cap = 0;
+	bool failed = false;
+	while (!failed && (rc = sqlite3_step(scan)) == SQLITE_ROW) {
+		bool nomem;
+		int len;
+		const char *text = trgm_subject(sqlite3_column_value(scan, 1), &len, &nomem);
+		if (nomem) {
+			rc = SQLITE_NOMEM;
+			failed = true;
+			break;
+		}
+		sqlite3_int64 id = sqlite3_column_int64(scan, 0);
+		if (!text) {
+			continue;
+		}
+		if (id < 0 || id >= (1LL << TRGM_ID_BITS)) {
+			// Does not fit in a pair
+			rc = trgm_update_doc(vtab, vtab->insert_stmt, id, text, len);
+			failed = rc != SQLITE_OK;
+			continue;
+		}
+		uint32_t *trigrams;
+		size_t n;
+		rc = trgm_doc_trigrams(text, len, &trigrams, &n);
+		for (size_t i = 0; i < n && rc == SQLITE_OK; i++) {
+			if (npairs == TRGM_REBUILD_SIZE) {
+				rc = trgm_flush_pairs(vtab, pairs, npairs);
+				npairs = 0;
+			} else if (npairs == cap) {
+				size_t ncap = cap ? 2 * cap : 1024;
+				if (ncap > TRGM_REBUILD_SIZE) {
+					ncap = TRGM_REBUILD_SIZE;
+				}
+				uint64_t *p = sqlite3_realloc64(pairs, sizeof(uint64_t) * ncap);
+				if (!p) {
+					rc = SQLITE_NOMEM;
+					break;
+				}
+				pairs = p;
+				cap = ncap;
+			}
+			pairs[npairs++] = ((uint64_t)trigrams[i] << TRGM_ID_BITS) | (uint64_t)id;
+		}
+		if (trigrams) {
+			re_free(trigrams);
+		}
+		failed = rc != SQLITE_OK;
+	}
+	if (!failed) {
+		if (rc == SQLITE_DONE) {
+			rc = trgm_flush_pairs(vtab, pairs, npairs);
+		} else {
+			rc = set_vtab_error(&vtab->base, sqlite3_mprintf("regexp_trgm: %s",
+			                                                 sqlite3_errmsg(vtab->db)));
+		}
+	}
+	if (pairs) {
+		re_free(pairs);
+	}
+	sqlite3_finalize(scan);
+	return rc;
+
+error:
+	return set_vtab_error(&vtab->base, sqlite3_mprintf("regexp_trgm: %s",
+	                                                   sqlite3_errmsg(vtab->db)));
+}
+
+// trgm_postings appends the sorted rowids of the documents that contain
+// trigram to out.
+static int trgm_postings(trgm_vtab *vtab, uint32_t trigram, trgm_ids *out) {
+	if (!vtab->postings_stmt) {
+		int rc = trgm_prepare(vtab, &vtab->postings_stmt,
+			"SELECT id FROM \"%w\".\"%w_trgm\" WHERE trigram = ?1 ORDER BY id",
+			vtab->schema, vtab->name);
+		if (rc != SQLITE_OK) {
+			return rc;
+		}
+	}
+	sqlite3_stmt *stmt = vtab->postings_stmt;
+	sqlite3_bind_int64(stmt, 1, trigram);
+	int rc;
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if (trgm_ids_push(out, sqlite3_column_int64(stmt, 0)) != SQLITE_OK) {
+			sqlite3_reset(stmt);
+			return SQLITE_NOMEM;
+		}
+	}
+	sqlite3_reset(stmt);
+	if (rc != SQLITE_DONE) {
+		return set_vtab_error(&vtab->base, sqlite3_mprintf("regexp_trgm: %s",
+		                                                   sqlite3_errmsg(vtab->db)));
+	}
+	return SQLITE_OK;
+}
+
+// trgm_eval stores the rowids of the documents that may match node of query q
+// in out. If the node does not restrict the documents *all is set instead.
+static int trgm_eval(trgm_vtab *vtab, const lit_query *q, int node,
+                     trgm_ids *out, bool *all) {
+	const lit_query_node *n = &q->nodes[node];
+	*all = false;
+	int rc = SQLITE_OK;
+	switch (n->op) {
+	case LITQ_ALL:
+		*all = true;
+		return SQLITE_OK;
+	case LITQ_LIT:
+		if (n->len < 3) {
+			*all = true;
+			return SQLITE_OK;
+		}
+		for (uint32_t i = 0; i + 3 <= n->len; i++) {
+			trgm_ids ids = { .ids = NULL, .n = 0, .cap = 0 };
+			rc = trgm_postings(vtab, trgm_trigram(&q->buf[n->off + i]), i == 0 ? out : &ids);
+			if (i > 0) {
+				trgm_ids_intersect(out, &ids);
+				trgm_ids_free(&ids);
+			}
+			if (rc != SQLITE_OK || out->n == 0) {
+				break;
+			}
+		}
+		return rc;
+	case LITQ_AND: {
+		bool first = true;
+		for (int c = n->child; c >= 0; c = q->nodes[c].next) {
+			trgm_ids ids = { .ids = NULL, .n = 0, .cap = 0 };
+			bool child_all;
+			rc = trgm_eval(vtab, q, c, first ? out : &ids, &child_all);
+			if (!first) {
+				if (!child_all) {
+					trgm_ids_intersect(out, &ids);
+				}
+				trgm_ids_free(&ids);
+			} else if (!child_all) {
+				first = false;
+			}
+			if (rc != SQLITE_OK || (!first && out->n == 0)) {
+				break;
+			}
+		}
+		*all = first;
+		return rc;
+	}
+	case LITQ_OR:
+		for (int c = n->child; c >= 0; c = q->nodes[c].next) {
+			trgm_ids ids = { .ids = NULL, .n = 0, .cap = 0 };
+			bool child_all;
+			rc = trgm_eval(vtab, q, c, &ids, &child_all);
+			if (rc == SQLITE_OK && !child_all) {
+				rc = trgm_ids_union(out, &ids);
+			}
+			trgm_ids_free(&ids);
+			if (rc != SQLITE_OK) {
+				return rc;
+			}
+			if (child_all) {
+				trgm_ids_free(out);
+				*all = true;
+				return SQLITE_OK;
+			}
+		}
+		return SQLITE_OK;
+	}
+	return SQLITE_OK;
+}
+
+static void trgm_vtab_free(trgm_vtab *vtab) {
+	trgm_finalize_stmts(vtab);
+	re_free(vtab->schema);
+	re_free(vtab->name);
+	re_free(vtab->content);
+	re_free(vtab->column);
+	re_free(vtab);
+}
+
+static int trgm_init(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                     sqlite3_vtab **ppVtab, char **pzErr, bool create) {
+	if (argc != 5) {
+		*pzErr = sqlite3_mprintf("regexp_trgm: expected arguments: content_table, column");
+		return SQLITE_ERROR;
+	}
+	trgm_vtab *vtab = re_malloc(sizeof(trgm_vtab));
+	if (!vtab) {
+		return SQLITE_NOMEM;
+	}
+	memset(vtab, 0, sizeof(trgm_vtab));
+	vtab->db = db;
+	vtab->cache = (cache_list *)pAux;
+	vtab->schema = sqlite3_mprintf("%s", argv[1]);
+	vtab->name = sqlite3_mprintf("%s", argv[2]);
+	vtab->content = dequote_arg(argv[3]);
+	vtab->column = dequote_arg(argv[4]);
+	if (!vtab->schema || !vtab->name || !vtab->content || !vtab->column) {
+		trgm_vtab_free(vtab);
+		return SQLITE_NOMEM;
+	}
+
+	char *sql = sqlite3_mprintf("CREATE TABLE x(\"%w\", \"%w\" HIDDEN)",
+	                            vtab->column, vtab->name);
+	if (!sql) {
+		trgm_vtab_free(vtab);
+		return SQLITE_NOMEM;
+	}
+	int rc = sqlite3_declare_vtab(db, sql);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		*pzErr = sqlite3_mprintf("regexp_trgm: %s", sqlite3_errmsg(db));
+		trgm_vtab_free(vtab);
+		return rc;
+	}
+	// Allow updating the index from triggers.
+	sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+
+	if (create) {
+		sql = sqlite3_mprintf(
+			"CREATE TABLE \"%w\".\"%w_trgm\"("
+			"trigram INTEGER NOT NULL, id INTEGER NOT NULL, "
+			"PRIMARY KEY(trigram, id)) WITHOUT ROWID",
+			vtab->schema, vtab->name);
+		if (!sql) {
+			trgm_vtab_free(vtab);
+			return SQLITE_NOMEM;
+		}
+		rc = sqlite3_exec(db, sql, NULL, NULL, pzErr);
+		re_free(sql);
+		if (rc == SQLITE_OK) {
+			rc = trgm_rebuild(vtab);
+			if (rc != SQLITE_OK) {
+				*pzErr = vtab->base.zErrMsg;
+				vtab->base.zErrMsg = NULL;
+			}
+		}
+		if (rc != SQLITE_OK) {
+			trgm_vtab_free(vtab);
+			return rc;
+		}
+	}
+	*ppVtab = &vtab->base;
+	return SQLITE_OK;
+}
+
+static int trgm_create(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                       sqlite3_vtab **ppVtab, char **pzErr) {
+	return trgm_init(db, pAux, argc, argv, ppVtab, pzErr, true);
+}
+
+static int trgm_connect(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                        sqlite3_vtab **ppVtab, char **pzErr) {
+	return trgm_init(db, pAux, argc, argv, ppVtab, pzErr, false);
+}
+
+static int trgm_disconnect(sqlite3_vtab *pVtab) {
+	trgm_vtab_free((trgm_vtab *)pVtab);
+	return SQLITE_OK;
+}
+
+static int trgm_destroy(sqlite3_vtab *pVtab) {
+	trgm_vtab *vtab = (trgm_vtab *)pVtab;
+	trgm_finalize_stmts(vtab);
+	char *sql = sqlite3_mprintf("DROP TABLE IF EXISTS \"%w\".\"%w_trgm\"",
+	                            vtab->schema, vtab->name);
+	if (!sql) {
+		return SQLITE_NOMEM;
+	}
+	int rc = sqlite3_exec(vtab->db, sql, NULL, NULL, NULL);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	trgm_vtab_free(vtab);
+	return SQLITE_OK;
+}
+
+static int trgm_rename(sqlite3_vtab *pVtab, const char *zNew) {
+	trgm_vtab *vtab = (trgm_vtab *)pVtab;
+	char *name = sqlite3_mprintf("%s", zNew);
+	char *sql = sqlite3_mprintf("ALTER TABLE \"%w\".\"%w_trgm\" RENAME TO \"%w_trgm\"",
+	                            vtab->schema, vtab->name, zNew);
+	if (!name || !sql) {
+		re_free(name);
+		re_free(sql);
+		return SQLITE_NOMEM;
+	}
+	int rc = sqlite3_exec(vtab->db, sql, NULL, NULL, NULL);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		re_free(name);
+		return rc;
+	}
+	trgm_finalize_stmts(vtab);
+	re_free(vtab->name);
+	vtab->name = name;
+	return SQLITE_OK;
+}
+
+static int trgm_shadow_name(const char *name) {
+	return sqlite3_stricmp(name, "trgm") == 0;
+}
+
+static int trgm_update(sqlite3_vtab *pVtab, int argc, sqlite3_value **argv,
+                       sqlite3_int64 *pRowid) {
+	(void)pRowid;
+	trgm_vtab *vtab = (trgm_vtab *)pVtab;
+	if (argc == 1 || sqlite3_value_type(argv[0]) != SQLITE_NULL) {
+		return set_vtab_error(pVtab, sqlite3_mprintf(
+			"regexp_trgm: rows must be removed with the 'delete' command"));
+	}
+
+	sqlite3_stmt **stmt = &vtab->insert_stmt;
+	const char *sql = "INSERT OR IGNORE INTO \"%w\".\"%w_trgm\"(trigram, id) VALUES (?1, ?2)";
+	sqlite3_value *cmd = argv[2 + TRGM_COL_COMMAND];
+	if (sqlite3_value_type(cmd) != SQLITE_NULL) {
+		const char *s = (const char *)sqlite3_value_text(cmd);
+		if (!s) {
+			return SQLITE_NOMEM;
+		}
+		if (sqlite3_stricmp(s, "rebuild") == 0) {
+			return trgm_rebuild(vtab);
+		}
+		if (sqlite3_stricmp(s, "delete") != 0) {
+			return set_vtab_error(pVtab, sqlite3_mprintf(
+				"regexp_trgm: invalid command: %s", s));
+		}
+		stmt = &vtab->delete_stmt;
+		sql = "DELETE FROM \"%w\".\"%w_trgm\" WHERE trigram = ?1 AND id = ?2";
+	}
+	if (sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+		return set_vtab_error(pVtab, sqlite3_mprintf("regexp_trgm: a rowid is required"));
+	}
+	if (!*stmt) {
+		int rc = trgm_prepare(vtab, stmt, sql, vtab->schema, vtab->name);
+		if (rc != SQLITE_OK) {
+			return rc;
+		}
+	}
+
+	bool nomem;
+	int len;
+	const char *text = trgm_subject(argv[2 + TRGM_COL_VALUE], &len, &nomem);
+	if (nomem) {
+		return SQLITE_NOMEM;
+	}
+	if (!text) {
+		return SQLITE_OK;
+	}
+	return trgm_update_doc(vtab, *stmt, sqlite3_value_int64(argv[1]), text, len);
+}
+
+static int trgm_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *info) {
+	(void)pVtab;
+	for (int i = 0; i < info->nConstraint; i++) {
+		const struct sqlite3_index_constraint *c = &info->aConstraint[i];
+		if (c->usable && c->iColumn == TRGM_COL_VALUE &&
+			c->op == SQLITE_INDEX_CONSTRAINT_REGEXP) {
+			info->aConstraintUsage[i].argvIndex = 1;
+			info->aConstraintUsage[i].omit = 1;
+			info->idxNum = 1;
+			info->estimatedCost = 1e4;
+			info->estimatedRows = 1000;
+			return SQLITE_OK;
+		}
+	}
+	info->idxNum = 0;
+	info->estimatedCost = 1e7;
+	info->estimatedRows = 1000000;
+	return SQLITE_OK;
+}
+
+static int trgm_open(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+	(void)pVtab;
+	trgm_cursor *cur = re_malloc(sizeof(trgm_cursor));
+	if (!cur) {
+		return SQLITE_NOMEM;
+	}
+	memset(cur, 0, sizeof(trgm_cursor));
+	*ppCursor = &cur->base;
+	return SQLITE_OK;
+}
+
+static void trgm_cursor_reset(trgm_cursor *cur) {
+	if (cur->stmt) {
+		sqlite3_reset(cur->stmt);
+	}
+	if (cur->ent) {
+		cache_entry_release(cur->ent);
+		cur->ent = NULL;
+	}
+	trgm_ids_free(&cur->ids);
+	cur->pos = 0;
+	cur->filtered = false;
+	cur->eof = false;
+}
+
+static int trgm_close(sqlite3_vtab_cursor *pCursor) {
+	trgm_cursor *cur = (trgm_cursor *)pCursor;
+	trgm_cursor_reset(cur);
+	sqlite3_finalize(cur->stmt);
+	re_free(cur);
+	return SQLITE_OK;
+}
+
+static int trgm_next(sqlite3_vtab_cursor *pCursor) {
+	trgm_cursor *cur = (trgm_cursor *)pCursor;
+	trgm_vtab *vtab = (trgm_vtab *)pCursor->pVtab;
+	for (;;) {
+		if (cur->lookup) {
+			sqlite3_reset(cur->stmt);
+			if (cur->pos >= cur->ids.n) {
+				cur->eof = true;
+				return SQLITE_OK;
+			}
+			sqlite3_bind_int64(cur->stmt, 1, cur->ids.ids[cur->pos++]);
+		}
+		int rc = sqlite3_step(cur->stmt);
+		if (rc == SQLITE_DONE) {
+			if (cur->lookup) {
+				continue; // the index is out of date
+			}
+			cur->eof = true;
+			return SQLITE_OK;
+		}
+		if (rc != SQLITE_ROW) {
+			return set_vtab_error(pCursor->pVtab, sqlite3_mprintf(
+				"regexp_trgm: %s", sqlite3_errmsg(vtab->db)));
+		}
+		if (!cur->filtered) {
+			return SQLITE_OK;
+		}
+
+		bool nomem;
+		int len;
+		const char *subject = trgm_subject(sqlite3_column_value(cur->stmt, 1), &len, &nomem);
+		if (nomem) {
+			return SQLITE_NOMEM;
+		}
+		if (!subject) {
+			continue; // NULL values never match
+		}
+		if (!cur->ent) {
+			return SQLITE_OK; // empty patterns match everything
+		}
+		rc = regexp_match(cur->ent->cache, cur->ent, subject, (size_t)len);
+		if (rc >= 0) {
+			return SQLITE_OK;
+		}
+		if (rc != PCRE2_ERROR_NOMATCH) {
+			return set_vtab_error(pCursor->pVtab, format_pcre2_match_error(rc,
+				cur->ent->pattern, cur->ent->pattern_len, subject, (uint32_t)len));
+		}
+	}
+}
+
+static int trgm_filter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                       const char *idxStr, int argc, sqlite3_value **argv) {
+	(void)idxStr;
+	(void)argc;
+	trgm_cursor *cur = (trgm_cursor *)pCursor;
+	trgm_vtab *vtab = (trgm_vtab *)pCursor->pVtab;
+	trgm_cursor_reset(cur);
+
+	bool lookup = false;
+	if (idxNum == 1) {
+		cur->filtered = true;
+		if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+			return set_vtab_error(pCursor->pVtab, sqlite3_mprintf("regexp: NULL pattern"));
+		}
+		const char *pattern = (const char *)sqlite3_value_text(argv[0]);
+		if (!pattern) {
+			return SQLITE_NOMEM;
+		}
+		uint32_t pattern_len = (uint32_t)sqlite3_value_bytes(argv[0]);
+		if (pattern_len > 0) {
+			char *errmsg;
+			cur->ent = cache_list_lookup(vtab->cache, pattern, pattern_len, false, &errmsg);
+			if (!cur->ent) {
+				return set_vtab_error(pCursor->pVtab, errmsg);
+			}
+			lit_query q;
+			int rc = lit_query_parse(&q, pattern, pattern_len, false);
+			if (rc != SQLITE_OK) {
+				return rc;
+			}
+			bool all;
+			rc = trgm_eval(vtab, &q, q.root, &cur->ids, &all);
+			lit_query_free(&q);
+			if (rc != SQLITE_OK) {
+				return rc;
+			}
+			lookup = !all;
+		}
+	}
+
+	if (cur->stmt && cur->lookup != lookup) {
+		sqlite3_finalize(cur->stmt);
+		cur->stmt = NULL;
+	}
+	if (!cur->stmt) {
+		int rc = trgm_prepare(vtab, &cur->stmt,
+			lookup
+				? "SELECT rowid, \"%w\".\"%w\" FROM \"%w\".\"%w\" WHERE rowid = ?1"
+				: "SELECT rowid, \"%w\".\"%w\" FROM \"%w\".\"%w\"",
+			vtab->content, vtab->column, vtab->schema, vtab->content);
+		if (rc != SQLITE_OK) {
+			return rc;
+		}
+		cur->lookup = lookup;
+	}
+	return trgm_next(pCursor);
+}
+
+static int trgm_eof(sqlite3_vtab_cursor *pCursor) {
+	return ((trgm_cursor *)pCursor)->eof;
+}
+
+static int trgm_column(sqlite3_vtab_cursor *pCursor, sqlite3_context *ctx, int i) {
+	trgm_cursor *cur = (trgm_cursor *)pCursor;
+	if (i == TRGM_COL_VALUE) {
+		sqlite3_result_value(ctx, sqlite3_column_value(cur->stmt, 1));
+	}
+	return SQLITE_OK;
+}
+
+static int trgm_rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid) {
+	*pRowid = sqlite3_column_int64(((trgm_cursor *)pCursor)->stmt, 0);
+	return SQLITE_OK;
+}
+
+static sqlite3_module trgm_module = {
+	.iVersion    = 3,
+	.xCreate     = trgm_create,
+	.xConnect    = trgm_connect,
+	.xBestIndex  = trgm_best_index,
+	.xDisconnect = trgm_disconnect,
+	.xDestroy    = trgm_destroy,
+	.xOpen       = trgm_open,
+	.xClose      = trgm_close,
+	.xFilter     = trgm_filter,
+	.xNext       = trgm_next,
+	.xEof        = trgm_eof,
+	.xColumn     = trgm_column,
+	.xRowid      = trgm_rowid,
+	.xUpdate     = trgm_update,
+	.xRename     = trgm_rename,
+	.xShadowName = trgm_shadow_name,
+};
+
+// regexp_filter
+//
+// regexp_filter(table, column, pattern) returns the rowids of the rows of
+// table where column matches pattern, like:
+//
+//	SELECT rowid FROM table WHERE column REGEXP pattern;
+//
+// The column is read through a single statement in batches of rows, which
+// are matched as they are read (the values of a row are only valid until the
+// next row is read): subjects that do not contain the required literal of the
+// pattern are ruled out with memchr (see: cache_entry_init_literal) and the
+// regex is run on the remaining ones. The rowids of the matching rows of the
+// batch are then returned. This avoids calling the REGEXP function and
+// fetching its auxiliary data for every row.
+
+#define FILTER_BATCH_SIZE 2048 // rows read per batch
+
+enum {
+	REGEXP_FILTER_ID,
+	REGEXP_FILTER_TABLE,   // hidden
+	REGEXP_FILTER_COLUMN,  // hidden
+	REGEXP_FILTER_PATTERN, // hidden
+};
+
+typedef struct {
+	sqlite3_vtab base;
+	sqlite3      *db;
+	cache_list   *cache;
+} regexp_filter_vtab;
+
+// filter_batch holds the matching rows of a batch.
+typedef struct {
+	int           n;
+	sqlite3_int64 ids[FILTER_BATCH_SIZE];
+} filter_batch;
+
+typedef struct {
+	sqlite3_vtab_cursor base;
+	sqlite3_stmt        *stmt;
+	cache_entry         *ent;       // NULL if the pattern is empty
+	bool                prefilter;  // see: regexp_filter_read
+	filter_batch        *batch;
+	int                 pos;        // current row of the batch
+	bool                done;       // stmt is exhausted
+	bool                eof;
+} regexp_filter_cursor;
+
+static int regexp_filter_connect(sqlite3 *db, void *pAux, int argc,
+                                 const char *const *argv,
+                                 sqlite3_vtab **ppVtab, char **pzErr) {
+	(void)argc;
+	(void)argv;
+	(void)pzErr;
+
+	int rc = sqlite3_declare_vtab(db,
+		"CREATE TABLE x(id, table_name HIDDEN, column_name HIDDEN, pattern HIDDEN)");
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	regexp_filter_vtab *vtab = re_malloc(sizeof(regexp_filter_vtab));
+	if (!vtab) {
+		return SQLITE_NOMEM;
+	}
+	memset(vtab, 0, sizeof(regexp_filter_vtab));
+	vtab->db = db;
+	vtab->cache = (cache_list *)pAux;
+	// The table to read is an argument, so only allow direct use.
+	sqlite3_vtab_config(db, SQLITE_VTAB_DIRECTONLY);
+	*ppVtab = &vtab->base;
+	return SQLITE_OK;
+}
+
+static int regexp_filter_disconnect(sqlite3_vtab *pVtab) {
+	re_free(pVtab);
+	return SQLITE_OK;
+}
+
+static int regexp_filter_open(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+	(void)pVtab;
+	regexp_filter_cursor *cur = re_malloc(sizeof(regexp_filter_cursor));
+	if (!cur) {
+		return SQLITE_NOMEM;
+	}
+	memset(cur, 0, sizeof(regexp_filter_cursor));
+	cur->eof = true;
+	*ppCursor = &cur->base;
+	return SQLITE_OK;
+}
+
+static void regexp_filter_cursor_reset(regexp_filter_cursor *cur) {
+	if (cur->stmt) {
+		sqlite3_finalize(cur->stmt);
+		cur->stmt = NULL;
+	}
+	if (cur->ent) {
+		cache_entry_release(cur->ent);
+		cur->ent = NULL;
+	}
+	if (cur->batch) {
+		cur->batch->n = 0;
+	}
+	cur->pos = 0;
+	cur->done = false;
+	cur->eof = true;
+}
+
+static int regexp_filter_close(sqlite3_vtab_cursor *pCursor) {
+	regexp_filter_cursor *cur = (regexp_filter_cursor *)pCursor;
+	regexp_filter_cursor_reset(cur);
+	if (cur->batch) {
+		re_free(cur->batch);
+	}
+	re_free(cur);
+	return SQLITE_OK;
+}
+
+// regexp_filter_read reads the next batch of rows and stores the rowids of
+// the matching rows. The prefilter is disabled if it does not rule out enough
+// subjects to pay for itself (the regex has to search for the literal again).
+static int regexp_filter_read(regexp_filter_cursor *cur) {
+	filter_batch *b = cur->batch;
+	cache_entry *ent = cur->ent;
+	b->n = 0;
+	int tested = 0;
+	int passed = 0;
+	for (int i = 0; i < FILTER_BATCH_SIZE; i++) {
+		int rc = sqlite3_step(cur->stmt);
+		if (rc != SQLITE_ROW) {
+			cur->done = true;
+			if (rc != SQLITE_DONE) {
+				sqlite3 *db = ((regexp_filter_vtab *)cur->base.pVtab)->db;
+				return set_vtab_error(cur->base.pVtab,
+					sqlite3_mprintf("regexp_filter: %s", sqlite3_errmsg(db)));
+			}
+			break;
+		}
+		bool nomem;
+		int len;
+		const char *subject = trgm_subject(sqlite3_column_value(cur->stmt, 1), &len, &nomem);
+		if (!subject) {
+			if (nomem) {
+				return SQLITE_NOMEM;
+			}
+			continue; // NULL values never match
+		}
+		if (ent) {
+			if (cur->prefilter) {
+				tested++;
+				if (!cache_entry_may_match(ent, subject, (size_t)len)) {
+					continue;
+				}
+				passed++;
+			}
+			rc = regexp_match(ent->cache, ent, subject, (size_t)len);
+			if (rc == PCRE2_ERROR_NOMATCH) {
+				continue;
+			}
+			if (rc < 0) {
+				return set_vtab_error(cur->base.pVtab,
+					format_pcre2_match_error(rc, ent->pattern, ent->pattern_len,
+					                         subject, (uint32_t)len));
+			}
+		}
+		b->ids[b->n++] = sqlite3_column_int64(cur->stmt, 0);
+	}
+	if (cur->prefilter && tested >= FILTER_BATCH_SIZE / 2 && passed > tested / 2) {
+		cur->prefilter = false;
+	}
+	return SQLITE_OK;
+}
+
+static int regexp_filter_next(sqlite3_vtab_cursor *pCursor) {
+	regexp_filter_cursor *cur = (regexp_filter_cursor *)pCursor;
+	if (++cur->pos < cur->batch->n) {
+		return SQLITE_OK;
+	}
+	cur->pos = 0;
+	cur->batch->n = 0;
+	while (cur->batch->n == 0) {
+		if (cur->done) {
+			cur->eof = true;
+			return SQLITE_OK;
+		}
+		int rc = regexp_filter_read(cur);
+		if (rc != SQLITE_OK) {
+			return rc;
+		}
+	}
+	return SQLITE_OK;
+}
+
+static int regexp_filter_filter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                                const char *idxStr, int argc, sqlite3_value **argv) {
+	(void)idxStr;
+	regexp_filter_cursor *cur = (regexp_filter_cursor *)pCursor;
+	regexp_filter_vtab *vtab = (regexp_filter_vtab *)pCursor->pVtab;
+	regexp_filter_cursor_reset(cur);
+
+	if (idxNum != 7 || argc != 3) {
+		return SQLITE_OK; // missing arguments: no rows
+	}
+	const char *table = (const char *)sqlite3_value_text(argv[0]);
+	const char *column = (const char *)sqlite3_value_text(argv[1]);
+	if (!table || !column) {
+		return set_vtab_error(pCursor->pVtab,
+			sqlite3_mprintf("regexp_filter: table and column must not be NULL"));
+	}
+	if (sqlite3_value_type(argv[2]) == SQLITE_NULL) {
+		return set_vtab_error(pCursor->pVtab, sqlite3_mprintf("regexp: NULL pattern"));
+	}
+	const char *pattern = (const char *)sqlite3_value_text(argv[2]);
+	if (!pattern) {
+		return SQLITE_NOMEM;
+	}
+	uint32_t pattern_len = (uint32_t)sqlite3_value_bytes(argv[2]);
+
+	if (!cur->batch) {
+		cur->batch = re_malloc(sizeof(filter_batch));
+		if (!cur->batch) {
+			return SQLITE_NOMEM;
+		}
+		memset(cur->batch, 0, sizeof(filter_batch));
+	}
+
+	// Qualify the column so that a missing column is not taken as a string.
+	char *sql = sqlite3_mprintf("SELECT rowid, \"%w\".\"%w\" FROM \"main\".\"%w\"",
+	                            table, column, table);
+	if (!sql) {
+		return SQLITE_NOMEM;
+	}
+	int rc = sqlite3_prepare_v2(vtab->db, sql, -1, &cur->stmt, NULL);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		return set_vtab_error(pCursor->pVtab, sqlite3_mprintf("regexp_filter: %s",
+		                                                      sqlite3_errmsg(vtab->db)));
+	}
+
+	if (pattern_len > 0) {
+		char *errmsg;
+		cur->ent = cache_list_lookup(vtab->cache, pattern, pattern_len, false, &errmsg);
+		if (!cur->ent) {
+			return set_vtab_error(pCursor->pVtab, errmsg);
+		}
+		if (cache_entry_init_literal(cur->ent) != SQLITE_OK) {
+			return SQLITE_NOMEM;
+		}
+		cur->prefilter = cur->ent->literal_len > 0;
+	}
+
+	cur->eof = false;
+	cur->pos = 0;
+	return regexp_filter_next(pCursor);
+}
+
+static int regexp_filter_eof(sqlite3_vtab_cursor *pCursor) {
+	return ((regexp_filter_cursor *)pCursor)->eof;
+}
+
+static int regexp_filter_column(sqlite3_vtab_cursor *pCursor,
+                                sqlite3_context *ctx, int i) {
+	regexp_filter_cursor *cur = (regexp_filter_cursor *)pCursor;
+	if (i == REGEXP_FILTER_ID) {
+		sqlite3_result_int64(ctx, cur->batch->ids[cur->pos]);
+	}
+	return SQLITE_OK;
+}
+
+static int regexp_filter_rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid) {
+	regexp_filter_cursor *cur = (regexp_filter_cursor *)pCursor;
+	*pRowid = cur->batch->ids[cur->pos];
+	return SQLITE_OK;
+}
+
+// regexp_filter_best_index requires that the table, column and pattern are
+// provided as equality constraints. idxNum is a bitmask of the constraints
+// present: 1 table, 2 column and 4 pattern.
+static int regexp_filter_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *info) {
+	(void)pVtab;
+	int idx[3] = {-1, -1, -1};
+	int unusable = 0;
+	const struct sqlite3_index_constraint *c = info->aConstraint;
+	for (int i = 0; i < info->nConstraint; i++, c++) {
+		if (c->iColumn < REGEXP_FILTER_TABLE) {
+			continue;
+		}
+		int col = c->iColumn - REGEXP_FILTER_TABLE;
+		if (!c->usable) {
+			unusable |= 1 << col;
+		} else if (c->op == SQLITE_INDEX_CONSTRAINT_EQ) {
+			idx[col] = i;
+		}
+	}
+	if (idx[0] < 0 || idx[1] < 0 || idx[2] < 0) {
+		if (unusable) {
+			return SQLITE_CONSTRAINT;
+		}
+		info->idxNum = 0;
+		info->estimatedCost = 2147483647.0;
+		return SQLITE_OK;
+	}
+	for (int i = 0; i < 3; i++) {
+		info->aConstraintUsage[idx[i]].argvIndex = i + 1;
+		info->aConstraintUsage[idx[i]].omit = 1;
+	}
+	info->idxNum = 7;
+	info->estimatedCost = 1000000.0;
+	return SQLITE_OK;
+}
+
+static sqlite3_module regexp_filter_module = {
+	.iVersion    = 0,
+	.xCreate     = NULL, // eponymous-only
+	.xConnect    = regexp_filter_connect,
+	.xBestIndex  = regexp_filter_best_index,
+	.xDisconnect = regexp_filter_disconnect,
+	.xDestroy    = NULL,
+	.xOpen       = regexp_filter_open,
+	.xClose      = regexp_filter_close,
+	.xFilter     = regexp_filter_filter,
+	.xNext       = regexp_filter_next,
+	.xEof        = regexp_filter_eof,
+	.xColumn     = regexp_filter_column,
+	.xRowid      = regexp_filter_rowid,
+};
+
+// regexp_scan
+//
+// regexp_scan(table, column, pattern [, threads]) returns the rowids of the
+// rows of table where column matches pattern. The rowid range of the table is
+// split into chunks that are scanned by worker threads, each with their own
+// read-only connection, JIT stack and match data. Matching rowids are returned
+// in the order the workers find them.
+//
+// Since the workers use their own connections they only see committed data
+// and the table must be in a database file (main).
+
+#ifndef _WIN32
+
+#define SCAN_BATCH_SIZE 256          // rowids sent to the cursor at a time
+#define SCAN_QUEUE_SIZE (64 * 1024)  // max rowids waiting for the cursor
+#define SCAN_MIN_CHUNK  1024         // min rowids per chunk
+
+enum {
+	REGEXP_SCAN_ID,
+	REGEXP_SCAN_TABLE,   // hidden
+	REGEXP_SCAN_COLUMN,  // hidden
+	REGEXP_SCAN_PATTERN, // hidden
+	REGEXP_SCAN_THREADS, // hidden
+};
+
+typedef struct {
+	sqlite3_vtab base;
+	sqlite3      *db;
+	cache_list   *cache;
+} regexp_scan_vtab;
+
+// scan_ids is a list of rowids.
+typedef struct {
+	sqlite3_int64 *ids;
+	size_t        n;
+	size_t        cap;
+} scan_ids;
+
+typedef struct regexp_scan_cursor regexp_scan_cursor;
+
+typedef struct {
+	regexp_scan_cursor  *cur;
+	pthread_t           thread;
+	bool                started;
+	sqlite3             *db;
+	sqlite3_stmt        *stmt;
+	// The pool of the cache is not thread-safe so workers allocate with
+	// their own general context.
+	pcre2_general_context *general_context;
+	match_env           env;
+	size_t              jit_stack_limit;
+	uint64_t            matches;
+} scan_worker;
+
+struct regexp_scan_cursor {
+	sqlite3_vtab_cursor base;
+	cache_entry         *ent;
+	scan_worker         *workers;
+	int                 nworkers;
+	bool                sync_init; // mu and cond are initialized
+	pthread_mutex_t     mu;
+	pthread_cond_t      cond;
+	// Guarded by mu.
+	sqlite3_int64       next;      // first rowid of the next chunk
+	sqlite3_int64       last;      // last rowid of the table
+	uint64_t            chunk;     // rowids per chunk
+	bool                exhausted; // all chunks were claimed
+	int                 running;   // number of running workers
+	bool                stop;
+	int                 rc;        // first worker error
+	char                *errmsg;
+	scan_ids            queue;     // matches not yet returned
+	// Owned by the cursor.
+	scan_ids            batch;     // matches being returned
+	size_t              pos;
+	bool                eof;
+};
+
+static int regexp_scan_connect(sqlite3 *db, void *pAux, int argc,
+                               const char *const *argv,
+                               sqlite3_vtab **ppVtab, char **pzErr) {
+	(void)argc;
+	(void)argv;
+	(void)pzErr;
+
+	int rc = sqlite3_declare_vtab(db,
+		"CREATE TABLE x(id, table_name HIDDEN, column_name HIDDEN, "
+		"pattern HIDDEN, threads HIDDEN)");
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	regexp_scan_vtab *vtab = re_malloc(sizeof(regexp_scan_vtab));
+	if (!vtab) {
+		return SQLITE_NOMEM;
+	}
+	memset(vtab, 0, sizeof(regexp_scan_vtab));
+	vtab->db = db;
+	vtab->cache = (cache_list *)pAux;
+	// The workers read the table with their own connections, which bypasses
+	// the authorizer, so only allow direct use.
+	sqlite3_vtab_config(db, SQLITE_VTAB_DIRECTONLY);
+	*ppVtab = &vtab->base;
+	return SQLITE_OK;
+}
+
+static int regexp_scan_disconnect(sqlite3_vtab *pVtab) {
+	re_free(pVtab);
+	return SQLITE_OK;
+}
+
+static int regexp_scan_open(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+	(void)pVtab;
+	regexp_scan_cursor *cur = re_malloc(sizeof(regexp_scan_cursor));
+	if (!cur) {
+		return SQLITE_NOMEM;
+	}
+	memset(cur, 0, sizeof(regexp_scan_cursor));
+	cur->eof = true;
+	*ppCursor = &cur->base;
+	return SQLITE_OK;
+}
+
+// regexp_scan_claim claims the next chunk of rowids [*lo, *hi] and returns
+// false if there are none left or the scan was stopped.
+static bool regexp_scan_claim(regexp_scan_cursor *cur, sqlite3_int64 *lo,
+                              sqlite3_int64 *hi) {
+	bool ok = false;
+	pthread_mutex_lock(&cur->mu);
+	if (!cur->stop && !cur->exhausted) {
+		*lo = cur->next;
+		if ((uint64_t)cur->last - (uint64_t)cur->next < cur->chunk) {
+			*hi = cur->last;
+			cur->exhausted = true;
+		} else {
+			*hi = (sqlite3_int64)((uint64_t)cur->next + cur->chunk - 1);
+			cur->next = *hi + 1;
+		}
+		ok = true;
+	}
+	pthread_mutex_unlock(&cur->mu);
+	return ok;
+}
+
+// regexp_scan_push adds matching rowids to the queue of the cursor and waits
+// if the queue is full. SQLITE_INTERRUPT is returned if the scan was stopped.
+static int regexp_scan_push(regexp_scan_cursor *cur, const sqlite3_int64 *ids,
+                            size_t n) {
+	int rc = SQLITE_OK;
+	pthread_mutex_lock(&cur->mu);
+	while (!cur->stop && cur->queue.n >= SCAN_QUEUE_SIZE) {
+		pthread_cond_wait(&cur->cond, &cur->mu);
+	}
+	if (cur->stop) {
+		rc = SQLITE_INTERRUPT;
+		goto exit;
+	}
+	if (cur->queue.n + n > cur->queue.cap) {
+		size_t cap = cur->queue.cap ? 2 * cur->queue.cap : SCAN_BATCH_SIZE;
+		while (cap < cur->queue.n + n) {
+			cap *= 2;
+		}
+		sqlite3_int64 *p = sqlite3_realloc64(cur->queue.ids, sizeof(sqlite3_int64) * cap);
+		if (!p) {
+			rc = SQLITE_NOMEM;
+			goto exit;
+		}
+		cur->queue.ids = p;
+		cur->queue.cap = cap;
+	}
+	memcpy(&cur->queue.ids[cur->queue.n], ids, sizeof(sqlite3_int64) * n);
+	cur->queue.n += n;
+	pthread_cond_broadcast(&cur->cond);
+exit:
+	pthread_mutex_unlock(&cur->mu);
+	return rc;
+}
+
+// regexp_scan_chunk matches the rows of chunk [lo, hi] and adds the rowids of
+// the matching rows to ids, which is flushed to the cursor when it is full.
+static int regexp_scan_chunk(scan_worker *w, sqlite3_int64 lo, sqlite3_int64 hi,
+                             sqlite3_int64 *ids, size_t *n, char **errmsg) {
+	const cache_entry *ent = w->cur->ent;
+	sqlite3_bind_int64(w->stmt, 1, lo);
+	sqlite3_bind_int64(w->stmt, 2, hi);
+	int rc;
+	while ((rc = sqlite3_step(w->stmt)) == SQLITE_ROW) {
+		bool nomem;
+		int len;
+		const char *subject = trgm_subject(sqlite3_column_value(w->stmt, 1), &len, &nomem);
+		if (!subject) {
+			if (nomem) {
+				rc = SQLITE_NOMEM;
+				break;
+			}
+			continue; // NULL values never match
+		}
+		if (!cache_entry_may_match(ent, subject, (size_t)len)) {
+			continue;
+		}
+		w->matches++;
+		int mrc;
+		if (ent->litset) {
+			mrc = litset_match(ent->litset, subject, (size_t)len);
+		} else {
+			mrc = regexp_match_env(ent, subject, (size_t)len, 0, w->env.match_data,
+			                       &w->env, w->jit_stack_limit);
+		}
+		if (mrc == PCRE2_ERROR_NOMATCH) {
+			continue;
+		}
+		if (mrc < 0) {
+			*errmsg = format_pcre2_match_error(mrc, ent->pattern, ent->pattern_len,
+			                                   subject, (uint32_t)len);
+			rc = SQLITE_ERROR;
+			break;
+		}
+		ids[(*n)++] = sqlite3_column_int64(w->stmt, 0);
+		if (*n == SCAN_BATCH_SIZE) {
+			rc = regexp_scan_push(w->cur, ids, *n);
+			*n = 0;
+			if (rc != SQLITE_OK) {
+				break;
+			}
+		}
+	}
+	if (rc != SQLITE_DONE && rc != SQLITE_NOMEM && rc != SQLITE_INTERRUPT && !*errmsg) {
+		*errmsg = sqlite3_mprintf("regexp_scan: %s", sqlite3_errmsg(w->db));
+	}
+	sqlite3_reset(w->stmt);
+	return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+static void *regexp_scan_worker(void *arg) {
+	scan_worker *w = (scan_worker *)arg;
+	regexp_scan_cursor *cur = w->cur;
+	sqlite3_int64 ids[SCAN_BATCH_SIZE];
+	size_t n = 0;
+	char *errmsg = NULL;
+	int rc = SQLITE_OK;
+
+	sqlite3_int64 lo, hi;
+	while (rc == SQLITE_OK && regexp_scan_claim(cur, &lo, &hi)) {
+		rc = regexp_scan_chunk(w, lo, hi, ids, &n, &errmsg);
+	}
+	if (rc == SQLITE_OK && n > 0) {
+		rc = regexp_scan_push(cur, ids, n);
+	}
+
+	pthread_mutex_lock(&cur->mu);
+	if (rc != SQLITE_OK && !cur->stop) {
+		// First error: stop the other workers.
+		cur->rc = rc;
+		cur->errmsg = errmsg;
+		cur->stop = true;
+		errmsg = NULL;
+	}
+	cur->running--;
+	pthread_cond_broadcast(&cur->cond);
+	pthread_mutex_unlock(&cur->mu);
+	if (errmsg) {
+		sqlite3_free(errmsg);
+	}
+	return NULL;
+}
+
+// regexp_scan_stop stops and joins the workers and frees their resources.
+static void regexp_scan_stop(regexp_scan_cursor *cur) {
+	if (!cur->workers) {
+		return;
+	}
+	pthread_mutex_lock(&cur->mu);
+	cur->stop = true;
+	pthread_cond_broadcast(&cur->cond);
+	pthread_mutex_unlock(&cur->mu);
+
+	uint64_t matches = 0;
+	for (int i = 0; i < cur->nworkers; i++) {
+		scan_worker *w = &cur->workers[i];
+		if (w->started) {
+			sqlite3_interrupt(w->db); // abort the current chunk
+			pthread_join(w->thread, NULL);
+		}
+		matches += w->matches;
+		if (w->stmt) {
+			sqlite3_finalize(w->stmt);
+		}
+		if (w->db) {
+			sqlite3_close(w->db);
+		}
+		match_env_free(&w->env);
+		if (w->general_context) {
+			pcre2_general_context_free(w->general_context);
+		}
+	}
+	re_free(cur->workers);
+	cur->workers = NULL;
+	cur->nworkers = 0;
+	if (cur->ent) {
+		cur->ent->stats.matches += matches;
+		cur->ent->cache->stats.matches += matches;
+	}
+}
+
+static void regexp_scan_cursor_reset(regexp_scan_cursor *cur) {
+	regexp_scan_stop(cur);
+	if (cur->sync_init) {
+		pthread_mutex_destroy(&cur->mu);
+		pthread_cond_destroy(&cur->cond);
+		cur->sync_init = false;
+	}
+	if (cur->ent) {
+		cache_entry_release(cur->ent);
+		cur->ent = NULL;
+	}
+	if (cur->errmsg) {
+		sqlite3_free(cur->errmsg);
+		cur->errmsg = NULL;
+	}
+	if (cur->queue.ids) {
+		re_free(cur->queue.ids);
+	}
+	if (cur->batch.ids) {
+		re_free(cur->batch.ids);
+	}
+	memset(&cur->queue, 0, sizeof(scan_ids));
+	memset(&cur->batch, 0, sizeof(scan_ids));
+	cur->stop = false;
+	cur->exhausted = false;
+	cur->running = 0;
+	cur->rc = SQLITE_OK;
+	cur->pos = 0;
+	cur->eof = true;
+}
+
+static int regexp_scan_close(sqlite3_vtab_cursor *pCursor) {
+	regexp_scan_cursor *cur = (regexp_scan_cursor *)pCursor;
+	regexp_scan_cursor_reset(cur);
+	re_free(cur);
+	return SQLITE_OK;
+}
+
+static int regexp_scan_next(sqlite3_vtab_cursor *pCursor) {
+	regexp_scan_cursor *cur = (regexp_scan_cursor *)pCursor;
+	if (++cur->pos < cur->batch.n) {
+		return SQLITE_OK;
+	}
+	cur->pos = 0;
+	cur->batch.n = 0;
+
+	pthread_mutex_lock(&cur->mu);
+	while (cur->queue.n == 0 && cur->running > 0 && cur->rc == SQLITE_OK) {
+		pthread_cond_wait(&cur->cond, &cur->mu);
+	}
+	int rc = cur->rc;
+	char *errmsg = cur->errmsg;
+	cur->errmsg = NULL;
+	if (rc == SQLITE_OK) {
+		if (cur->queue.n == 0) {
+			cur->eof = true;
+		} else {
+			// Take the queued rowids and let the workers refill the queue.
+			scan_ids tmp = cur->batch;
+			cur->batch = cur->queue;
+			cur->queue = tmp;
+			pthread_cond_broadcast(&cur->cond);
+		}
+	}
+	pthread_mutex_unlock(&cur->mu);
+
+	if (rc != SQLITE_OK) {
+		if (errmsg) {
+			return set_vtab_error(pCursor->pVtab, errmsg);
+		}
+		return rc;
+	}
+	return SQLITE_OK;
+}
+
+// regexp_scan_worker_init opens the connection of the worker and allocates
+// its JIT stack and match data.
+static int regexp_scan_worker_init(regexp_scan_cursor *cur, scan_worker *w,
+                                   const char *filename, const char *sql) {
+	regexp_scan_vtab *vtab = (regexp_scan_vtab *)cur->base.pVtab;
+	cache_list *cache = vtab->cache;
+	w->cur = cur;
+	int rc = sqlite3_open_v2(filename, &w->db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+	                         NULL);
+	if (rc == SQLITE_OK) {
+		rc = sqlite3_prepare_v2(w->db, sql, -1, &w->stmt, NULL);
+	}
+	if (rc != SQLITE_OK) {
+		if (!w->db) {
+			return SQLITE_NOMEM;
+		}
+		return set_vtab_error(&vtab->base, sqlite3_mprintf("regexp_scan: %s",
+		                                                   sqlite3_errmsg(w->db)));
+	}
+	w->jit_stack_limit = cache->config.jit_stack_limit;
+	w->general_context = pcre2_general_context_create(re_pcre2_malloc, re_pcre2_free, NULL);
+	if (!w->general_context) {
+		return SQLITE_NOMEM;
+	}
+	return match_env_init(&w->env, w->general_context);
+}
+
+static int regexp_scan_filter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                              const char *idxStr, int argc, sqlite3_value **argv) {
+	(void)idxStr;
+	regexp_scan_cursor *cur = (regexp_scan_cursor *)pCursor;
+	regexp_scan_vtab *vtab = (regexp_scan_vtab *)pCursor->pVtab;
+	regexp_scan_cursor_reset(cur);
+
+	if ((idxNum & 7) != 7 || argc < 3) {
+		return SQLITE_OK; // missing arguments: no rows
+	}
+	const char *table = (const char *)sqlite3_value_text(argv[0]);
+	const char *column = (const char *)sqlite3_value_text(argv[1]);
+	if (!table || !column) {
+		return set_vtab_error(pCursor->pVtab,
+			sqlite3_mprintf("regexp_scan: table and column must not be NULL"));
+	}
+	if (sqlite3_value_type(argv[2]) == SQLITE_NULL) {
+		return set_vtab_error(pCursor->pVtab, sqlite3_mprintf("regexp: NULL pattern"));
+	}
+	const char *pattern = (const char *)sqlite3_value_text(argv[2]);
+	if (!pattern) {
+		return SQLITE_NOMEM;
+	}
+	uint32_t pattern_len = (uint32_t)sqlite3_value_bytes(argv[2]);
+
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	sqlite3_int64 threads = ncpu > 0 ? ncpu : 1;
+	if (idxNum & 8) {
+		threads = sqlite3_value_int64(argv[3]);
+		if (threads < 1) {
+			return set_vtab_error(pCursor->pVtab,
+				sqlite3_mprintf("regexp_scan: invalid number of threads: %lld", threads));
+		}
+	}
+	if (threads > SCAN_MAX_THREADS) {
+		threads = SCAN_MAX_THREADS;
+	}
+
+	if (!sqlite3_threadsafe()) {
+		return set_vtab_error(pCursor->pVtab,
+			sqlite3_mprintf("regexp_scan: SQLite was built without thread support"));
+	}
+	const char *filename = sqlite3_db_filename(vtab->db, "main");
+	if (!filename || filename[0] == '\0') {
+		return set_vtab_error(pCursor->pVtab,
+			sqlite3_mprintf("regexp_scan: the main database must be a file"));
+	}
+
+	// Find the range of rowids to scan.
+	char *sql = sqlite3_mprintf("SELECT min(rowid), max(rowid) FROM \"main\".\"%w\"", table);
+	if (!sql) {
+		return SQLITE_NOMEM;
+	}
+	sqlite3_stmt *stmt;
+	int rc = sqlite3_prepare_v2(vtab->db, sql, -1, &stmt, NULL);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		return set_vtab_error(pCursor->pVtab, sqlite3_mprintf("regexp_scan: %s",
+		                                                      sqlite3_errmsg(vtab->db)));
+	}
+	rc = sqlite3_step(stmt);
+	bool empty = rc != SQLITE_ROW || sqlite3_column_type(stmt, 0) == SQLITE_NULL;
+	cur->next = sqlite3_column_int64(stmt, 0);
+	cur->last = sqlite3_column_int64(stmt, 1);
+	sqlite3_finalize(stmt);
+	if (rc != SQLITE_ROW) {
+		return set_vtab_error(pCursor->pVtab, sqlite3_mprintf("regexp_scan: %s",
+		                                                      sqlite3_errmsg(vtab->db)));
+	}
+
+	char *errmsg;
+	cur->ent = cache_list_lookup(vtab->cache, pattern, pattern_len, false, &errmsg);
+	if (!cur->ent) {
+		return set_vtab_error(pCursor->pVtab, errmsg);
+	}
+	if (cache_entry_init_literal(cur->ent) != SQLITE_OK) {
+		return SQLITE_NOMEM;
+	}
+	if (empty) {
+		return SQLITE_OK;
+	}
+	// Use enough chunks that the workers finish at about the same time.
+	cur->chunk = ((uint64_t)cur->last - (uint64_t)cur->next) / ((uint64_t)threads * 16) + 1;
+	if (cur->chunk < SCAN_MIN_CHUNK) {
+		cur->chunk = SCAN_MIN_CHUNK;
+	}
+
+	if (pthread_mutex_init(&cur->mu, NULL) != 0) {
+		return SQLITE_NOMEM;
+	}
+	if (pthread_cond_init(&cur->cond, NULL) != 0) {
+		pthread_mutex_destroy(&cur->mu);
+		return SQLITE_NOMEM;
+	}
+	cur->sync_init = true;
+
+	cur->workers = re_malloc(sizeof(scan_worker) * (size_t)threads);
+	if (!cur->workers) {
+		return SQLITE_NOMEM;
+	}
+	memset(cur->workers, 0, sizeof(scan_worker) * (size_t)threads);
+	cur->nworkers = (int)threads;
+
+	// Qualify the column so that a missing column is not taken as a string.
+	sql = sqlite3_mprintf("SELECT rowid, \"%w\".\"%w\" FROM \"main\".\"%w\" "
+	                      "WHERE rowid BETWEEN ?1 AND ?2", table, column, table);
+	if (!sql) {
+		return SQLITE_NOMEM;
+	}
+	for (int i = 0; i < cur->nworkers; i++) {
+		rc = regexp_scan_worker_init(cur, &cur->workers[i], filename, sql);
+		if (rc != SQLITE_OK) {
+			re_free(sql);
+			return rc;
+		}
+	}
+	re_free(sql);
+
+	for (int i = 0; i < cur->nworkers; i++) {
+		scan_worker *w = &cur->workers[i];
+		pthread_mutex_lock(&cur->mu);
+		cur->running++;
+		pthread_mutex_unlock(&cur->mu);
+		if (pthread_create(&w->thread, NULL, regexp_scan_worker, w) != 0) {
+			pthread_mutex_lock(&cur->mu);
+			cur->running--;
+			pthread_mutex_unlock(&cur->mu);
+			return set_vtab_error(pCursor->pVtab,
+				sqlite3_mprintf("regexp_scan: failed to create thread"));
+		}
+		w->started = true;
+	}
+
+	cur->eof = false;
+	cur->pos = 0;
+	return regexp_scan_next(pCursor);
+}
+
+static int regexp_scan_eof(sqlite3_vtab_cursor *pCursor) {
+	return ((regexp_scan_cursor *)pCursor)->eof;
+}
+
+static int regexp_scan_column(sqlite3_vtab_cursor *pCursor,
+                              sqlite3_context *ctx, int i) {
+	regexp_scan_cursor *cur = (regexp_scan_cursor *)pCursor;
+	if (i == REGEXP_SCAN_ID) {
+		sqlite3_result_int64(ctx, cur->batch.ids[cur->pos]);
+	}
+	return SQLITE_OK;
+}
+
+static int regexp_scan_rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid) {
+	regexp_scan_cursor *cur = (regexp_scan_cursor *)pCursor;
+	*pRowid = cur->batch.ids[cur->pos];
+	return SQLITE_OK;
+}
+
+// regexp_scan_best_index requires that the table, column and pattern are
+// provided as equality constraints, threads is optional. idxNum is a bitmask
+// of the constraints present: 1 table, 2 column, 4 pattern and 8 threads.
+static int regexp_scan_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *info) {
+	(void)pVtab;
+	int idx[4] = {-1, -1, -1, -1};
+	int unusable = 0;
+	const struct sqlite3_index_constraint *c = info->aConstraint;
+	for (int i = 0; i < info->nConstraint; i++, c++) {
+		if (c->iColumn < REGEXP_SCAN_TABLE) {
+			continue;
+		}
+		int col = c->iColumn - REGEXP_SCAN_TABLE;
+		if (!c->usable) {
+			unusable |= 1 << col;
+		} else if (c->op == SQLITE_INDEX_CONSTRAINT_EQ) {
+			idx[col] = i;
+		}
+	}
+	if (idx[0] < 0 || idx[1] < 0 || idx[2] < 0) {
+		if (unusable) {
+			return SQLITE_CONSTRAINT;
+		}
+		info->idxNum = 0;
+		info->estimatedCost = 2147483647.0;
+		return SQLITE_OK;
+	}
+	int argc = 0;
+	info->idxNum = 0;
+	for (int i = 0; i < 4; i++) {
+		if (idx[i] >= 0) {
+			info->aConstraintUsage[idx[i]].argvIndex = ++argc;
+			info->aConstraintUsage[idx[i]].omit = 1;
+			info->idxNum |= 1 << i;
+		}
+	}
+	info->estimatedCost = 1000000.0;
+	return SQLITE_OK;
+}
+
+static sqlite3_module regexp_scan_module = {
+	.iVersion    = 0,
+	.xCreate     = NULL, // eponymous-only
+	.xConnect    = regexp_scan_connect,
+	.xBestIndex  = regexp_scan_best_index,
+	.xDisconnect = regexp_scan_disconnect,
+	.xDestroy    = NULL,
+	.xOpen       = regexp_scan_open,
+	.xClose      = regexp_scan_close,
+	.xFilter     = regexp_scan_filter,
+	.xNext       = regexp_scan_next,
+	.xEof        = regexp_scan_eof,
+	.xColumn     = regexp_scan_column,
+	.xRowid      = regexp_scan_rowid,
+};
+
+// regexp_grep
+//
+// regexp_grep(path, pattern) searches a file for the lines that match pattern
+// and returns their line number (starting at 1), byte offset and text:
+//
+//	SELECT line_number, line FROM regexp_grep('/var/log/app.log', 'ERROR \d+');
+//
+// The file is memory-mapped and only the matching lines are copied. If the
+// pattern has a required literal (see: cache_entry_init_literal) the mapped
+// file is searched for the literal and only the lines that contain it are
+// matched, otherwise every line is matched. Lines are matched without their
+// newline, so patterns never match across lines.
+//
+// Gzip files and zlib streams are decompressed on the fly into a sliding
+// window of GREP_WINDOW_SIZE bytes, which grows to hold lines that are longer
+// than the window, and offsets are those of the decompressed data. This
+// requires building with zlib (HAVE_ZLIB, see: make ZLIB=1). Since a zlib
+// header is only two bytes that text may start with (e.g. "x^"), a file with
+// one that does not inflate is searched as text.
+//
+// Since it reads files regexp_grep can only be used directly, not from
+// triggers or views.
+
+enum {
+	REGEXP_GREP_LINE_NUMBER,
+	REGEXP_GREP_OFFSET,
+	REGEXP_GREP_LINE,
+	REGEXP_GREP_PATH,    // hidden
+	REGEXP_GREP_PATTERN, // hidden
+};
+
+typedef struct {
+	sqlite3_vtab base;
+	cache_list   *cache;
+} regexp_grep_vtab;
+
+typedef struct {
+	sqlite3_vtab_cursor base;
+	cache_entry         *ent;
+	char                *path;
+	const char          *map; // the mapped file
+	size_t              map_len;
+#ifdef HAVE_ZLIB
+	z_stream            zs;
+	bool                zs_init;
+	size_t              in_off;  // bytes of map passed to zs
+	char                *window; // decompressed data
+	size_t              window_cap;
+#endif
+	const char          *data;   // map or window
+	size_t              len;     // bytes in data
+	bool                final;   // data holds the rest of the file
+	sqlite3_int64       data_off; // offset of data in the file
+	size_t              pos;     // start of the next line in data
+	sqlite3_int64       lineno;  // line number of the line at pos
+	size_t              line_start;
+	size_t              line_end;
+	sqlite3_int64       line_number;
+	bool                eof;
+	sqlite3_int64       rowid;
+} regexp_grep_cursor;
+
+static int regexp_grep_connect(sqlite3 *db, void *pAux, int argc,
+                               const char *const *argv,
+                               sqlite3_vtab **ppVtab, char **pzErr) {
+	(void)argc;
+	(void)argv;
+	(void)pzErr;
+
+	int rc = sqlite3_declare_vtab(db,
+		"CREATE TABLE x(line_number, offset, line, path HIDDEN, pattern HIDDEN)");
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	regexp_grep_vtab *vtab = re_malloc(sizeof(regexp_grep_vtab));
+	if (!vtab) {
+		return SQLITE_NOMEM;
+	}
+	memset(vtab, 0, sizeof(regexp_grep_vtab));
+	vtab->cache = (cache_list *)pAux;
+	sqlite3_vtab_config(db, SQLITE_VTAB_DIRECTONLY);
+	*ppVtab = &vtab->base;
+	return SQLITE_OK;
+}
+
+static int regexp_grep_disconnect(sqlite3_vtab *pVtab) {
+	re_free(pVtab);
+	return SQLITE_OK;
+}
+
+static int regexp_grep_open(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+	(void)pVtab;
+	regexp_grep_cursor *cur = re_malloc(sizeof(regexp_grep_cursor));
+	if (!cur) {
+		return SQLITE_NOMEM;
+	}
+	memset(cur, 0, sizeof(regexp_grep_cursor));
+	cur->eof = true;
+	*ppCursor = &cur->base;
+	return SQLITE_OK;
+}
+
+static void regexp_grep_cursor_reset(regexp_grep_cursor *cur) {
+	if (cur->ent) {
+		cache_entry_release(cur->ent);
+	}
+	if (cur->path) {
+		re_free(cur->path);
+	}
+	if (cur->map) {
+		munmap((void *)(uintptr_t)cur->map, cur->map_len);
+	}
+#ifdef HAVE_ZLIB
+	if (cur->zs_init) {
+		inflateEnd(&cur->zs);
+	}
+	if (cur->window) {
+		re_free(cur->window);
+	}
+#endif
+	memset(&cur->ent, 0, sizeof(regexp_grep_cursor) - offsetof(regexp_grep_cursor, ent));
+	cur->eof = true;
+}
+
+static int regexp_grep_close(sqlite3_vtab_cursor *pCursor) {
+	regexp_grep_cursor *cur = (regexp_grep_cursor *)pCursor;
+	regexp_grep_cursor_reset(cur);
+	re_free(cur);
+	return SQLITE_OK;
+}
+
+#ifdef HAVE_ZLIB
+
+#define GREP_WINDOW_SIZE (1024 * 1024) // initial window for compressed files
+
+// regexp_grep_inflate slides the window of a compressed file past the lines
+// that were searched and fills it with more decompressed data. The window is
+// doubled if it does not hold a complete line.
+static int regexp_grep_inflate(regexp_grep_cursor *cur) {
+	size_t keep = cur->len - cur->pos;
+	if (cur->pos > 0) {
+		memmove(cur->window, cur->window + cur->pos, keep);
+		cur->data_off += (sqlite3_int64)cur->pos;
+		cur->pos = 0;
+	}
+	cur->len = keep;
+	if (keep == cur->window_cap) {
+		char *p = sqlite3_realloc64(cur->window, 2 * cur->window_cap);
+		if (!p) {
+			return SQLITE_NOMEM;
+		}
+		cur->window = p;
+		cur->window_cap *= 2;
+	}
+	z_stream *zs = &cur->zs;
+	while (cur->len < cur->window_cap && !cur->final) {
+		if (zs->avail_in == 0) {
+			// zlib counts in 32 bits: pass the file in chunks.
+			size_t n = cur->map_len - cur->in_off;
+			zs->next_in = (Bytef *)(uintptr_t)&cur->map[cur->in_off];
+			zs->avail_in = n > UINT32_MAX ? UINT32_MAX : (uInt)n;
+			cur->in_off += zs->avail_in;
+		}
+		size_t avail = cur->window_cap - cur->len;
+		zs->next_out = (Bytef *)&cur->window[cur->len];
+		zs->avail_out = avail > UINT32_MAX ? UINT32_MAX : (uInt)avail;
+		size_t start = cur->len;
+		uInt before = zs->avail_out;
+		int zrc = inflate(zs, Z_NO_FLUSH);
+		cur->len += before - zs->avail_out;
+		bool at_end = zs->avail_in == 0 && cur->in_off == cur->map_len;
+		if (zrc == Z_STREAM_END) {
+			if (at_end) {
+				cur->final = true;
+			} else if (inflateReset(zs) != Z_OK) { // next gzip member
+				zrc = Z_DATA_ERROR;
+			}
+		}
+		if (zrc == Z_MEM_ERROR) {
+			return SQLITE_NOMEM;
+		}
+		if (zrc != Z_STREAM_END && at_end && zs->avail_out > 0) {
+			return set_vtab_error(cur->base.pVtab, sqlite3_mprintf(
+				"regexp_grep: %s: unexpected end of compressed data", cur->path));
+		}
+		if (zrc != Z_OK && zrc != Z_STREAM_END && zrc != Z_BUF_ERROR) {
+			return set_vtab_error(cur->base.pVtab, sqlite3_mprintf(
+				"regexp_grep: %s: %s", cur->path, zs->msg ? zs->msg : "invalid compressed data"));
+		}
+		// Stop once the new data has a complete line.
+		if (memchr(&cur->window[start], '\n', cur->len - start)) {
+			break;
+		}
+	}
+	cur->data = cur->window;
+	return SQLITE_OK;
+}
+
+// regexp_grep_start_inflate starts decompressing the mapped gzip file or zlib
+// stream and fills the first window. Since a zlib header is only two bytes
+// that text may start with (e.g. "x^"), SQLITE_NOTFOUND is returned if a
+// zlib stream does not inflate, in which case the file is searched as text.
+static int regexp_grep_start_inflate(regexp_grep_cursor *cur, bool gzip) {
+	cur->window = re_malloc(GREP_WINDOW_SIZE);
+	if (!cur->window) {
+		return SQLITE_NOMEM;
+	}
+	cur->window_cap = GREP_WINDOW_SIZE;
+	cur->zs.zalloc = re_zalloc;
+	cur->zs.zfree = re_zfree;
+	// Detect the gzip or zlib header.
+	if (inflateInit2(&cur->zs, 15 + 32) != Z_OK) {
+		return SQLITE_NOMEM;
+	}
+	cur->zs_init = true;
+	int rc = regexp_grep_inflate(cur);
+	if (rc == SQLITE_OK || rc == SQLITE_NOMEM || gzip) {
+		return rc;
+	}
+	sqlite3_vtab *vtab = cur->base.pVtab;
+	sqlite3_free(vtab->zErrMsg);
+	vtab->zErrMsg = NULL;
+	inflateEnd(&cur->zs);
+	cur->zs_init = false;
+	re_free(cur->window);
+	cur->window = NULL;
+	cur->window_cap = 0;
+	cur->in_off = 0;
+	cur->len = 0;
+	cur->pos = 0;
+	cur->data_off = 0;
+	cur->lineno = 0;
+	cur->final = false;
+	return SQLITE_NOTFOUND;
+}
+
+#endif // HAVE_ZLIB
+
+// regexp_grep_count_lines adds the number of newlines in data[from:to] to the
+// line number of the cursor.
+static void regexp_grep_count_lines(regexp_grep_cursor *cur, size_t from, size_t to) {
+	const char *p = cur->data + from;
+	const char *end = cur->data + to;
+	while (p < end && (p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+		cur->lineno++;
+		p++;
+	}
+}
+
+// regexp_grep_search searches the complete lines of data[pos:] for the next
+// match. It returns SQLITE_DONE if there is none and moves pos past them.
+static int regexp_grep_search(regexp_grep_cursor *cur) {
+	const char *data = cur->data;
+	size_t limit = cur->len;
+	if (!cur->final) {
+		// Only search complete lines.
+		while (limit > cur->pos && data[limit - 1] != '\n') {
+			limit--;
+		}
+	}
+	cache_entry *ent = cur->ent;
+	while (cur->pos < limit) {
+		size_t start = cur->pos;
+		if (ent->literal_len > 0) {
+			const char *p = cache_entry_find_literal(ent, data + start, limit - start);
+			if (!p) {
+				regexp_grep_count_lines(cur, start, limit);
+				cur->pos = limit;
+				break;
+			}
+			// Find the start of the line that contains the literal.
+			size_t i = (size_t)(p - data);
+			while (i > start && data[i - 1] != '\n') {
+				i--;
+			}
+			regexp_grep_count_lines(cur, start, i);
+			start = i;
+		}
+		const char *nl = memchr(data + start, '\n', limit - start);
+		size_t end = nl ? (size_t)(nl - data) : limit;
+		cur->pos = nl ? end + 1 : limit;
+		sqlite3_int64 lineno = cur->lineno++;
+		int rc = regexp_match(ent->cache, ent, data + start, end - start);
+		if (rc >= 0) {
+			cur->line_start = start;
+			cur->line_end = end;
+			cur->line_number = lineno + 1;
+			return SQLITE_OK;
+		}
+		if (rc != PCRE2_ERROR_NOMATCH) {
+			return set_vtab_error(cur->base.pVtab, format_pcre2_match_error(
+				rc, ent->pattern, ent->pattern_len, data + start, (uint32_t)(end - start)));
+		}
+	}
+	return SQLITE_DONE;
+}
+
+static int regexp_grep_next(sqlite3_vtab_cursor *pCursor) {
+	regexp_grep_cursor *cur = (regexp_grep_cursor *)pCursor;
+	cur->rowid++;
+	for (;;) {
+		int rc = regexp_grep_search(cur);
+		if (rc != SQLITE_DONE) {
+			return rc;
+		}
+		if (cur->final) {
+			cur->eof = true;
+			return SQLITE_OK;
+		}
+#ifdef HAVE_ZLIB
+		rc = regexp_grep_inflate(cur);
+		if (rc != SQLITE_OK) {
+			return rc;
+		}
+#endif
+	}
+}
+
+// regexp_grep_map maps the file of the cursor, which is left unmapped if it
+// is empty.
+static int regexp_grep_map(regexp_grep_cursor *cur) {
+	int fd = open(cur->path, O_RDONLY);
+	if (fd < 0) {
+		return set_vtab_error(cur->base.pVtab, sqlite3_mprintf(
+			"regexp_grep: cannot open '%s': %s", cur->path, strerror(errno)));
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return set_vtab_error(cur->base.pVtab, sqlite3_mprintf(
+			"regexp_grep: '%s' is not a regular file", cur->path));
+	}
+	if ((uint64_t)st.st_size > SIZE_MAX) {
+		close(fd);
+		return set_vtab_error(cur->base.pVtab, sqlite3_mprintf(
+			"regexp_grep: '%s' is too large", cur->path));
+	}
+	if (st.st_size > 0) {
+		void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			return set_vtab_error(cur->base.pVtab, sqlite3_mprintf(
+				"regexp_grep: cannot map '%s': %s", cur->path, strerror(errno)));
+		}
+		posix_madvise(p, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+		cur->map = p;
+		cur->map_len = (size_t)st.st_size;
+	}
+	close(fd);
+	return SQLITE_OK;
+}
+
+static int regexp_grep_filter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                              const char *idxStr, int argc, sqlite3_value **argv) {
+	(void)idxStr;
+	regexp_grep_cursor *cur = (regexp_grep_cursor *)pCursor;
+	regexp_grep_vtab *vtab = (regexp_grep_vtab *)pCursor->pVtab;
+	regexp_grep_cursor_reset(cur);
+
+	if (idxNum != 3 || argc != 2) {
+		return SQLITE_OK; // missing arguments: no rows
+	}
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+		return set_vtab_error(pCursor->pVtab, sqlite3_mprintf("regexp_grep: NULL path"));
+	}
+	if (sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+		return set_vtab_error(pCursor->pVtab, sqlite3_mprintf("regexp: NULL pattern"));
+	}
+	const char *path = (const char *)sqlite3_value_text(argv[0]);
+	const char *pattern = (const char *)sqlite3_value_text(argv[1]);
+	if (!path || !pattern) {
+		return SQLITE_NOMEM;
+	}
+	uint32_t pattern_len = (uint32_t)sqlite3_value_bytes(argv[1]);
+
+	char *errmsg;
+	cur->ent = cache_list_lookup(vtab->cache, pattern, pattern_len, false, &errmsg);
+	if (!cur->ent) {
+		return set_vtab_error(pCursor->pVtab, errmsg);
+	}
+	if (cache_entry_init_literal(cur->ent) != SQLITE_OK) {
+		return SQLITE_NOMEM;
+	}
+	cur->path = sqlite3_mprintf("%s", path);
+	if (!cur->path) {
+		return SQLITE_NOMEM;
+	}
+	int rc = regexp_grep_map(cur);
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+
+	bool gzip = is_gzip_header(cur->map, cur->map_len);
+	rc = SQLITE_NOTFOUND; // not compressed
+	if (gzip || is_zlib_header(cur->map, cur->map_len)) {
+#ifdef HAVE_ZLIB
+		rc = regexp_grep_start_inflate(cur, gzip);
+		if (rc != SQLITE_OK && rc != SQLITE_NOTFOUND) {
+			return rc;
+		}
+#else
+		if (gzip) {
+			return set_vtab_error(pCursor->pVtab, sqlite3_mprintf(
+				"regexp_grep: '%s' is compressed but zlib support was not built", cur->path));
+		}
+#endif
+	}
+	if (rc == SQLITE_NOTFOUND) {
+		cur->data = cur->map;
+		cur->len = cur->map_len;
+		cur->final = true;
+	}
+	cur->eof = false;
+	return regexp_grep_next(pCursor);
+}
+
+static int regexp_grep_eof(sqlite3_vtab_cursor *pCursor) {
+	return ((regexp_grep_cursor *)pCursor)->eof;
+}
+
+static int regexp_grep_column(sqlite3_vtab_cursor *pCursor,
+                              sqlite3_context *ctx, int i) {
+	regexp_grep_cursor *cur = (regexp_grep_cursor *)pCursor;
+	switch (i) {
+	case REGEXP_GREP_LINE_NUMBER:
+		sqlite3_result_int64(ctx, cur->line_number);
+		break;
+	case REGEXP_GREP_OFFSET:
+		sqlite3_result_int64(ctx, cur->data_off + (sqlite3_int64)cur->line_start);
+		break;
+	case REGEXP_GREP_LINE:
+		sqlite3_result_text64(ctx, cur->data + cur->line_start,
+		                      cur->line_end - cur->line_start, SQLITE_TRANSIENT,
+		                      SQLITE_UTF8);
+		break;
+	case REGEXP_GREP_PATH:
+		sqlite3_result_text(ctx, cur->path, -1, SQLITE_TRANSIENT);
+		break;
+	case REGEXP_GREP_PATTERN:
+		sqlite3_result_text(ctx, cur->ent->pattern, (int)cur->ent->pattern_len,
+		                    SQLITE_TRANSIENT);
+		break;
+	default:
+		break;
+	}
+	return SQLITE_OK;
+}
+
+static int regexp_grep_rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid) {
+	*pRowid = ((regexp_grep_cursor *)pCursor)->rowid;
+	return SQLITE_OK;
+}
+
+// regexp_grep_best_index requires that both the path and pattern are provided
+// as equality constraints (see: regexp_split_best_index).
+static int regexp_grep_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *info) {
+	(void)pVtab;
+	int idx[2] = {-1, -1};
+	int unusable = 0;
+	const struct sqlite3_index_constraint *c = info->aConstraint;
+	for (int i = 0; i < info->nConstraint; i++, c++) {
+		if (c->iColumn < REGEXP_GREP_PATH) {
+			continue;
+		}
+		int col = c->iColumn - REGEXP_GREP_PATH;
+		if (!c->usable) {
+			unusable |= 1 << col;
+		} else if (c->op == SQLITE_INDEX_CONSTRAINT_EQ) {
+			idx[col] = i;
+		}
+	}
+	if (idx[0] < 0 || idx[1] < 0) {
+		if (unusable) {
+			return SQLITE_CONSTRAINT;
+		}
+		info->idxNum = 0;
+		info->estimatedCost = 2147483647.0;
+		return SQLITE_OK;
+	}
+	for (int i = 0; i < 2; i++) {
+		info->aConstraintUsage[idx[i]].argvIndex = i + 1;
+		info->aConstraintUsage[idx[i]].omit = 1;
+	}
+	info->idxNum = 3;
+	info->estimatedCost = 1000000.0;
+	return SQLITE_OK;
+}
+
+static sqlite3_module regexp_grep_module = {
+	.iVersion    = 0,
+	.xCreate     = NULL, // eponymous-only
+	.xConnect    = regexp_grep_connect,
+	.xBestIndex  = regexp_grep_best_index,
+	.xDisconnect = regexp_grep_disconnect,
+	.xDestroy    = NULL,
+	.xOpen       = regexp_grep_open,
+	.xClose      = regexp_grep_close,
+	.xFilter     = regexp_grep_filter,
+	.xNext       = regexp_grep_next,
+	.xEof        = regexp_grep_eof,
+	.xColumn     = regexp_grep_column,
+	.xRowid      = regexp_grep_rowid,
+};
+
+#endif // _WIN32
+
+// regexp_any and regexp_which
+//
+// regexp_any(subject, pattern1, pattern2, ...) returns 1 if any of the
+// patterns match subject and regexp_which returns the index (starting at 1)
+// of the first pattern, in argument order, that matches or 0 if none do.
+//
+// The patterns are compiled once per statement. If every pattern has a
+// required literal (see: cache_entry_init_literal) the subject is searched
+// for the literals with memchr and only the patterns whose literal it
+// contains are run. Otherwise the patterns are combined into a single
+// alternation, which is cached like any other pattern and matched once:
+//
+//	(?:pattern1)(*:1)|(?:pattern2)(*:2)|...
+//
+// The mark of the match identifies the pattern that matched at the leftmost
+// position, but since an earlier pattern may still match further into the
+// subject regexp_which then checks the patterns before it individually.
+// Patterns whose meaning could change when wrapped in a group (back
+// references, subroutine calls, named groups, verbs, \Q...\E and extended
+// mode) are never combined.
+//
+// When the patterns are run individually regexp_any, which may stop at any
+// pattern that matches, runs them in the order of their measured hit rates
+// and reorders them every REGEXP_SET_REORDER calls, so that the patterns that
+// match most often are tried first.
+
+// Auxiliary data is only kept for the first 32 arguments of a function, the
+// patterns after that are compared to those of the set on every call.
+#define REGEXP_SET_MAX_AUX_ARG 31
+
+#define REGEXP_SET_REORDER 1024
+
+typedef struct {
+	int      index; // of the pattern in regexp_set.ents
+	uint32_t tries; // including subjects ruled out by the literal
+	uint32_t hits;
+} regexp_set_rank;
+
+typedef struct {
+	cache_list      *cache;
+	cache_entry     *all;   // combined patterns or NULL
+	regexp_set_rank *order; // regexp_any: order in which to try the patterns
+	uint32_t        calls;  // since the last reordering
+	int             n;      // number of patterns
+	cache_entry     *ents[] __counted_by(n);
+} regexp_set;
+
+static void regexp_set_free(regexp_set *set) {
+	if (set->all) {
+		cache_entry_release(set->all);
+	}
+	for (int i = 0; i < set->n; i++) {
+		if (set->ents[i]) {
+			cache_entry_release(set->ents[i]);
+		}
+	}
+	re_free(set);
+}
+
+static void regexp_set_aux_data_destroy(void *p) {
+	regexp_set_free((regexp_set *)p);
+}
+
+// regexp_set_combinable returns true if pattern means the same when it is
+// wrapped in a non-capturing group and alternated with other patterns. It is
+// conservative and may reject patterns that could be combined.
+static bool regexp_set_combinable(const char *p, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		if (p[i] == '\\') {
+			// Back references and \Q...\E, \K and \G.
+			if (i + 1 < len && p[i + 1] != '\0' && strchr("123456789gkKQEG", p[i + 1])) {
+				return false;
+			}
+			i++;
+			continue;
+		}
+		if (p[i] != '(' || i + 1 >= len) {
+			continue;
+		}
+		if (p[i + 1] == '*') {
+			return false; // verb
+		}
+		if (p[i + 1] != '?') {
+			continue;
+		}
+		size_t j = i + 2;
+		if (j >= len) {
+			return false;
+		}
+		switch (p[j]) {
+		case ':': // group
+		case '=': // lookahead
+		case '!':
+		case '>': // atomic group
+		case '#': // comment
+			continue;
+		case '<':
+			// Lookbehind, but not a named group.
+			if (j + 1 < len && (p[j + 1] == '=' || p[j + 1] == '!')) {
+				continue;
+			}
+			return false;
+		default:
+			break;
+		}
+		// Option settings other than extended mode.
+		while (j < len && p[j] != '\0' && strchr("imnsJU^-", p[j])) {
+			j++;
+		}
+		if (j >= len || (p[j] != ':' && p[j] != ')')) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// regexp_set_combine sets set->all to the alternation of the patterns of set.
+static int regexp_set_combine(regexp_set *set) {
+	size_t size = 1;
+	for (int i = 0; i < set->n; i++) {
+		size += set->ents[i]->pattern_len + 32; // "|(?:" ")(*:N)"
+	}
+	if (size > INT32_MAX) {
+		return SQLITE_OK;
+	}
+	char *buf = re_malloc(size);
+	if (!buf) {
+		return SQLITE_NOMEM;
+	}
+	size_t len = 0;
+	for (int i = 0; i < set->n; i++) {
+		const cache_entry *ent = set->ents[i];
+		if (i > 0) {
+			buf[len++] = '|';
+		}
+		memcpy(&buf[len], "(?:", 3);
+		len += 3;
+		memcpy(&buf[len], ent->pattern, ent->pattern_len);
+		len += ent->pattern_len;
+		sqlite3_snprintf((int)(size - len), &buf[len], ")(*:%d)", i + 1);
+		len += strlen(&buf[len]);
+	}
+	char *errmsg;
+	set->all = cache_list_lookup(set->cache, buf, (uint32_t)len, false, &errmsg);
+	re_free(buf);
+	if (!set->all) {
+		if (!errmsg) {
+			return SQLITE_NOMEM;
+		}
+		// The combined pattern is too large: match the patterns one at
+		// a time.
+		re_free(errmsg);
+	}
+	return SQLITE_OK;
+}
+
+// regexp_set_new compiles the patterns of a regexp_any or regexp_which call.
+// On error NULL is returned and *errmsg is set (NULL if out of memory).
+static regexp_set *regexp_set_new(cache_list *cache, const char *func, int n,
+                                  sqlite3_value **argv, char **errmsg) {
+	*errmsg = NULL;
+	size_t size = sizeof(regexp_set) + (size_t)n * (sizeof(cache_entry *) +
+	                                                sizeof(regexp_set_rank));
+	regexp_set *set = re_malloc(size);
+	if (!set) {
+		return NULL;
+	}
+	memset(set, 0, size);
+	set->cache = cache;
+	set->n = n;
+	set->order = (regexp_set_rank *)&set->ents[n];
+	for (int i = 0; i < n; i++) {
+		set->order[i].index = i;
+	}
+
+	bool literals = true;
+	bool combinable = true;
+	for (int i = 0; i < n; i++) {
+		if (sqlite3_value_type(argv[i]) == SQLITE_NULL) {
+			*errmsg = sqlite3_mprintf("%s: NULL pattern", func);
+			goto error;
+		}
+		const char *pattern = (const char *)sqlite3_value_text(argv[i]);
+		if (!pattern) {
+			goto error;
+		}
+		uint32_t len = (uint32_t)sqlite3_value_bytes(argv[i]);
+		set->ents[i] = cache_list_lookup(cache, pattern, len, false, errmsg);
+		if (!set->ents[i]) {
+			goto error;
+		}
+		if (cache_entry_init_literal(set->ents[i]) != SQLITE_OK) {
+			goto error;
+		}
+		literals = literals && set->ents[i]->literal_len != 0;
+		combinable = combinable && regexp_set_combinable(pattern, len);
+	}
+	if (!literals && combinable && n > 1) {
+		if (regexp_set_combine(set) != SQLITE_OK) {
+			goto error;
+		}
+	}
+	return set;
+
+error:
+	regexp_set_free(set);
+	return NULL;
+}
+
+// regexp_set_rank_compare orders patterns by decreasing hit rate, estimated
+// as (hits + 1) / (tries + 2) so that patterns that were rarely tried are not
+// ranked by chance, and then by argument order.
+static int regexp_set_rank_compare(const void *a, const void *b) {
+	const regexp_set_rank *x = a;
+	const regexp_set_rank *y = b;
+	uint64_t rx = ((uint64_t)x->hits + 1) * ((uint64_t)y->tries + 2);
+	uint64_t ry = ((uint64_t)y->hits + 1) * ((uint64_t)x->tries + 2);
+	if (rx != ry) {
+		return rx > ry ? -1 : 1;
+	}
+	return x->index - y->index;
+}
+
+// regexp_set_reorder sorts the patterns of set by their hit rates and halves
+// the counts so that the order follows changes in the subjects.
+static void regexp_set_reorder(regexp_set *set) {
+	qsort(set->order, (size_t)set->n, sizeof(regexp_set_rank), regexp_set_rank_compare);
+	for (int i = 0; i < set->n; i++) {
+		set->order[i].tries /= 2;
+		set->order[i].hits /= 2;
+	}
+	set->calls = 0;
+}
+
+// regexp_set_changed returns true if the patterns after REGEXP_SET_MAX_AUX_ARG
+// differ from those of set.
+static bool regexp_set_changed(const regexp_set *set, sqlite3_value **argv) {
+	for (int i = REGEXP_SET_MAX_AUX_ARG; i < set->n; i++) {
+		const cache_entry *ent = set->ents[i];
+		const char *pattern = (const char *)sqlite3_value_text(argv[i]);
+		if (!pattern || (uint32_t)sqlite3_value_bytes(argv[i]) != ent->pattern_len ||
+		    memcmp(pattern, ent->pattern, ent->pattern_len) != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// regexp_set_execute implements regexp_any (which == false) and regexp_which.
+static void regexp_set_execute(sqlite3_context *ctx, int argc, sqlite3_value **argv,
+                               bool which) {
+	const char *func = which ? "regexp_which" : "regexp_any";
+	if (argc < 2) {
+		char *err = sqlite3_mprintf("%s: expected a subject and at least one pattern", func);
+		set_result_error(ctx, err);
+		return;
+	}
+
+	regexp_set *set = sqlite3_get_auxdata(ctx, 1);
+	for (int i = 2; set && i < argc && i <= REGEXP_SET_MAX_AUX_ARG; i++) {
+		if (sqlite3_get_auxdata(ctx, i) != set) {
+			set = NULL; // a pattern changed
+		}
+	}
+	if (set && argc > REGEXP_SET_MAX_AUX_ARG + 1 && regexp_set_changed(set, &argv[1])) {
+		set = NULL;
+	}
+	if (set == NULL) {
+		cache_list *cache = sqlite3_user_data(ctx);
+		assert(cache);
+		char *errmsg;
+		set = regexp_set_new(cache, func, argc - 1, &argv[1], &errmsg);
+		if (!set) {
+			set_result_error(ctx, errmsg);
+			return;
+		}
+		sqlite3_set_auxdata(ctx, 1, set, regexp_set_aux_data_destroy);
+		// The set is freed immediately if the aux data could not be set.
+		if (sqlite3_get_auxdata(ctx, 1) != set) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+		// Mark the other patterns so that a change to any of them is
+		// detected.
+		for (int i = 2; i < argc && i <= REGEXP_SET_MAX_AUX_ARG; i++) {
+			sqlite3_set_auxdata(ctx, i, set, NULL);
+		}
+	}
+
+	bool nomem;
+	int len;
+	const char *subject = trgm_subject(argv[0], &len, &nomem);
+	if (!subject) {
+		if (nomem) {
+			sqlite3_result_error_nomem(ctx);
+		} else {
+			sqlite3_result_int(ctx, 0); // NULL values never match
+		}
+		return;
+	}
+
+	int found = 0;
+	int last = set->n; // patterns to check individually
+	cache_entry *ent = set->all;
+	int rc;
+	if (ent) {
+		rc = regexp_match(set->cache, ent, subject, (size_t)len);
+		if (rc >= 0) {
+			PCRE2_SPTR mark = pcre2_get_mark(set->cache->env.match_data);
+			found = mark ? atoi((const char *)mark) : 1;
+			last = which ? found - 1 : 0;
+		} else if (rc == PCRE2_ERROR_NOMATCH) {
+			last = 0;
+		} else {
+			goto match_error;
+		}
+	}
+	// regexp_which must check the patterns in argument order.
+	for (int k = 0; k < last; k++) {
+		regexp_set_rank *rank = which ? NULL : &set->order[k];
+		int i = rank ? rank->index : k;
+		ent = set->ents[i];
+		if (rank) {
+			rank->tries++;
+		}
+		if (!cache_entry_may_match(ent, subject, (size_t)len)) {
+			continue;
+		}
+		rc = regexp_match(set->cache, ent, subject, (size_t)len);
+		if (rc >= 0) {
+			found = i + 1;
+			if (rank) {
+				rank->hits++;
+			}
+			break;
+		}
+		if (rc != PCRE2_ERROR_NOMATCH) {
+			goto match_error;
+		}
+	}
+	if (!which && last > 1 && ++set->calls >= REGEXP_SET_REORDER) {
+		regexp_set_reorder(set);
+	}
+	sqlite3_result_int(ctx, which ? found : found != 0);
+	return;
+
+match_error:
+	set_result_error(ctx, format_pcre2_match_error(
+		rc, ent->pattern, ent->pattern_len, subject, (uint32_t)len));
+}
+
+static void regexp_any(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	regexp_set_execute(ctx, argc, argv, false);
+}
+
+static void regexp_which(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	regexp_set_execute(ctx, argc, argv, true);
+}
+
+// regexp_estimate(table, column, pattern [, sample_rows [, schema]])
+// estimates the selectivity of "column REGEXP pattern" and its cost per row
+// from a random sample of the rows of table (default ESTIMATE_SAMPLE_ROWS, or
+// if sample_rows is NULL) in schema (default "main") and returns them as a
+// JSON object:
+//
+//	SELECT regexp_estimate('logs', 'line', 'ERROR \d+');
+//	-- {"rows":100000,"sampled":1000,"matches":12,"selectivity":0.012,"cost_ns":215.4}
+//	SELECT regexp_estimate('logs', 'line', 'ERROR \d+', NULL, 'temp');
+//
+// The selectivity can be passed to likelihood() or used to order predicates.
+// The rowids are sampled with reservoir sampling in a single pass, which does
+// not read the column, and the sampled rows are then read by rowid and
+// matched with the cached pattern. The cost is the average match time of the
+// sampled rows, excluding the time to read them (NULLs count as 0).
+
+// estimate_rand returns the next value of a xorshift64* generator.
+static uint64_t estimate_rand(uint64_t *state) {
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+static int estimate_compare_rowid(const void *a, const void *b) {
+	sqlite3_int64 x = *(const sqlite3_int64 *)a;
+	sqlite3_int64 y = *(const sqlite3_int64 *)b;
+	return (x > y) - (x < y);
+}
+
+static void regexp_estimate(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	for (int i = 0; i < 3; i++) {
+		if (sqlite3_value_type(argv[i]) == SQLITE_NULL) {
+			sqlite3_result_error(ctx, "regexp_estimate: NULL argument", -1);
+			return;
+		}
+	}
+	sqlite3_int64 sample_rows = ESTIMATE_SAMPLE_ROWS;
+	if (argc > 3 && sqlite3_value_type(argv[3]) != SQLITE_NULL) {
+		sample_rows = sqlite3_value_int64(argv[3]);
+		if (sample_rows < 1 || sample_rows > ESTIMATE_MAX_SAMPLE_ROWS) {
+			set_result_error(ctx, sqlite3_mprintf(
+				"regexp_estimate: sample_rows must be between 1 and %d",
+				ESTIMATE_MAX_SAMPLE_ROWS));
+			return;
+		}
+	}
+	const char *table = (const char *)sqlite3_value_text(argv[0]);
+	const char *column = (const char *)sqlite3_value_text(argv[1]);
+	const char *pattern = (const char *)sqlite3_value_text(argv[2]);
+	if (!table || !column || !pattern) {
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+	uint32_t pattern_len = (uint32_t)sqlite3_value_bytes(argv[2]);
+	const char *schema = "main";
+	if (argc > 4) {
+		if (sqlite3_value_type(argv[4]) == SQLITE_NULL) {
+			sqlite3_result_error(ctx, "regexp_estimate: NULL argument", -1);
+			return;
+		}
+		schema = (const char *)sqlite3_value_text(argv[4]);
+		if (!schema) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+	}
+
+	sqlite3 *db = sqlite3_context_db_handle(ctx);
+	cache_list *cache = sqlite3_user_data(ctx);
+	sqlite3_stmt *stmt = NULL;
+	sqlite3_int64 *rowids = NULL;
+	cache_entry *ent = NULL;
+	char *errmsg = NULL;
+	int rc;
+
+	char *sql = sqlite3_mprintf("SELECT rowid FROM \"%w\".\"%w\"", schema, table);
+	if (!sql) {
+		goto nomem;
+	}
+	rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		goto sql_error;
+	}
+	rowids = re_malloc(sizeof(sqlite3_int64) * (size_t)sample_rows);
+	if (!rowids) {
+		goto nomem;
+	}
+	uint64_t seed;
+	sqlite3_randomness(sizeof(seed), &seed);
+	seed |= 1;
+	sqlite3_int64 nrows = 0;
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		sqlite3_int64 rowid = sqlite3_column_int64(stmt, 0);
+		if (nrows < sample_rows) {
+			rowids[nrows] = rowid;
+		} else {
+			uint64_t j = estimate_rand(&seed) % (uint64_t)(nrows + 1);
+			if (j < (uint64_t)sample_rows) {
+				rowids[j] = rowid;
+			}
+		}
+		nrows++;
+	}
+	if (rc != SQLITE_DONE) {
+		goto sql_error;
+	}
+	sqlite3_finalize(stmt);
+	stmt = NULL;
+	sqlite3_int64 nsampled = nrows < sample_rows ? nrows : sample_rows;
+	// Read the sampled rows in rowid order.
+	qsort(rowids, (size_t)nsampled, sizeof(sqlite3_int64), estimate_compare_rowid);
+
+	ent = cache_list_lookup(cache, pattern, pattern_len, false, &errmsg);
+	if (!ent) {
+		set_result_error(ctx, errmsg);
+		goto done;
+	}
+	// Qualify the column so that a missing column is not taken as a string.
+	sql = sqlite3_mprintf("SELECT \"%w\".\"%w\" FROM \"%w\".\"%w\" WHERE rowid = ?1",
+	                      table, column, schema, table);
+	if (!sql) {
+		goto nomem;
+	}
+	rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		goto sql_error;
+	}
+	sqlite3_int64 matches = 0;
+	uint64_t ticks = 0;
+	for (sqlite3_int64 i = 0; i < nsampled; i++) {
+		sqlite3_bind_int64(stmt, 1, rowids[i]);
+		rc = sqlite3_step(stmt);
+		if (rc == SQLITE_ROW) {
+			bool nomem;
+			int len;
+			const char *subject = trgm_subject(sqlite3_column_value(stmt, 0), &len, &nomem);
+			if (nomem) {
+				goto nomem;
+			}
+			if (subject) {
+				uint64_t start = re_ticks();
+				int mrc = regexp_match(cache, ent, subject, (size_t)len);
+				ticks += re_ticks() - start;
+				if (mrc >= 0) {
+					matches++;
+				} else if (mrc != PCRE2_ERROR_NOMATCH) {
+					set_result_error(ctx, format_pcre2_match_error(
+						mrc, pattern, pattern_len, subject, (uint32_t)len));
+					goto done;
+				}
+			}
+		} else if (rc != SQLITE_DONE) {
+			goto sql_error;
+		}
+		sqlite3_reset(stmt);
+	}
+
+	double selectivity = nsampled ? (double)matches / (double)nsampled : 0.0;
+	double cost = nsampled ? (double)re_clock_ns(&cache->clock, ticks) / (double)nsampled : 0.0;
+	char *json = sqlite3_mprintf("{\"rows\":%lld,\"sampled\":%lld,\"matches\":%lld,"
+	                             "\"selectivity\":%.6g,\"cost_ns\":%.1f}",
+	                             nrows, nsampled, matches, selectivity, cost);
+	if (!json) {
+		goto nomem;
+	}
+	sqlite3_result_text(ctx, json, -1, re_free);
+	goto done;
+
+nomem:
+	sqlite3_result_error_nomem(ctx);
+	goto done;
+sql_error:
+	set_result_error(ctx, sqlite3_mprintf("regexp_estimate: %s", sqlite3_errmsg(db)));
+done:
+	if (stmt) {
+		sqlite3_finalize(stmt);
+	}
+	if (ent) {
+		cache_entry_release(ent);
+	}
+	if (rowids) {
+		re_free(rowids);
+	}
+}
+
+// regexp_z(pattern, blob [, codec]) returns 1 if the compressed blob matches
+// pattern, like REGEXP on the decompressed blob, without decompressing all of
+// it. The codec is 'zlib' (the default, which also accepts gzip), 'gzip' or
+// 'deflate' (raw):
+//
+//	SELECT id FROM docs WHERE regexp_z('invoice #\d+', body);
+//
+// The blob is inflated into a window of REGEXP_Z_WINDOW bytes and every window
+// is matched with PCRE2_PARTIAL_HARD, which reports a match that could
+// continue in the next window as partial. The window then slides to the start
+// of the partial match and the rest is filled with more data, so matches that
+// cross windows are found and the window only grows if a partial match is
+// longer than it. Enough data before the start of the next match is kept for
+// lookbehinds. Decompression stops at the first match.
+
+#ifdef HAVE_ZLIB
+
+// regexp_z_jit_partial JIT compiles a private copy of the code of ent for
+// partial matching (in addition to complete matching) on first use, since
+// pcre2_jit_compile modifies the code that regexp_scan workers may be matching
+// with. If that fails partial matches use the interpreter, which only reads
+// the code. Returns SQLITE_NOMEM if the code could not be copied.
+static int regexp_z_jit_partial(cache_entry *ent) {
+	if (ent->jit_compiled && !ent->partial_code) {
+		ent->partial_code = pcre2_code_copy(ent->code);
+		if (!ent->partial_code) {
+			return SQLITE_NOMEM;
+		}
+		ent->jit_partial = pcre2_jit_compile(ent->partial_code, PCRE2_JIT_COMPLETE |
+		                                     PCRE2_JIT_PARTIAL_HARD) == 0;
+	}
+	return SQLITE_OK;
+}
+
+// regexp_z_match matches the window buf with options, which is like
+// regexp_match_env but allows partial matching.
+static int regexp_z_match(cache_entry *ent, const char *buf, size_t len,
+                          size_t offset, uint32_t options) {
+	match_env *env = &ent->cache->env;
+	if (!ent->jit_partial) {
+		return pcre2_match(ent->code, (PCRE2_SPTR)buf, len, offset,
+		                   options | PCRE2_NO_UTF_CHECK, env->match_data, env->context);
+	}
+	int rc;
+	do {
+		rc = pcre2_jit_match(ent->partial_code, (PCRE2_SPTR)buf, len, offset,
+		                     options | PCRE2_NO_UTF_CHECK, env->match_data, env->context);
+	} while (unlikely(rc == PCRE2_ERROR_JIT_STACKLIMIT) &&
+	         match_env_grow(env, ent->cache->config.jit_stack_limit));
+	return rc;
+}
+
+// regexp_z_char_start returns the start of the UTF-8 character that is cut
+// off at the end of buf[:len], or len if the last character is complete.
+static size_t regexp_z_char_start(const char *buf, size_t len) {
+	size_t i = len;
+	while (i > 0 && len - i < 3 && ((unsigned char)buf[i - 1] & 0xc0) == 0x80) {
+		i--;
+	}
+	if (i == 0) {
+		return len;
+	}
+	unsigned char lead = (unsigned char)buf[i - 1];
+	size_t n = lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : lead >= 0xc0 ? 2 : 1;
+	return i - 1 + n > len ? i - 1 : len;
+}
+
+// regexp_z_execute matches the blob compressed with windowBits wbits (see:
+// inflateInit2) and returns 1 if it matches, 0 if it does not or -1 if the
+// result of ctx was set to an error.
+static int regexp_z_execute(sqlite3_context *ctx, cache_entry *ent,
+                            const char *blob, size_t blob_len, int wbits) {
+	uint32_t lookbehind = 0;
+	pcre2_pattern_info(ent->code, PCRE2_INFO_MAXLOOKBEHIND, &lookbehind);
+	// Lookbehinds count characters of up to 4 bytes, \b and ^ need one and
+	// the start of a match is moved back by up to 3 to a character boundary.
+	size_t back = 4 * (size_t)lookbehind + 4;
+
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	zs.zalloc = re_zalloc;
+	zs.zfree = re_zfree;
+	if (inflateInit2(&zs, wbits) != Z_OK) {
+		sqlite3_result_error_nomem(ctx);
+		return -1;
+	}
+	size_t cap = REGEXP_Z_WINDOW;
+	char *buf = re_malloc(cap);
+	if (!buf) {
+		inflateEnd(&zs);
+		sqlite3_result_error_nomem(ctx);
+		return -1;
+	}
+
+	int ret = 0;
+	size_t in_off = 0;   // bytes of blob passed to zs
+	size_t len = 0;      // bytes in buf
+	size_t offset = 0;   // where to start matching in buf
+	bool final = false;  // buf holds the rest of the data
+	bool bol = true;     // buf starts at the start of the data
+	for (;;) {
+		while (len < cap && !final) {
+			if (zs.avail_in == 0 && in_off < blob_len) {
+				size_t n = blob_len - in_off;
+				zs.next_in = (Bytef *)(uintptr_t)&blob[in_off];
+				zs.avail_in = n > UINT32_MAX ? UINT32_MAX : (uInt)n;
+				in_off += zs.avail_in;
+			}
+			size_t avail = cap - len;
+			zs.next_out = (Bytef *)&buf[len];
+			zs.avail_out = avail > UINT32_MAX ? UINT32_MAX : (uInt)avail;
+			uInt before = zs.avail_out;
+			int zrc = inflate(&zs, Z_NO_FLUSH);
+			len += before - zs.avail_out;
+			if (zrc == Z_STREAM_END) {
+				// Concatenated gzip members (e.g. cat a.gz b.gz) are one
+				// stream, other data after the stream is ignored.
+				size_t used = in_off - zs.avail_in;
+				if (wbits > 15 && is_gzip_header(&blob[used], blob_len - used)) {
+					if (inflateReset(&zs) != Z_OK) {
+						set_result_error(ctx, sqlite3_mprintf("regexp_z: %s", zs.msg
+							? zs.msg : "invalid compressed data"));
+						ret = -1;
+						goto done;
+					}
+				} else {
+					final = true;
+				}
+			} else if (zrc == Z_MEM_ERROR) {
+				sqlite3_result_error_nomem(ctx);
+				ret = -1;
+				goto done;
+			} else if ((zrc != Z_OK && zrc != Z_BUF_ERROR) ||
+			           (zs.avail_in == 0 && in_off == blob_len && zs.avail_out > 0)) {
+				set_result_error(ctx, sqlite3_mprintf("regexp_z: %s", zs.msg
+					? zs.msg : "unexpected end of compressed data"));
+				ret = -1;
+				goto done;
+			}
+		}
+
+		uint32_t options = (final ? 0 : PCRE2_PARTIAL_HARD) | (bol ? 0 : PCRE2_NOTBOL);
+		int rc = regexp_z_match(ent, buf, len, offset, options);
+		if (rc >= 0) {
+			ret = 1;
+			goto done;
+		}
+		if (rc != PCRE2_ERROR_NOMATCH && rc != PCRE2_ERROR_PARTIAL) {
+			set_result_error(ctx, format_pcre2_match_error(
+				rc, ent->pattern, ent->pattern_len, buf, (uint32_t)(len > UINT32_MAX ? UINT32_MAX : len)));
+			ret = -1;
+			goto done;
+		}
+		if (final) {
+			break; // no match
+		}
+		// Resume at the start of the partial match or after the window.
+		size_t next = rc == PCRE2_ERROR_PARTIAL
+			? pcre2_get_ovector_pointer(ent->cache->env.match_data)[0]
+			: len;
+		size_t keep = next > back ? next - back : 0;
+		if (keep == 0 && len == cap) {
+			// The partial match fills the window.
+			char *p = sqlite3_realloc64(buf, 2 * cap);
+			if (!p) {
+				sqlite3_result_error_nomem(ctx);
+				ret = -1;
+				goto done;
+			}
+			buf = p;
+			cap *= 2;
+		}
+		memmove(buf, buf + keep, len - keep);
+		len -= keep;
+		offset = next - keep;
+		bol = bol && keep == 0;
+		if (rc == PCRE2_ERROR_NOMATCH) {
+			offset = regexp_z_char_start(buf, offset);
+		}
+	}
+
+done:
+	inflateEnd(&zs);
+	re_free(buf);
+	return ret;
+}
+
+static void regexp_z(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	int wbits = 15 + 32; // zlib or gzip
+	if (argc > 2 && sqlite3_value_type(argv[2]) != SQLITE_NULL) {
+		const char *codec = (const char *)sqlite3_value_text(argv[2]);
+		if (!codec) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+		if (sqlite3_stricmp(codec, "gzip") == 0) {
+			wbits = 15 + 16;
+		} else if (sqlite3_stricmp(codec, "deflate") == 0) {
+			wbits = -15;
+		} else if (sqlite3_stricmp(codec, "zlib") != 0) {
+			set_result_error(ctx, sqlite3_mprintf("regexp_z: unknown codec: '%s'", codec));
+			return;
+		}
+	}
+
+	// NULL values never match
+	if (sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+		sqlite3_result_int(ctx, 0);
+		return;
+	}
+	cache_entry *ent = sqlite3_get_auxdata(ctx, 0);
+	if (ent == NULL) {
+		if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+			sqlite3_result_error(ctx, "regexp_z: NULL pattern", -1);
+			return;
+		}
+		int pattern_len = sqlite3_value_bytes(argv[0]);
+		// Empty patterns match everything.
+		if (pattern_len <= 0) {
+			sqlite3_result_int(ctx, 1);
+			return;
+		}
+		const char *pattern = (const char *)sqlite3_value_text(argv[0]);
+		if (unlikely(pattern == NULL)) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+		cache_list *cache = sqlite3_user_data(ctx);
+		char *errmsg;
+		ent = cache_list_lookup(cache, pattern, pattern_len, false, &errmsg);
+		if (ent == NULL) {
+			set_result_error(ctx, errmsg);
+			return;
+		}
+		cache_aux_data_set(ctx, ent);
+		ent = sqlite3_get_auxdata(ctx, 0);
+		if (unlikely(ent == NULL)) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+	}
+	if (!ent->code) {
+		sqlite3_result_error(ctx, "regexp_z: " LITSET_ONLY_ERROR, -1);
+		return;
+	}
+	if (regexp_z_jit_partial(ent) != SQLITE_OK) {
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+
+	int blob_len = sqlite3_value_bytes(argv[1]);
+	const char *blob = sqlite3_value_blob(argv[1]);
+	if (unlikely(blob == NULL && blob_len > 0)) {
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+	ent->cache->stats.matches++;
+	ent->stats.matches++;
+	int rc = regexp_z_execute(ctx, ent, blob ? blob : "", (size_t)blob_len, wbits);
+	if (rc >= 0) {
+		sqlite3_result_int(ctx, rc);
+	}
+}
+
+#endif // HAVE_ZLIB
+
+// regexp_json_any(json, pattern [, path [, flags]]) returns 1 if any string
+// value of a JSON document matches pattern, which is like the following, but
+// walks the JSON text once without building a cursor:
+//
+//	EXISTS (SELECT 1 FROM json_each(json) WHERE type = 'text' AND value REGEXP pattern)
+//
+// Unlike json_each strings are matched at any depth. If path is given only the
+// strings of the value at path (e.g. '$.user.names' or '$.tags[0]') are
+// matched and the flag 'k' also matches the keys of objects:
+//
+//	SELECT * FROM events WHERE regexp_json_any(body, '^admin', '$', 'k');
+//
+// Strings without escapes are matched in place and the others are decoded
+// into a buffer first. The walk stops at the first match, so the rest of the
+// document is only validated if nothing matches, which is an error if the
+// document is not valid JSON (RFC 8259, except that control characters are
+// allowed in strings). BLOBs are JSONB to SQLite's JSON functions, which is
+// not supported: convert them with json() first.
+
+#define JSON_MAX_DEPTH 1000
+
+typedef enum {
+	JSON_WALK_NONE,      // no match
+	JSON_WALK_MATCH,
+	JSON_WALK_MALFORMED,
+	JSON_WALK_NOMEM,
+	JSON_WALK_ERROR,     // match error (see: json_walker.rc)
+} json_walk_result;
+
+typedef struct {
+	const char  *p;
+	const char  *end;
+	cache_entry *ent;
+	bool        keys;  // also match object keys
+	unsigned    depth;
+	char        *buf;  // decoded strings
+	size_t      cap;
+	char        *key;  // decoded key of the path
+	size_t      key_cap;
+	int         rc;    // pcre2 error of JSON_WALK_ERROR
+	const char  *subject;
+	size_t      subject_len;
+} json_walker;
+
+static void json_skip_ws(json_walker *w) {
+	while (w->p < w->end && (*w->p == ' ' || *w->p == '\t' || *w->p == '\n' ||
+	                         *w->p == '\r')) {
+		w->p++;
+	}
+}
+
+static inline int json_hex(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	c = (char)(c | 0x20);
+	return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+static int json_hex4(const char *p) {
+	int v = 0;
+	for (int i = 0; i < 4; i++) {
+		int h = json_hex(p[i]);
+		if (h < 0) {
+			return -1;
+		}
+		v = v << 4 | h;
+	}
+	return v;
+}
+
+static size_t json_put_utf8(char *out, uint32_t c) {
+	if (c < 0x80) {
+		out[0] = (char)c;
+		return 1;
+	}
+	if (c < 0x800) {
+		out[0] = (char)(0xc0 | c >> 6);
+		out[1] = (char)(0x80 | (c & 0x3f));
+		return 2;
+	}
+	if (c < 0x10000) {
+		out[0] = (char)(0xe0 | c >> 12);
+		out[1] = (char)(0x80 | (c >> 6 & 0x3f));
+		out[2] = (char)(0x80 | (c & 0x3f));
+		return 3;
+	}
+	out[0] = (char)(0xf0 | c >> 18);
+	out[1] = (char)(0x80 | (c >> 12 & 0x3f));
+	out[2] = (char)(0x80 | (c >> 6 & 0x3f));
+	out[3] = (char)(0x80 | (c & 0x3f));
+	return 4;
+}
+
+// json_decode_into decodes the escapes of the string s[:n] (without quotes)
+// into *buf, which has *cap bytes and is grown as needed.
+static json_walk_result json_decode_into(char **buf, size_t *cap, const char *s,
+                                         size_t n, const char **out, size_t *out_len) {
+	// Escapes never decode to more bytes than they take.
+	if (n > *cap) {
+		char *p = sqlite3_realloc64(*buf, n);
+		if (!p) {
+			return JSON_WALK_NOMEM;
+		}
+		*buf = p;
+		*cap = n;
+	}
+	char *dst = *buf;
+	size_t len = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (s[i] != '\\') {
+			dst[len++] = s[i];
+			continue;
+		}
+		if (++i >= n) {
+			return JSON_WALK_MALFORMED;
+		}
+		switch (s[i]) {
+		case '"':
+		case '\\':
+		case '/':
+			dst[len++] = s[i];
+			break;
+		case 'b':
+			dst[len++] = '\b';
+			break;
+		case 'f':
+			dst[len++] = '\f';
+			break;
+		case 'n':
+			dst[len++] = '\n';
+			break;
+		case 'r':
+			dst[len++] = '\r';
+			break;
+		case 't':
+			dst[len++] = '\t';
+			break;
+		case 'u': {
+			int c = i + 4 < n ? json_hex4(&s[i + 1]) : -1;
+			if (c < 0) {
+				return JSON_WALK_MALFORMED;
+			}
+			i += 4;
+			// Combine surrogate pairs.
+			if (c >= 0xd800 && c < 0xdc00 && i + 6 < n && s[i + 1] == '\\' &&
+			    s[i + 2] == 'u') {
+				int lo = json_hex4(&s[i + 3]);
+				if (lo >= 0xdc00 && lo < 0xe000) {
+					c = 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+					i += 6;
+				}
+			}
+			len += json_put_utf8(&dst[len], (uint32_t)c);
+			break;
+		}
+		default:
+			return JSON_WALK_MALFORMED;
+		}
+	}
+	*out = dst;
+	*out_len = len;
+	return JSON_WALK_NONE;
+}
+
+// json_decode decodes the escapes of a string of the document into the buffer
+// of w.
+static json_walk_result json_decode(json_walker *w, const char *s, size_t n,
+                                    const char **out, size_t *out_len) {
+	return json_decode_into(&w->buf, &w->cap, s, n, out, out_len);
+}
+
+// json_valid_escapes reports if the escapes of the string s[:n] (without
+// quotes) are valid, without decoding them.
+static bool json_valid_escapes(const char *s, size_t n) {
+	for (const char *p = memchr(s, '\\', n); p; ) {
+		size_t i = (size_t)(p - s) + 1;
+		if (i >= n) {
+			return false;
+		}
+		if (s[i] == 'u') {
+			if (i + 4 >= n || json_hex4(&s[i + 1]) < 0) {
+				return false;
+			}
+			i += 4;
+		} else if (!strchr("\"\\/bfnrt", s[i]) || s[i] == '\0') {
+			return false;
+		}
+		i++;
+		p = i < n ? memchr(&s[i], '\\', n - i) : NULL;
+	}
+	return true;
+}
+
+// json_string scans the string at w->p and stores it in *s and *n, decoded if
+// decode is set (otherwise escapes are left as is).
+static json_walk_result json_string(json_walker *w, bool decode, const char **s,
+                                    size_t *n) {
+	const char *start = ++w->p; // opening quote
+	for (;;) {
+		const char *q = memchr(w->p, '"', (size_t)(w->end - w->p));
+		if (!q) {
+			return JSON_WALK_MALFORMED;
+		}
+		// The quote is escaped if it follows an odd number of backslashes.
+		const char *b = q;
+		while (b > start && b[-1] == '\\') {
+			b--;
+		}
+		w->p = q + 1;
+		if ((q - b) % 2 == 0) {
+			break;
+		}
+	}
+	*s = start;
+	*n = (size_t)(w->p - 1 - start);
+	if (memchr(start, '\\', *n)) {
+		if (decode) {
+			return json_decode(w, start, *n, s, n);
+		}
+		if (!json_valid_escapes(start, *n)) {
+			return JSON_WALK_MALFORMED;
+		}
+	}
+	return JSON_WALK_NONE;
+}
+
+static inline bool json_digit(const json_walker *w, const char *p) {
+	return p < w->end && *p >= '0' && *p <= '9';
+}
+
+// json_number scans the number at w->p:
+//
+//	-?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+static json_walk_result json_number(json_walker *w) {
+	const char *p = w->p;
+	if (p < w->end && *p == '-') {
+		p++;
+	}
+	if (!json_digit(w, p)) {
+		return JSON_WALK_MALFORMED;
+	}
+	if (*p++ != '0') {
+		while (json_digit(w, p)) {
+			p++;
+		}
+	}
+	if (p < w->end && *p == '.') {
+		if (!json_digit(w, ++p)) {
+			return JSON_WALK_MALFORMED;
+		}
+		while (json_digit(w, p)) {
+			p++;
+		}
+	}
+	if (p < w->end && (*p == 'e' || *p == 'E')) {
+		p++;
+		if (p < w->end && (*p == '+' || *p == '-')) {
+			p++;
+		}
+		if (!json_digit(w, p)) {
+			return JSON_WALK_MALFORMED;
+		}
+		while (json_digit(w, p)) {
+			p++;
+		}
+	}
+	w->p = p;
+	return JSON_WALK_NONE;
+}
+
+// json_literal scans the literal word (true, false or null) at w->p.
+static json_walk_result json_literal(json_walker *w, const char *word) {
+	size_t n = strlen(word);
+	if ((size_t)(w->end - w->p) < n || memcmp(w->p, word, n) != 0) {
+		return JSON_WALK_MALFORMED;
+	}
+	w->p += n;
+	return JSON_WALK_NONE;
+}
+
+static json_walk_result json_match(json_walker *w, const char *s, size_t n) {
+	int rc = regexp_match(w->ent->cache, w->ent, s, n);
+	if (rc >= 0) {
+		return JSON_WALK_MATCH;
+	}
+	if (rc == PCRE2_ERROR_NOMATCH) {
+		return JSON_WALK_NONE;
+	}
+	w->rc = rc;
+	w->subject = s;
+	w->subject_len = n;
+	return JSON_WALK_ERROR;
+}
+
+// json_walk walks the value at w->p and matches its strings if match is set
+// or skips it.
+static json_walk_result json_walk(json_walker *w, bool match) {
+	json_skip_ws(w);
+	if (w->p >= w->end) {
+		return JSON_WALK_MALFORMED;
+	}
+	json_walk_result r;
+	const char *s;
+	size_t n;
+	char c = *w->p;
+	switch (c) {
+	case '"':
+		r = json_string(w, match, &s, &n);
+		if (r != JSON_WALK_NONE || !match) {
+			return r;
+		}
+		return json_match(w, s, n);
+	case '{':
+	case '[': {
+		if (++w->depth > JSON_MAX_DEPTH) {
+			return JSON_WALK_MALFORMED;
+		}
+		w->p++;
+		json_skip_ws(w);
+		char close = c == '{' ? '}' : ']';
+		if (w->p < w->end && *w->p == close) {
+			w->p++;
+			w->depth--;
+			return JSON_WALK_NONE;
+		}
+		for (;;) {
+			if (c == '{') {
+				json_skip_ws(w);
+				if (w->p >= w->end || *w->p != '"') {
+					return JSON_WALK_MALFORMED;
+				}
+				bool key = match && w->keys;
+				r = json_string(w, key, &s, &n);
+				if (r == JSON_WALK_NONE && key) {
+					r = json_match(w, s, n);
+				}
+				if (r != JSON_WALK_NONE) {
+					return r;
+				}
+				json_skip_ws(w);
+				if (w->p >= w->end || *w->p != ':') {
+					return JSON_WALK_MALFORMED;
+				}
+				w->p++;
+			}
+			r = json_walk(w, match);
+			if (r != JSON_WALK_NONE) {
+				return r;
+			}
+			json_skip_ws(w);
+			if (w->p < w->end && *w->p == ',') {
+				w->p++;
+				continue;
+			}
+			if (w->p < w->end && *w->p == close) {
+				w->p++;
+				w->depth--;
+				return JSON_WALK_NONE;
+			}
+			return JSON_WALK_MALFORMED;
+		}
+	}
+	case 't':
+		return json_literal(w, "true");
+	case 'f':
+		return json_literal(w, "false");
+	case 'n':
+		return json_literal(w, "null");
+	default:
+		return json_number(w);
+	}
+}
+
+// json_check_end validates the rest of the document after a walk that did
+// not match. If rescan is set only part of it was walked (see: json_find) and
+// it is walked again from start.
+static json_walk_result json_check_end(json_walker *w, const char *start, bool rescan) {
+	if (rescan) {
+		w->p = start;
+		w->depth = 0;
+		json_walk_result r = json_walk(w, false);
+		if (r != JSON_WALK_NONE) {
+			return r;
+		}
+	}
+	json_skip_ws(w);
+	return w->p == w->end ? JSON_WALK_NONE : JSON_WALK_MALFORMED;
+}
+
+// json_find moves w->p to the value at path, which follows the "$" of a JSON
+// path, and returns JSON_WALK_MATCH if it is found.
+static json_walk_result json_find(json_walker *w, const char *path, bool *bad_path) {
+	*bad_path = false;
+	while (*path) {
+		json_skip_ws(w);
+		if (w->p >= w->end) {
+			return JSON_WALK_MALFORMED;
+		}
+		if (*path == '[') {
+			char *endp;
+			long idx = strtol(path + 1, &endp, 10);
+			if (endp == path + 1 || *endp != ']' || idx < 0) {
+				*bad_path = true;
+				return JSON_WALK_NONE;
+			}
+			path = endp + 1;
+			if (*w->p != '[') {
+				return JSON_WALK_NONE;
+			}
+			w->p++;
+			json_skip_ws(w);
+			if (w->p < w->end && *w->p == ']') {
+				return JSON_WALK_NONE;
+			}
+			for (long i = 0; i < idx; i++) {
+				json_walk_result r = json_walk(w, false);
+				if (r != JSON_WALK_NONE) {
+					return r;
+				}
+				json_skip_ws(w);
+				if (w->p >= w->end || *w->p != ',') {
+					return w->p < w->end && *w->p == ']' ? JSON_WALK_NONE
+					                                     : JSON_WALK_MALFORMED;
+				}
+				w->p++;
+			}
+			continue;
+		}
+		if (*path != '.') {
+			*bad_path = true;
+			return JSON_WALK_NONE;
+		}
+		path++;
+		const char *key = path;
+		size_t key_len;
+		if (*path == '"') {
+			// Quoted keys may have escapes, like the keys of the document.
+			const char *q = path + 1;
+			while (*q && *q != '"') {
+				q += q[0] == '\\' && q[1] ? 2 : 1;
+			}
+			if (!*q) {
+				*bad_path = true;
+				return JSON_WALK_NONE;
+			}
+			key = path + 1;
+			key_len = (size_t)(q - key);
+			path = q + 1;
+			if (memchr(key, '\\', key_len)) {
+				json_walk_result r = json_decode_into(&w->key, &w->key_cap, key, key_len,
+				                                      &key, &key_len);
+				if (r == JSON_WALK_MALFORMED) {
+					*bad_path = true;
+					return JSON_WALK_NONE;
+				}
+				if (r != JSON_WALK_NONE) {
+					return r;
+				}
+			}
+		} else {
+			key_len = strcspn(path, ".[");
+			path += key_len;
+		}
+		if (key_len == 0) {
+			*bad_path = true;
+			return JSON_WALK_NONE;
+		}
+		if (*w->p != '{') {
+			return JSON_WALK_NONE;
+		}
+		w->p++;
+		for (;;) {
+			json_skip_ws(w);
+			if (w->p < w->end && *w->p == '}') {
+				return JSON_WALK_NONE;
+			}
+			if (w->p >= w->end || *w->p != '"') {
+				return JSON_WALK_MALFORMED;
+			}
+			const char *s;
+			size_t n;
+			json_walk_result r = json_string(w, true, &s, &n);
+			if (r != JSON_WALK_NONE) {
+				return r;
+			}
+			bool found = n == key_len && memcmp(s, key, n) == 0;
+			json_skip_ws(w);
+			if (w->p >= w->end || *w->p != ':') {
+				return JSON_WALK_MALFORMED;
+			}
+			w->p++;
+			if (found) {
+				break;
+			}
+			r = json_walk(w, false);
+			if (r != JSON_WALK_NONE) {
+				return r;
+			}
+			json_skip_ws(w);
+			if (w->p < w->end && *w->p == ',') {
+				w->p++;
+			} else if (w->p >= w->end || *w->p != '}') {
+				return JSON_WALK_MALFORMED;
+			}
+		}
+	}
+	return JSON_WALK_MATCH;
+}
+
+static void regexp_json_any(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	// NULL values never match
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+		sqlite3_result_int(ctx, 0);
+		return;
+	}
+	if (sqlite3_value_type(argv[0]) == SQLITE_BLOB) {
+		sqlite3_result_error(ctx, "regexp_json_any: JSONB is not supported, "
+		                     "convert it to text with json()", -1);
+		return;
+	}
+	const char *path = "$";
+	bool keys = false;
+	if (argc > 2 && sqlite3_value_type(argv[2]) != SQLITE_NULL) {
+		path = (const char *)sqlite3_value_text(argv[2]);
+		if (!path) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+	}
+	if (argc > 3 && sqlite3_value_type(argv[3]) != SQLITE_NULL) {
+		const char *flags = (const char *)sqlite3_value_text(argv[3]);
+		if (!flags) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+		for (const char *p = flags; *p; p++) {
+			if (*p == 'k') {
+				keys = true;
+			} else {
+				set_result_error(ctx, sqlite3_mprintf(
+					"regexp_json_any: invalid flag: '%c'", *p));
+				return;
+			}
+		}
+	}
+	if (path[0] != '$') {
+		set_result_error(ctx, sqlite3_mprintf("regexp_json_any: bad JSON path: '%s'", path));
+		return;
+	}
+
+	cache_entry *ent = sqlite3_get_auxdata(ctx, 1);
+	if (ent == NULL) {
+		if (sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+			sqlite3_result_error(ctx, "regexp_json_any: NULL pattern", -1);
+			return;
+		}
+		const char *pattern = (const char *)sqlite3_value_text(argv[1]);
+		if (unlikely(pattern == NULL)) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+		uint32_t pattern_len = (uint32_t)sqlite3_value_bytes(argv[1]);
+		cache_list *cache = sqlite3_user_data(ctx);
+		char *errmsg;
+		ent = cache_list_lookup(cache, pattern, pattern_len, false, &errmsg);
+		if (ent == NULL) {
+			set_result_error(ctx, errmsg);
+			return;
+		}
+		sqlite3_set_auxdata(ctx, 1, ent, cache_aux_data_destroy);
+		ent = sqlite3_get_auxdata(ctx, 1);
+		if (unlikely(ent == NULL)) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+	}
+
+	const char *json = (const char *)sqlite3_value_text(argv[0]);
+	if (!json) {
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+	json_walker w = {
+		.p   = json,
+		.end = json + sqlite3_value_bytes(argv[0]),
+		.ent = ent,
+		.keys = keys,
+	};
+	bool bad_path;
+	json_walk_result r = json_find(&w, path + 1, &bad_path);
+	if (bad_path) {
+		set_result_error(ctx, sqlite3_mprintf("regexp_json_any: bad JSON path: '%s'", path));
+		goto done;
+	}
+	if (r == JSON_WALK_MATCH) {
+		r = json_walk(&w, true);
+		if (r == JSON_WALK_NONE) {
+			r = json_check_end(&w, json, path[1] != '\0');
+		}
+	} else if (r == JSON_WALK_NONE) {
+		r = json_check_end(&w, json, true); // path not found
+	}
+	switch (r) {
+	case JSON_WALK_NONE:
+	case JSON_WALK_MATCH:
+		sqlite3_result_int(ctx, r == JSON_WALK_MATCH);
+		break;
+	case JSON_WALK_MALFORMED:
+		sqlite3_result_error(ctx, "regexp_json_any: malformed JSON", -1);
+		break;
+	case JSON_WALK_NOMEM:
+		sqlite3_result_error_nomem(ctx);
+		break;
+	case JSON_WALK_ERROR:
+		set_result_error(ctx, format_pcre2_match_error(w.rc, ent->pattern, ent->pattern_len,
+		                                               w.subject, (uint32_t)w.subject_len));
+		break;
+	}
+done:
+	if (w.buf) {
+		re_free(w.buf);
+	}
+	if (w.key) {
+		re_free(w.key);
+	}
+}
+
+// regexp_ruleset
+//
+// regexp_ruleset is a virtual table that matches a subject against every
+// pattern of a rules table and returns the rules that match:
+//
+//	CREATE TABLE rules(pattern TEXT, action TEXT);
+//	CREATE VIRTUAL TABLE rules_rx USING regexp_ruleset(rules, pattern);
+//	SELECT rowid FROM rules_rx('GET /index.html');
+//
+// This is the same as the following query, which compiles every pattern for
+// every subject once there are more rules than fit in the cache (CACHE_SIZE):
+//
+//	SELECT rowid FROM rules WHERE 'GET /index.html' REGEXP pattern;
+//
+// The rules are compiled once and kept by the table (not in the cache). The
+// required literals of the rules (see: cache_entry_init_literal) are indexed
+// by their rarest bigram so that a single pass over the subject finds the
+// rules whose literal it contains, and only those rules and the rules without
+// a literal are run. Rules are returned in rowid order and NULL patterns never
+// match.
+//
+// The rules are reloaded when the database changes (SQLITE_FCNTL_DATA_VERSION)
+// or the connection writes to any table, which reuses the compiled rules whose
+// pattern did not change. Rules that were changed inside a transaction and
+// then undone with ROLLBACK TO are only reloaded when the transaction ends.
+
+enum {
+	RULESET_COL_PATTERN,
+	RULESET_COL_SUBJECT, // hidden
+};
+
+#define RULESET_SINGLE 65536          // first key of 1-byte literals
+#define RULESET_KEYS   (65536 + 256)  // bigrams and 1-byte literals
+
+// ruleset_ref is a rule whose literal is indexed by a key.
+typedef struct {
+	uint32_t rule; // index of the rule
+	uint32_t off;  // offset of the key in the literal
+} ruleset_ref;
+
+// ruleset is the compiled rules table. It is shared by the table and its
+// cursors and rules whose pattern did not change are shared by successive
+// rulesets (the ref_count of a rule's entry is the number of rulesets).
+typedef struct {
+	uint32_t      refs;
+	uint32_t      n;
+	uint32_t      cap;
+	sqlite3_int64 *ids;  // rowids of the rules in ascending order
+	cache_entry   **ents;
+	uint64_t      *always; // bitmap of the rules without a literal
+	uint32_t      *heads;  // refs of key k are by_key[heads[k]:heads[k+1]]
+	ruleset_ref   *by_key;
+	uint64_t      keys[RULESET_KEYS / 64]; // keys that have refs
+} ruleset;
+
+typedef struct {
+	sqlite3_vtab  base;
+	sqlite3       *db;
+	cache_list    *cache;
+	char          *schema; // database of the table
+	char          *source; // rules table
+	char          *column; // pattern column of the rules table
+	sqlite3_stmt  *load_stmt;
+	ruleset       *set; // NULL until the rules are loaded
+	unsigned int  data_version;
+	sqlite3_int64 total_changes;
+	bool          txn_load; // loaded inside a write transaction
+} ruleset_vtab;
+
+typedef struct {
+	sqlite3_vtab_cursor base;
+	ruleset             *set;
+	sqlite3_value       *subject_val; // copy of the subject
+	const char          *subject;
+	size_t              subject_len;
+	uint64_t            *candidates; // bitmap of the rules that may match
+	uint32_t            cap;         // words allocated for candidates
+	uint32_t            rule;        // current rule
+	bool                eof;
+} ruleset_cursor;
+
+static void ruleset_release(ruleset *set) {
+	if (!set || --set->refs > 0) {
+		return;
+	}
+	for (uint32_t i = 0; i < set->n; i++) {
+		if (--set->ents[i]->ref_count == 0) {
+			cache_entry_free(set->ents[i]);
+			re_free(set->ents[i]);
+		}
+	}
+	re_free(set->ids);
+	re_free(set->ents);
+	re_free(set->always);
+	re_free(set->heads);
+	re_free(set->by_key);
+	re_free(set);
+}
+
+static int ruleset_push(ruleset *set, sqlite3_int64 id, cache_entry *ent) {
+	if (set->n == set->cap) {
+		uint32_t cap = set->cap ? 2 * set->cap : 64;
+		sqlite3_int64 *ids = sqlite3_realloc64(set->ids, sizeof(sqlite3_int64) * cap);
+		if (!ids) {
+			return SQLITE_NOMEM;
+		}
+		set->ids = ids;
+		cache_entry **ents = sqlite3_realloc64(set->ents, sizeof(cache_entry *) * cap);
+		if (!ents) {
+			return SQLITE_NOMEM;
+		}
+		set->ents = ents;
+		set->cap = cap;
+	}
+	set->ids[set->n] = id;
+	set->ents[set->n] = ent;
+	set->n++;
+	return SQLITE_OK;
+}
+
+// ruleset_key returns the key that indexes the literal of ent, which is its
+// rarest bigram (see: byte_rank), and stores its offset in *off.
+static uint32_t ruleset_key(const cache_entry *ent, uint32_t *off) {
+	const unsigned char *lit = (const unsigned char *)ent->literal;
+	*off = 0;
+	if (ent->literal_len == 1) {
+		return RULESET_SINGLE + lit[0];
+	}
+	int best = 0;
+	for (uint32_t i = 0; i + 1 < ent->literal_len; i++) {
+		int rank = byte_rank(lit[i]) + byte_rank(lit[i+1]);
+		if (i == 0 || rank < best) {
+			best = rank;
+			*off = i;
+		}
+	}
+	return ((uint32_t)lit[*off] << 8) | lit[*off + 1];
+}
+
+// ruleset_index builds the literal index of set.
+static int ruleset_index(ruleset *set) {
+	size_t words = (set->n + 63) / 64;
+	set->always = re_malloc(sizeof(uint64_t) * (words + 1));
+	set->heads = re_malloc(sizeof(uint32_t) * (RULESET_KEYS + 1));
+	set->by_key = re_malloc(sizeof(ruleset_ref) * ((size_t)set->n + 1));
+	if (!set->always || !set->heads || !set->by_key) {
+		return SQLITE_NOMEM;
+	}
+	memset(set->always, 0, sizeof(uint64_t) * (words + 1));
+	memset(set->heads, 0, sizeof(uint32_t) * (RULESET_KEYS + 1));
+	memset(set->keys, 0, sizeof(set->keys));
+	for (uint32_t i = 0; i < set->n; i++) {
+		if (set->ents[i]->literal_len == 0) {
+			set->always[i / 64] |= UINT64_C(1) << (i % 64);
+			continue;
+		}
+		uint32_t off;
+		uint32_t key = ruleset_key(set->ents[i], &off);
+		set->heads[key + 1]++;
+		set->keys[key / 64] |= UINT64_C(1) << (key % 64);
+	}
+	for (uint32_t k = 0; k < RULESET_KEYS; k++) {
+		set->heads[k + 1] += set->heads[k];
+	}
+	// Fill the refs in rule order using heads[k] as the insert position of
+	// key k, which leaves heads[k] at the start of key k + 1.
+	for (uint32_t i = 0; i < set->n; i++) {
+		if (set->ents[i]->literal_len == 0) {
+			continue;
+		}
+		uint32_t off;
+		uint32_t key = ruleset_key(set->ents[i], &off);
+		set->by_key[set->heads[key]++] = (ruleset_ref){ .rule = i, .off = off };
+	}
+	memmove(set->heads + 1, set->heads, sizeof(uint32_t) * RULESET_KEYS);
+	set->heads[0] = 0;
+	return SQLITE_OK;
+}
+
+// ruleset_check marks the rules indexed by key whose literal occurs in
+// subject s at the position of the key at offset i.
+static inline void ruleset_check(const ruleset *set, uint32_t key, const char *s,
+                                 size_t n, size_t i, uint64_t *out) {
+	for (uint32_t j = set->heads[key]; j < set->heads[key + 1]; j++) {
+		const ruleset_ref *r = &set->by_key[j];
+		uint64_t bit = UINT64_C(1) << (r->rule % 64);
+		if (out[r->rule / 64] & bit) {
+			continue;
+		}
+		const cache_entry *ent = set->ents[r->rule];
+		if (i < r->off || n - (i - r->off) < ent->literal_len) {
+			continue;
+		}
+		if (memcmp(s + i - r->off, ent->literal, ent->literal_len) == 0) {
+			out[r->rule / 64] |= bit;
+		}
+	}
+}
+
+// ruleset_candidates sets the bits of out of the rules that may match
+// subject s: the rules without a literal and the rules whose literal it
+// contains.
+static void ruleset_candidates(const ruleset *set, const char *s, size_t n,
+                               uint64_t *out) {
+	memcpy(out, set->always, sizeof(uint64_t) * ((set->n + 63) / 64));
+	const unsigned char *u = (const unsigned char *)s;
+	for (size_t i = 0; i < n; i++) {
+		uint32_t key = RULESET_SINGLE + u[i];
+		if (unlikely(set->keys[key / 64] & (UINT64_C(1) << (key % 64)))) {
+			ruleset_check(set, key, s, n, i, out);
+		}
+		if (i + 1 < n) {
+			key = ((uint32_t)u[i] << 8) | u[i+1];
+			if (unlikely(set->keys[key / 64] & (UINT64_C(1) << (key % 64)))) {
+				ruleset_check(set, key, s, n, i, out);
+			}
+		}
+	}
+}
+
+// ruleset_load loads the rules table if it changed since it was last loaded.
+static int ruleset_load(ruleset_vtab *vtab) {
+	unsigned int data_version = 0;
+	sqlite3_file_control(vtab->db, vtab->schema, SQLITE_FCNTL_DATA_VERSION,
+	                     &data_version);
+	sqlite3_int64 total_changes = sqlite3_total_changes64(vtab->db);
+	bool txn = sqlite3_txn_state(vtab->db, vtab->schema) == SQLITE_TXN_WRITE;
+	// Changes of this connection only change the data version once they are
+	// committed and a rollback changes neither.
+	if (vtab->set && vtab->data_version == data_version &&
+	    vtab->total_changes == total_changes && (txn || !vtab->txn_load)) {
+		return SQLITE_OK;
+	}
+
+	if (!vtab->load_stmt) {
+		char *sql = sqlite3_mprintf(
+			"SELECT rowid, \"%w\".\"%w\" FROM \"%w\".\"%w\" ORDER BY rowid",
+			vtab->source, vtab->column, vtab->schema, vtab->source);
+		if (!sql) {
+			return SQLITE_NOMEM;
+		}
+		int rc = sqlite3_prepare_v3(vtab->db, sql, -1, SQLITE_PREPARE_PERSISTENT,
+		                            &vtab->load_stmt, NULL);
+		re_free(sql);
+		if (rc != SQLITE_OK) {
+			return set_vtab_error(&vtab->base, sqlite3_mprintf(
+				"regexp_ruleset: %s", sqlite3_errmsg(vtab->db)));
+		}
+	}
+
+	ruleset *set = re_malloc(sizeof(ruleset));
+	if (!set) {
+		return SQLITE_NOMEM;
+	}
+	memset(set, 0, sizeof(ruleset));
+	set->refs = 1;
+
+	// Reuse the entries of the rules whose pattern did not change.
+	const ruleset *old = vtab->set;
+	bool same = old != NULL;
+	uint32_t j = 0;
+	int rc;
+	while ((rc = sqlite3_step(vtab->load_stmt)) == SQLITE_ROW) {
+		if (sqlite3_column_type(vtab->load_stmt, 1) == SQLITE_NULL) {
+			continue;
+		}
+		sqlite3_int64 id = sqlite3_column_int64(vtab->load_stmt, 0);
+		const char *pattern = (const char *)sqlite3_column_text(vtab->load_stmt, 1);
+		if (!pattern) {
+			rc = SQLITE_NOMEM;
+			goto done;
+		}
+		uint32_t pattern_len = (uint32_t)sqlite3_column_bytes(vtab->load_stmt, 1);
+		for (; old && j < old->n && old->ids[j] < id; j++) {
+			same = false; // deleted rule
+		}
+		cache_entry *ent;
+		if (old && j < old->n && old->ids[j] == id &&
+		    cache_entry_match(old->ents[j], pattern, pattern_len)) {
+			ent = old->ents[j++];
+		} else {
+			same = false;
+			char *errmsg;
+			ent = regexp_compile(vtab->cache, pattern, pattern_len, false, &errmsg);
+			if (!ent) {
+				rc = set_vtab_error(&vtab->base, errmsg
+					? sqlite3_mprintf("regexp_ruleset: rule %lld: %s", id, errmsg)
+					: NULL);
+				re_free(errmsg);
+				goto done;
+			}
+			if (cache_entry_init_literal(ent) != SQLITE_OK) {
+				cache_entry_free(ent);
+				re_free(ent);
+				rc = SQLITE_NOMEM;
+				goto done;
+			}
+		}
+		if (ruleset_push(set, id, ent) != SQLITE_OK) {
+			if (ent->ref_count == 0) {
+				cache_entry_free(ent);
+				re_free(ent);
+			}
+			rc = SQLITE_NOMEM;
+			goto done;
+		}
+		ent->ref_count++;
+	}
+	if (rc != SQLITE_DONE) {
+		rc = set_vtab_error(&vtab->base, sqlite3_mprintf(
+			"regexp_ruleset: %s", sqlite3_errmsg(vtab->db)));
+		goto done;
+	}
+	rc = SQLITE_OK;
+	if (!(same && j == old->n)) {
+		rc = ruleset_index(set);
+		if (rc == SQLITE_OK) {
+			ruleset_release(vtab->set);
+			vtab->set = set;
+			set = NULL;
+		}
+	}
+	if (rc == SQLITE_OK) {
+		vtab->data_version = data_version;
+		vtab->total_changes = total_changes;
+		vtab->txn_load = txn;
+	}
+
+done:
+	sqlite3_reset(vtab->load_stmt);
+	ruleset_release(set);
+	return rc;
+}
+
+static void ruleset_vtab_free(ruleset_vtab *vtab) {
+	sqlite3_finalize(vtab->load_stmt);
+	ruleset_release(vtab->set);
+	re_free(vtab->schema);
+	re_free(vtab->source);
+	re_free(vtab->column);
+	re_free(vtab);
+}
+
+static int ruleset_connect(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                           sqlite3_vtab **ppVtab, char **pzErr) {
+	if (argc != 5) {
+		*pzErr = sqlite3_mprintf("regexp_ruleset: expected arguments: rules_table, column");
+		return SQLITE_ERROR;
+	}
+	ruleset_vtab *vtab = re_malloc(sizeof(ruleset_vtab));
+	if (!vtab) {
+		return SQLITE_NOMEM;
+	}
+	memset(vtab, 0, sizeof(ruleset_vtab));
+	vtab->db = db;
+	vtab->cache = (cache_list *)pAux;
+	vtab->schema = sqlite3_mprintf("%s", argv[1]);
+	vtab->source = dequote_arg(argv[3]);
+	vtab->column = dequote_arg(argv[4]);
+	if (!vtab->schema || !vtab->source || !vtab->column) {
+		ruleset_vtab_free(vtab);
+		return SQLITE_NOMEM;
+	}
+
+	char *sql = sqlite3_mprintf("CREATE TABLE x(\"%w\", subject HIDDEN)", vtab->column);
+	if (!sql) {
+		ruleset_vtab_free(vtab);
+		return SQLITE_NOMEM;
+	}
+	int rc = sqlite3_declare_vtab(db, sql);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		*pzErr = sqlite3_mprintf("regexp_ruleset: %s", sqlite3_errmsg(db));
+		ruleset_vtab_free(vtab);
+		return rc;
+	}
+	// Allow matching rules in triggers and views.
+	sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+	*ppVtab = &vtab->base;
+	return SQLITE_OK;
+}
+
+// ruleset_create is distinct from ruleset_connect so that regexp_ruleset is
+// not an eponymous virtual table. The rules are loaded so that a missing
+// table or column and invalid patterns are reported when the table is
+// created.
+static int ruleset_create(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                          sqlite3_vtab **ppVtab, char **pzErr) {
+	int rc = ruleset_connect(db, pAux, argc, argv, ppVtab, pzErr);
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	ruleset_vtab *vtab = (ruleset_vtab *)*ppVtab;
+	rc = ruleset_load(vtab);
+	if (rc != SQLITE_OK) {
+		*pzErr = vtab->base.zErrMsg;
+		vtab->base.zErrMsg = NULL;
+		ruleset_vtab_free(vtab);
+		*ppVtab = NULL;
+	}
+	return rc;
+}
+
+static int ruleset_disconnect(sqlite3_vtab *pVtab) {
+	ruleset_vtab_free((ruleset_vtab *)pVtab);
+	return SQLITE_OK;
+}
+
+static int ruleset_open(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+	(void)pVtab;
+	ruleset_cursor *cur = re_malloc(sizeof(ruleset_cursor));
+	if (!cur) {
+		return SQLITE_NOMEM;
+	}
+	memset(cur, 0, sizeof(ruleset_cursor));
+	cur->eof = true;
+	*ppCursor = &cur->base;
+	return SQLITE_OK;
+}
+
+static void ruleset_cursor_reset(ruleset_cursor *cur) {
+	ruleset_release(cur->set);
+	cur->set = NULL;
+	if (cur->subject_val) {
+		sqlite3_value_free(cur->subject_val);
+		cur->subject_val = NULL;
+	}
+	cur->subject = NULL;
+	cur->subject_len = 0;
+	cur->eof = true;
+}
+
+static int ruleset_close(sqlite3_vtab_cursor *pCursor) {
+	ruleset_cursor *cur = (ruleset_cursor *)pCursor;
+	ruleset_cursor_reset(cur);
+	re_free(cur->candidates);
+	re_free(cur);
+	return SQLITE_OK;
+}
+
+// ruleset_advance moves the cursor to the first matching rule starting at
+// rule i.
+static int ruleset_advance(ruleset_cursor *cur, uint32_t i) {
+	const ruleset *set = cur->set;
+	while (i < set->n) {
+		uint64_t word = cur->candidates[i / 64] >> (i % 64);
+		if (word == 0) {
+			i = (i / 64 + 1) * 64;
+			continue;
+		}
+		for (; (word & 1) == 0; word >>= 1) {
+			i++;
+		}
+		if (i >= set->n) {
+			break;
+		}
+		cache_entry *ent = set->ents[i];
+		int rc = regexp_match(ent->cache, ent, cur->subject, cur->subject_len);
+		if (rc >= 0) {
+			cur->rule = i;
+			return SQLITE_OK;
+		}
+		if (rc != PCRE2_ERROR_NOMATCH) {
+			return set_vtab_error(cur->base.pVtab, format_pcre2_match_error(rc,
+				ent->pattern, ent->pattern_len, cur->subject, (uint32_t)cur->subject_len));
+		}
+		i++;
+	}
+	cur->eof = true;
+	return SQLITE_OK;
+}
+
+static int ruleset_next(sqlite3_vtab_cursor *pCursor) {
+	ruleset_cursor *cur = (ruleset_cursor *)pCursor;
+	return ruleset_advance(cur, cur->rule + 1);
+}
+
+static int ruleset_filter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                          const char *idxStr, int argc, sqlite3_value **argv) {
+	(void)idxStr;
+	ruleset_cursor *cur = (ruleset_cursor *)pCursor;
+	ruleset_vtab *vtab = (ruleset_vtab *)pCursor->pVtab;
+	ruleset_cursor_reset(cur);
+
+	if (idxNum != 1 || argc != 1 || sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+		return SQLITE_OK; // no subject: no rows
+	}
+	int rc = ruleset_load(vtab);
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	cur->subject_val = sqlite3_value_dup(argv[0]);
+	if (!cur->subject_val) {
+		return SQLITE_NOMEM;
+	}
+	bool nomem;
+	int len;
+	cur->subject = trgm_subject(cur->subject_val, &len, &nomem);
+	if (nomem) {
+		return SQLITE_NOMEM;
+	}
+	cur->subject_len = (size_t)len;
+
+	ruleset *set = vtab->set;
+	uint32_t words = (set->n + 63) / 64;
+	if (words > cur->cap) {
+		re_free(cur->candidates);
+		cur->candidates = re_malloc(sizeof(uint64_t) * words);
+		cur->cap = cur->candidates ? words : 0;
+		if (!cur->candidates) {
+			return SQLITE_NOMEM;
+		}
+	}
+	cur->set = set;
+	set->refs++;
+	cur->eof = false;
+	ruleset_candidates(set, cur->subject, cur->subject_len, cur->candidates);
+	return ruleset_advance(cur, 0);
+}
+
+static int ruleset_eof(sqlite3_vtab_cursor *pCursor) {
+	return ((ruleset_cursor *)pCursor)->eof;
+}
+
+static int ruleset_column(sqlite3_vtab_cursor *pCursor, sqlite3_context *ctx, int i) {
+	ruleset_cursor *cur = (ruleset_cursor *)pCursor;
+	if (i == RULESET_COL_PATTERN) {
+		const cache_entry *ent = cur->set->ents[cur->rule];
+		sqlite3_result_text(ctx, ent->pattern, (int)ent->pattern_len, SQLITE_TRANSIENT);
+	} else if (i == RULESET_COL_SUBJECT) {
+		sqlite3_result_value(ctx, cur->subject_val);
+	}
+	return SQLITE_OK;
+}
+
+static int ruleset_rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid) {
+	ruleset_cursor *cur = (ruleset_cursor *)pCursor;
+	*pRowid = cur->set->ids[cur->rule];
+	return SQLITE_OK;
+}
+
+// ruleset_best_index requires an equality constraint on the subject.
+static int ruleset_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *info) {
+	(void)pVtab;
+	bool unusable = false;
+	const struct sqlite3_index_constraint *c = info->aConstraint;
+	for (int i = 0; i < info->nConstraint; i++, c++) {
+		if (c->iColumn != RULESET_COL_SUBJECT) {
+			continue;
+		}
+		if (!c->usable) {
+			unusable = true;
+		} else if (c->op == SQLITE_INDEX_CONSTRAINT_EQ) {
+			info->aConstraintUsage[i].argvIndex = 1;
+			info->aConstraintUsage[i].omit = 1;
+			info->idxNum = 1;
+			info->estimatedCost = 1e3;
+			info->estimatedRows = 10;
+			return SQLITE_OK;
+		}
+	}
+	if (unusable) {
+		return SQLITE_CONSTRAINT;
+	}
+	info->idxNum = 0;
+	info->estimatedCost = 2147483647.0;
+	return SQLITE_OK;
+}
+
+static sqlite3_module ruleset_module = {
+	.iVersion    = 0,
+	.xCreate     = ruleset_create,
+	.xConnect    = ruleset_connect,
+	.xBestIndex  = ruleset_best_index,
+	.xDisconnect = ruleset_disconnect,
+	.xDestroy    = ruleset_disconnect,
+	.xOpen       = ruleset_open,
+	.xClose      = ruleset_close,
+	.xFilter     = ruleset_filter,
+	.xNext       = ruleset_next,
+	.xEof        = ruleset_eof,
+	.xColumn     = ruleset_column,
+	.xRowid      = ruleset_rowid,
+};
+
+// regexp_results caches the rowids of the rows of a table whose column
+// matches a pattern, so that dashboards that repeat the same REGEXP filters
+// over mostly static tables read a list of rowids instead of rescanning:
+//
+//	CREATE TABLE logs(line TEXT);
+//	CREATE VIRTUAL TABLE logs_rr USING regexp_results(logs, line);
+//	SELECT count(*) FROM logs_rr('timeout after \d+ms');
+//
+// The results are stored in the shadow table %_results, keyed by pattern,
+// with the largest rowid that was scanned. Rows appended after it are
+// matched by the next query, which updates the stored results, but rows that
+// are inserted at or below it (an explicit or reused rowid) and changes to
+// rows that were already scanned must be reported with triggers on INSERT
+// (new.rowid), UPDATE (old.rowid and new.rowid) and DELETE (old.rowid):
+//
+//	INSERT INTO logs_rr(logs_rr, rowid) VALUES ('invalidate', new.rowid);
+//
+// which drops the results that cover the rowid, i.e. that were scanned up to
+// it or past it, so appended rows do not drop anything (without a rowid all
+// results are dropped). The rowids are stored as varint deltas or, when that is
+// smaller, as a bitmap (see: results_encode). Results that cannot be stored,
+// e.g. because the database is read-only, are still returned.
+
+enum {
+	RESULTS_COL_ID,
+	RESULTS_COL_PATTERN, // hidden
+	RESULTS_COL_COMMAND, // hidden, has the name of the table
+};
+
+#define RESULTS_DELTAS 0 // format of a list of varint deltas
+#define RESULTS_BITMAP 1 // format of a bitmap
+
+typedef struct {
+	sqlite3_vtab base;
+	sqlite3      *db;
+	cache_list   *cache;
+	char         *schema;  // database of the table
+	char         *name;    // name of the table
+	char         *content; // content table
+	char         *column;  // matched column of the content table
+	sqlite3_stmt *load_stmt;
+	sqlite3_stmt *store_stmt;
+	sqlite3_stmt *scan_stmt;
+	sqlite3_stmt *invalidate_stmt;
+} results_vtab;
+
+typedef struct {
+	sqlite3_vtab_cursor base;
+	sqlite3_value       *pattern; // copy of the pattern
+	trgm_ids            ids;      // matching rows
+	sqlite3_int64       pos;
+} results_cursor;
+
+static size_t results_put_varint(uint8_t *p, uint64_t v) {
+	size_t n = 0;
+	for (; v >= 0x80; v >>= 7) {
+		p[n++] = (uint8_t)(v | 0x80);
+	}
+	p[n++] = (uint8_t)v;
+	return n;
+}
+
+static size_t results_varint_len(uint64_t v) {
+	size_t n = 1;
+	for (; v >= 0x80; v >>= 7) {
+		n++;
+	}
+	return n;
+}
+
+// results_get_varint reads a varint from p, which has n bytes left, and
+// returns its length or 0 if it is truncated.
+static size_t results_get_varint(const uint8_t *p, size_t n, uint64_t *v) {
+	*v = 0;
+	for (size_t i = 0; i < n && i < 10; i++) {
+		*v |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+		if ((p[i] & 0x80) == 0) {
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+// The first rowid is zigzag encoded since rowids may be negative.
+static inline uint64_t results_zigzag(sqlite3_int64 v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline sqlite3_int64 results_unzigzag(uint64_t v) {
+	return (sqlite3_int64)(v >> 1) ^ -(sqlite3_int64)(v & 1);
+}
+
+// results_encode encodes the sorted rowids of ids in *out, which must be
+// freed with re_free, as a list of varint deltas or a bitmap of the range of
+// the rowids, whichever is smaller.
+static int results_encode(const trgm_ids *ids, uint8_t **out, size_t *n) {
+	size_t deltas = 1;
+	for (sqlite3_int64 i = 0; i < ids->n; i++) {
+		deltas += i == 0 ? results_varint_len(results_zigzag(ids->ids[0]))
+			: results_varint_len((uint64_t)ids->ids[i] - (uint64_t)ids->ids[i-1]);
+	}
+	// The differences are computed unsigned since they may not fit in an
+	// int64 (e.g. INT64_MAX - INT64_MIN).
+	size_t bitmap = SIZE_MAX;
+	if (ids->n > 0) {
+		uint64_t span = (uint64_t)ids->ids[ids->n-1] - (uint64_t)ids->ids[0];
+		if (span / 8 < deltas) {
+			bitmap = 1 + results_varint_len(results_zigzag(ids->ids[0])) +
+				(size_t)(span / 8 + 1);
+		}
+	}
+	size_t size = bitmap < deltas ? bitmap : deltas;
+	uint8_t *p = re_malloc(size);
+	if (!p) {
+		return SQLITE_NOMEM;
+	}
+	if (bitmap < deltas) {
+		p[0] = RESULTS_BITMAP;
+		size_t off = 1 + results_put_varint(&p[1], results_zigzag(ids->ids[0]));
+		memset(&p[off], 0, size - off);
+		for (sqlite3_int64 i = 0; i < ids->n; i++) {
+			uint64_t bit = (uint64_t)ids->ids[i] - (uint64_t)ids->ids[0];
+			p[off + bit / 8] |= (uint8_t)(1u << (bit % 8));
+		}
+	} else {
+		p[0] = RESULTS_DELTAS;
+		size_t off = 1;
+		for (sqlite3_int64 i = 0; i < ids->n; i++) {
+			off += results_put_varint(&p[off], i == 0 ? results_zigzag(ids->ids[0])
+				: (uint64_t)ids->ids[i] - (uint64_t)ids->ids[i-1]);
+		}
+	}
+	*out = p;
+	*n = size;
+	return SQLITE_OK;
+}
+
+// results_decode appends the rowids encoded by results_encode to ids. It
+// returns SQLITE_CORRUPT if the encoding is invalid.
+static int results_decode(const uint8_t *p, size_t n, trgm_ids *ids) {
+	if (n == 0) {
+		return SQLITE_CORRUPT;
+	}
+	uint64_t v;
+	size_t off = 1;
+	if (p[0] == RESULTS_BITMAP) {
+		size_t len = results_get_varint(&p[off], n - off, &v);
+		if (len == 0) {
+			return SQLITE_CORRUPT;
+		}
+		sqlite3_int64 first = results_unzigzag(v);
+		for (off += len; off < n; off++) {
+			for (uint8_t byte = p[off], bit = 0; byte; byte >>= 1, bit++) {
+				if ((byte & 1) && trgm_ids_push(ids, (sqlite3_int64)((uint64_t)first +
+				    (off - 1 - len) * 8 + bit)) != SQLITE_OK) {
+					return SQLITE_NOMEM;
+				}
+			}
+		}
+		return SQLITE_OK;
+	}
+	if (p[0] != RESULTS_DELTAS) {
+		return SQLITE_CORRUPT;
+	}
+	sqlite3_int64 id = 0;
+	for (bool first = true; off < n; first = false) {
+		size_t len = results_get_varint(&p[off], n - off, &v);
+		if (len == 0 || (!first && v == 0)) {
+			return SQLITE_CORRUPT;
+		}
+		off += len;
+		id = first ? results_unzigzag(v) : (sqlite3_int64)((uint64_t)id + v);
+		if (trgm_ids_push(ids, id) != SQLITE_OK) {
+			return SQLITE_NOMEM;
+		}
+	}
+	return SQLITE_OK;
+}
+
+// results_prepare prepares the statement created from the sqlite3_mprintf
+// style format (which supports "%w" for quoting identifiers) unless *stmt
+// was already prepared.
+static int results_prepare(results_vtab *vtab, sqlite3_stmt **stmt, const char *format, ...) {
+	if (*stmt) {
+		return SQLITE_OK;
+	}
+	va_list args;
+	va_start(args, format);
+	char *sql = sqlite3_vmprintf(format, args);
+	va_end(args);
+	if (!sql) {
+		return SQLITE_NOMEM;
+	}
+	int rc = sqlite3_prepare_v3(vtab->db, sql, -1, SQLITE_PREPARE_PERSISTENT, stmt, NULL);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		return set_vtab_error(&vtab->base, sqlite3_mprintf("regexp_results: %s",
+		                                                   sqlite3_errmsg(vtab->db)));
+	}
+	return SQLITE_OK;
+}
+
+static void results_finalize_stmts(results_vtab *vtab) {
+	sqlite3_finalize(vtab->load_stmt);
+	sqlite3_finalize(vtab->store_stmt);
+	sqlite3_finalize(vtab->scan_stmt);
+	sqlite3_finalize(vtab->invalidate_stmt);
+	vtab->load_stmt = NULL;
+	vtab->store_stmt = NULL;
+	vtab->scan_stmt = NULL;
+	vtab->invalidate_stmt = NULL;
+}
+
+static int results_prepare_scan(results_vtab *vtab) {
+	// Qualify the column so that a missing column is not taken as a string.
+	return results_prepare(vtab, &vtab->scan_stmt,
+		"SELECT rowid, \"%w\".\"%w\" FROM \"%w\".\"%w\" WHERE rowid >= ?1 ORDER BY rowid",
+		vtab->content, vtab->column, vtab->schema, vtab->content);
+}
+
+// results_load appends the stored results of pattern to ids and sets *found
+// and the largest scanned rowid *last. Invalid results are ignored.
+static int results_load(results_vtab *vtab, sqlite3_value *pattern, trgm_ids *ids,
+                        bool *found, sqlite3_int64 *last) {
+	*found = false;
+	int rc = results_prepare(vtab, &vtab->load_stmt,
+		"SELECT max_rowid, ids FROM \"%w\".\"%w_results\" WHERE pattern = ?1",
+		vtab->schema, vtab->name);
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	sqlite3_stmt *stmt = vtab->load_stmt;
+	sqlite3_bind_value(stmt, 1, pattern);
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW && sqlite3_column_type(stmt, 0) == SQLITE_INTEGER) {
+		const uint8_t *p = sqlite3_column_blob(stmt, 1);
+		size_t n = (size_t)sqlite3_column_bytes(stmt, 1);
+		rc = p ? results_decode(p, n, ids) : SQLITE_NOMEM;
+		if (rc == SQLITE_OK) {
+			*found = true;
+			*last = sqlite3_column_int64(stmt, 0);
+		} else if (rc == SQLITE_CORRUPT) {
+			trgm_ids_free(ids);
+			rc = SQLITE_OK; // rescan the table
+		}
+	} else if (rc == SQLITE_ROW || rc == SQLITE_DONE) {
+		rc = SQLITE_OK;
+	} else {
+		rc = set_vtab_error(&vtab->base, sqlite3_mprintf("regexp_results: %s",
+		                                                 sqlite3_errmsg(vtab->db)));
+	}
+	sqlite3_reset(stmt);
+	return rc;
+}
+
+// results_scan matches ent against the rows from rowid first on, appends the
+// rowids of the matching rows to ids and sets *last to the largest rowid
+// scanned (it is not changed if there are no rows). An empty pattern (ent is
+// NULL) matches all non-NULL values.
+static int results_scan(results_vtab *vtab, cache_entry *ent, sqlite3_int64 first,
+                        trgm_ids *ids, sqlite3_int64 *last) {
+	int rc = results_prepare_scan(vtab);
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	sqlite3_stmt *stmt = vtab->scan_stmt;
+	sqlite3_bind_int64(stmt, 1, first);
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		sqlite3_int64 id = sqlite3_column_int64(stmt, 0);
+		*last = id;
+		bool nomem;
+		int len;
+		const char *subject = trgm_subject(sqlite3_column_value(stmt, 1), &len, &nomem);
+		if (!subject) {
+			if (nomem) {
+				rc = SQLITE_NOMEM;
+				goto done;
+			}
+			continue; // NULL values never match
+		}
+		if (ent) {
+			if (!cache_entry_may_match(ent, subject, (size_t)len)) {
+				continue;
+			}
+			int mrc = regexp_match(ent->cache, ent, subject, (size_t)len);
+			if (mrc == PCRE2_ERROR_NOMATCH) {
+				continue;
+			}
+			if (mrc < 0) {
+				rc = set_vtab_error(&vtab->base, format_pcre2_match_error(mrc,
+					ent->pattern, ent->pattern_len, subject, (uint32_t)len));
+				goto done;
+			}
+		}
+		if (trgm_ids_push(ids, id) != SQLITE_OK) {
+			rc = SQLITE_NOMEM;
+			goto done;
+		}
+	}
+	if (rc == SQLITE_DONE) {
+		rc = SQLITE_OK;
+	} else {
+		rc = set_vtab_error(&vtab->base, sqlite3_mprintf("regexp_results: %s",
+		                                                 sqlite3_errmsg(vtab->db)));
+	}
+
+done:
+	sqlite3_reset(stmt);
+	return rc;
+}
+
+// results_store stores the results of pattern. Storing is best effort: the
+// results are correct whether or not they were stored, so errors (e.g. a
+// read-only database or a busy lock) other than out of memory are ignored.
+static int results_store(results_vtab *vtab, sqlite3_value *pattern,
+                         const trgm_ids *ids, sqlite3_int64 last) {
+	if (sqlite3_db_readonly(vtab->db, vtab->schema) != 0) {
+		return SQLITE_OK;
+	}
+	int rc = results_prepare(vtab, &vtab->store_stmt,
+		"INSERT OR REPLACE INTO \"%w\".\"%w_results\"(pattern, max_rowid, ids) "
+		"VALUES (?1, ?2, ?3)", vtab->schema, vtab->name);
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	uint8_t *p;
+	size_t n;
+	if (results_encode(ids, &p, &n) != SQLITE_OK) {
+		return SQLITE_NOMEM;
+	}
+	sqlite3_stmt *stmt = vtab->store_stmt;
+	sqlite3_bind_value(stmt, 1, pattern);
+	sqlite3_bind_int64(stmt, 2, last);
+	sqlite3_bind_blob64(stmt, 3, p, n, re_free);
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	return rc == SQLITE_NOMEM ? SQLITE_NOMEM : SQLITE_OK;
+}
+
+// results_invalidate drops the stored results that were scanned up to or past
+// rowid id, which covers inserted, changed and deleted rows, or all of them if
+// id is NULL.
+static int results_invalidate(results_vtab *vtab, sqlite3_value *id) {
+	int rc = results_prepare(vtab, &vtab->invalidate_stmt,
+		"DELETE FROM \"%w\".\"%w_results\" WHERE ?1 IS NULL OR max_rowid >= ?1",
+		vtab->schema, vtab->name);
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	sqlite3_bind_value(vtab->invalidate_stmt, 1, id);
+	rc = sqlite3_step(vtab->invalidate_stmt);
+	sqlite3_reset(vtab->invalidate_stmt);
+	if (rc != SQLITE_DONE) {
+		return set_vtab_error(&vtab->base, sqlite3_mprintf("regexp_results: %s",
+		                                                   sqlite3_errmsg(vtab->db)));
+	}
+	return SQLITE_OK;
+}
+
+static void results_vtab_free(results_vtab *vtab) {
+	results_finalize_stmts(vtab);
+	re_free(vtab->schema);
+	re_free(vtab->name);
+	re_free(vtab->content);
+	re_free(vtab->column);
+	re_free(vtab);
+}
+
+static int results_init(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                        sqlite3_vtab **ppVtab, char **pzErr, bool create) {
+	if (argc != 5) {
+		*pzErr = sqlite3_mprintf("regexp_results: expected arguments: content_table, column");
+		return SQLITE_ERROR;
+	}
+	results_vtab *vtab = re_malloc(sizeof(results_vtab));
+	if (!vtab) {
+		return SQLITE_NOMEM;
+	}
+	memset(vtab, 0, sizeof(results_vtab));
+	vtab->db = db;
+	vtab->cache = (cache_list *)pAux;
+	vtab->schema = sqlite3_mprintf("%s", argv[1]);
+	vtab->name = sqlite3_mprintf("%s", argv[2]);
+	vtab->content = dequote_arg(argv[3]);
+	vtab->column = dequote_arg(argv[4]);
+	if (!vtab->schema || !vtab->name || !vtab->content || !vtab->column) {
+		results_vtab_free(vtab);
+		return SQLITE_NOMEM;
+	}
+
+	char *sql = sqlite3_mprintf("CREATE TABLE x(id, pattern HIDDEN, \"%w\" HIDDEN)",
+	                            vtab->name);
+	if (!sql) {
+		results_vtab_free(vtab);
+		return SQLITE_NOMEM;
+	}
+	int rc = sqlite3_declare_vtab(db, sql);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		*pzErr = sqlite3_mprintf("regexp_results: %s", sqlite3_errmsg(db));
+		results_vtab_free(vtab);
+		return rc;
+	}
+	// Allow invalidating the results from triggers.
+	sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+
+	if (create) {
+		sql = sqlite3_mprintf(
+			"CREATE TABLE \"%w\".\"%w_results\"("
+			"pattern TEXT PRIMARY KEY, max_rowid INTEGER NOT NULL, ids BLOB NOT NULL"
+			") WITHOUT ROWID",
+			vtab->schema, vtab->name);
+		if (!sql) {
+			results_vtab_free(vtab);
+			return SQLITE_NOMEM;
+		}
+		rc = sqlite3_exec(db, sql, NULL, NULL, pzErr);
+		re_free(sql);
+		if (rc == SQLITE_OK) {
+			// Report a missing table or column when the table is created.
+			rc = results_prepare_scan(vtab);
+			if (rc != SQLITE_OK) {
+				*pzErr = vtab->base.zErrMsg;
+				vtab->base.zErrMsg = NULL;
+			}
+		}
+		if (rc != SQLITE_OK) {
+			results_vtab_free(vtab);
+			return rc;
+		}
+	}
+	*ppVtab = &vtab->base;
+	return SQLITE_OK;
+}
+
+static int results_create(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                          sqlite3_vtab **ppVtab, char **pzErr) {
+	return results_init(db, pAux, argc, argv, ppVtab, pzErr, true);
+}
+
+static int results_connect(sqlite3 *db, void *pAux, int argc, const char *const *argv,
+                           sqlite3_vtab **ppVtab, char **pzErr) {
+	return results_init(db, pAux, argc, argv, ppVtab, pzErr, false);
+}
+
+static int results_disconnect(sqlite3_vtab *pVtab) {
+	results_vtab_free((results_vtab *)pVtab);
+	return SQLITE_OK;
+}
+
+static int results_destroy(sqlite3_vtab *pVtab) {
+	results_vtab *vtab = (results_vtab *)pVtab;
+	results_finalize_stmts(vtab);
+	char *sql = sqlite3_mprintf("DROP TABLE IF EXISTS \"%w\".\"%w_results\"",
+	                            vtab->schema, vtab->name);
+	if (!sql) {
+		return SQLITE_NOMEM;
+	}
+	int rc = sqlite3_exec(vtab->db, sql, NULL, NULL, NULL);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	results_vtab_free(vtab);
+	return SQLITE_OK;
+}
+
+static int results_rename(sqlite3_vtab *pVtab, const char *zNew) {
+	results_vtab *vtab = (results_vtab *)pVtab;
+	char *name = sqlite3_mprintf("%s", zNew);
+	char *sql = sqlite3_mprintf("ALTER TABLE \"%w\".\"%w_results\" RENAME TO \"%w_results\"",
+	                            vtab->schema, vtab->name, zNew);
+	if (!name || !sql) {
+		re_free(name);
+		re_free(sql);
+		return SQLITE_NOMEM;
+	}
+	int rc = sqlite3_exec(vtab->db, sql, NULL, NULL, NULL);
+	re_free(sql);
+	if (rc != SQLITE_OK) {
+		re_free(name);
+		return rc;
+	}
+	results_finalize_stmts(vtab);
+	re_free(vtab->name);
+	vtab->name = name;
+	return SQLITE_OK;
+}
+
+static int results_shadow_name(const char *name) {
+	return sqlite3_stricmp(name, "results") == 0;
+}
+
+// results_update only supports the 'invalidate' command.
+static int results_update(sqlite3_vtab *pVtab, int argc, sqlite3_value **argv,
+                          sqlite3_int64 *pRowid) {
+	(void)pRowid;
+	results_vtab *vtab = (results_vtab *)pVtab;
+	const char *cmd = NULL;
+	if (argc > 1 && sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+		cmd = (const char *)sqlite3_value_text(argv[2 + RESULTS_COL_COMMAND]);
+	}
+	if (!cmd || sqlite3_stricmp(cmd, "invalidate") != 0) {
+		return set_vtab_error(pVtab, cmd
+			? sqlite3_mprintf("regexp_results: invalid command: %s", cmd)
+			: sqlite3_mprintf("regexp_results: only the 'invalidate' command is supported"));
+	}
+	return results_invalidate(vtab, argv[1]);
+}
+
+static int results_open(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+	(void)pVtab;
+	results_cursor *cur = re_malloc(sizeof(results_cursor));
+	if (!cur) {
+		return SQLITE_NOMEM;
+	}
+	memset(cur, 0, sizeof(results_cursor));
+	*ppCursor = &cur->base;
+	return SQLITE_OK;
+}
+
+static void results_cursor_reset(results_cursor *cur) {
+	if (cur->pattern) {
+		sqlite3_value_free(cur->pattern);
+		cur->pattern = NULL;
+	}
+	trgm_ids_free(&cur->ids);
+	cur->pos = 0;
+}
+
+static int results_close(sqlite3_vtab_cursor *pCursor) {
+	results_cursor *cur = (results_cursor *)pCursor;
+	results_cursor_reset(cur);
+	re_free(cur);
+	return SQLITE_OK;
+}
+
+// results_filter loads the stored results of the pattern, matches the rows
+// appended since they were stored and stores the updated results.
+static int results_filter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                          const char *idxStr, int argc, sqlite3_value **argv) {
+	(void)idxStr;
+	results_cursor *cur = (results_cursor *)pCursor;
+	results_vtab *vtab = (results_vtab *)pCursor->pVtab;
+	results_cursor_reset(cur);
+
+	if (idxNum != 1 || argc != 1) {
+		return SQLITE_OK; // no pattern: no rows
+	}
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+		return set_vtab_error(pCursor->pVtab, sqlite3_mprintf("regexp: NULL pattern"));
+	}
+	cur->pattern = sqlite3_value_dup(argv[0]);
+	if (!cur->pattern) {
+		return SQLITE_NOMEM;
+	}
+
+	bool found;
+	sqlite3_int64 last = 0;
+	int rc = results_load(vtab, cur->pattern, &cur->ids, &found, &last);
+	if (rc != SQLITE_OK || (found && last == INT64_MAX)) {
+		return rc;
+	}
+	sqlite3_int64 first = found ? last + 1 : INT64_MIN;
+
+	// Only compile the pattern if there are rows to match.
+	rc = results_prepare_scan(vtab);
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	sqlite3_bind_int64(vtab->scan_stmt, 1, first);
+	rc = sqlite3_step(vtab->scan_stmt);
+	sqlite3_reset(vtab->scan_stmt);
+	if (rc == SQLITE_DONE) {
+		return SQLITE_OK; // nothing to match or store
+	}
+
+	const char *pattern = (const char *)sqlite3_value_text(cur->pattern);
+	if (!pattern) {
+		return SQLITE_NOMEM;
+	}
+	uint32_t pattern_len = (uint32_t)sqlite3_value_bytes(cur->pattern);
+	cache_entry *ent = NULL;
+	if (pattern_len > 0) {
+		char *errmsg;
+		ent = cache_list_lookup(vtab->cache, pattern, pattern_len, false, &errmsg);
+		if (!ent) {
+			return set_vtab_error(pCursor->pVtab, errmsg);
+		}
+		if (cache_entry_init_literal(ent) != SQLITE_OK) {
+			cache_entry_release(ent);
+			return SQLITE_NOMEM;
+		}
+	}
+	sqlite3_int64 scanned = found ? last : INT64_MIN;
+	rc = results_scan(vtab, ent, first, &cur->ids, &scanned);
+	if (ent) {
+		cache_entry_release(ent);
+	}
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	return results_store(vtab, cur->pattern, &cur->ids, scanned);
+}
+
+static int results_next(sqlite3_vtab_cursor *pCursor) {
+	((results_cursor *)pCursor)->pos++;
+	return SQLITE_OK;
+}
+
+static int results_eof(sqlite3_vtab_cursor *pCursor) {
+	results_cursor *cur = (results_cursor *)pCursor;
+	return cur->pos >= cur->ids.n;
+}
+
+static int results_column(sqlite3_vtab_cursor *pCursor, sqlite3_context *ctx, int i) {
+	results_cursor *cur = (results_cursor *)pCursor;
+	if (i == RESULTS_COL_ID) {
+		sqlite3_result_int64(ctx, cur->ids.ids[cur->pos]);
+	} else if (i == RESULTS_COL_PATTERN) {
+		sqlite3_result_value(ctx, cur->pattern);
+	}
+	return SQLITE_OK;
+}
+
+static int results_rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid) {
+	results_cursor *cur = (results_cursor *)pCursor;
+	*pRowid = cur->ids.ids[cur->pos];
+	return SQLITE_OK;
+}
+
+// results_best_index requires an equality constraint on the pattern.
+static int results_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *info) {
+	(void)pVtab;
+	bool unusable = false;
+	const struct sqlite3_index_constraint *c = info->aConstraint;
+	for (int i = 0; i < info->nConstraint; i++, c++) {
+		if (c->iColumn != RESULTS_COL_PATTERN) {
+			continue;
+		}
+		if (!c->usable) {
+			unusable = true;
+		} else if (c->op == SQLITE_INDEX_CONSTRAINT_EQ) {
+			info->aConstraintUsage[i].argvIndex = 1;
+			info->aConstraintUsage[i].omit = 1;
+			info->idxNum = 1;
+			info->estimatedCost = 1e3;
+			info->estimatedRows = 1000;
+			info->orderByConsumed = info->nOrderBy == 1 &&
+				info->aOrderBy[0].iColumn <= RESULTS_COL_ID && !info->aOrderBy[0].desc;
+			return SQLITE_OK;
+		}
+	}
+	if (unusable) {
+		return SQLITE_CONSTRAINT;
+	}
+	info->idxNum = 0;
+	info->estimatedCost = 2147483647.0;
+	return SQLITE_OK;
+}
+
+static sqlite3_module results_module = {
+	.iVersion    = 3,
+	.xCreate     = results_create,
+	.xConnect    = results_connect,
+	.xBestIndex  = results_best_index,
+	.xDisconnect = results_disconnect,
+	.xDestroy    = results_destroy,
+	.xOpen       = results_open,
+	.xClose      = results_close,
+	.xFilter     = results_filter,
+	.xNext       = results_next,
+	.xEof        = results_eof,
+	.xColumn     = results_column,
+	.xRowid      = results_rowid,
+	.xUpdate     = results_update,
+	.xRename     = results_rename,
+	.xShadowName = results_shadow_name,
+};
+
+// regexp_signature returns the signature of a text, a bitmap of the byte
+// bigrams it contains, which is meant to be stored in a generated column:
+//
+//	CREATE TABLE logs(
+//		sig  BLOB GENERATED ALWAYS AS (regexp_signature(line)) STORED,
+//		line TEXT
+//	);
+//	SELECT line FROM logs WHERE regexp_may_match(sig, ?1) AND line REGEXP ?1;
+//
+// regexp_may_match tests the signature against the literals that every match
+// of a pattern must contain (see: lit_query) and returns 0 if a row cannot
+// match without reading its text. Since SQLite reads the columns of a record
+// in order, the signature should be declared before the text so that it is
+// stored before any overflow pages. Bigrams are compared case-insensitively
+// (ASCII only) and hashed to one of SIG_BITS bits, which a smaller signature
+// folds onto its size: the bits of a long text are mostly set, so signatures
+// work best for short to medium texts.
+
+#define SIG_BITS 256
+#define SIG_WORDS (SIG_BITS / 64)
+
+// sig_node is a node of a lit_query whose literals have been replaced by the
+// mask of their bigrams. The mask of an AND node includes the masks of its
+// literal children, which are removed from its children.
+typedef struct {
+	lit_query_op op;
+	int          child;
+	int          next;
+	uint64_t     mask[SIG_WORDS];
+} sig_node;
+
+struct sig_query {
+	int      root;
+	sig_node nodes[];
+};
+
+static inline uint32_t sig_bigram(unsigned char a, unsigned char b) {
+	return ((trgm_fold(a) << 8 | trgm_fold(b)) * 0x9E3779B1u) >> 24;
+}
+
+static void sig_add(uint64_t *mask, const char *s, size_t len) {
+	for (size_t i = 0; i + 1 < len; i++) {
+		uint32_t h = sig_bigram((unsigned char)s[i], (unsigned char)s[i + 1]);
+		mask[h / 64] |= (uint64_t)1 << (h % 64);
+	}
+}
+
+// sig_query_new returns the signature query of pattern, NULL if it is ALL or
+// memory could not be allocated (*nomem is set).
+static sig_query *sig_query_new(const char *pattern, uint32_t len, bool *nomem) {
+	*nomem = false;
+	lit_query q;
+	if (lit_query_parse(&q, pattern, len, false) != SQLITE_OK) {
+		*nomem = true;
+		return NULL;
+	}
+	if (q.root == 0) {
+		lit_query_free(&q);
+		return NULL;
+	}
+	sig_query *sq = re_malloc(sizeof(sig_query) + sizeof(sig_node) * (size_t)q.nnodes);
+	if (!sq) {
+		lit_query_free(&q);
+		*nomem = true;
+		return NULL;
+	}
+	sq->root = q.root;
+	for (int i = 0; i < q.nnodes; i++) {
+		const lit_query_node *n = &q.nodes[i];
+		sig_node *s = &sq->nodes[i];
+		memset(s, 0, sizeof(sig_node));
+		s->op = n->op;
+		s->child = n->op == LITQ_AND || n->op == LITQ_OR ? n->child : -1;
+		s->next = n->next;
+		if (n->op == LITQ_LIT) {
+			// Literals without a bigram do not restrict the rows.
+			if (n->len < 2) {
+				s->op = LITQ_ALL;
+			}
+			sig_add(s->mask, &q.buf[n->off], n->len);
+		}
+	}
+	// Children are numbered before their parents.
+	for (int i = 0; i < q.nnodes; i++) {
+		sig_node *s = &sq->nodes[i];
+		if (s->op != LITQ_AND) {
+			continue;
+		}
+		int *link = &s->child;
+		while (*link >= 0) {
+			sig_node *c = &sq->nodes[*link];
+			if (c->op == LITQ_LIT || c->op == LITQ_ALL) {
+				for (int w = 0; w < SIG_WORDS; w++) {
+					s->mask[w] |= c->mask[w];
+				}
+				*link = c->next;
+			} else {
+				link = &c->next;
+			}
+		}
+	}
+	lit_query_free(&q);
+	return sq;
+}
+
+// sig_eval returns false if no text with the signature sig of nwords words
+// can match node.
+static bool sig_eval(const sig_query *q, int node, const uint64_t *sig, int nwords) {
+	const sig_node *n = &q->nodes[node];
+	switch (n->op) {
+	case LITQ_ALL:
+		return true;
+	case LITQ_LIT:
+	case LITQ_AND:
+		for (int w = 0; w < SIG_WORDS; w++) {
+			if ((sig[w % nwords] & n->mask[w]) != n->mask[w]) {
+				return false;
+			}
+		}
+		for (int c = n->child; c >= 0; c = q->nodes[c].next) {
+			if (!sig_eval(q, c, sig, nwords)) {
+				return false;
+			}
+		}
+		return true;
+	case LITQ_OR:
+		for (int c = n->child; c >= 0; c = q->nodes[c].next) {
+			if (sig_eval(q, c, sig, nwords)) {
+				return true;
+			}
+		}
+		return false;
+	}
+	return true;
+}
+
+// regexp_signature(text [, bits]) returns the signature of text as a BLOB of
+// bits / 8 bytes, where bits is 64, 128 or 256 (the default).
+static void regexp_signature(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	int type = sqlite3_value_type(argv[0]);
+	if (type == SQLITE_NULL) {
+		return;
+	}
+	int bits = SIG_BITS;
+	if (argc > 1) {
+		bits = sqlite3_value_int(argv[1]);
+		if (bits != 64 && bits != 128 && bits != 256) {
+			sqlite3_result_error(ctx, "regexp_signature: bits must be 64, 128 or 256", -1);
+			return;
+		}
+	}
+	const char *s = type == SQLITE_BLOB
+		? (const char *)sqlite3_value_blob(argv[0])
+		: (const char *)sqlite3_value_text(argv[0]);
+	int len = sqlite3_value_bytes(argv[0]);
+	if (unlikely(s == NULL && len > 0)) {
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+	uint64_t mask[SIG_WORDS] = { 0 };
+	if (s) {
+		sig_add(mask, s, (size_t)len);
+	}
+	int nwords = bits / 64;
+	for (int w = nwords; w < SIG_WORDS; w++) {
+		mask[w % nwords] |= mask[w];
+	}
+	unsigned char out[SIG_BITS / 8];
+	for (int i = 0; i < bits / 8; i++) {
+		out[i] = (unsigned char)(mask[i / 8] >> (8 * (i % 8)));
+	}
+	sqlite3_result_blob(ctx, out, bits / 8, SQLITE_TRANSIENT);
+}
+
+// regexp_may_match(signature, pattern) returns 0 if no text with signature
+// can match pattern and 1 if it may. Like REGEXP, NULL never matches.
+static void regexp_may_match(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	(void)argc;
+	assert(argc == 2);
+	if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+		sqlite3_result_int(ctx, 0);
+		return;
+	}
+	cache_entry *ent = sqlite3_get_auxdata(ctx, 1);
+	if (ent == NULL) {
+		if (sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+			sqlite3_result_error(ctx, "regexp_may_match: NULL pattern", -1);
+			return;
+		}
+		int pattern_len = sqlite3_value_bytes(argv[1]);
+		if (pattern_len <= 0) {
+			sqlite3_result_int(ctx, 1);
+			return;
+		}
+		const char *pattern = (const char *)sqlite3_value_text(argv[1]);
+		if (unlikely(pattern == NULL)) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+		cache_list *cache = sqlite3_user_data(ctx);
+		char *errmsg;
+		ent = cache_list_lookup(cache, pattern, pattern_len, false, &errmsg);
+		if (ent == NULL) {
+			set_result_error(ctx, errmsg);
+			return;
+		}
+		sqlite3_set_auxdata(ctx, 1, ent, cache_aux_data_destroy);
+		ent = sqlite3_get_auxdata(ctx, 1);
+		if (unlikely(ent == NULL)) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+	}
+	if (!ent->sig_init) {
+		bool nomem;
+		ent->sig = sig_query_new(ent->pattern, ent->pattern_len, &nomem);
+		if (nomem) {
+			sqlite3_result_error_nomem(ctx);
+			return;
+		}
+		ent->sig_init = true;
+	}
+	if (ent->sig == NULL) {
+		sqlite3_result_int(ctx, 1);
+		return;
+	}
+
+	int n = sqlite3_value_bytes(argv[0]);
+	const unsigned char *b = sqlite3_value_blob(argv[0]);
+	if (n != 8 && n != 16 && n != 32) {
+		sqlite3_result_error(ctx, "regexp_may_match: invalid signature", -1);
+		return;
+	}
+	if (unlikely(b == NULL)) {
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+	uint64_t sig[SIG_WORDS] = { 0 };
+	for (int i = 0; i < n; i++) {
+		sig[i / 8] |= (uint64_t)b[i] << (8 * (i % 8));
+	}
+	sqlite3_result_int(ctx, sig_eval(ent->sig, ent->sig->root, sig, n / 8));
+}
+
+// regexp_state holds the caches of a database connection and is used by
+// modules that report on both of them.
+typedef struct {
+	cache_list *caches[2]; // regexp and iregexp
+	slow_log   slow_log;   // shared by the caches
+} regexp_state;
+
+static void regexp_state_destroy(void *p) {
+	regexp_state *state = (regexp_state *)p;
+	slow_log_reset(&state->slow_log);
+	re_free(state);
+}
+
+// regexp_config returns the value of a runtime setting, which applies to both
+// REGEXP and IREGEXP, and sets it first if a value is provided:
+//
+//	SELECT regexp_config('histograms', 1);
+//
+// Settings:
+//
+//	sample_rate:       time one in N matches (0 disables timing)
+//	histograms:        record timed matches in latency histograms (0 or 1)
+//	slow_threshold_ns: log compilations and matches that take at least
+//	                   this long to pcre2_slow_log (0 disables the log)
+//	jit_stack_limit:   size in bytes that the JIT stack may grow to when a
+//	                   match runs out of stack, larger stacks are shrunk
+//	memo_size:         number of subjects whose REGEXP result is memoized
+//	                   per pattern (0 disables memoization), setting it
+//	                   clears the memos and turns them back on
+static void regexp_config(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	regexp_state *state = sqlite3_user_data(ctx);
+	assert(state);
+
+	if (sqlite3_value_type(argv[0]) != SQLITE_TEXT) {
+		sqlite3_result_error_code(ctx, SQLITE_MISMATCH);
+		sqlite3_result_error(ctx, "regexp: argument to config must be a string", -1);
+		return;
+	}
+	const char *name = (const char *)sqlite3_value_text(argv[0]);
+	if (name == NULL) {
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+	sqlite3_value *val = argc == 2 ? argv[1] : NULL;
+	sqlite3_int64 v = val ? sqlite3_value_int64(val) : 0;
+
+	#define strieq(_s1, _s2) (sqlite3_stricmp((_s1), (_s2)) == 0)
+
+	// Both caches have the same settings
+	const cache_list_config *config = &state->caches[0]->config;
+
+	if (strieq("sample_rate", name)) {
+		if (val) {
+			if (v < 0 || v > UINT32_MAX) {
+				sqlite3_result_error(ctx, "regexp: sample_rate must be "
+				                     "between 0 and 4294967295", -1);
+				return;
+			}
+			for (int i = 0; i < 2; i++) {
+				cache_list *l = state->caches[i];
+				l->config.sample_rate = (uint32_t)v;
+				for (cache_entry *e = l->root.next; e != &l->root; e = e->next) {
+					e->sample_countdown = 1;
+				}
+			}
+		}
+		sqlite3_result_int64(ctx, config->sample_rate);
+	} else if (strieq("histograms", name)) {
+		if (val) {
+			for (int i = 0; i < 2; i++) {
+				state->caches[i]->config.histograms = v != 0;
+			}
+		}
+		sqlite3_result_int(ctx, config->histograms);
+	} else if (strieq("slow_threshold_ns", name)) {
+		if (val) {
+			if (v < 0) {
+				sqlite3_result_error(ctx, "regexp: slow_threshold_ns must "
+				                     "not be negative", -1);
+				return;
+			}
+			for (int i = 0; i < 2; i++) {
+				cache_list *l = state->caches[i];
+				l->config.slow_threshold_ns = (uint64_t)v;
+				l->config.slow_ticks = 0;
+				if (v > 0) {
+					uint64_t ticks = re_clock_ticks(&l->clock, (uint64_t)v);
+					l->config.slow_ticks = ticks ? ticks : 1;
+				}
+			}
+		}
+		sqlite3_result_int64(ctx, (sqlite3_int64)config->slow_threshold_ns);
+	} else if (strieq("jit_stack_limit", name)) {
+		if (val) {
+			if (v < 0) {
+				sqlite3_result_error(ctx, "regexp: jit_stack_limit must "
+				                     "not be negative", -1);
+				return;
+			}
+			for (int i = 0; i < 2; i++) {
+				cache_list *l = state->caches[i];
+				l->config.jit_stack_limit = (size_t)v;
+				match_env_shrink(&l->env, (size_t)v);
+			}
+		}
+		sqlite3_result_int64(ctx, (sqlite3_int64)config->jit_stack_limit);
+	} else if (strieq("memo_size", name)) {
+		if (val) {
+			if (v < 0 || v > 65536) {
+				sqlite3_result_error(ctx, "regexp: memo_size must be "
+				                     "between 0 and 65536", -1);
+				return;
+			}
+			for (int i = 0; i < 2; i++) {
+				cache_list *l = state->caches[i];
+				l->config.memo_size = memo_round_size(v);
+				for (cache_entry *e = l->root.next; e != &l->root; e = e->next) {
+					if (e->memo) {
+						memo_free(e->memo);
+						e->memo = NULL;
+					}
+					e->memo_off = false;
+				}
+			}
+		}
+		sqlite3_result_int64(ctx, config->memo_size);
+	} else {
+		char *err = sqlite3_mprintf("regexp: invalid setting: %s", name);
+		if (err) {
+			sqlite3_result_error(ctx, err, -1);
+			re_free(err);
+		} else {
+			sqlite3_result_error_nomem(ctx);
+		}
+	}
+
+	#undef strieq
+}
+
+// regexp_shrink releases the memory that the caches do not need right now
+// (see: cache_list_shrink) and returns the number of bytes released:
+//
+//	SELECT regexp_shrink();
+//
+// SQLite does not let extensions hook sqlite3_release_memory, so processes
+// that react to memory pressure must call this on each connection.
+static void regexp_shrink(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+	(void)argc;
+	(void)argv;
+	regexp_state *state = sqlite3_user_data(ctx);
+	assert(state);
+
+	sqlite3_int64 released = 0;
+	for (int i = 0; i < 2; i++) {
+		cache_list *l = state->caches[i];
+		cache_memory before;
+		cache_memory after;
+		cache_list_memory(l, &before);
+		cache_list_shrink(l);
+		cache_list_memory(l, &after);
+		released += (sqlite3_int64)(before.code + before.jit + before.jit_stack +
+		                            before.match_data + before.pool + before.memo);
+		released -= (sqlite3_int64)(after.code + after.jit + after.jit_stack +
+		                            after.match_data + after.pool + after.memo);
+	}
+	sqlite3_result_int64(ctx, released);
+}
+
+// pcre2_cache_stats is an eponymous virtual table that reports statistics
+// for each cache (pattern IS NULL) and each pattern in the caches:
+//
+//	SELECT cache, pattern, matches, match_time_ns FROM pcre2_cache_stats
+//	ORDER BY match_time_ns DESC;
+//
+// Per-pattern statistics are lost when a pattern is evicted from the cache.
+// match_time_ns is an estimate extrapolated from the sampled matches (see
+// MATCH_SAMPLE_RATE). The latency percentiles are only available when
+// histograms are enabled with: regexp_config('histograms', 1).
+
+enum {
+	CACHE_STATS_CACHE,
+	CACHE_STATS_PATTERN,
+	CACHE_STATS_PATTERN_LENGTH,
+	CACHE_STATS_JIT_COMPILED,
+	CACHE_STATS_CODE_SIZE,
+	CACHE_STATS_JIT_SIZE,
+	CACHE_STATS_COMPILE_TIME_NS,
+	CACHE_STATS_HITS,
+	CACHE_STATS_MISSES,
+	CACHE_STATS_MATCHES,
+	CACHE_STATS_MATCH_TIME_NS,
+	CACHE_STATS_REF_COUNT,
+	CACHE_STATS_EVICTIONS,
+	CACHE_STATS_COMPILED,
+	CACHE_STATS_ENTRIES,
+	CACHE_STATS_SAMPLES,
+	CACHE_STATS_P50_NS,
+	CACHE_STATS_P90_NS,
+	CACHE_STATS_P99_NS,
+	CACHE_STATS_P999_NS,
+	CACHE_STATS_MAX_NS,
+	CACHE_STATS_JIT_STACK_SIZE,
+	CACHE_STATS_MATCH_DATA_SIZE,
+	CACHE_STATS_POOL_SIZE,
+	CACHE_STATS_MEMO_HITS,
+	CACHE_STATS_MEMO_SIZE,
+	CACHE_STATS_NCOL,
+};
+
+typedef struct {
+	const char    *cache;
+	char          *pattern; // truncated pattern or NULL for cache totals
+	uint32_t      nulls;    // bitmask of NULL columns
+	sqlite3_int64 vals[CACHE_STATS_NCOL];
+} cache_stats_row;
+
+typedef struct {
+	sqlite3_vtab base;
+	regexp_state *state;
+} cache_stats_vtab;
+
+typedef struct {
+	sqlite3_vtab_cursor base;
+	cache_stats_row     *rows;
+	int                 nrows;
+	int                 pos;
+} cache_stats_cursor;
+
+static int cache_stats_connect(sqlite3 *db, void *pAux, int argc,
+                               const char *const *argv,
+                               sqlite3_vtab **ppVtab, char **pzErr) {
+	(void)argc;
+	(void)argv;
+	(void)pzErr;
+
+	int rc = sqlite3_declare_vtab(db,
+		"CREATE TABLE x("
+		"cache TEXT, pattern TEXT, pattern_length INTEGER, jit_compiled INTEGER, "
+		"code_size INTEGER, jit_size INTEGER, compile_time_ns INTEGER, "
+		"hits INTEGER, misses INTEGER, matches INTEGER, match_time_ns INTEGER, "
+		"ref_count INTEGER, evictions INTEGER, compiled INTEGER, entries INTEGER, "
+		"samples INTEGER, p50_ns INTEGER, p90_ns INTEGER, p99_ns INTEGER, "
+		"p999_ns INTEGER, max_ns INTEGER, jit_stack_size INTEGER, "
+		"match_data_size INTEGER, pool_size INTEGER, memo_hits INTEGER, "
+		"memo_size INTEGER)");
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	cache_stats_vtab *vtab = re_malloc(sizeof(cache_stats_vtab));
+	if (!vtab) {
+		return SQLITE_NOMEM;
+	}
+	memset(vtab, 0, sizeof(cache_stats_vtab));
+	vtab->state = (regexp_state *)pAux;
+	*ppVtab = &vtab->base;
+	return SQLITE_OK;
+}
+
+static int cache_stats_disconnect(sqlite3_vtab *pVtab) {
+	re_free(pVtab);
+	return SQLITE_OK;
+}
+
+static int cache_stats_open(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+	(void)pVtab;
+	cache_stats_cursor *cur = re_malloc(sizeof(cache_stats_cursor));
+	if (!cur) {
+		return SQLITE_NOMEM;
+	}
+	memset(cur, 0, sizeof(cache_stats_cursor));
+	*ppCursor = &cur->base;
+	return SQLITE_OK;
+}
+
+static void cache_stats_cursor_reset(cache_stats_cursor *cur) {
+	for (int i = 0; i < cur->nrows; i++) {
+		if (cur->rows[i].pattern) {
+			re_free(cur->rows[i].pattern);
+		}
+	}
+	if (cur->rows) {
+		re_free(cur->rows);
+	}
+	cur->rows = NULL;
+	cur->nrows = 0;
+	cur->pos = 0;
+}
+
+static int cache_stats_close(sqlite3_vtab_cursor *pCursor) {
+	cache_stats_cursor *cur = (cache_stats_cursor *)pCursor;
+	cache_stats_cursor_reset(cur);
+	re_free(cur);
+	return SQLITE_OK;
+}
+
+// cache_stats_add_hist adds the percentiles of latency histogram h to row,
+// which are NULL if histograms are not enabled.
+static void cache_stats_add_hist(cache_stats_row *row, const re_clock *clock,
+                                 const latency_hist *h) {
+	if (!h) {
+		for (int i = CACHE_STATS_SAMPLES; i <= CACHE_STATS_MAX_NS; i++) {
+			row->nulls |= 1u << i;
+		}
+		return;
+	}
+	row->vals[CACHE_STATS_SAMPLES] = (sqlite3_int64)h->count;
+	row->vals[CACHE_STATS_P50_NS] = (sqlite3_int64)re_clock_ns(clock, hist_percentile(h, 50));
+	row->vals[CACHE_STATS_P90_NS] = (sqlite3_int64)re_clock_ns(clock, hist_percentile(h, 90));
+	row->vals[CACHE_STATS_P99_NS] = (sqlite3_int64)re_clock_ns(clock, hist_percentile(h, 99));
+	row->vals[CACHE_STATS_P999_NS] = (sqlite3_int64)re_clock_ns(clock, hist_percentile(h, 99.9));
+	row->vals[CACHE_STATS_MAX_NS] = (sqlite3_int64)re_clock_ns(clock, h->max);
+}
+
+// estimate_match_time_ns extrapolates the total time spent matching from the
+// timed (sampled) matches. Matches whose result was taken from the memo must
+// not be included in matches.
+static sqlite3_int64 estimate_match_time_ns(const re_clock *clock, uint64_t ticks,
+                                           uint64_t timed, uint64_t matches) {
+	if (timed == 0) {
+		return 0;
+	}
+	double ns = (double)re_clock_ns(clock, ticks);
+	return (sqlite3_int64)(ns * ((double)matches / (double)timed));
+}
+
+// cache_stats_add_entry adds the statistics of entry e to row and returns
+// false if memory could not be allocated.
+static bool cache_stats_add_entry(cache_stats_row *row, const cache_entry *e) {
+	const re_clock *clock = &e->cache->clock;
+	bool nomem;
+	row->pattern = truncate_pattern(e->pattern, e->pattern_len, &nomem);
+	if (nomem) {
+		return false;
+	}
+	if (!row->pattern) {
+		row->pattern = sqlite3_mprintf("%s", e->pattern);
+		if (!row->pattern) {
+			return false;
+		}
+	}
+
+	cache_memory mem;
+	memset(&mem, 0, sizeof(mem));
+	cache_entry_memory(e, &mem);
+	row->nulls = (1u << CACHE_STATS_MISSES) | (1u << CACHE_STATS_EVICTIONS) |
+		(1u << CACHE_STATS_COMPILED) | (1u << CACHE_STATS_ENTRIES) |
+		(1u << CACHE_STATS_JIT_STACK_SIZE) | (1u << CACHE_STATS_MATCH_DATA_SIZE) |
+		(1u << CACHE_STATS_POOL_SIZE);
+	row->vals[CACHE_STATS_PATTERN_LENGTH] = e->pattern_len;
+	row->vals[CACHE_STATS_JIT_COMPILED] = e->jit_compiled;
+	row->vals[CACHE_STATS_CODE_SIZE] = (sqlite3_int64)mem.code;
+	row->vals[CACHE_STATS_JIT_SIZE] = (sqlite3_int64)mem.jit;
+	row->vals[CACHE_STATS_COMPILE_TIME_NS] = (sqlite3_int64)re_clock_ns(clock, e->stats.compile_ticks);
+	row->vals[CACHE_STATS_HITS] = (sqlite3_int64)e->stats.hits;
+	row->vals[CACHE_STATS_MATCHES] = (sqlite3_int64)e->stats.matches;
+	row->vals[CACHE_STATS_MEMO_HITS] = (sqlite3_int64)e->stats.memo_hits;
+	row->vals[CACHE_STATS_MEMO_SIZE] = (sqlite3_int64)mem.memo;
+	row->vals[CACHE_STATS_MATCH_TIME_NS] = estimate_match_time_ns(clock,
+		e->stats.match_ticks, e->stats.timed_matches,
+		e->stats.matches - e->stats.memo_hits);
+	row->vals[CACHE_STATS_REF_COUNT] = e->ref_count;
+	cache_stats_add_hist(row, clock, e->hist);
+	return true;
+}
+
+static void cache_stats_add_totals(cache_stats_row *row, const cache_list *l) {
+	const re_clock *clock = &l->clock;
+	cache_memory mem;
+	cache_list_memory(l, &mem);
+	row->nulls = (1u << CACHE_STATS_PATTERN) | (1u << CACHE_STATS_PATTERN_LENGTH) |
+		(1u << CACHE_STATS_JIT_COMPILED) | (1u << CACHE_STATS_REF_COUNT);
+	row->vals[CACHE_STATS_CODE_SIZE] = (sqlite3_int64)mem.code;
+	row->vals[CACHE_STATS_JIT_SIZE] = (sqlite3_int64)mem.jit;
+	row->vals[CACHE_STATS_JIT_STACK_SIZE] = (sqlite3_int64)mem.jit_stack;
+	row->vals[CACHE_STATS_MATCH_DATA_SIZE] = (sqlite3_int64)mem.match_data;
+	row->vals[CACHE_STATS_POOL_SIZE] = (sqlite3_int64)mem.pool;
+	row->vals[CACHE_STATS_MEMO_HITS] = (sqlite3_int64)l->stats.memo_hits;
+	row->vals[CACHE_STATS_MEMO_SIZE] = (sqlite3_int64)mem.memo;
+	row->vals[CACHE_STATS_COMPILE_TIME_NS] = (sqlite3_int64)re_clock_ns(clock, l->stats.compile_ticks);
+	row->vals[CACHE_STATS_HITS] = (sqlite3_int64)l->stats.hits;
+	row->vals[CACHE_STATS_MISSES] = (sqlite3_int64)l->stats.misses;
+	row->vals[CACHE_STATS_MATCHES] = (sqlite3_int64)l->stats.matches;
+	row->vals[CACHE_STATS_MATCH_TIME_NS] = estimate_match_time_ns(clock,
+		l->stats.match_ticks, l->stats.timed_matches,
+		l->stats.matches - l->stats.memo_hits);
+	row->vals[CACHE_STATS_EVICTIONS] = (sqlite3_int64)l->stats.evacuations;
+	row->vals[CACHE_STATS_COMPILED] = (sqlite3_int64)l->stats.regexes_compiled;
+	row->vals[CACHE_STATS_ENTRIES] = cache_list_size(l);
+	cache_stats_add_hist(row, clock, l->hist);
+}
+
+// cache_stats_filter takes a snapshot of the caches since evaluating the
+// query may modify them (e.g. "WHERE pattern REGEXP ...").
+static int cache_stats_filter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                              const char *idxStr, int argc, sqlite3_value **argv) {
+	(void)idxNum;
+	(void)idxStr;
+	(void)argc;
+	(void)argv;
+	cache_stats_cursor *cur = (cache_stats_cursor *)pCursor;
+	regexp_state *state = ((cache_stats_vtab *)pCursor->pVtab)->state;
+	cache_stats_cursor_reset(cur);
+
+	int n = 0;
+	for (int i = 0; i < 2; i++) {
+		n += 1 + cache_list_size(state->caches[i]);
+	}
+	cur->rows = re_malloc(sizeof(cache_stats_row) * (size_t)n);
+	if (!cur->rows) {
+		return SQLITE_NOMEM;
+	}
+	memset(cur->rows, 0, sizeof(cache_stats_row) * (size_t)n);
+
+	for (int i = 0; i < 2; i++) {
+		const cache_list *l = state->caches[i];
+		cache_stats_row *row = &cur->rows[cur->nrows++];
+		row->cache = l->name;
+		cache_stats_add_totals(row, l);
+		for (const cache_entry *e = l->root.next; e != &l->root; e = e->next) {
+			row = &cur->rows[cur->nrows++];
+			row->cache = l->name;
+			if (!cache_stats_add_entry(row, e)) {
+				return SQLITE_NOMEM;
+			}
+		}
+	}
+	return SQLITE_OK;
+}
+
+static int cache_stats_next(sqlite3_vtab_cursor *pCursor) {
+	((cache_stats_cursor *)pCursor)->pos++;
+	return SQLITE_OK;
+}
+
+static int cache_stats_eof(sqlite3_vtab_cursor *pCursor) {
+	cache_stats_cursor *cur = (cache_stats_cursor *)pCursor;
+	return cur->pos >= cur->nrows;
+}
+
+static int cache_stats_column(sqlite3_vtab_cursor *pCursor,
+                              sqlite3_context *ctx, int i) {
+	cache_stats_cursor *cur = (cache_stats_cursor *)pCursor;
+	const cache_stats_row *row = &cur->rows[cur->pos];
+	if (row->nulls & (1u << i)) {
+		return SQLITE_OK;
+	}
+	switch (i) {
+	case CACHE_STATS_CACHE:
+		sqlite3_result_text(ctx, row->cache, -1, SQLITE_STATIC);
+		break;
+	case CACHE_STATS_PATTERN:
+		sqlite3_result_text(ctx, row->pattern, -1, SQLITE_TRANSIENT);
+		break;
+	default:
+		sqlite3_result_int64(ctx, row->vals[i]);
+		break;
+	}
+	return SQLITE_OK;
+}
+
+static int cache_stats_rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid) {
+	*pRowid = ((cache_stats_cursor *)pCursor)->pos + 1;
+	return SQLITE_OK;
+}
+
+static int cache_stats_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *info) {
+	(void)pVtab;
+	info->estimatedCost = 2.0 * CACHE_SIZE;
+	info->estimatedRows = 2 * (CACHE_SIZE + 1);
+	return SQLITE_OK;
+}
+
+static sqlite3_module cache_stats_module = {
+	.iVersion    = 0,
+	.xCreate     = NULL, // eponymous-only
+	.xConnect    = cache_stats_connect,
+	.xBestIndex  = cache_stats_best_index,
+	.xDisconnect = cache_stats_disconnect,
+	.xDestroy    = NULL,
+	.xOpen       = cache_stats_open,
+	.xClose      = cache_stats_close,
+	.xFilter     = cache_stats_filter,
+	.xNext       = cache_stats_next,
+	.xEof        = cache_stats_eof,
+	.xColumn     = cache_stats_column,
+	.xRowid      = cache_stats_rowid,
+};
+
+// pcre2_slow_log is an eponymous virtual table that reports the compilations
+// and matches that took at least slow_threshold_ns:
+//
+//	SELECT regexp_config('slow_threshold_ns', 1000000); -- 1ms
+//	SELECT * FROM pcre2_slow_log ORDER BY duration_ns DESC;
+//
+// Only the last SLOW_LOG_SIZE records are kept and the log can be cleared
+// with: regexp_info('reset_slow_log'). The subject of a match is not
+// recorded, only its length.
+
+enum {
+	SLOW_LOG_SEQ,
+	SLOW_LOG_CACHE,
+	SLOW_LOG_OPERATION,
+	SLOW_LOG_PATTERN,
+	SLOW_LOG_PATTERN_LENGTH,
+	SLOW_LOG_SUBJECT_LENGTH,
+	SLOW_LOG_DURATION_NS,
+	SLOW_LOG_JIT,
+};
+
+typedef struct {
+	sqlite3_vtab base;
+	regexp_state *state;
+} slow_log_vtab;
+
+typedef struct {
+	sqlite3_vtab_cursor base;
+	slow_log_record     *rows; // copy of the log, oldest first
+	int                 nrows;
+	int                 pos;
+} slow_log_cursor;
+
+static int slow_log_connect(sqlite3 *db, void *pAux, int argc,
+                            const char *const *argv,
+                            sqlite3_vtab **ppVtab, char **pzErr) {
+	(void)argc;
+	(void)argv;
+	(void)pzErr;
+
+	int rc = sqlite3_declare_vtab(db,
+		"CREATE TABLE x("
+		"seq INTEGER, cache TEXT, operation TEXT, pattern TEXT, "
+		"pattern_length INTEGER, subject_length INTEGER, duration_ns INTEGER, "
+		"jit INTEGER)");
+	if (rc != SQLITE_OK) {
+		return rc;
+	}
+	slow_log_vtab *vtab = re_malloc(sizeof(slow_log_vtab));
+	if (!vtab) {
+		return SQLITE_NOMEM;
+	}
+	memset(vtab, 0, sizeof(slow_log_vtab));
+	vtab->state = (regexp_state *)pAux;
+	*ppVtab = &vtab->base;
+	return SQLITE_OK;
+}
+
+static int slow_log_disconnect(sqlite3_vtab *pVtab) {
+	re_free(pVtab);
+	return SQLITE_OK;
+}
+
+static int slow_log_open(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor) {
+	(void)pVtab;
+	slow_log_cursor *cur = re_malloc(sizeof(slow_log_cursor));
+	if (!cur) {
+		return SQLITE_NOMEM;
+	}
+	memset(cur, 0, sizeof(slow_log_cursor));
+	*ppCursor = &cur->base;
+	return SQLITE_OK;
+}
+
+static void slow_log_cursor_reset(slow_log_cursor *cur) {
+	for (int i = 0; i < cur->nrows; i++) {
+		if (cur->rows[i].pattern) {
+			re_free(cur->rows[i].pattern);
+		}
+	}
+	if (cur->rows) {
+		re_free(cur->rows);
+	}
+	cur->rows = NULL;
+	cur->nrows = 0;
+	cur->pos = 0;
+}
+
+static int slow_log_close(sqlite3_vtab_cursor *pCursor) {
+	slow_log_cursor *cur = (slow_log_cursor *)pCursor;
+	slow_log_cursor_reset(cur);
+	re_free(cur);
+	return SQLITE_OK;
+}
+
+// slow_log_filter takes a snapshot of the log since evaluating the query may
+// add records to it.
+static int slow_log_filter(sqlite3_vtab_cursor *pCursor, int idxNum,
+                           const char *idxStr, int argc, sqlite3_value **argv) {
+	(void)idxNum;
+	(void)idxStr;
+	(void)argc;
+	(void)argv;
+	slow_log_cursor *cur = (slow_log_cursor *)pCursor;
+	const slow_log *log = &((slow_log_vtab *)pCursor->pVtab)->state->slow_log;
+	slow_log_cursor_reset(cur);
+	if (log->len == 0) {
+		return SQLITE_OK;
+	}
+
+	cur->rows = re_malloc(sizeof(slow_log_record) * (size_t)log->len);
+	if (!cur->rows) {
+		return SQLITE_NOMEM;
+	}
+	for (uint64_t seq = log->seq - (uint64_t)log->len; seq < log->seq; seq++) {
+		const slow_log_record *rec = &log->records[seq % SLOW_LOG_SIZE];
+		slow_log_record *row = &cur->rows[cur->nrows];
+		*row = *rec;
+		row->pattern = sqlite3_mprintf("%s", rec->pattern);
+		if (!row->pattern) {
+			return SQLITE_NOMEM;
+		}
+		cur->nrows++;
+	}
+	return SQLITE_OK;
+}
+
+static int slow_log_next(sqlite3_vtab_cursor *pCursor) {
+	((slow_log_cursor *)pCursor)->pos++;
+	return SQLITE_OK;
+}
+
+static int slow_log_eof(sqlite3_vtab_cursor *pCursor) {
+	slow_log_cursor *cur = (slow_log_cursor *)pCursor;
+	return cur->pos >= cur->nrows;
+}
+
+static int slow_log_column(sqlite3_vtab_cursor *pCursor,
+                           sqlite3_context *ctx, int i) {
+	slow_log_cursor *cur = (slow_log_cursor *)pCursor;
+	const slow_log_record *row = &cur->rows[cur->pos];
+	switch (i) {
+	case SLOW_LOG_SEQ:
+		sqlite3_result_int64(ctx, (sqlite3_int64)row->seq);
+		break;
+	case SLOW_LOG_CACHE:
+		sqlite3_result_text(ctx, row->cache, -1, SQLITE_STATIC);
+		break;
+	case SLOW_LOG_OPERATION:
+		sqlite3_result_text(ctx, row->subject_len < 0 ? "compile" : "match",
+		                    -1, SQLITE_STATIC);
+		break;
+	case SLOW_LOG_PATTERN:
+		sqlite3_result_text(ctx, row->pattern, -1, SQLITE_TRANSIENT);
+		break;
+	case SLOW_LOG_PATTERN_LENGTH:
+		sqlite3_result_int64(ctx, row->pattern_len);
+		break;
+	case SLOW_LOG_SUBJECT_LENGTH:
+		if (row->subject_len >= 0) {
+			sqlite3_result_int64(ctx, row->subject_len);
+		}
+		break;
+	case SLOW_LOG_DURATION_NS:
+		sqlite3_result_int64(ctx, (sqlite3_int64)row->duration_ns);
+		break;
+	case SLOW_LOG_JIT:
+		sqlite3_result_int(ctx, row->jit);
+		break;
+	}
+	return SQLITE_OK;
+}
+
+static int slow_log_rowid(sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid) {
+	slow_log_cursor *cur = (slow_log_cursor *)pCursor;
+	*pRowid = (sqlite3_int64)cur->rows[cur->pos].seq + 1;
+	return SQLITE_OK;
+}
+
+static int slow_log_best_index(sqlite3_vtab *pVtab, sqlite3_index_info *info) {
+	(void)pVtab;
+	info->estimatedCost = SLOW_LOG_SIZE;
+	info->estimatedRows = SLOW_LOG_SIZE;
+	return SQLITE_OK;
+}
+
+static sqlite3_module slow_log_module = {
+	.iVersion    = 0,
+	.xCreate     = NULL, // eponymous-only
+	.xConnect    = slow_log_connect,
+	.xBestIndex  = slow_log_best_index,
+	.xDisconnect = slow_log_disconnect,
+	.xDestroy    = NULL,
+	.xOpen       = slow_log_open,
+	.xClose      = slow_log_close,
+	.xFilter     = slow_log_filter,
+	.xNext       = slow_log_next,
+	.xEof        = slow_log_eof,
+	.xColumn     = slow_log_column,
+	.xRowid      = slow_log_rowid,
+};
+
+// FTS5 tokenizer
+//
+// The "pcre2" tokenizer emits every non-empty match of a pattern as a token:
+//
+//   CREATE VIRTUAL TABLE logs USING fts5(line, tokenize = "pcre2 '\w+'");
+//
+// An optional second argument of 'i' compiles the pattern caseless and folds
+// ASCII letters of the tokens to lower case so that queries are also
+// case-insensitive. The compiled pattern is taken from (and held in) the
+// regexp or iregexp cache for the lifetime of the tokenizer.
+
+typedef struct {
+	cache_entry      *ent;
+	pcre2_match_data *match_data; // oveccount == 1
+	bool             fold;        // fold tokens to lower case
+	char             *buf;        // folded token
+	size_t           buf_cap;
+} regexp_tokenizer;
+
+static void regexp_tokenizer_delete(Fts5Tokenizer *pTok) {
+	regexp_tokenizer *tok = (regexp_tokenizer *)pTok;
+	if (tok->match_data) {
+		pcre2_match_data_free(tok->match_data);
+	}
+	if (tok->ent) {
+		cache_entry_release(tok->ent);
+	}
+	if (tok->buf) {
+		re_free(tok->buf);
+	}
+	re_free(tok);
+}
+
+static int regexp_tokenizer_create(void *pCtx, const char **azArg, int nArg,
+                                   Fts5Tokenizer **ppOut) {
+	regexp_state *state = (regexp_state *)pCtx;
+	*ppOut = NULL;
+	// FTS5 does not provide a way to report an error message.
+	if (nArg < 1 || nArg > 2) {
+		return SQLITE_ERROR;
+	}
+	bool caseless = false;
+	if (nArg == 2) {
+		if (strcmp(azArg[1], "i") != 0) {
+			return SQLITE_ERROR;
+		}
+		caseless = true;
+	}
+	size_t pattern_len = strlen(azArg[0]);
+	if (pattern_len > UINT32_MAX) {
+		return SQLITE_TOOBIG;
+	}
+
+	regexp_tokenizer *tok = re_malloc(sizeof(regexp_tokenizer));
+	if (!tok) {
+		return SQLITE_NOMEM;
+	}
+	memset(tok, 0, sizeof(regexp_tokenizer));
+	tok->fold = caseless;
+
+	cache_list *cache = state->caches[caseless ? 1 : 0];
+	char *errmsg;
+	tok->ent = cache_list_lookup(cache, azArg[0], (uint32_t)pattern_len, caseless, &errmsg);
+	if (!tok->ent) {
+		regexp_tokenizer_delete((Fts5Tokenizer *)tok);
+		if (!errmsg) {
+			return SQLITE_NOMEM;
+		}
+		sqlite3_log(SQLITE_ERROR, "pcre2 tokenizer: %s", errmsg);
+		sqlite3_free(errmsg);
+		return SQLITE_ERROR;
+	}
+	if (!tok->ent->code) {
+		regexp_tokenizer_delete((Fts5Tokenizer *)tok);
+		sqlite3_log(SQLITE_ERROR, "pcre2 tokenizer: %s", LITSET_ONLY_ERROR);
+		return SQLITE_ERROR;
+	}
+	tok->match_data = pcre2_match_data_create(1, cache->general_context);
+	if (!tok->match_data) {
+		regexp_tokenizer_delete((Fts5Tokenizer *)tok);
+		return SQLITE_NOMEM;
+	}
+	*ppOut = (Fts5Tokenizer *)tok;
+	return SQLITE_OK;
+}
+
+// regexp_tokenizer_fold returns token folded to lower case (ASCII only).
+static const char *regexp_tokenizer_fold(regexp_tokenizer *tok, const char *token,
+                                         size_t len) {
+	if (len > tok->buf_cap) {
+		size_t cap = len < 64 ? 64 : len;
+		char *buf = re_malloc(cap);
+		if (!buf) {
+			return NULL;
+		}
+		if (tok->buf) {
+			re_free(tok->buf);
+		}
+		tok->buf = buf;
+		tok->buf_cap = cap;
+	}
+	for (size_t i = 0; i < len; i++) {
+		char c = token[i];
+		tok->buf[i] = (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+	}
+	return tok->buf;
+}
+
+static int regexp_tokenizer_tokenize(
+	Fts5Tokenizer *pTok, void *pCtx, int flags, const char *pText, int nText,
+	int (*xToken)(void *pCtx, int tflags, const char *pToken, int nToken,
+	              int iStart, int iEnd)) {
+	(void)flags;
+	regexp_tokenizer *tok = (regexp_tokenizer *)pTok;
+	if (nText <= 0) {
+		return SQLITE_OK;
+	}
+	regexp_iter it;
+	regexp_iter_init(&it, pText, (size_t)nText);
+	int rc;
+	while ((rc = regexp_iter_next(&it, tok->ent, tok->match_data)) == 1) {
+		const PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(tok->match_data);
+		size_t start = ovector[0];
+		size_t end = ovector[1];
+		if (start >= end) {
+			continue; // empty match or \K past the end
+		}
+		const char *token = &pText[start];
+		if (tok->fold) {
+			token = regexp_tokenizer_fold(tok, token, end - start);
+			if (!token) {
+				return SQLITE_NOMEM;
+			}
+		}
+		rc = xToken(pCtx, 0, token, (int)(end - start), (int)start, (int)end);
+		if (rc != SQLITE_OK) {
+			return rc;
+		}
+	}
+	if (rc < 0) {
+		if (rc == PCRE2_ERROR_NOMEMORY) {
+			return SQLITE_NOMEM;
+		}
+		sqlite3_log(SQLITE_ERROR, "pcre2 tokenizer: match error: %d", rc);
+		return SQLITE_ERROR;
+	}
+	return SQLITE_OK;
+}
+
+static fts5_tokenizer regexp_tokenizer_module = {
+	.xCreate   = regexp_tokenizer_create,
+	.xDelete   = regexp_tokenizer_delete,
+	.xTokenize = regexp_tokenizer_tokenize,
+};
+
+// fts5_api_from_db returns the FTS5 API of db or NULL if FTS5 is not
+// available (see: https://sqlite.org/fts5.html#extending_fts5).
+static fts5_api *fts5_api_from_db(sqlite3 *db) {
+	fts5_api *api = NULL;
+	sqlite3_stmt *stmt;
+	if (sqlite3_prepare_v2(db, "SELECT fts5(?1)", -1, &stmt, NULL) != SQLITE_OK) {
+		return NULL;
+	}
+	sqlite3_bind_pointer(stmt, 1, (void *)&api, "fts5_api_ptr", NULL);
+	sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	return api;
+}
+
+// C API (see: sqlite3_pcre2.h). A pcre2x_pattern is a cache_entry of the
+// cache_list of a pcre2x_cache.
+
+struct pcre2x_cache {
+	cache_list *cache;
+	bool       caseless;
+};
+
+// Minimum number of subjects pcre2x_match_many tests with the required
+// literal before it checks whether the literal rules out enough subjects.
+#define PCRE2X_PREFILTER_SAMPLE 1024
+
+API pcre2x_cache *pcre2x_cache_new(int flags) {
+	if (sqlite3_api == NULL) {
+		return NULL; // extension not loaded
+	}
+	pcre2x_cache *c = re_malloc(sizeof(pcre2x_cache));
+	if (!c) {
+		return NULL;
+	}
+	c->caseless = (flags & PCRE2X_CASELESS) != 0;
+	c->cache = cache_list_init(c->caseless ? "pcre2x_icache" : "pcre2x_cache");
+	if (!c->cache) {
+		re_free(c);
+		return NULL;
+	}
+	return c;
+}
+
+API void pcre2x_cache_free(pcre2x_cache *c) {
+	if (c) {
+		cache_list_free(c->cache);
+		re_free(c);
+	}
+}
+
+API int pcre2x_compile(pcre2x_cache *c, const char *pattern, int pattern_len,
+                       pcre2x_pattern **out, char **errmsg) {
+	*out = NULL;
+	*errmsg = NULL;
+	size_t len = pattern_len < 0 ? strlen(pattern) : (size_t)pattern_len;
+	if (len > INT32_MAX) {
+		*errmsg = sqlite3_mprintf("pcre2x_compile: pattern too long");
+		return SQLITE_TOOBIG;
+	}
+	cache_entry *ent = cache_list_lookup(c->cache, pattern, (uint32_t)len,
+	                                     c->caseless, errmsg);
+	if (!ent) {
+		return *errmsg ? SQLITE_ERROR : SQLITE_NOMEM;
+	}
+	*out = (pcre2x_pattern *)ent;
+	return SQLITE_OK;
+}
+
+API void pcre2x_release(pcre2x_pattern *p) {
+	if (p) {
+		cache_entry_release((cache_entry *)p);
+	}
+}
+
+API int pcre2x_match(pcre2x_pattern *p, const char *subject, size_t subject_len) {
+	cache_entry *ent = (cache_entry *)p;
+	int rc = regexp_match(ent->cache, ent, subject, subject_len);
+	if (rc == PCRE2_ERROR_NOMATCH) {
+		return 0;
+	}
+	return rc < 0 ? rc : 1;
+}
+
+API int pcre2x_match_many(pcre2x_pattern *p, const char *const *subjects,
+                          const size_t *lens, size_t n, uint8_t *out) {
+	cache_entry *ent = (cache_entry *)p;
+	memset(out, 0, (n + 7) / 8);
+	if (cache_entry_init_literal(ent) != SQLITE_OK) {
+		return PCRE2_ERROR_NOMEMORY;
+	}
+	// Like regexp_filter, stop using the required literal if it does not
+	// rule out at least half of the subjects.
+	bool prefilter = ent->literal_len != 0;
+	size_t tested = 0;
+	size_t passed = 0;
+	for (size_t i = 0; i < n; i++) {
+		const char *subject = subjects[i];
+		if (!subject) {
+			continue;
+		}
+		if (prefilter) {
+			tested++;
+			if (!cache_entry_may_match(ent, subject, lens[i])) {
+				continue;
+			}
+			passed++;
+			if (tested >= PCRE2X_PREFILTER_SAMPLE && passed > tested / 2) {
+				prefilter = false;
+			}
+		}
+		int rc = regexp_match(ent->cache, ent, subject, lens[i]);
+		if (rc == PCRE2_ERROR_NOMATCH) {
+			continue;
+		}
+		if (rc < 0) {
+			return rc;
+		}
+		out[i / 8] |= (uint8_t)(1u << (i % 8));
+	}
+	return 0;
+}
+
+// Extension entry point.
+API int sqlite3_sqlitepcre_init(sqlite3 *db, char **pzErrMsg, const sqlite3_api_routines *pApi) {
+	(void)pzErrMsg;
+
+	int rc = SQLITE_OK;
+	SQLITE_EXTENSION_INIT2(pApi);
+
+	cache_list *rcache = cache_list_init("regexp");
+	cache_list *icache = cache_list_init("iregexp");
+	// The caches that are freed on error, which are cleared once SQLite owns
+	// them: the function destructor is called even if registering fails.
+	cache_list *rcache_free = rcache;
+	cache_list *icache_free = icache;
+	if (!rcache || !icache) {
+		rc = SQLITE_NOMEM;
+		goto err_exit;
+	}
+
+	const int opts = SQLITE_UTF8 | SQLITE_INNOCUOUS | SQLITE_DETERMINISTIC;
+
+	// REGEXP and IREGEXP own the caches and are registered first so that
+	// nothing else refers to a cache that is freed on error.
+	rc = sqlite3_create_function_v2(db, "regexp", 2, opts, (void*)rcache, regexp,
+	                                NULL, NULL, sqlite3_cache_list_destroy);
+	rcache_free = NULL;
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "iregexp", 2, opts, (void*)icache, iregexp,
 	                                NULL, NULL, sqlite3_cache_list_destroy);
+	icache_free = NULL;
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+
+	regexp_state *state = re_malloc(sizeof(regexp_state));
+	if (!state) {
+		rc = SQLITE_NOMEM;
+		goto err_exit;
+	}
+	memset(state, 0, sizeof(regexp_state));
+	state->caches[0] = rcache;
+	state->caches[1] = icache;
+	// The module destructor frees state (even if this call fails).
+	rc = sqlite3_create_module_v2(db, "pcre2_cache_stats", &cache_stats_module,
+	                              (void*)state, regexp_state_destroy);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rcache->slow_log = &state->slow_log;
+	icache->slow_log = &state->slow_log;
+	rc = sqlite3_create_module_v2(db, "pcre2_slow_log", &slow_log_module,
+	                              (void*)state, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+
+	// Variadic: regexp_any(subject, pattern1, pattern2, ...)
+	rc = sqlite3_create_function_v2(db, "regexp_any", -1, opts, (void*)rcache, regexp_any,
+	                                NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "regexp_which", -1, opts, (void*)rcache,
+	                                regexp_which, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+#ifdef HAVE_ZLIB
+	rc = sqlite3_create_function_v2(db, "regexp_z", 2, opts, (void*)rcache, regexp_z,
+	                                NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "regexp_z", 3, opts, (void*)rcache, regexp_z,
+	                                NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+#endif
+	rc = sqlite3_create_function_v2(db, "regexp_json_any", 2, opts, (void*)rcache,
+	                                regexp_json_any, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "regexp_json_any", 3, opts, (void*)rcache,
+	                                regexp_json_any, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "regexp_json_any", 4, opts, (void*)rcache,
+	                                regexp_json_any, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "regexp_signature", 1, opts, NULL,
+	                                regexp_signature, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "regexp_signature", 2, opts, NULL,
+	                                regexp_signature, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "regexp_may_match", 2, opts, (void*)rcache,
+	                                regexp_may_match, NULL, NULL, NULL);
 	if (rc != SQLITE_OK) {
 		goto err_exit;
 	}
@@ -762,13 +10055,114 @@ API int sqlite3_sqlitepcre_init(sqlite3 *db, char **pzErrMsg, const sqlite3_api_
 		goto err_exit;
 	}
 
+	// Not deterministic since the result includes the compile time.
+	const int explain_opts = SQLITE_UTF8 | SQLITE_INNOCUOUS;
+	rc = sqlite3_create_function_v2(db, "regexp_explain", 1, explain_opts, (void*)rcache,
+	                                regexp_explain, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "regexp_explain", 2, explain_opts, (void*)rcache,
+	                                regexp_explain, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+
+	// Settings are changed by side effect so regexp_config is not
+	// deterministic and cannot be used in triggers or views.
+	const int config_opts = SQLITE_UTF8 | SQLITE_DIRECTONLY;
+	rc = sqlite3_create_function_v2(db, "regexp_config", 1, config_opts, (void*)state,
+	                                regexp_config, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "regexp_config", 2, config_opts, (void*)state,
+	                                regexp_config, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "regexp_shrink", 0, config_opts, (void*)state,
+	                                regexp_shrink, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	// Reads a table given by name and samples it at random.
+	rc = sqlite3_create_function_v2(db, "regexp_estimate", 3, config_opts, (void*)rcache,
+	                                regexp_estimate, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "regexp_estimate", 4, config_opts, (void*)rcache,
+	                                regexp_estimate, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_function_v2(db, "regexp_estimate", 5, config_opts, (void*)rcache,
+	                                regexp_estimate, NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+
+	rc = sqlite3_create_module_v2(db, "regexp_split", &regexp_split_module,
+	                              (void*)rcache, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_module_v2(db, "regexp_parse", &regexp_parse_module,
+	                              (void*)rcache, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_module_v2(db, "regexp_trgm", &trgm_module,
+	                              (void*)rcache, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_module_v2(db, "regexp_filter", &regexp_filter_module,
+	                              (void*)rcache, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_module_v2(db, "regexp_ruleset", &ruleset_module,
+	                              (void*)rcache, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_module_v2(db, "regexp_results", &results_module,
+	                              (void*)rcache, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+#ifndef _WIN32
+	rc = sqlite3_create_module_v2(db, "regexp_scan", &regexp_scan_module,
+	                              (void*)rcache, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+	rc = sqlite3_create_module_v2(db, "regexp_grep", &regexp_grep_module,
+	                              (void*)rcache, NULL);
+	if (rc != SQLITE_OK) {
+		goto err_exit;
+	}
+#endif
+
+	// The tokenizer is only registered if FTS5 is available.
+	fts5_api *fts5 = fts5_api_from_db(db);
+	if (fts5) {
+		rc = fts5->xCreateTokenizer(fts5, "pcre2", (void*)state,
+		                            &regexp_tokenizer_module, NULL);
+		if (rc != SQLITE_OK) {
+			goto err_exit;
+		}
+	}
+
 err_exit:
 	if (rc != SQLITE_OK) {
-		if (rcache) {
-			cache_list_free(rcache);
+		if (rcache_free) {
+			cache_list_free(rcache_free);
 		}
-		if (icache) {
-			cache_list_free(icache);
+		if (icache_free) {
+			cache_list_free(icache_free);
 		}
 	}
 	return rc;
@@ -8,6 +8,9 @@
 // test suite.
 
 #include <sqlite3.h>
+#include <dlfcn.h>
+
+#include "sqlite3_pcre2.h"
 
 #include <fstream>
 #include <iostream>
@@ -15,6 +18,7 @@
 #include <cstring>
 #include <thread>
 #include <cassert>
+#include <iterator>
 
 static void check_sqlite3_response_impl(int code, int line) {
 	const char *err = sqlite3_errstr(code);
@@ -199,6 +203,93 @@ static bool test_regex(sqlite3 *db, bool caseless) {
 	return passed;
 }
 
+#ifdef __APPLE__
+#define EXTENSION_LIBRARY "./sqlite3_pcre2.dylib"
+#else
+#define EXTENSION_LIBRARY "./sqlite3_pcre2.so"
+#endif
+
+// test_batch_api tests the C API of sqlite3_pcre2.h, which is looked up in the
+// extension library loaded by init_test_database.
+static bool test_batch_api(bool caseless) {
+	void *lib = dlopen(EXTENSION_LIBRARY, RTLD_NOW | RTLD_NOLOAD);
+	if (!lib) {
+		std::printf("Error: dlopen: %s\n", dlerror());
+		return false;
+	}
+	#define LOOKUP(name) auto name = (decltype(&::name))dlsym(lib, #name)
+	LOOKUP(pcre2x_cache_new);
+	LOOKUP(pcre2x_cache_free);
+	LOOKUP(pcre2x_compile);
+	LOOKUP(pcre2x_release);
+	LOOKUP(pcre2x_match);
+	LOOKUP(pcre2x_match_many);
+	#undef LOOKUP
+
+	bool passed = true;
+	pcre2x_cache *cache = pcre2x_cache_new(caseless ? PCRE2X_CASELESS : 0);
+	assert(cache);
+
+	// Match every pattern against all the subjects (and a NULL subject)
+	// and check that the bitmap agrees with pcre2x_match.
+	constexpr size_t n = std::size(regexTests) + 1;
+	const char *subjects[n];
+	size_t lens[n];
+	for (size_t i = 0; i < n - 1; i++) {
+		subjects[i] = regexTests[i].subject.c_str();
+		lens[i] = regexTests[i].subject.size();
+	}
+	subjects[n - 1] = NULL;
+	lens[n - 1] = 0;
+
+	for (size_t i = 0; i < n - 1; i++) {
+		const RegexTest &test = regexTests[i];
+		pcre2x_pattern *p;
+		char *errmsg;
+		if (pcre2x_compile(cache, test.pattern.c_str(), (int)test.pattern.size(),
+		                   &p, &errmsg) != SQLITE_OK) {
+			std::printf("Error: pcre2x_compile: %s\n", errmsg);
+			sqlite3_free(errmsg);
+			passed = false;
+			continue;
+		}
+		uint8_t out[(n + 7) / 8];
+		int rc = pcre2x_match_many(p, subjects, lens, n, out);
+		if (rc != 0) {
+			std::printf("Error: pcre2x_match_many(%s): %d\n", test.pattern.c_str(), rc);
+			passed = false;
+		}
+		for (size_t j = 0; rc == 0 && j < n; j++) {
+			bool got = out[j / 8] & (1 << (j % 8));
+			bool want = j < n - 1 && pcre2x_match(p, subjects[j], lens[j]) == 1;
+			if (j == i && want != test.match) {
+				std::printf("Error: pcre2x_match(%s, %s) = %s want: %s\n",
+					test.pattern.c_str(), test.subject.c_str(), bool_to_string(want),
+					bool_to_string(test.match));
+				passed = false;
+			}
+			if (got != want) {
+				std::printf("Error: pcre2x_match_many(%s)[%zu] = %s want: %s\n",
+					test.pattern.c_str(), j, bool_to_string(got), bool_to_string(want));
+				passed = false;
+			}
+		}
+		pcre2x_release(p);
+	}
+
+	pcre2x_pattern *p;
+	char *errmsg;
+	if (pcre2x_compile(cache, "(", -1, &p, &errmsg) != SQLITE_ERROR || !errmsg) {
+		std::printf("Error: pcre2x_compile: invalid pattern compiled\n");
+		passed = false;
+	}
+	sqlite3_free(errmsg);
+
+	pcre2x_cache_free(cache);
+	dlclose(lib);
+	return passed;
+}
+
 int main(int argc, char const *argv[]) {
 	(void)argc;
 	(void)argv;
@@ -214,6 +305,14 @@ int main(int argc, char const *argv[]) {
 		std::cout << "FAIL: iregexp" << std::endl;
 		failed = true;
 	}
+	if (!test_batch_api(false)) {
+		std::cout << "FAIL: pcre2x" << std::endl;
+		failed = true;
+	}
+	if (!test_batch_api(true)) {
+		std::cout << "FAIL: pcre2x caseless" << std::endl;
+		failed = true;
+	}
 	assert(sqlite3_close_v2(db) == SQLITE_OK);
 
 	if (failed) {
@@ -0,0 +1,93 @@
+// vim: ts=4 sw=4
+
+// C API of the sqlite3-pcre2 extension for matching outside of SQL.
+//
+// The API uses the allocator of the SQLite library that loaded the extension
+// so the extension must be loaded (sqlite3_load_extension or
+// sqlite3_auto_extension) before any of these functions are called.
+//
+// A pcre2x_cache is the same compiled pattern cache that is used by the
+// REGEXP function and must only be used by one thread at a time (use one
+// cache per thread). Patterns are compiled and JIT compiled like they are for
+// REGEXP and matched with the same pcre2 match call, but without the memo of
+// recent subjects that REGEXP keeps. Only pcre2x_match_many skips subjects that
+// do not contain the pattern's required literal, like regexp_filter.
+//
+// Example:
+//
+//	pcre2x_cache *cache = pcre2x_cache_new(0);
+//	pcre2x_pattern *p;
+//	char *errmsg;
+//	if (pcre2x_compile(cache, "ERROR \\d+", -1, &p, &errmsg) != SQLITE_OK) {
+//		fprintf(stderr, "%s\n", errmsg);
+//		sqlite3_free(errmsg);
+//	}
+//	uint8_t matches[(N + 7) / 8];
+//	pcre2x_match_many(p, subjects, lens, N, matches);
+//	pcre2x_release(p);
+//	pcre2x_cache_free(cache);
+
+#ifndef SQLITE3_PCRE2_H
+#define SQLITE3_PCRE2_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef PCRE2X_API
+#ifdef _WIN32
+#define PCRE2X_API __declspec(dllimport)
+#else
+#define PCRE2X_API
+#endif
+#endif
+
+// pcre2x_cache_new flags.
+#define PCRE2X_CASELESS 0x1 // compile patterns caseless (like IREGEXP)
+
+typedef struct pcre2x_cache pcre2x_cache;
+typedef struct pcre2x_pattern pcre2x_pattern;
+
+// pcre2x_cache_new returns a new pattern cache or NULL if memory could not be
+// allocated or the extension has not been loaded.
+PCRE2X_API pcre2x_cache *pcre2x_cache_new(int flags);
+
+// pcre2x_cache_free frees cache. All patterns must have been released.
+PCRE2X_API void pcre2x_cache_free(pcre2x_cache *cache);
+
+// pcre2x_compile stores the compiled pattern in *out, which is taken from the
+// cache if it was compiled before, and must be released with pcre2x_release.
+// If pattern_len is negative pattern must be NUL-terminated. On error an
+// SQLite error code is returned and *errmsg is set to an error message, which
+// must be freed with sqlite3_free (NULL if memory could not be allocated).
+PCRE2X_API int pcre2x_compile(pcre2x_cache *cache, const char *pattern,
+                              int pattern_len, pcre2x_pattern **out,
+                              char **errmsg);
+
+// pcre2x_release releases a pattern returned by pcre2x_compile.
+PCRE2X_API void pcre2x_release(pcre2x_pattern *pattern);
+
+// pcre2x_match returns 1 if subject matches pattern, 0 if it does not or a
+// negative PCRE2 error code (see: pcre2_get_error_message).
+PCRE2X_API int pcre2x_match(pcre2x_pattern *pattern, const char *subject,
+                            size_t subject_len);
+
+// pcre2x_match_many matches pattern against n subjects and sets bit i of the
+// bitmap out, which must be (n + 7) / 8 bytes long, if subjects[i] matches:
+//
+//	out[i / 8] & (1 << (i % 8))
+//
+// NULL subjects never match. Returns 0 or a negative PCRE2 error code, in
+// which case out is undefined.
+PCRE2X_API int pcre2x_match_many(pcre2x_pattern *pattern,
+                                 const char *const *subjects,
+                                 const size_t *lens, size_t n, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SQLITE3_PCRE2_H
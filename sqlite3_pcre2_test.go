@@ -4,8 +4,11 @@ package pcre2
 
 import (
 	"bytes"
+	"compress/flate"
 	"compress/gzip"
+	"compress/zlib"
 	"database/sql"
+	"encoding/json"
 	"errors"
 	"fmt"
 	"io"
@@ -13,6 +16,7 @@ import (
 	"os"
 	"path/filepath"
 	"reflect"
+	"regexp"
 	"sort"
 	"strings"
 	"sync"
@@ -139,6 +143,45 @@ func InsertIntoTable(t testing.TB, db *sql.DB, tableName string, values ...any)
 	}
 }
 
+// InitSharedDatabase is InitDatabase limited to a single connection, for tests
+// that create their own tables: the tables live in a shared in-memory database
+// and the pattern caches are per-connection.
+func InitSharedDatabase(t testing.TB) *sql.DB {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+	db.SetMaxOpenConns(1)
+	return db
+}
+
+// MustExec executes query and fails the test if it returns an error.
+func MustExec(t testing.TB, db *sql.DB, query string, args ...any) {
+	t.Helper()
+	if _, err := db.Exec(query, args...); err != nil {
+		t.Fatalf("%s: %v", query, err)
+	}
+}
+
+func QueryIDs(t testing.TB, db *sql.DB, query string, args ...any) []int64 {
+	t.Helper()
+	rows, err := db.Query(query, args...)
+	if err != nil {
+		t.Fatalf("%s: %v", query, err)
+	}
+	defer rows.Close()
+	ids := []int64{}
+	for rows.Next() {
+		var id int64
+		if err := rows.Scan(&id); err != nil {
+			t.Fatal(err)
+		}
+		ids = append(ids, id)
+	}
+	if err := rows.Err(); err != nil {
+		t.Fatal(err)
+	}
+	return ids
+}
+
 func InsertIntoStringsTable(t testing.TB, db *sql.DB, values ...any) {
 	InsertIntoTable(t, db, "strings_table", values...)
 }
@@ -768,6 +811,49 @@ func TestMatchFailure(t *testing.T) {
 	}
 }
 
+func TestJITStackGrowth(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	// Settings are per-connection.
+	db.SetMaxOpenConns(1)
+
+	const pattern = `^(?:(a)|b)*$`
+	subject := strings.Repeat("a", 100000)
+	var match bool
+	if err := db.QueryRow(`SELECT ? REGEXP ?;`, subject, pattern).Scan(&match); err != nil {
+		t.Fatal(err)
+	}
+	if !match {
+		t.Error("expected a match")
+	}
+	var size, grows int64
+	if err := db.QueryRow(`SELECT regexp_info('jit_stack_size'), regexp_info('jit_stack_grows');`).Scan(&size, &grows); err != nil {
+		t.Fatal(err)
+	}
+	if size <= 512*1024 || grows == 0 {
+		t.Errorf("jit_stack_size: %d jit_stack_grows: %d: expected the stack to grow", size, grows)
+	}
+
+	// Lowering the limit shrinks the stack and the match fails.
+	if _, err := db.Exec(`SELECT regexp_config('jit_stack_limit', 512 * 1024);`); err != nil {
+		t.Fatal(err)
+	}
+	if err := db.QueryRow(`SELECT regexp_info('jit_stack_size');`).Scan(&size); err != nil {
+		t.Fatal(err)
+	}
+	if size != 512*1024 {
+		t.Errorf("jit_stack_size: got %d want: %d", size, 512*1024)
+	}
+	err := db.QueryRow(`SELECT ? REGEXP ?;`, subject, pattern).Scan(&match)
+	if err == nil || !strings.HasSuffix(err.Error(), "JIT stack limit reached") {
+		t.Errorf("expected a JIT stack limit error got: %v", err)
+	}
+	if _, err := db.Exec(`SELECT regexp_config('jit_stack_limit', -1);`); err == nil {
+		t.Error("expected an error for a negative jit_stack_limit")
+	}
+}
+
 func TestLibraryNotFound(t *testing.T) {
 	origPath := libraryPath
 	SetLibraryPath("/tmp")
@@ -888,6 +974,148 @@ loop:
 	}
 }
 
+func TestRegexpAny(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	tests := []struct {
+		subject  any
+		patterns []any
+		which    int
+	}{
+		{"abc", []any{"x", "b", "a"}, 2},
+		{"abc", []any{"x", "y"}, 0},
+		{"abc", []any{"c$"}, 1},
+		{nil, []any{"a"}, 0},
+		{"xyz", []any{"", "x"}, 1},
+		// Combined: the leftmost match is the second pattern.
+		{"a1 b2", []any{`b\d`, `a\d`, `\s`}, 1},
+		{"a1 b2", []any{`[xy]\d`, `a\d`, `\s`}, 2},
+		// Not combined (back reference and named group).
+		{"abab", []any{`(ab)\1`, `(?<x>b)`}, 1},
+		{"ABab", []any{`(?i)x`, `(?i:b)`}, 2},
+		// Caseless with an option reset, which has no required literal.
+		{"xFOO", []any{`x(?^i)foo`, `zzz`}, 1},
+	}
+	for _, test := range tests {
+		args := append([]any{test.subject}, test.patterns...)
+		params := strings.Repeat(", ?", len(test.patterns))
+		var anyMatch bool
+		var which int
+		query := `SELECT regexp_any(?` + params + `), regexp_which(?` + params + `);`
+		if err := db.QueryRow(query, append(args, args...)...).Scan(&anyMatch, &which); err != nil {
+			t.Fatal(err)
+		}
+		if anyMatch != (test.which != 0) || which != test.which {
+			t.Errorf("%q %q: regexp_any = %t regexp_which = %d; want: %t %d",
+				test.subject, test.patterns, anyMatch, which, test.which != 0, test.which)
+		}
+	}
+
+	// More than 32 patterns: the patterns after the 32nd are not cached
+	// as auxiliary data.
+	var values []string
+	for i := 0; i < 40; i++ {
+		values = append(values, fmt.Sprintf("v%02d", i))
+	}
+	InsertIntoStringsTable(t, db, anySlice(values)...)
+	var a []string
+	for i := len(values) - 1; i >= 0; i-- {
+		a = append(a, `'^`+values[i]+`$'`)
+	}
+	rows, err := db.Query(`SELECT value, regexp_which(value, ` + strings.Join(a, ", ") +
+		`) FROM strings_table ORDER BY value;`)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer rows.Close()
+	for i := 0; rows.Next(); i++ {
+		var s string
+		var which int
+		if err := rows.Scan(&s, &which); err != nil {
+			t.Fatal(err)
+		}
+		if want := len(values) - i; which != want {
+			t.Errorf("regexp_which(%q) = %d; want: %d", s, which, want)
+		}
+	}
+	if err := rows.Err(); err != nil {
+		t.Fatal(err)
+	}
+
+	for _, query := range []string{
+		`SELECT regexp_any('a');`,
+		`SELECT regexp_any('a', 'b', '(');`,
+		`SELECT regexp_which('a', NULL);`,
+	} {
+		var n int
+		if err := db.QueryRow(query).Scan(&n); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}
+
+func TestKeywordList(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	// Use a single connection since the caches are per-connection.
+	db.SetMaxOpenConns(1)
+
+	var keywords []string
+	for i := 0; i < 20000; i++ {
+		keywords = append(keywords, fmt.Sprintf("kw%d\\.x", i))
+	}
+	small := "(" + strings.Join(keywords[:10], "|") + ")"
+	large := "(?:" + strings.Join(keywords, "|") + ")"
+
+	var engine string
+	if err := db.QueryRow(`SELECT regexp_explain(?) ->> '$.engine';`, small).Scan(&engine); err != nil {
+		t.Fatal(err)
+	}
+	if engine != "literal_set" {
+		t.Errorf("engine = %q; want: %q", engine, "literal_set")
+	}
+
+	tests := []struct {
+		pattern  string
+		subject  string
+		caseless bool
+		want     bool
+	}{
+		{small, "a kw9.x b", false, true},
+		{small, "a kw10.x b", false, false},
+		{small, "a kw9x b", false, false},
+		{small, "KW1.X", false, false},
+		{small, "KW1.X", true, true},
+		{small, "Kw1.x", true, true}, // Kelvin sign
+		{large, "a kw19999.x b", false, true},
+		{large, "a kw20000.x b", false, false},
+		{large, "KW123.X", true, true},
+	}
+	for _, test := range tests {
+		query := `SELECT REGEXP(?, ?);`
+		if test.caseless {
+			query = `SELECT IREGEXP(?, ?);`
+		}
+		var got bool
+		if err := db.QueryRow(query, test.pattern, test.subject).Scan(&got); err != nil {
+			t.Fatal(err)
+		}
+		if got != test.want {
+			t.Errorf("%s %.20q %q = %t; want: %t", query, test.pattern, test.subject,
+				got, test.want)
+		}
+	}
+
+	// The large list is too large for PCRE2 so only REGEXP can use it.
+	var n int
+	err := db.QueryRow(`SELECT count(*) FROM regexp_split('a', ?);`, large).Scan(&n)
+	if err == nil || !strings.Contains(err.Error(), "pattern is too large") {
+		t.Errorf("regexp_split: got error %v; want: %q", err, "pattern is too large")
+	}
+}
+
 func TestCacheExhaustion(t *testing.T) {
 	db, cleanup := InitDatabase(t)
 	t.Cleanup(cleanup)
@@ -1084,3 +1312,1365 @@ func BenchmarkFindLibrary(b *testing.B) {
 		}
 	}
 }
+
+func TestRegexpSplit(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	// Expected values match Go's regexp.Split
+	tests := []struct {
+		subject, pattern string
+		want             []string
+	}{
+		{"a, b,c", `\s*,\s*`, []string{"a", "b", "c"}},
+		{"abc", ``, []string{"a", "b", "c"}},
+		{"", `,`, []string{""}},
+		{"", ``, nil},
+		{",a,,b,", `,`, []string{"", "a", "", "b", ""}},
+		{"abaabaccadaaae", `a*`, []string{"", "b", "b", "c", "c", "d", "e"}},
+		{"日本語,x", `,`, []string{"日本語", "x"}},
+		{"line1\nline2\n", `\r?\n`, []string{"line1", "line2", ""}},
+		{"no match", `\d`, []string{"no match"}},
+	}
+	for _, test := range tests {
+		rows, err := db.Query(`SELECT value FROM regexp_split(?, ?) ORDER BY rowid;`,
+			test.subject, test.pattern)
+		if err != nil {
+			t.Fatal(err)
+		}
+		var got []string
+		for rows.Next() {
+			var s string
+			if err := rows.Scan(&s); err != nil {
+				t.Fatal(err)
+			}
+			got = append(got, s)
+		}
+		if err := rows.Err(); err != nil {
+			t.Fatal(err)
+		}
+		if !reflect.DeepEqual(got, test.want) {
+			t.Errorf("regexp_split(%q, %q) = %q; want: %q", test.subject,
+				test.pattern, got, test.want)
+		}
+	}
+
+	// Join against a table
+	InsertIntoStringsTable(t, db, "a,b", "c,d,e")
+	var n int64
+	err := db.QueryRow(`SELECT COUNT(*) FROM strings_table, regexp_split(strings_table.value, ',');`).Scan(&n)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if n != 5 {
+		t.Errorf("got %d rows; want: %d", n, 5)
+	}
+
+	// Invalid patterns
+	err = db.QueryRow(`SELECT COUNT(*) FROM regexp_split('a', '[a');`).Scan(&n)
+	const exp = "regexp: error compiling pattern '[a' at offset 2: missing terminating ] for character class"
+	if err == nil || err.Error() != exp {
+		t.Errorf("error got: %v want: %q", err, exp)
+	}
+}
+
+func TestRegexpParse(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	for _, stmt := range []string{
+		`DROP TABLE IF EXISTS kv_parse;`,
+		`CREATE VIRTUAL TABLE kv_parse USING regexp_parse('(?<key>\w+)=(?<value>\w+)?');`,
+	} {
+		if _, err := db.Exec(stmt); err != nil {
+			t.Fatal(err)
+		}
+	}
+	t.Cleanup(func() { db.Exec(`DROP TABLE IF EXISTS kv_parse;`) })
+
+	InsertIntoStringsTable(t, db, "a=1 b= c=3", "garbage", nil)
+	rows, err := db.Query(`
+		SELECT strings_table.id, kv_parse.key, kv_parse.value
+		FROM strings_table, kv_parse(strings_table.value)
+		ORDER BY strings_table.id, kv_parse.rowid;`)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer rows.Close()
+
+	type KeyValue struct {
+		ID    int64
+		Key   string
+		Value sql.NullString
+	}
+	var got []KeyValue
+	for rows.Next() {
+		var kv KeyValue
+		if err := rows.Scan(&kv.ID, &kv.Key, &kv.Value); err != nil {
+			t.Fatal(err)
+		}
+		got = append(got, kv)
+	}
+	if err := rows.Err(); err != nil {
+		t.Fatal(err)
+	}
+	want := []KeyValue{
+		{1, "a", sql.NullString{String: "1", Valid: true}},
+		{1, "b", sql.NullString{}},
+		{1, "c", sql.NullString{String: "3", Valid: true}},
+	}
+	if !reflect.DeepEqual(got, want) {
+		t.Fatalf("got: %+v\nwant: %+v", got, want)
+	}
+
+	// Patterns without named groups are rejected
+	_, err = db.Exec(`CREATE VIRTUAL TABLE temp.kv_invalid USING regexp_parse('(a)');`)
+	const exp = "regexp_parse: pattern has no named capture groups"
+	if err == nil || err.Error() != exp {
+		t.Errorf("error got: %v want: %q", err, exp)
+	}
+}
+
+func TestCacheStats(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	// Use a single connection since the caches are per-connection.
+	db.SetMaxOpenConns(1)
+
+	InsertIntoStringsTable(t, db, "a1", "b2", "c3", "a4")
+	const pattern = `^a\d$`
+	for i := 0; i < 2; i++ {
+		var n int64
+		err := db.QueryRow(`SELECT COUNT(*) FROM strings_table WHERE value REGEXP ?;`, pattern).Scan(&n)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if n != 2 {
+			t.Fatalf("got %d rows; want: %d", n, 2)
+		}
+	}
+
+	var matches, hits, refCount, codeSize int64
+	var cache string
+	err := db.QueryRow(`
+		SELECT cache, matches, hits, ref_count, code_size
+		FROM pcre2_cache_stats WHERE pattern = ?;`, pattern).Scan(
+		&cache, &matches, &hits, &refCount, &codeSize)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if cache != "regexp" {
+		t.Errorf("cache = %q; want: %q", cache, "regexp")
+	}
+	if matches != 8 {
+		t.Errorf("matches = %d; want: %d", matches, 8)
+	}
+	if hits != 1 {
+		t.Errorf("hits = %d; want: %d", hits, 1)
+	}
+	if refCount != 0 {
+		t.Errorf("ref_count = %d; want: %d", refCount, 0)
+	}
+	if codeSize <= 0 {
+		t.Errorf("code_size = %d; want: > 0", codeSize)
+	}
+
+	// Each cache has a row with its totals
+	var caches []string
+	rows, err := db.Query(`SELECT cache FROM pcre2_cache_stats WHERE pattern IS NULL ORDER BY cache;`)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer rows.Close()
+	for rows.Next() {
+		var s string
+		if err := rows.Scan(&s); err != nil {
+			t.Fatal(err)
+		}
+		caches = append(caches, s)
+	}
+	if err := rows.Err(); err != nil {
+		t.Fatal(err)
+	}
+	if want := []string{"iregexp", "regexp"}; !reflect.DeepEqual(caches, want) {
+		t.Errorf("caches = %q; want: %q", caches, want)
+	}
+}
+
+func TestRegexpShrink(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	// Use a single connection since the caches are per-connection.
+	db.SetMaxOpenConns(1)
+
+	for i := 0; i < 4; i++ {
+		var match bool
+		if err := db.QueryRow(`SELECT ? REGEXP ?;`, fmt.Sprintf("a%d", i), fmt.Sprintf(`^a%d$`, i)).Scan(&match); err != nil {
+			t.Fatal(err)
+		}
+	}
+	stats := func() (entries, codeSize, jitStackSize, matchDataSize int64) {
+		t.Helper()
+		err := db.QueryRow(`
+			SELECT entries, code_size, jit_stack_size, match_data_size
+			FROM pcre2_cache_stats WHERE cache = 'regexp' AND pattern IS NULL;`).Scan(
+			&entries, &codeSize, &jitStackSize, &matchDataSize)
+		if err != nil {
+			t.Fatal(err)
+		}
+		return entries, codeSize, jitStackSize, matchDataSize
+	}
+	entries, codeSize, jitStackSize, matchDataSize := stats()
+	if entries != 4 || codeSize <= 0 || jitStackSize <= 0 || matchDataSize <= 0 {
+		t.Errorf("entries: %d code_size: %d jit_stack_size: %d match_data_size: %d",
+			entries, codeSize, jitStackSize, matchDataSize)
+	}
+
+	var released int64
+	if err := db.QueryRow(`SELECT regexp_shrink();`).Scan(&released); err != nil {
+		t.Fatal(err)
+	}
+	if released < codeSize {
+		t.Errorf("regexp_shrink() = %d; want: >= %d", released, codeSize)
+	}
+	if entries, codeSize, _, _ = stats(); entries != 0 || codeSize != 0 {
+		t.Errorf("after regexp_shrink: entries: %d code_size: %d; want: 0", entries, codeSize)
+	}
+
+	// Patterns are compiled again when they are used.
+	var match bool
+	if err := db.QueryRow(`SELECT 'a1' REGEXP '^a1$';`).Scan(&match); err != nil {
+		t.Fatal(err)
+	}
+	if !match {
+		t.Error("expected a match")
+	}
+}
+
+func TestAllocationPool(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	// Use a single connection since the caches are per-connection.
+	db.SetMaxOpenConns(1)
+
+	poolSize := func() int64 {
+		t.Helper()
+		var n int64
+		err := db.QueryRow(`
+			SELECT pool_size FROM pcre2_cache_stats
+			WHERE cache = 'regexp' AND pattern IS NULL;`).Scan(&n)
+		if err != nil {
+			t.Fatal(err)
+		}
+		return n
+	}
+
+	// Evicted patterns return their memory to the pool, which is reused by
+	// the patterns compiled next.
+	for i := 0; i < 64; i++ {
+		var match bool
+		err := db.QueryRow(`SELECT ? REGEXP ?;`, fmt.Sprintf("a%d", i),
+			fmt.Sprintf(`^a%d(b|c)*$`, i)).Scan(&match)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if !match {
+			t.Fatalf("%d: expected a match", i)
+		}
+	}
+	if n := poolSize(); n <= 0 {
+		t.Errorf("pool_size = %d; want: > 0", n)
+	}
+	if _, err := db.Exec(`SELECT regexp_shrink();`); err != nil {
+		t.Fatal(err)
+	}
+	if n := poolSize(); n != 0 {
+		t.Errorf("after regexp_shrink: pool_size = %d; want: 0", n)
+	}
+}
+
+func TestMemo(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	// Use a single connection since the caches are per-connection.
+	db.SetMaxOpenConns(1)
+
+	_, err := db.Exec(`
+		CREATE TABLE t (status TEXT, id TEXT);
+		WITH RECURSIVE n(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM n WHERE i < 2999)
+		INSERT INTO t SELECT CASE i % 3 WHEN 0 THEN 'ok' WHEN 1 THEN 'error' ELSE 'timeout' END,
+			'id-' || i FROM n;`)
+	if err != nil {
+		t.Fatal(err)
+	}
+	stats := func(pattern string) (matches, memoHits, memoSize int64) {
+		t.Helper()
+		err := db.QueryRow(`
+			SELECT matches, memo_hits, memo_size FROM pcre2_cache_stats
+			WHERE cache = 'regexp' AND pattern = ?;`, pattern).Scan(&matches, &memoHits, &memoSize)
+		if err != nil {
+			t.Fatal(err)
+		}
+		return matches, memoHits, memoSize
+	}
+
+	var n int64
+	if err := db.QueryRow(`SELECT count(*) FROM t WHERE status REGEXP '^(error|timeout)$';`).Scan(&n); err != nil {
+		t.Fatal(err)
+	}
+	if n != 2000 {
+		t.Errorf("count = %d; want: %d", n, 2000)
+	}
+	matches, memoHits, memoSize := stats(`^(error|timeout)$`)
+	if matches != 3000 || memoHits != 2997 || memoSize <= 0 {
+		t.Errorf("matches: %d memo_hits: %d memo_size: %d; want: 3000, 2997, > 0",
+			matches, memoHits, memoSize)
+	}
+
+	// The memo turns itself off when the subjects are unique.
+	if err := db.QueryRow(`SELECT count(*) FROM t WHERE id REGEXP '-1\d*$';`).Scan(&n); err != nil {
+		t.Fatal(err)
+	}
+	if n != 1111 {
+		t.Errorf("count = %d; want: %d", n, 1111)
+	}
+	matches, memoHits, memoSize = stats(`-1\d*$`)
+	if matches != 3000 || memoHits != 0 || memoSize != 0 {
+		t.Errorf("matches: %d memo_hits: %d memo_size: %d; want: 3000, 0, 0",
+			matches, memoHits, memoSize)
+	}
+
+	// Setting memo_size rounds it up to a power of two and 0 disables the memo.
+	var size int64
+	if err := db.QueryRow(`SELECT regexp_config('memo_size', 100);`).Scan(&size); err != nil {
+		t.Fatal(err)
+	}
+	if size != 128 {
+		t.Errorf("memo_size = %d; want: %d", size, 128)
+	}
+	if err := db.QueryRow(`SELECT regexp_config('memo_size', 0);`).Scan(&size); err != nil {
+		t.Fatal(err)
+	}
+	if err := db.QueryRow(`SELECT count(*) FROM t WHERE status REGEXP '^ok$';`).Scan(&n); err != nil {
+		t.Fatal(err)
+	}
+	if matches, memoHits, _ = stats(`^ok$`); n != 1000 || matches != 3000 || memoHits != 0 {
+		t.Errorf("count: %d matches: %d memo_hits: %d; want: 1000, 3000, 0", n, matches, memoHits)
+	}
+	if _, err := db.Exec(`SELECT regexp_config('memo_size', -1);`); err == nil {
+		t.Error("expected an error for a negative memo_size")
+	}
+}
+
+func TestLatencyHistograms(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	// Use a single connection since the settings are per-connection.
+	db.SetMaxOpenConns(1)
+
+	var enabled int64
+	if err := db.QueryRow(`SELECT regexp_config('histograms');`).Scan(&enabled); err != nil {
+		t.Fatal(err)
+	}
+	if enabled != 0 {
+		t.Fatalf("histograms = %d; want: %d", enabled, 0)
+	}
+	for _, query := range []string{
+		`SELECT regexp_config('histograms', 1);`,
+		`SELECT regexp_config('sample_rate', 1);`,
+	} {
+		var n int64
+		if err := db.QueryRow(query).Scan(&n); err != nil {
+			t.Fatal(err)
+		}
+		if n != 1 {
+			t.Fatalf("%s = %d; want: %d", query, n, 1)
+		}
+	}
+
+	InsertIntoStringsTable(t, db, "a1", "b2", "c3", "a4")
+	const pattern = `^a\d$`
+	if _, err := db.Exec(`SELECT COUNT(*) FROM strings_table WHERE value REGEXP ?;`, pattern); err != nil {
+		t.Fatal(err)
+	}
+
+	var samples, p50, p99, max int64
+	err := db.QueryRow(`
+		SELECT samples, p50_ns, p99_ns, max_ns
+		FROM pcre2_cache_stats WHERE pattern = ?;`, pattern).Scan(
+		&samples, &p50, &p99, &max)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if samples != 4 {
+		t.Errorf("samples = %d; want: %d", samples, 4)
+	}
+	if p50 < 0 || p50 > p99 || p99 > max {
+		t.Errorf("invalid percentiles: p50 = %d p99 = %d max = %d", p50, p99, max)
+	}
+
+	// Invalid settings are an error
+	for _, query := range []string{
+		`SELECT regexp_config('invalid');`,
+		`SELECT regexp_config('sample_rate', -1);`,
+	} {
+		var n int64
+		if err := db.QueryRow(query).Scan(&n); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}
+
+func TestSlowLog(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	// Use a single connection since the slow log is per-connection.
+	db.SetMaxOpenConns(1)
+
+	// Log every compilation and match
+	if _, err := db.Exec(`SELECT regexp_config('slow_threshold_ns', 1);`); err != nil {
+		t.Fatal(err)
+	}
+	InsertIntoStringsTable(t, db, "a1", "b22")
+	const pattern = `^a\d$`
+	if _, err := db.Exec(`SELECT COUNT(*) FROM strings_table WHERE value REGEXP ?;`, pattern); err != nil {
+		t.Fatal(err)
+	}
+
+	type Record struct {
+		Cache         string
+		Operation     string
+		Pattern       string
+		SubjectLength sql.NullInt64
+	}
+	rows, err := db.Query(`
+		SELECT cache, operation, pattern, subject_length
+		FROM pcre2_slow_log ORDER BY seq;`)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer rows.Close()
+	var records []Record
+	for rows.Next() {
+		var r Record
+		if err := rows.Scan(&r.Cache, &r.Operation, &r.Pattern, &r.SubjectLength); err != nil {
+			t.Fatal(err)
+		}
+		records = append(records, r)
+	}
+	if err := rows.Err(); err != nil {
+		t.Fatal(err)
+	}
+	want := []Record{
+		{"regexp", "compile", pattern, sql.NullInt64{}},
+		{"regexp", "match", pattern, sql.NullInt64{Int64: 2, Valid: true}},
+		{"regexp", "match", pattern, sql.NullInt64{Int64: 3, Valid: true}},
+	}
+	if !reflect.DeepEqual(records, want) {
+		t.Errorf("records = %+v; want: %+v", records, want)
+	}
+
+	if _, err := db.Exec(`SELECT regexp_info('reset_slow_log');`); err != nil {
+		t.Fatal(err)
+	}
+	var n int64
+	if err := db.QueryRow(`SELECT COUNT(*) FROM pcre2_slow_log;`).Scan(&n); err != nil {
+		t.Fatal(err)
+	}
+	if n != 0 {
+		t.Errorf("got %d records after reset; want: %d", n, 0)
+	}
+}
+
+func TestRegexpExplain(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	// Use a single connection since the caches are per-connection.
+	db.SetMaxOpenConns(1)
+
+	type Explain struct {
+		Pattern       string  `json:"pattern"`
+		Caseless      bool    `json:"caseless"`
+		CaptureCount  int     `json:"capture_count"`
+		MinLength     int     `json:"min_length"`
+		StartOfLine   bool    `json:"start_of_line"`
+		FirstCodeUnit *string `json:"first_code_unit"`
+		LastCodeUnit  *string `json:"last_code_unit"`
+		Backrefs      bool    `json:"backrefs"`
+	}
+	str := func(s string) *string { return &s }
+
+	tests := []struct {
+		pattern string
+		flags   any
+		want    Explain
+	}{
+		{`^\d+foo`, nil, Explain{
+			Pattern: `^\d+foo`, MinLength: 4, StartOfLine: true, LastCodeUnit: str("o"),
+		}},
+		{`ab(c)\1`, "i", Explain{
+			Pattern: `ab(c)\1`, Caseless: true, CaptureCount: 1, MinLength: 4,
+			FirstCodeUnit: str("a"), LastCodeUnit: str("c"), Backrefs: true,
+		}},
+		{`"x"`, nil, Explain{
+			Pattern: `"x"`, MinLength: 3, FirstCodeUnit: str(`"`), LastCodeUnit: str(`"`),
+		}},
+	}
+	for _, test := range tests {
+		var s string
+		if err := db.QueryRow(`SELECT regexp_explain(?, ?);`, test.pattern, test.flags).Scan(&s); err != nil {
+			t.Fatal(err)
+		}
+		var got Explain
+		if err := json.Unmarshal([]byte(s), &got); err != nil {
+			t.Fatalf("%s: %v", s, err)
+		}
+		if !reflect.DeepEqual(got, test.want) {
+			t.Errorf("regexp_explain(%q) = %+v; want: %+v", test.pattern, got, test.want)
+		}
+	}
+
+	// Explained patterns are not added to the cache
+	var n int64
+	if err := db.QueryRow(`SELECT regexp_info('regexes_compiled');`).Scan(&n); err != nil {
+		t.Fatal(err)
+	}
+	if n != 0 {
+		t.Errorf("regexes_compiled = %d; want: %d", n, 0)
+	}
+
+	for _, query := range []string{
+		`SELECT regexp_explain('(');`,
+		`SELECT regexp_explain('a', 'x');`,
+	} {
+		var s string
+		if err := db.QueryRow(query).Scan(&s); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}
+
+func TestRegexpTrgm(t *testing.T) {
+	db := InitSharedDatabase(t)
+
+	contents := []any{
+		"hello world", "Hello World", "foo bar", "foobar baz", "the quick brown fox",
+		"the quick red fox", "abc", nil, 42, "xyzzy hello",
+	}
+	MustExec(t, db, `CREATE TABLE docs(content TEXT);`)
+	for _, c := range contents[:5] {
+		MustExec(t, db, `INSERT INTO docs VALUES (?);`, c)
+	}
+	MustExec(t, db, `CREATE VIRTUAL TABLE docs_rx USING regexp_trgm(docs, content);`)
+	MustExec(t, db, `CREATE TRIGGER docs_ai AFTER INSERT ON docs BEGIN
+		INSERT INTO docs_rx(rowid, content) VALUES (new.rowid, new.content);
+	END;`)
+	MustExec(t, db, `CREATE TRIGGER docs_ad AFTER DELETE ON docs BEGIN
+		INSERT INTO docs_rx(docs_rx, rowid, content) VALUES ('delete', old.rowid, old.content);
+	END;`)
+	MustExec(t, db, `CREATE TRIGGER docs_au AFTER UPDATE ON docs BEGIN
+		INSERT INTO docs_rx(docs_rx, rowid, content) VALUES ('delete', old.rowid, old.content);
+		INSERT INTO docs_rx(rowid, content) VALUES (new.rowid, new.content);
+	END;`)
+	for _, c := range contents[5:] {
+		MustExec(t, db, `INSERT INTO docs VALUES (?);`, c)
+	}
+	MustExec(t, db, `UPDATE docs SET content = 'goodbye world' WHERE rowid = 3;`)
+	MustExec(t, db, `DELETE FROM docs WHERE rowid = 4;`)
+
+	patterns := []string{
+		`hello`, `(?i)HELLO`, `world$`, `quick (brown|red) fox`, `foo|xyz`,
+		`ab`, `.*`, `42`, `good(bye)?`, `l+o`,
+	}
+	check := func() {
+		t.Helper()
+		for _, pattern := range patterns {
+			want := QueryIDs(t, db, `SELECT rowid FROM docs WHERE content REGEXP ? ORDER BY rowid;`, pattern)
+			got := QueryIDs(t, db, `SELECT rowid FROM docs_rx WHERE content REGEXP ? ORDER BY rowid;`, pattern)
+			if !reflect.DeepEqual(got, want) {
+				t.Errorf("%q: got: %v want: %v", pattern, got, want)
+			}
+		}
+	}
+	check()
+	MustExec(t, db, `INSERT INTO docs_rx(docs_rx) VALUES ('rebuild');`)
+	check()
+
+	for _, query := range []string{
+		`DELETE FROM docs_rx;`,
+		`INSERT INTO docs_rx(docs_rx) VALUES ('bogus');`,
+		`CREATE VIRTUAL TABLE bad_rx USING regexp_trgm(missing, content);`,
+		`CREATE VIRTUAL TABLE bad_rx USING regexp_trgm(docs, missing);`,
+		`SELECT rowid FROM docs_rx WHERE content REGEXP NULL;`,
+	} {
+		if _, err := db.Exec(query); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}
+
+func TestFTS5Tokenizer(t *testing.T) {
+	db := InitSharedDatabase(t)
+
+	_, err := db.Exec(`CREATE VIRTUAL TABLE logs USING fts5(line,
+		tokenize = "pcre2 '\d+\.\d+\.\d+\.\d+|[A-Za-z_]\w*'");`)
+	if err != nil {
+		if strings.Contains(err.Error(), "no such module: fts5") {
+			t.Skip("FTS5 is not available")
+		}
+		t.Fatal(err)
+	}
+	if _, err := db.Exec(`CREATE VIRTUAL TABLE logs_i USING fts5(line, tokenize = "pcre2 '\w+' i");`); err != nil {
+		t.Fatal(err)
+	}
+	lines := []string{
+		"connect from 10.0.0.1 user=Alice",
+		"DENY 192.168.1.20 bob",
+		"alice logout",
+	}
+	for _, line := range lines {
+		for _, table := range []string{"logs", "logs_i"} {
+			if _, err := db.Exec(`INSERT INTO `+table+` VALUES (?);`, line); err != nil {
+				t.Fatal(err)
+			}
+		}
+	}
+
+	tests := []struct {
+		query string
+		want  []string
+	}{
+		{`SELECT highlight(logs, 0, '[', ']') FROM logs WHERE logs MATCH '"10.0.0.1"';`,
+			[]string{"connect from [10.0.0.1] user=Alice"}},
+		{`SELECT highlight(logs, 0, '[', ']') FROM logs WHERE logs MATCH 'alice';`,
+			[]string{"[alice] logout"}},
+		{`SELECT highlight(logs_i, 0, '[', ']') FROM logs_i WHERE logs_i MATCH 'ALICE' ORDER BY rowid;`,
+			[]string{"connect from 10.0.0.1 user=[Alice]", "[alice] logout"}},
+		{`SELECT term FROM fts5vocab_logs WHERE term GLOB '[0-9]*' ORDER BY term;`,
+			[]string{"10.0.0.1", "192.168.1.20"}},
+	}
+	if _, err := db.Exec(`CREATE VIRTUAL TABLE fts5vocab_logs USING fts5vocab(logs, 'row');`); err != nil {
+		t.Fatal(err)
+	}
+	for _, test := range tests {
+		rows, err := db.Query(test.query)
+		if err != nil {
+			t.Fatalf("%s: %v", test.query, err)
+		}
+		got := []string{}
+		for rows.Next() {
+			var s string
+			if err := rows.Scan(&s); err != nil {
+				t.Fatal(err)
+			}
+			got = append(got, s)
+		}
+		if err := rows.Err(); err != nil {
+			t.Fatal(err)
+		}
+		rows.Close()
+		if !reflect.DeepEqual(got, test.want) {
+			t.Errorf("%s: got: %q want: %q", test.query, got, test.want)
+		}
+	}
+
+	for _, query := range []string{
+		`CREATE VIRTUAL TABLE bad USING fts5(line, tokenize = "pcre2 '('");`,
+		`CREATE VIRTUAL TABLE bad USING fts5(line, tokenize = "pcre2");`,
+		`CREATE VIRTUAL TABLE bad USING fts5(line, tokenize = "pcre2 'a' x");`,
+	} {
+		if _, err := db.Exec(query); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}
+
+func TestRegexpScan(t *testing.T) {
+	// regexp_scan requires a database file.
+	name := filepath.Join(t.TempDir(), "scan.sqlite3")
+	db, err := sql.Open(DriverName, "file:"+name+"?_journal_mode=WAL")
+	if err != nil {
+		t.Fatal(err)
+	}
+	t.Cleanup(func() { db.Close() })
+
+	if _, err := db.Exec(`CREATE TABLE logs (line TEXT);`); err != nil {
+		t.Fatal(err)
+	}
+	tx, err := db.Begin()
+	if err != nil {
+		t.Fatal(err)
+	}
+	for i := 0; i < 20000; i++ {
+		var line any = fmt.Sprintf("request %d took %dms", i, i%1000)
+		switch i % 97 {
+		case 0:
+			line = nil
+		case 1:
+			line = []byte(fmt.Sprintf("ERROR %d", i))
+		}
+		if _, err := tx.Exec(`INSERT INTO logs VALUES (?);`, line); err != nil {
+			t.Fatal(err)
+		}
+	}
+	if err := tx.Commit(); err != nil {
+		t.Fatal(err)
+	}
+
+	for _, pattern := range []string{`took 99\dms`, `^ERROR`, `request 1\d{3} `, `no match`} {
+		want := QueryIDs(t, db, `SELECT rowid FROM logs WHERE line REGEXP ? ORDER BY rowid;`, pattern)
+		for _, threads := range []any{nil, 1, 3, 8} {
+			var got []int64
+			if threads == nil {
+				got = QueryIDs(t, db, `SELECT id FROM regexp_scan('logs', 'line', ?) ORDER BY id;`, pattern)
+			} else {
+				got = QueryIDs(t, db, `SELECT id FROM regexp_scan('logs', 'line', ?, ?) ORDER BY id;`, pattern, threads)
+			}
+			if !reflect.DeepEqual(got, want) {
+				t.Errorf("regexp_scan(%q, %v): got %d rows want: %d", pattern, threads, len(got), len(want))
+			}
+		}
+	}
+
+	// Stop early
+	if got := QueryIDs(t, db, `SELECT id FROM regexp_scan('logs', 'line', 'request', 4) LIMIT 10;`); len(got) != 10 {
+		t.Errorf("LIMIT 10: got %d rows", len(got))
+	}
+
+	for _, query := range []string{
+		`SELECT id FROM regexp_scan('missing', 'line', 'a');`,
+		`SELECT id FROM regexp_scan('logs', 'missing', 'a');`,
+		`SELECT id FROM regexp_scan('logs', 'line', '(');`,
+		`SELECT id FROM regexp_scan('logs', 'line', 'a', 0);`,
+	} {
+		if _, err := db.Exec(query); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}
+
+func TestRegexpFilter(t *testing.T) {
+	db := InitSharedDatabase(t)
+
+	if _, err := db.Exec(`CREATE TABLE logs (line);`); err != nil {
+		t.Fatal(err)
+	}
+	for i := 0; i < 5000; i++ {
+		var line any = fmt.Sprintf("request %d took %dms", i, i%1000)
+		switch i % 97 {
+		case 0:
+			line = nil
+		case 1:
+			line = []byte(fmt.Sprintf("ERROR %d", i))
+		case 2:
+			line = i
+		}
+		if _, err := db.Exec(`INSERT INTO logs VALUES (?);`, line); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	for _, pattern := range []string{
+		`took 99\dms`, `^ERROR`, `request 1\d{3} `, `no match`, `^\d+$`,
+		`(?i)error`, `(?^i)TOOK 99\dms`, `took|ERROR`, `took (?!1)`, ``,
+	} {
+		want := QueryIDs(t, db, `SELECT rowid FROM logs WHERE line REGEXP ? ORDER BY rowid;`, pattern)
+		got := QueryIDs(t, db, `SELECT id FROM regexp_filter('logs', 'line', ?);`, pattern)
+		if !reflect.DeepEqual(got, want) {
+			t.Errorf("regexp_filter(%q): got %d rows want: %d", pattern, len(got), len(want))
+		}
+	}
+
+	for _, query := range []string{
+		`SELECT id FROM regexp_filter('missing', 'line', 'a');`,
+		`SELECT id FROM regexp_filter('logs', 'missing', 'a');`,
+		`SELECT id FROM regexp_filter('logs', 'line', '(');`,
+		`SELECT id FROM regexp_filter('logs', 'line', NULL);`,
+	} {
+		if _, err := db.Exec(query); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}
+
+func TestRegexpRuleset(t *testing.T) {
+	db := InitSharedDatabase(t)
+
+	MustExec(t, db, `CREATE TABLE rules (pattern TEXT);`)
+	for i := 0; i < 200; i++ {
+		var pattern any = fmt.Sprintf(`^GET /api/v%d/\w+$`, i)
+		switch i % 10 {
+		case 1:
+			pattern = fmt.Sprintf(`user%d`, i)
+		case 2:
+			pattern = `\d{3}`
+		case 3:
+			pattern = nil
+		case 4:
+			pattern = `(?i)post`
+		case 5:
+			pattern = `(?^i)/API/V1/`
+		}
+		MustExec(t, db, `INSERT INTO rules VALUES (?);`, pattern)
+	}
+	MustExec(t, db, `CREATE VIRTUAL TABLE rules_rx USING regexp_ruleset(rules, pattern);`)
+
+	check := func() {
+		t.Helper()
+		for _, subject := range []string{
+			"GET /api/v10/users", "POST /api/v1/user11", "user121 404", "", "nothing",
+		} {
+			want := QueryIDs(t, db, `SELECT rowid FROM rules WHERE pattern IS NOT NULL AND ? REGEXP pattern ORDER BY rowid;`, subject)
+			got := QueryIDs(t, db, `SELECT rowid FROM rules_rx(?);`, subject)
+			if !reflect.DeepEqual(got, want) {
+				t.Errorf("%q: got: %v want: %v", subject, got, want)
+			}
+		}
+	}
+	check()
+
+	// The rules are reloaded when the table changes.
+	MustExec(t, db, `INSERT INTO rules VALUES ('nothing');`)
+	MustExec(t, db, `UPDATE rules SET pattern = 'users$' WHERE rowid = 1;`)
+	MustExec(t, db, `DELETE FROM rules WHERE rowid = 2;`)
+	check()
+
+	MustExec(t, db, `INSERT INTO rules VALUES ('(');`)
+	for _, query := range []string{
+		`SELECT rowid FROM rules_rx('a');`,
+		`CREATE VIRTUAL TABLE bad_rx USING regexp_ruleset(missing, pattern);`,
+		`CREATE VIRTUAL TABLE bad_rx USING regexp_ruleset(rules, missing);`,
+		`CREATE VIRTUAL TABLE bad_rx USING regexp_ruleset(rules, pattern);`,
+	} {
+		if _, err := db.Exec(query); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}
+
+func TestRegexpResults(t *testing.T) {
+	db := InitSharedDatabase(t)
+
+	MustExec(t, db, `CREATE TABLE logs (line TEXT);`)
+	for i := 0; i < 500; i++ {
+		var line any = fmt.Sprintf("GET /api/v%d timeout after %dms", i%7, i)
+		if i%50 == 0 {
+			line = nil
+		}
+		MustExec(t, db, `INSERT INTO logs VALUES (?);`, line)
+	}
+	MustExec(t, db, `CREATE VIRTUAL TABLE logs_rr USING regexp_results(logs, line);`)
+	MustExec(t, db, `CREATE TRIGGER logs_insert AFTER INSERT ON logs BEGIN
+		INSERT INTO logs_rr(logs_rr, rowid) VALUES ('invalidate', new.rowid);
+	END;`)
+	MustExec(t, db, `CREATE TRIGGER logs_update AFTER UPDATE ON logs BEGIN
+		INSERT INTO logs_rr(logs_rr, rowid) VALUES ('invalidate', old.rowid);
+		INSERT INTO logs_rr(logs_rr, rowid) VALUES ('invalidate', new.rowid);
+	END;`)
+	MustExec(t, db, `CREATE TRIGGER logs_delete AFTER DELETE ON logs BEGIN
+		INSERT INTO logs_rr(logs_rr, rowid) VALUES ('invalidate', old.rowid);
+	END;`)
+
+	patterns := []string{`v3 timeout after \d*7ms`, `^GET`, `v[0-2]`, ``}
+	check := func() {
+		t.Helper()
+		for _, pattern := range patterns {
+			want := QueryIDs(t, db, `SELECT rowid FROM logs WHERE line REGEXP ? ORDER BY rowid;`, pattern)
+			got := QueryIDs(t, db, `SELECT rowid FROM logs_rr(?);`, pattern)
+			if !reflect.DeepEqual(got, want) {
+				t.Errorf("%q: got: %v want: %v", pattern, got, want)
+			}
+		}
+	}
+	check()
+
+	var stored int64
+	if err := db.QueryRow(`SELECT count(*) FROM logs_rr_results;`).Scan(&stored); err != nil {
+		t.Fatal(err)
+	}
+	if stored != int64(len(patterns)) {
+		t.Errorf("stored results = %d; want: %d", stored, len(patterns))
+	}
+
+	// Appended rows are matched by the next query and changed rows are
+	// invalidated by the triggers.
+	MustExec(t, db, `INSERT INTO logs VALUES ('GET /api/v3 timeout after 17ms');`)
+	check()
+	MustExec(t, db, `UPDATE logs SET line = 'POST /api/v1' WHERE rowid = 10;`)
+	MustExec(t, db, `DELETE FROM logs WHERE rowid = 20;`)
+	check()
+	// Rows inserted below the largest scanned rowid (a reused rowid).
+	MustExec(t, db, `INSERT INTO logs(rowid, line) VALUES (20, 'GET /api/v1 timeout after 7ms');`)
+	check()
+
+	// The rowids are stored (and loaded by the second check) at both ends of
+	// the rowid range.
+	MustExec(t, db, `INSERT INTO logs(rowid, line) VALUES
+		(-9223372036854775808, 'GET /api/v3 timeout after 7ms'),
+		(9223372036854775807, 'GET /api/v3 timeout after 27ms');`)
+	check()
+	check()
+	MustExec(t, db, `INSERT INTO logs_rr(logs_rr) VALUES ('invalidate');`)
+	if err := db.QueryRow(`SELECT count(*) FROM logs_rr_results;`).Scan(&stored); err != nil {
+		t.Fatal(err)
+	}
+	if stored != 0 {
+		t.Errorf("stored results = %d; want: %d", stored, 0)
+	}
+	check()
+
+	for _, query := range []string{
+		`SELECT rowid FROM logs_rr('(');`,
+		`SELECT rowid FROM logs_rr(NULL);`,
+		`INSERT INTO logs_rr(logs_rr) VALUES ('rebuild');`,
+		`CREATE VIRTUAL TABLE bad_rr USING regexp_results(missing, line);`,
+		`CREATE VIRTUAL TABLE bad_rr USING regexp_results(logs, missing);`,
+	} {
+		if _, err := db.Exec(query); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}
+
+func TestRegexpSignature(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	if _, err := db.Exec(`CREATE TABLE logs (
+		sig  BLOB GENERATED ALWAYS AS (regexp_signature(line)) STORED,
+		sig64 BLOB GENERATED ALWAYS AS (regexp_signature(line, 64)) STORED,
+		line TEXT
+	);`); err != nil {
+		t.Fatal(err)
+	}
+	words := []string{"GET", "POST", "/api/v1", "timeout", "refused", "user=alice", "404", "200"}
+	for i := 0; i < 500; i++ {
+		var line any = fmt.Sprintf("%s %s %s", words[i%8], words[(i/8)%8], words[(i/64)%8])
+		if i%50 == 0 {
+			line = nil
+		}
+		if _, err := db.Exec(`INSERT INTO logs(line) VALUES (?);`, line); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	for _, pattern := range []string{`timeout`, `(?i)POST /API`, `refused|alice`,
+		`^GET .*404`, `\d+`, `user=(alice|bob) 200`, `nothing here`, ``} {
+		for _, column := range []string{"sig", "sig64"} {
+			var missed, skipped int
+			err := db.QueryRow(fmt.Sprintf(`SELECT
+				count(*) FILTER (WHERE line REGEXP ?1 AND NOT regexp_may_match(%[1]s, ?1)),
+				count(*) FILTER (WHERE NOT regexp_may_match(%[1]s, ?1))
+			FROM logs;`, column), pattern).Scan(&missed, &skipped)
+			if err != nil {
+				t.Fatal(err)
+			}
+			if missed != 0 {
+				t.Errorf("%s: %q: %d matching rows were ruled out", column, pattern, missed)
+			}
+			if column == "sig" && pattern == `nothing here` && skipped <= 10 {
+				t.Errorf("%s: %q: only %d rows were ruled out", column, pattern, skipped)
+			}
+		}
+	}
+
+	for _, query := range []string{
+		`SELECT regexp_signature('abc', 100);`,
+		`SELECT regexp_may_match(x'00', 'abc');`,
+		`SELECT regexp_may_match(regexp_signature('abc'), '(');`,
+		`SELECT regexp_may_match(regexp_signature('abc'), NULL);`,
+	} {
+		var v any
+		if err := db.QueryRow(query).Scan(&v); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}
+
+func TestRegexpEstimate(t *testing.T) {
+	db := InitSharedDatabase(t)
+
+	if _, err := db.Exec(`CREATE TABLE logs (line TEXT);`); err != nil {
+		t.Fatal(err)
+	}
+	for i := 0; i < 3000; i++ {
+		var line any = fmt.Sprintf("GET /api id=%d status=%d", i, 200+100*(i%4))
+		if i%10 == 0 {
+			line = nil
+		}
+		if _, err := db.Exec(`INSERT INTO logs VALUES (?);`, line); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	type estimate struct {
+		Rows        int64   `json:"rows"`
+		Sampled     int64   `json:"sampled"`
+		Matches     int64   `json:"matches"`
+		Selectivity float64 `json:"selectivity"`
+		CostNs      float64 `json:"cost_ns"`
+	}
+	tests := []struct {
+		pattern    string
+		sampleRows int
+		want       float64
+		exact      bool
+	}{
+		{`status=500`, 5000, 750.0 / 3000, true}, // odd i, never NULL
+		{`status=[45]00`, 3000, 1350.0 / 3000, true},
+		{`POST`, 100, 0, true},
+		{`^GET`, 1000, 0.9, false},
+	}
+	for _, test := range tests {
+		var s string
+		err := db.QueryRow(`SELECT regexp_estimate('logs', 'line', ?, ?);`,
+			test.pattern, test.sampleRows).Scan(&s)
+		if err != nil {
+			t.Fatal(err)
+		}
+		var e estimate
+		if err := json.Unmarshal([]byte(s), &e); err != nil {
+			t.Fatalf("%s: %v", s, err)
+		}
+		wantSampled := min(int64(test.sampleRows), 3000)
+		if e.Rows != 3000 || e.Sampled != wantSampled || e.CostNs < 0 {
+			t.Errorf("%q: %s", test.pattern, s)
+		}
+		if test.exact && math.Abs(e.Selectivity-test.want) > 1e-5 ||
+			math.Abs(e.Selectivity-test.want) > 0.1 {
+			t.Errorf("%q: selectivity = %g; want: %g", test.pattern, e.Selectivity, test.want)
+		}
+	}
+
+	for _, query := range []string{
+		`SELECT regexp_estimate('missing', 'line', 'a');`,
+		`SELECT regexp_estimate('logs', 'missing', 'a');`,
+		`SELECT regexp_estimate('logs', 'line', '(');`,
+		`SELECT regexp_estimate('logs', 'line', 'a', 0);`,
+		`SELECT regexp_estimate('logs', NULL, 'a');`,
+		`SELECT regexp_estimate('logs', 'line', 'a', NULL, 'temp');`,
+		`SELECT regexp_estimate('logs', 'line', 'a', NULL, 'missing');`,
+	} {
+		var s string
+		if err := db.QueryRow(query).Scan(&s); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+
+	// Tables in other schemas.
+	MustExec(t, db, `CREATE TEMP TABLE temp_logs AS SELECT line FROM logs LIMIT 100;`)
+	var s string
+	err := db.QueryRow(`SELECT regexp_estimate('temp_logs', 'line', 'status=500', NULL,
+		'temp');`).Scan(&s)
+	if err != nil {
+		t.Fatal(err)
+	}
+	var e estimate
+	if err := json.Unmarshal([]byte(s), &e); err != nil {
+		t.Fatalf("%s: %v", s, err)
+	}
+	if e.Rows != 100 || e.Sampled != 100 || e.Matches != 25 {
+		t.Errorf("temp: %s", s)
+	}
+
+	// regexp_any reorders the patterns by hit rate, which must not change
+	// its result.
+	var mismatches int
+	err = db.QueryRow(`SELECT count(*) FROM logs
+		WHERE regexp_any(line, 'status=9\d\d', 'id=\d*7 ', 'status=300')
+			IS NOT (line REGEXP 'status=9\d\d' OR line REGEXP 'id=\d*7 ' OR
+			        line REGEXP 'status=300');`).Scan(&mismatches)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if mismatches != 0 {
+		t.Errorf("regexp_any: %d mismatches", mismatches)
+	}
+}
+
+func TestRegexpGrep(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	f, err := os.Open("testdata/web2.gz")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer f.Close()
+	r, err := gzip.NewReader(f)
+	if err != nil {
+		t.Fatal(err)
+	}
+	data, err := io.ReadAll(r)
+	if err != nil {
+		t.Fatal(err)
+	}
+	// Drop the trailing newline to test a last line without one.
+	data = bytes.TrimSuffix(data, []byte("\n"))
+	plain := filepath.Join(t.TempDir(), "web2.txt")
+	if err := os.WriteFile(plain, data, 0644); err != nil {
+		t.Fatal(err)
+	}
+	var zbuf bytes.Buffer
+	zw := zlib.NewWriter(&zbuf)
+	if _, err := zw.Write(data); err != nil {
+		t.Fatal(err)
+	}
+	if err := zw.Close(); err != nil {
+		t.Fatal(err)
+	}
+	zlibbed := filepath.Join(t.TempDir(), "web2.z")
+	if err := os.WriteFile(zlibbed, zbuf.Bytes(), 0644); err != nil {
+		t.Fatal(err)
+	}
+	// Text that starts with a valid zlib header is searched as text.
+	zlibText := filepath.Join(t.TempDir(), "zlib.txt")
+	if err := os.WriteFile(zlibText, []byte("x^ one\nx^ two\n"), 0644); err != nil {
+		t.Fatal(err)
+	}
+
+	type row struct {
+		LineNumber int64
+		Offset     int64
+		Line       string
+	}
+	for _, pattern := range []string{`^zym`, `tion$`, `qu[aeiou]{3}`, `(?i)^xY`, `zythum`} {
+		re := regexp.MustCompile(`(?m)` + pattern)
+		var want []row
+		var offset int64
+		for i, line := range strings.Split(string(data), "\n") {
+			if re.MatchString(line) {
+				want = append(want, row{int64(i + 1), offset, line})
+			}
+			offset += int64(len(line)) + 1
+		}
+		for _, path := range []string{plain, "testdata/web2.gz", zlibbed} {
+			rows, err := db.Query(`SELECT line_number, offset, line FROM regexp_grep(?, ?);`,
+				path, pattern)
+			if err != nil {
+				t.Fatal(err)
+			}
+			var got []row
+			for rows.Next() {
+				var r row
+				if err := rows.Scan(&r.LineNumber, &r.Offset, &r.Line); err != nil {
+					t.Fatal(err)
+				}
+				got = append(got, r)
+			}
+			if err := rows.Err(); err != nil {
+				t.Fatal(err)
+			}
+			rows.Close()
+			if !reflect.DeepEqual(got, want) {
+				t.Errorf("%s: %q: got %d rows want: %d", path, pattern, len(got), len(want))
+			}
+		}
+	}
+
+	var n int
+	if err := db.QueryRow(`SELECT count(*) FROM regexp_grep(?, '^x\^ t');`,
+		zlibText).Scan(&n); err != nil || n != 1 {
+		t.Errorf("%s: got: %d, %v want: 1", zlibText, n, err)
+	}
+
+	for _, query := range []string{
+		`SELECT * FROM regexp_grep('testdata/missing.txt', 'a');`,
+		`SELECT * FROM regexp_grep('testdata', 'a');`,
+		`SELECT * FROM regexp_grep('testdata/web2.gz', '(');`,
+		`SELECT * FROM regexp_grep(NULL, 'a');`,
+	} {
+		if _, err := db.Exec(query); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}
+
+func TestRegexpZ(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	compress := func(codec string, data []byte) []byte {
+		var buf bytes.Buffer
+		var w io.WriteCloser
+		switch codec {
+		case "zlib":
+			w = zlib.NewWriter(&buf)
+		case "gzip":
+			w = gzip.NewWriter(&buf)
+		case "deflate":
+			w, _ = flate.NewWriter(&buf, flate.DefaultCompression)
+		}
+		if _, err := w.Write(data); err != nil {
+			t.Fatal(err)
+		}
+		if err := w.Close(); err != nil {
+			t.Fatal(err)
+		}
+		return buf.Bytes()
+	}
+
+	// Put matches at the start, across and after the 64 KiB windows.
+	filler := strings.Repeat("lorem ipsum dolor sit amet\n", 10000)
+	docs := []string{
+		"needle " + filler,
+		filler[:65530] + "needle" + filler,
+		filler + "needle",
+		filler + "中文 needle",
+		filler,
+		"",
+	}
+	tests := []struct {
+		pattern string
+		want    []bool
+	}{
+		{`needle`, []bool{true, true, true, true, false, false}},
+		{`^needle`, []bool{true, false, true, false, false, false}},
+		{`(?<=文 )needle$`, []bool{false, false, false, true, false, false}},
+		{`\bamet\b`, []bool{true, true, true, true, true, false}},
+		{`(?s)ipsum.*needle`, []bool{false, true, true, true, false, false}},
+	}
+	for _, codec := range []string{"zlib", "gzip", "deflate"} {
+		for _, test := range tests {
+			for i, doc := range docs {
+				var got bool
+				err := db.QueryRow(`SELECT regexp_z(?, ?, ?);`, test.pattern,
+					compress(codec, []byte(doc)), codec).Scan(&got)
+				if err != nil {
+					t.Fatal(err)
+				}
+				if got != test.want[i] {
+					t.Errorf("%s: %q: doc %d: got: %t want: %t", codec, test.pattern,
+						i, got, test.want[i])
+				}
+			}
+		}
+	}
+
+	// Concatenated gzip members (cat a.gz b.gz) are decompressed as one.
+	multi := append(compress("gzip", []byte(filler)), compress("gzip", []byte("needle\n"))...)
+	for _, codec := range []string{"zlib", "gzip"} {
+		var got bool
+		err := db.QueryRow(`SELECT regexp_z('^needle$', ?, ?);`, multi, codec).Scan(&got)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if !got {
+			t.Errorf("%s: the second gzip member was not matched", codec)
+		}
+	}
+
+	var match sql.NullBool
+	if err := db.QueryRow(`SELECT regexp_z('a', NULL);`).Scan(&match); err != nil {
+		t.Fatal(err)
+	}
+	if match.Bool {
+		t.Error("NULL matched")
+	}
+	for _, query := range []string{
+		`SELECT regexp_z('a', x'0000000000');`,
+		`SELECT regexp_z('a', x'789c');`,
+		`SELECT regexp_z('a', x'00', 'lz4');`,
+		`SELECT regexp_z('(', x'00');`,
+	} {
+		if err := db.QueryRow(query).Scan(&match); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}
+
+func TestRegexpJSONAny(t *testing.T) {
+	db, cleanup := InitDatabase(t)
+	t.Cleanup(cleanup)
+
+	doc := `{"id": 7, "tags": ["a\"b", "été", "😀"],
+		"log": [{"msg": "ERROR 42"}, {"msg": "ok"}], "ERR key": null, "a\"b": "x"}`
+	tests := []struct {
+		pattern string
+		path    string
+		flags   string
+		want    bool
+	}{
+		{`^ERROR \d+$`, `$`, ``, true},
+		{`^a"b$`, `$`, ``, true},
+		{`^été$`, `$.tags`, ``, true},
+		{`^😀$`, `$.tags[2]`, ``, true},
+		{`ERROR`, `$.log[1]`, ``, false},
+		{`ERROR`, `$.log[0].msg`, ``, true},
+		{`ERROR`, `$."log"[5]`, ``, false},
+		{`ERROR`, `$.missing`, ``, false},
+		{`^7$`, `$`, ``, false},
+		{`^ERR key$`, `$`, ``, false},
+		{`^ERR key$`, `$`, `k`, true},
+		{`^null$`, `$`, `k`, false},
+		{`^x$`, `$."a\"b"`, ``, true},
+		{`^x$`, `$."a\u0022b"`, ``, true},
+		{`^x$`, `$."a"`, ``, false},
+	}
+	for _, test := range tests {
+		var got bool
+		err := db.QueryRow(`SELECT regexp_json_any(?, ?, ?, ?);`, doc, test.pattern,
+			test.path, test.flags).Scan(&got)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if got != test.want {
+			t.Errorf("%q: %q: got: %t want: %t", test.pattern, test.path, got, test.want)
+		}
+	}
+
+	// Compare against json_tree.
+	rows, err := db.Query(`
+		WITH docs(d) AS (VALUES ('[]'), ('"x\\y"'), ('{"a": {"b": ["zz", 1]}}'),
+			('[{"k": "line\nbreak"}]'), ('"quote\""'))
+		SELECT d, regexp_json_any(d, '[\\\n"]|^zz$'),
+			EXISTS (SELECT 1 FROM json_tree(d)
+			        WHERE type = 'text' AND value REGEXP '[\\\n"]|^zz$')
+		FROM docs;`)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer rows.Close()
+	for rows.Next() {
+		var d string
+		var got, want bool
+		if err := rows.Scan(&d, &got, &want); err != nil {
+			t.Fatal(err)
+		}
+		if got != want {
+			t.Errorf("%s: got: %t want: %t", d, got, want)
+		}
+	}
+	if err := rows.Err(); err != nil {
+		t.Fatal(err)
+	}
+
+	for _, query := range []string{
+		`SELECT regexp_json_any('{"a":', 'a');`,
+		`SELECT regexp_json_any('[1,]', 'a');`,
+		`SELECT regexp_json_any('{"a":1} garbage', 'a');`,
+		`SELECT regexp_json_any('{"a":1} x', 'b', '$.a');`,
+		`SELECT regexp_json_any('{"a":1} x', 'b', '$.missing');`,
+		`SELECT regexp_json_any('nul', 'a');`,
+		`SELECT regexp_json_any('[01]', 'a');`,
+		`SELECT regexp_json_any('[1.]', 'a');`,
+		`SELECT regexp_json_any('["\q"]', 'a');`,
+		`SELECT regexp_json_any(jsonb('["a"]'), 'a');`,
+		`SELECT regexp_json_any('{}', 'a', '$."a\q"');`,
+		`SELECT regexp_json_any('{}', 'a', 'a');`,
+		`SELECT regexp_json_any('{}', 'a', '$[x]');`,
+		`SELECT regexp_json_any('{}', '(');`,
+	} {
+		var match bool
+		if err := db.QueryRow(query).Scan(&match); err == nil {
+			t.Errorf("%s: expected an error", query)
+		}
+	}
+}